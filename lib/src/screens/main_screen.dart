@@ -2,6 +2,7 @@ import 'package:flutter/material.dart';
 import 'package:file_picker/file_picker.dart';
 import 'package:path/path.dart' as path;
 import '../services/iso_service.dart';
+import '../widgets/entry_tree_view.dart';
 
 class MainScreen extends StatefulWidget {
   const MainScreen({super.key});
@@ -15,6 +16,19 @@ class _MainScreenState extends State<MainScreen> {
   String? outputPath;
   String status = '';
   bool isProcessing = false;
+  IsoProgress? progress;
+  IsoEntryTable? table;
+
+  @override
+  void dispose() {
+    table?.dispose();
+    super.dispose();
+  }
+
+  void _setTable(IsoEntryTable? loaded) {
+    table?.dispose();
+    table = loaded;
+  }
 
   Future<void> _pickIsoFile() async {
     final result = await FilePicker.platform.pickFiles(
@@ -25,6 +39,8 @@ class _MainScreenState extends State<MainScreen> {
     if (result != null) {
       setState(() {
         selectedIsoPath = result.files.single.path;
+        _setTable(null);
+        status = '';
       });
     }
   }
@@ -48,22 +64,30 @@ class _MainScreenState extends State<MainScreen> {
 
     setState(() {
       isProcessing = true;
+      _setTable(null);
       status = 'Listing contents...';
     });
 
     try {
-      final contents = await IsoService.listContents(selectedIsoPath!);
+      final loaded = await IsoService.loadTable(selectedIsoPath!);
+      if (!mounted) {
+        loaded.dispose();
+        return;
+      }
       setState(() {
-        status = contents;
+        _setTable(loaded);
+        status = '${loaded.length} entries';
       });
     } catch (e) {
       setState(() {
         status = 'Error: ${e.toString()}';
       });
     } finally {
-      setState(() {
-        isProcessing = false;
-      });
+      if (mounted) {
+        setState(() {
+          isProcessing = false;
+        });
+      }
     }
   }
 
@@ -84,14 +108,24 @@ class _MainScreenState extends State<MainScreen> {
 
     setState(() {
       isProcessing = true;
+      progress = null;
       status = 'Extracting...';
     });
 
     try {
-      await IsoService.extractContents(selectedIsoPath!, outputPath!);
+      await for (final update in IsoService.extract(selectedIsoPath!, outputPath!)) {
+        setState(() {
+          progress = update;
+          status = 'Extracted ${update.filesDone} of ${update.filesTotal} files';
+        });
+      }
       setState(() {
         status = 'Extraction completed successfully';
       });
+    } on IsoException catch (e) {
+      setState(() {
+        status = e.cancelled ? 'Extraction cancelled: $e' : 'Error: $e';
+      });
     } catch (e) {
       setState(() {
         status = 'Error: ${e.toString()}';
@@ -99,6 +133,7 @@ class _MainScreenState extends State<MainScreen> {
     } finally {
       setState(() {
         isProcessing = false;
+        progress = null;
       });
     }
   }
@@ -207,6 +242,13 @@ class _MainScreenState extends State<MainScreen> {
                     child: const Text('Extract All'),
                   ),
                 ),
+                const SizedBox(width: 16),
+                Expanded(
+                  child: ElevatedButton(
+                    onPressed: isProcessing ? IsoService.cancel : null,
+                    child: const Text('Cancel'),
+                  ),
+                ),
               ],
             ),
             const SizedBox(height: 16),
@@ -227,9 +269,17 @@ class _MainScreenState extends State<MainScreen> {
                         ),
                       ),
                       const SizedBox(height: 8),
-                      if (isProcessing)
-                        const LinearProgressIndicator()
-                      else
+                      if (isProcessing) ...[
+                        LinearProgressIndicator(value: progress?.fraction),
+                        const SizedBox(height: 8),
+                      ],
+                      if (table != null && !isProcessing) ...[
+                        Text(status),
+                        const SizedBox(height: 8),
+                        Expanded(
+                          child: EntryTreeView(table: table!),
+                        ),
+                      ] else
                         Expanded(
                           child: SingleChildScrollView(
                             child: Text(status),
@@ -1,5 +1,7 @@
+import 'dart:async';
 import 'dart:ffi' as ffi;
 import 'dart:io';
+import 'dart:isolate';
 import 'package:path/path.dart' as path;
 import 'package:ffi/ffi.dart';
 
@@ -11,6 +13,19 @@ typedef XisoExtractFunc = ffi.Bool Function(
 typedef XisoListFunc = ffi.Bool Function(
     ffi.Pointer<ffi.Char> isoPath, ffi.Pointer<ffi.Char> buffer, ffi.Size bufferSize);
 typedef XisoGetLastErrorFunc = ffi.Pointer<ffi.Char> Function();
+typedef XisoEntryCallbackFunc = ffi.Bool Function(
+    ffi.Pointer<XisoEntryInfo> entry, ffi.Pointer<ffi.Void> userData);
+typedef XisoWalkFunc = ffi.Bool Function(ffi.Pointer<ffi.Char> isoPath,
+    ffi.Pointer<ffi.NativeFunction<XisoEntryCallbackFunc>> callback,
+    ffi.Pointer<ffi.Void> userData);
+typedef XisoGetProgressFunc = ffi.Void Function(ffi.Pointer<XisoProgress> progress);
+typedef XisoCancelFunc = ffi.Void Function();
+typedef XisoGetLastErrorCodeFunc = ffi.Int Function();
+typedef XisoSetBandwidthLimitFunc = ffi.Void Function(ffi.Uint64 readBytesPerSecond,
+    ffi.Uint64 writeBytesPerSecond);
+typedef XisoLoadTableFunc = ffi.Bool Function(
+    ffi.Pointer<ffi.Char> isoPath, ffi.Pointer<XisoEntryTable> table);
+typedef XisoFreeTableFunc = ffi.Void Function(ffi.Pointer<XisoEntryTable> table);
 
 // Dart function signatures
 typedef XisoInit = bool Function();
@@ -20,16 +35,292 @@ typedef XisoExtract = bool Function(
 typedef XisoList = bool Function(
     ffi.Pointer<ffi.Char> isoPath, ffi.Pointer<ffi.Char> buffer, int bufferSize);
 typedef XisoGetLastError = ffi.Pointer<ffi.Char> Function();
+typedef XisoWalk = bool Function(ffi.Pointer<ffi.Char> isoPath,
+    ffi.Pointer<ffi.NativeFunction<XisoEntryCallbackFunc>> callback,
+    ffi.Pointer<ffi.Void> userData);
+typedef XisoGetProgress = void Function(ffi.Pointer<XisoProgress> progress);
+typedef XisoCancel = void Function();
+typedef XisoGetLastErrorCode = int Function();
+typedef XisoSetBandwidthLimit = void Function(int readBytesPerSecond, int writeBytesPerSecond);
+typedef XisoLoadTable = bool Function(
+    ffi.Pointer<ffi.Char> isoPath, ffi.Pointer<XisoEntryTable> table);
+typedef XisoFreeTable = void Function(ffi.Pointer<XisoEntryTable> table);
+
+// Native structs, matching xiso.h
+final class XisoEntryInfo extends ffi.Struct {
+  external ffi.Pointer<Utf8> path;
+  external ffi.Pointer<Utf8> name;
+  @ffi.Uint64()
+  external int size;
+  @ffi.Uint32()
+  external int startSector;
+  @ffi.Uint8()
+  external int attributes;
+  @ffi.Bool()
+  external bool isDirectory;
+  @ffi.UnsignedInt()
+  external int depth;
+}
+
+const xisoNoParent = 0xFFFFFFFF;
+
+final class XisoTableEntry extends ffi.Struct {
+  @ffi.Uint32()
+  external int pathOffset;
+  @ffi.Uint32()
+  external int nameOffset;
+  @ffi.Uint32()
+  external int parent;
+  @ffi.Uint32()
+  external int subtreeEnd;
+  @ffi.Uint32()
+  external int startSector;
+  @ffi.Uint32()
+  external int size;
+  @ffi.Uint32()
+  external int depth;
+  @ffi.Uint8()
+  external int attributes;
+  @ffi.Bool()
+  external bool isDirectory;
+}
+
+final class XisoEntryTable extends ffi.Struct {
+  external ffi.Pointer<XisoTableEntry> entries;
+  @ffi.Size()
+  external int count;
+  external ffi.Pointer<ffi.Char> names;
+  @ffi.Size()
+  external int namesSize;
+}
+
+final class XisoProgress extends ffi.Struct {
+  @ffi.Uint64()
+  external int filesTotal;
+  @ffi.Uint64()
+  external int filesDone;
+  @ffi.Uint64()
+  external int bytesTotal;
+  @ffi.Uint64()
+  external int bytesDone;
+}
+
+/// One file or directory in an image, as streamed by [IsoService.listEntries]
+class IsoEntry {
+  final String path;
+  final String name;
+  final int size;
+  final int startSector;
+  final int attributes;
+  final bool isDirectory;
+  final int depth;
+
+  const IsoEntry({
+    required this.path,
+    required this.name,
+    required this.size,
+    required this.startSector,
+    required this.attributes,
+    required this.isDirectory,
+    required this.depth,
+  });
+}
+
+/// An image's directory tree, held in native memory and read in place.
+/// Entries are in preorder: a directory's children follow it, and each
+/// child's subtreeEnd is the index of the next. Call [dispose] when done.
+class IsoEntryTable {
+  final ffi.Pointer<XisoEntryTable> _table;
+  bool _disposed = false;
+
+  IsoEntryTable._(this._table);
+
+  int get length => _table.ref.count;
+
+  /// A view of the native entry, valid until [dispose]
+  XisoTableEntry operator [](int index) => _table.ref.entries[index];
+
+  String path(int index) => _string(this[index].pathOffset);
+
+  String name(int index) => _string(this[index].nameOffset);
+
+  String _string(int offset) {
+    return ffi.Pointer<Utf8>.fromAddress(_table.ref.names.address + offset).toDartString();
+  }
+
+  /// Indexes of the entries directly inside [directory], or inside the
+  /// root when it is null
+  List<int> children(int? directory) {
+    final end = directory == null ? length : this[directory].subtreeEnd;
+    final result = <int>[];
+    for (var index = directory == null ? 0 : directory + 1; index < end;) {
+      result.add(index);
+      index = this[index].subtreeEnd;
+    }
+    return result;
+  }
+
+  void dispose() {
+    if (_disposed) return;
+    _disposed = true;
+    IsoService._xisoFreeTable(_table);
+    calloc.free(_table);
+  }
+}
+
+/// Progress of a running extraction, as streamed by [IsoService.extract]
+class IsoProgress {
+  final int filesTotal;
+  final int filesDone;
+  final int bytesTotal;
+  final int bytesDone;
+
+  const IsoProgress({
+    required this.filesTotal,
+    required this.filesDone,
+    required this.bytesTotal,
+    required this.bytesDone,
+  });
+
+  /// Fraction of the bytes copied, or null while the total is unknown
+  double? get fraction => bytesTotal > 0 ? bytesDone / bytesTotal : null;
+}
+
+// XisoErrorCode values
+const xisoError = 1;
+const xisoErrorCancelled = 2;
+const xisoErrorDeadline = 3;
+
+/// A failed native operation, with the XisoErrorCode saying why
+class IsoException implements Exception {
+  final int code;
+  final String message;
+
+  const IsoException(this.code, this.message);
+
+  /// Stopped by [IsoService.cancel] or a deadline rather than a failure
+  bool get cancelled => code == xisoErrorCancelled || code == xisoErrorDeadline;
+
+  @override
+  String toString() => message;
+}
+
+// Messages between the service and its worker isolate
+enum _Operation { list, table, extract }
+
+class _WorkerRequest {
+  final SendPort port;
+  final _Operation operation;
+  final String isoPath;
+  final String? outputPath;
+
+  const _WorkerRequest(this.port, this.operation, this.isoPath, this.outputPath);
+}
+
+class _WorkerDone {
+  final bool success;
+  final String error;
+  final int code;
+  final int table;               // address of a loaded XisoEntryTable
+
+  const _WorkerDone(this.success, this.error, {this.code = 0, this.table = 0});
+}
+
+// Listing entries cross to the main isolate in batches, not one message each
+const _entryBatchSize = 256;
+const _pollInterval = Duration(milliseconds: 100);
+
+// Worker isolate state; each isolate has its own copy of these
+SendPort? _workerPort;
+List<IsoEntry> _pendingEntries = [];
+
+void _flushEntries() {
+  if (_pendingEntries.isEmpty) return;
+  _workerPort!.send(_pendingEntries);
+  _pendingEntries = [];
+}
+
+bool _onEntry(ffi.Pointer<XisoEntryInfo> entry, ffi.Pointer<ffi.Void> userData) {
+  final info = entry.ref;
+  _pendingEntries.add(IsoEntry(
+    path: info.path.toDartString(),
+    name: info.name.toDartString(),
+    size: info.size,
+    startSector: info.startSector,
+    attributes: info.attributes,
+    isDirectory: info.isDirectory,
+    depth: info.depth,
+  ));
+  if (_pendingEntries.length >= _entryBatchSize) _flushEntries();
+  return true;
+}
+
+// Runs one blocking native call off the UI isolate. The native library is
+// process-wide, so its progress counters and cancel flag are shared with
+// the main isolate, which reads and sets them while this one is blocked.
+void _runWorker(_WorkerRequest request) {
+  _workerPort = request.port;
+  var done = const _WorkerDone(false, 'Failed to initialize XISO library', code: xisoError);
+
+  try {
+    IsoService._initLibrary();
+    if (IsoService._xisoInit()) {
+      final isoPathPtr = request.isoPath.toNativeUtf8();
+      final outputPathPtr = (request.outputPath ?? '').toNativeUtf8();
+      final table = request.operation == _Operation.table
+          ? calloc<XisoEntryTable>()
+          : ffi.Pointer<XisoEntryTable>.fromAddress(0);
+      try {
+        final result = switch (request.operation) {
+          _Operation.list => IsoService._xisoWalk(
+              isoPathPtr.cast(),
+              ffi.Pointer.fromFunction<XisoEntryCallbackFunc>(_onEntry, false),
+              ffi.nullptr),
+          _Operation.table => IsoService._xisoLoadTable(isoPathPtr.cast(), table),
+          _Operation.extract =>
+            IsoService._xisoExtract(isoPathPtr.cast(), outputPathPtr.cast()),
+        };
+        _flushEntries();
+        // The table is malloc'd, so the main isolate can take it over
+        done = result
+            ? _WorkerDone(true, '', table: table.address)
+            : _WorkerDone(false, IsoService._getLastError(),
+                code: IsoService._xisoGetLastErrorCode());
+        if (!result && table != ffi.nullptr) calloc.free(table);
+      } finally {
+        calloc.free(isoPathPtr);
+        calloc.free(outputPathPtr);
+        IsoService._xisoCleanup();
+      }
+    } else {
+      done = _WorkerDone(false, 'Failed to initialize XISO library: ${IsoService._getLastError()}',
+          code: xisoError);
+    }
+  } catch (e) {
+    done = _WorkerDone(false, e.toString(), code: xisoError);
+  }
+  request.port.send(done);
+}
 
 class IsoService {
   static late final ffi.DynamicLibrary _lib;
   static late final XisoInit _xisoInit;
   static late final XisoCleanup _xisoCleanup;
   static late final XisoExtract _xisoExtract;
-  static late final XisoList _xisoList;
   static late final XisoGetLastError _xisoGetLastError;
+  static late final XisoWalk _xisoWalk;
+  static late final XisoGetProgress _xisoGetProgress;
+  static late final XisoCancel _xisoCancel;
+  static late final XisoGetLastErrorCode _xisoGetLastErrorCode;
+  static late final XisoSetBandwidthLimit _xisoSetBandwidthLimit;
+  static late final XisoLoadTable _xisoLoadTable;
+  static late final XisoFreeTable _xisoFreeTable;
   static bool _initialized = false;
 
+  // The native library keeps one operation's state at a time
+  static bool _busy = false;
+  static bool _cancelRequested = false;
+
   static void _initLibrary() {
     if (_initialized) return;
 
@@ -42,10 +333,22 @@ class IsoService {
         .lookupFunction<XisoCleanupFunc, XisoCleanup>('xiso_cleanup');
     _xisoExtract = _lib
         .lookupFunction<XisoExtractFunc, XisoExtract>('xiso_extract');
-    _xisoList = _lib
-        .lookupFunction<XisoListFunc, XisoList>('xiso_list');
     _xisoGetLastError = _lib
         .lookupFunction<XisoGetLastErrorFunc, XisoGetLastError>('xiso_get_last_error');
+    _xisoWalk = _lib
+        .lookupFunction<XisoWalkFunc, XisoWalk>('xiso_walk');
+    _xisoGetProgress = _lib
+        .lookupFunction<XisoGetProgressFunc, XisoGetProgress>('xiso_get_progress');
+    _xisoCancel = _lib
+        .lookupFunction<XisoCancelFunc, XisoCancel>('xiso_cancel');
+    _xisoGetLastErrorCode = _lib
+        .lookupFunction<XisoGetLastErrorCodeFunc, XisoGetLastErrorCode>('xiso_get_last_error_code');
+    _xisoSetBandwidthLimit = _lib
+        .lookupFunction<XisoSetBandwidthLimitFunc, XisoSetBandwidthLimit>('xiso_set_bandwidth_limit');
+    _xisoLoadTable = _lib
+        .lookupFunction<XisoLoadTableFunc, XisoLoadTable>('xiso_load_table');
+    _xisoFreeTable = _lib
+        .lookupFunction<XisoFreeTableFunc, XisoFreeTable>('xiso_free_table');
 
     _initialized = true;
   }
@@ -83,59 +386,137 @@ class IsoService {
     return errorPtr.cast<Utf8>().toDartString();
   }
 
-  static Future<String> listContents(String isoPath) async {
+  /// Asks the running list or extract to stop. The native code checks
+  /// between chunks, and the stream then ends with a "Cancelled" error.
+  static void cancel() {
+    if (!_busy) return;
+    _cancelRequested = true;
+    _xisoCancel();
+  }
+
+  /// Caps native reads and writes in bytes per second, 0 for unlimited.
+  /// Takes effect immediately, including on a running extraction.
+  static void setBandwidthLimit({int readBytesPerSecond = 0, int writeBytesPerSecond = 0}) {
     _initLibrary();
-    
-    // Initialize XISO library
-    if (!_xisoInit()) {
-      throw Exception('Failed to initialize XISO library: ${_getLastError()}');
-    }
+    _xisoSetBandwidthLimit(readBytesPerSecond, writeBytesPerSecond);
+  }
 
-    try {
-      // Allocate a large buffer for the listing
-      final bufferSize = 1024 * 1024; // 1MB should be enough
-      final buffer = calloc<ffi.Char>(bufferSize);
-      final isoPathPtr = isoPath.toNativeUtf8();
+  /// Streams every entry in the image, walked in a background isolate
+  static Stream<IsoEntry> listEntries(String isoPath) {
+    return _run<IsoEntry>(_Operation.list, isoPath, null);
+  }
 
-      try {
-        final result = _xisoList(isoPathPtr.cast(), buffer, bufferSize);
-        if (!result) {
-          throw Exception('Failed to list ISO contents: ${_getLastError()}');
-        }
+  /// Loads the whole directory tree in a background isolate, for reading
+  /// in place through [IsoEntryTable]
+  static Future<IsoEntryTable> loadTable(String isoPath) {
+    return _run<IsoEntryTable>(_Operation.table, isoPath, null).single;
+  }
 
-        return buffer.cast<Utf8>().toDartString();
-      } finally {
-        calloc.free(buffer);
-        calloc.free(isoPathPtr);
-      }
-    } finally {
-      _xisoCleanup();
-    }
+  /// Extracts the image in a background isolate, streaming progress until
+  /// the extraction completes
+  static Stream<IsoProgress> extract(String isoPath, String outputPath) {
+    return _run<IsoProgress>(_Operation.extract, isoPath, outputPath);
   }
 
-  static Future<void> extractContents(String isoPath, String outputPath) async {
-    _initLibrary();
-    
-    // Initialize XISO library
-    if (!_xisoInit()) {
-      throw Exception('Failed to initialize XISO library: ${_getLastError()}');
+  static Stream<T> _run<T>(_Operation operation, String isoPath, String? outputPath) {
+    late final StreamController<T> controller;
+    ReceivePort? port;
+    Timer? timer;
+    ffi.Pointer<XisoProgress>? progress;
+
+    void finish([Object? error]) {
+      timer?.cancel();
+      port?.close();
+      if (progress != null) calloc.free(progress!);
+      progress = null;
+      _busy = false;
+      if (error != null) controller.addError(error);
+      controller.close();
     }
 
-    try {
-      final isoPathPtr = isoPath.toNativeUtf8();
-      final outputPathPtr = outputPath.toNativeUtf8();
+    void report() {
+      final current = progress!.ref;
+      controller.add(IsoProgress(
+        filesTotal: current.filesTotal,
+        filesDone: current.filesDone,
+        bytesTotal: current.bytesTotal,
+        bytesDone: current.bytesDone,
+      ) as T);
+    }
 
+    Future<void> start() async {
       try {
-        final result = _xisoExtract(isoPathPtr.cast(), outputPathPtr.cast());
-        if (!result) {
-          throw Exception('Failed to extract ISO: ${_getLastError()}');
+        _initLibrary();
+        if (_busy) throw Exception('Another ISO operation is already running');
+      } catch (e) {
+        controller.addError(e);
+        controller.close();
+        return;
+      }
+      _busy = true;
+      _cancelRequested = false;
+
+      port = ReceivePort();
+      port!.listen((message) {
+        if (message is List<IsoEntry>) {
+          for (final entry in message) {
+            controller.add(entry as T);
+          }
+        } else if (message is _WorkerDone) {
+          // The last timer tick can predate the worker's final counts
+          if (progress != null) {
+            _xisoGetProgress(progress!);
+            report();
+          }
+          if (message.table != 0) {
+            final table = IsoEntryTable._(ffi.Pointer.fromAddress(message.table));
+            if (controller.hasListener) {
+              controller.add(table as T);
+            } else {
+              table.dispose();
+            }
+          }
+          finish(message.success ? null : IsoException(message.code, message.error));
         }
-      } finally {
-        calloc.free(isoPathPtr);
-        calloc.free(outputPathPtr);
+      });
+
+      // The worker resets the native cancel flag when it opens the image,
+      // so a cancel that lands before then is repeated on every tick
+      if (operation == _Operation.extract) progress = calloc<XisoProgress>();
+      timer = Timer.periodic(_pollInterval, (_) {
+        if (_cancelRequested) _xisoCancel();
+        if (progress != null) {
+          _xisoGetProgress(progress!);
+          report();
+        }
+      });
+
+      try {
+        await Isolate.spawn(
+            _runWorker, _WorkerRequest(port!.sendPort, operation, isoPath, outputPath));
+      } catch (e) {
+        finish(e);
       }
-    } finally {
-      _xisoCleanup();
     }
+
+    controller = StreamController<T>(
+      onListen: start,
+      onCancel: cancel,
+    );
+    return controller.stream;
+  }
+
+  static Future<String> listContents(String isoPath) async {
+    final listing = StringBuffer();
+    await for (final entry in listEntries(isoPath)) {
+      listing.writeln(entry.isDirectory
+          ? '${entry.path}/'
+          : '${entry.path} (${entry.size} bytes)');
+    }
+    return listing.toString();
+  }
+
+  static Future<void> extractContents(String isoPath, String outputPath) {
+    return extract(isoPath, outputPath).drain<void>();
   }
 }
@@ -0,0 +1,178 @@
+import 'package:flutter/material.dart';
+import '../services/iso_service.dart';
+
+enum EntrySortColumn { name, size, sector }
+
+/// Expandable tree over an [IsoEntryTable]. Only expanded directories are
+/// sorted and flattened into rows, and only the rows on screen are built,
+/// so huge images open as fast as small ones.
+class EntryTreeView extends StatefulWidget {
+  final IsoEntryTable table;
+
+  const EntryTreeView({super.key, required this.table});
+
+  @override
+  State<EntryTreeView> createState() => _EntryTreeViewState();
+}
+
+class _EntryTreeViewState extends State<EntryTreeView> {
+  static const _rowHeight = 28.0;
+  static const _indent = 16.0;
+
+  final Set<int> _expanded = {};
+  // Sorted children by directory (null for the root), dropped when the sort changes
+  final Map<int?, List<int>> _children = {};
+  List<int> _rows = [];
+  EntrySortColumn _sortColumn = EntrySortColumn.name;
+  bool _ascending = true;
+
+  @override
+  void initState() {
+    super.initState();
+    _rebuildRows();
+  }
+
+  @override
+  void didUpdateWidget(EntryTreeView oldWidget) {
+    super.didUpdateWidget(oldWidget);
+    if (oldWidget.table != widget.table) {
+      _expanded.clear();
+      _children.clear();
+      _rebuildRows();
+    }
+  }
+
+  List<int> _sortedChildren(int? directory) {
+    return _children.putIfAbsent(directory, () {
+      final table = widget.table;
+      final children = table.children(directory);
+      // Names are decoded once per sort rather than once per comparison
+      final names = _sortColumn == EntrySortColumn.name
+          ? {for (final index in children) index: table.name(index).toLowerCase()}
+          : const <int, String>{};
+
+      children.sort((a, b) {
+        final first = table[a];
+        final second = table[b];
+        // Directories stay ahead of files whichever way the column sorts
+        if (first.isDirectory != second.isDirectory) {
+          return first.isDirectory ? -1 : 1;
+        }
+        final result = switch (_sortColumn) {
+          EntrySortColumn.name => names[a]!.compareTo(names[b]!),
+          EntrySortColumn.size => first.size.compareTo(second.size),
+          EntrySortColumn.sector => first.startSector.compareTo(second.startSector),
+        };
+        return _ascending ? result : -result;
+      });
+      return children;
+    });
+  }
+
+  void _rebuildRows() {
+    final rows = <int>[];
+    void addChildren(int? directory) {
+      for (final index in _sortedChildren(directory)) {
+        rows.add(index);
+        if (_expanded.contains(index)) addChildren(index);
+      }
+    }
+
+    addChildren(null);
+    _rows = rows;
+  }
+
+  void _toggle(int index) {
+    setState(() {
+      if (!_expanded.remove(index)) _expanded.add(index);
+      _rebuildRows();
+    });
+  }
+
+  void _sortBy(EntrySortColumn column) {
+    setState(() {
+      _ascending = _sortColumn == column ? !_ascending : true;
+      _sortColumn = column;
+      _children.clear();
+      _rebuildRows();
+    });
+  }
+
+  Widget _header(String label, EntrySortColumn column, {double? width, TextAlign? align}) {
+    final sorted = _sortColumn == column;
+    final button = TextButton(
+      onPressed: () => _sortBy(column),
+      child: Row(
+        mainAxisSize: MainAxisSize.min,
+        children: [
+          Text(label, style: const TextStyle(fontWeight: FontWeight.bold)),
+          if (sorted)
+            Icon(_ascending ? Icons.arrow_upward : Icons.arrow_downward, size: 14),
+        ],
+      ),
+    );
+    final aligned = Align(
+      alignment: align == TextAlign.right ? Alignment.centerRight : Alignment.centerLeft,
+      child: button,
+    );
+    return width == null ? Expanded(child: aligned) : SizedBox(width: width, child: aligned);
+  }
+
+  Widget _row(BuildContext context, int position) {
+    final table = widget.table;
+    final index = _rows[position];
+    final entry = table[index];
+    final isDirectory = entry.isDirectory;
+
+    return InkWell(
+      onTap: isDirectory ? () => _toggle(index) : null,
+      child: Row(
+        children: [
+          SizedBox(width: entry.depth * _indent),
+          Icon(
+            isDirectory
+                ? (_expanded.contains(index) ? Icons.expand_more : Icons.chevron_right)
+                : Icons.insert_drive_file_outlined,
+            size: 16,
+          ),
+          const SizedBox(width: 4),
+          Expanded(
+            child: Text(table.name(index), overflow: TextOverflow.ellipsis),
+          ),
+          SizedBox(
+            width: 120,
+            child: Text(isDirectory ? '' : '${entry.size}', textAlign: TextAlign.right),
+          ),
+          SizedBox(
+            width: 100,
+            child: Text('${entry.startSector}', textAlign: TextAlign.right),
+          ),
+        ],
+      ),
+    );
+  }
+
+  @override
+  Widget build(BuildContext context) {
+    return Column(
+      crossAxisAlignment: CrossAxisAlignment.stretch,
+      children: [
+        Row(
+          children: [
+            _header('Name', EntrySortColumn.name),
+            _header('Size', EntrySortColumn.size, width: 120, align: TextAlign.right),
+            _header('Sector', EntrySortColumn.sector, width: 100, align: TextAlign.right),
+          ],
+        ),
+        const Divider(height: 1),
+        Expanded(
+          child: ListView.builder(
+            itemCount: _rows.length,
+            itemExtent: _rowHeight,
+            itemBuilder: _row,
+          ),
+        ),
+      ],
+    );
+  }
+}
@@ -5,15 +5,377 @@
 #include <stdint.h>
 #include <stddef.h>
 
-// Public API functions
+// Strategies for copying file data out of the image
+typedef enum {
+    XISO_IO_BUFFERED = 0,   // read()/write() through the page cache
+    XISO_IO_DIRECT,         // O_DIRECT reads from the image
+    XISO_IO_COPY_RANGE,     // in-kernel copy_file_range()
+} XisoIoStrategy;
+
+// I/O buffer pool statistics
+typedef struct {
+    size_t limit;            // configured cap in bytes, 0 if unlimited
+    size_t bytes_allocated;  // bytes held by the pool (in use + cached)
+    size_t bytes_cached;     // bytes held in free buffers ready for reuse
+    size_t high_water;       // largest bytes_allocated seen
+    size_t in_use;           // buffers currently checked out
+    uint64_t allocations;    // buffers obtained from the system allocator
+    uint64_t checkouts;      // total buffer checkouts
+} XisoBufferPoolStats;
+
+// Performance counters for the most recent list/extract run. Syscall and
+// byte counts are summed over all threads, as are the phase timings.
+typedef struct {
+    uint64_t read_calls;
+    uint64_t lseek_calls;
+    uint64_t write_calls;
+    uint64_t open_calls;
+    uint64_t mkdir_calls;
+    uint64_t copy_range_calls;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t seek_distance;      // bytes skipped between consecutive image reads
+    uint64_t entries_parsed;
+    uint64_t files_created;
+    uint64_t dirs_created;
+    uint64_t files_skipped;      // already extracted by an earlier run
+    uint64_t verify_ns;          // header probing
+    uint64_t walk_ns;            // directory traversal, excluding data copy
+    uint64_t copy_ns;            // file data copy
+} XisoStats;
+
+// Where the game partition was found
+typedef enum {
+    XISO_LAYOUT_XISO = 0,   // plain XISO, partition at offset 0
+    XISO_LAYOUT_REDUMP,     // full redump image, partition after the video partition
+    XISO_LAYOUT_XGD3,       // XGD3 redump image
+} XisoLayout;
+
+typedef struct {
+    XisoLayout layout;
+    uint64_t partition_offset;
+    uint32_t root_dir_sector;
+    uint32_t root_dir_size;
+    uint64_t image_size;
+    uint64_t file_count;
+    uint64_t dir_count;
+    uint64_t total_bytes;        // sum of all file sizes
+} XisoImageInfo;
+
+// One directory entry as reported by xiso_walk()
+typedef struct {
+    const char* path;            // relative to the image root, '/' separated
+    const char* name;
+    uint64_t size;
+    uint32_t start_sector;
+    uint8_t attributes;
+    bool is_directory;
+    unsigned depth;
+} XisoEntryInfo;
+
+// Return false to stop the walk
+typedef bool (*XisoEntryCallback)(const XisoEntryInfo* entry, void* user_data);
+
+// Public API functions. Any iso_path may also name an image split into
+// parts (name.1.iso, name.2.iso, ...), either by its first part or as
+// name.iso when no such file exists; the parts are read as one image.
+// Split images are read-only: xiso_replace() refuses them.
 bool xiso_init(void);
 void xiso_cleanup(void);
 bool xiso_extract(const char* iso_path, const char* output_path);
 bool xiso_list(const char* iso_path, char* output_buffer, size_t buffer_size);
 const char* xiso_get_last_error(void);
+void xiso_get_stats(XisoStats* stats);
+
+// What kind of failure xiso_get_last_error() describes, so schedulers can
+// tell a stopped job from a broken one
+typedef enum {
+    XISO_OK = 0,
+    XISO_ERROR,                  // anything not listed below
+    XISO_ERROR_CANCELLED,
+    XISO_ERROR_DEADLINE,
+} XisoErrorCode;
+
+XisoErrorCode xiso_get_last_error_code(void);
+
+// Structured access: visit every entry, report layout and totals, or
+// additionally check every extent lies in the image and can be read
+bool xiso_walk(const char* iso_path, XisoEntryCallback callback, void* user_data);
+bool xiso_stat(const char* iso_path, XisoImageInfo* info);
+bool xiso_verify(const char* iso_path, XisoImageInfo* info);
+
+// The whole directory tree as one array in preorder, for callers that would
+// rather read entries in place than take a callback per entry (the Dart UI
+// reads it through FFI without copying). Paths live in a single arena of
+// NUL-terminated strings; a directory's children follow it, and the next
+// one starts at the subtree_end of the previous.
+#define XISO_NO_PARENT UINT32_MAX
+
+typedef struct {
+    uint32_t path_offset;        // into names
+    uint32_t name_offset;        // the last component of the path
+    uint32_t parent;             // index, or XISO_NO_PARENT in the root
+    uint32_t subtree_end;        // index after the entry's last descendant
+    uint32_t start_sector;
+    uint32_t size;
+    uint32_t depth;
+    uint8_t attributes;
+    bool is_directory;
+} XisoTableEntry;
+
+typedef struct {
+    XisoTableEntry* entries;
+    size_t count;
+    char* names;
+    size_t names_size;
+} XisoEntryTable;
+
+bool xiso_load_table(const char* iso_path, XisoEntryTable* table);
+void xiso_free_table(XisoEntryTable* table);
+
+// Order of file data in images written by xiso_rebuild() and xiso_create()
+typedef enum {
+    XISO_ORDER_SOURCE = 0,  // as laid out in the source image, or by inode
+    XISO_ORDER_TREE,        // depth-first, entries sorted by name
+    XISO_ORDER_SIZE,        // smallest files first
+} XisoFileOrder;
+
+// Rewrites the game partition of any supported image (redump, XGD3 or
+// XISO) as a compact XISO holding only the sectors the directory tree
+// references. Filters apply, so this can also drop content.
+bool xiso_rebuild(const char* iso_path, const char* out_path);
+void xiso_set_file_order(XisoFileOrder order);
+
+// Packs a directory tree into a new XISO image. Files are read ahead in
+// parallel (one reader per extraction thread) and the image is written in a
+// single sequential pass. Filters apply to paths relative to src_dir.
+bool xiso_create(const char* src_dir, const char* out_path);
+
+// Replaces the contents of file_path inside the image with src_path. Data
+// that fits the file's current sectors is overwritten in place, writing
+// only the sectors that differ; otherwise it is appended to the image and
+// the entry repointed. Updates go through <iso_path>.journal, so a crash
+// leaves either the old or the new file, and the next call finishes an
+// interrupted update.
+bool xiso_replace(const char* iso_path, const char* file_path, const char* src_path);
+
+// Image comparison. xiso_diff() reports added, removed, changed and moved
+// files through callback (either may be NULL) and can write a patch that
+// rebuilds new_iso from old_iso, carrying only data old_iso lacks. Filters
+// limit the report; the patch always covers the whole image.
+typedef enum {
+    XISO_DIFF_ADDED = 0,
+    XISO_DIFF_REMOVED,
+    XISO_DIFF_CHANGED,
+    XISO_DIFF_MOVED,            // same contents under a new path
+} XisoDiffKind;
+
+typedef struct {
+    XisoDiffKind kind;
+    const char* path;            // in the new image, or the old one if removed
+    const char* old_path;        // moved files: path in the old image
+    uint64_t old_size;
+    uint64_t new_size;
+    uint64_t changed_bytes;      // file data the patch has to carry
+} XisoDiffEntry;
+
+// Return false to stop the report
+typedef bool (*XisoDiffCallback)(const XisoDiffEntry* entry, void* user_data);
+
+bool xiso_diff(const char* old_iso, const char* new_iso, const char* patch_path,
+               XisoDiffCallback callback, void* user_data);
+// Writes the patched image to out_fd (a file, pipe or stdout)
+bool xiso_apply_patch(const char* old_iso, const char* patch_path, int out_fd);
+
+// Checks an extracted tree against the image: every file the image lists
+// (filters apply) must exist under output_path with the same size and
+// contents. Files are compared in parallel on the extraction threads and
+// each problem is reported through callback, possibly from a worker thread
+// but never concurrently. Returns false only when the check couldn't run
+// or the callback stopped it.
+typedef enum {
+    XISO_CHECK_MISSING = 0,     // not in the extracted tree
+    XISO_CHECK_SIZE,            // not a regular file of the right size
+    XISO_CHECK_CONTENT,         // same size, different data
+} XisoCheckKind;
+
+typedef struct {
+    XisoCheckKind kind;
+    const char* path;
+    bool is_directory;
+    uint64_t expected_size;
+    uint64_t actual_size;
+    uint64_t offset;             // first differing byte
+} XisoCheckEntry;
+
+// Return false to stop the check
+typedef bool (*XisoCheckCallback)(const XisoCheckEntry* entry, void* user_data);
+
+bool xiso_verify_extracted(const char* iso_path, const char* output_path,
+                           XisoCheckCallback callback, void* user_data);
+
+// Content search straight from the image. Every file extent (filters
+// apply) is scanned on the extraction threads for a literal string or a
+// POSIX extended regex; regex matches don't cross NUL bytes or newlines on
+// systems without REG_STARTEND, nor run longer than 4KB. Hits arrive in no
+// particular order, one callback at a time. Returning false from the
+// callback ends the search early without making it fail.
+typedef enum {
+    XISO_SEARCH_REGEX = 1 << 0,
+    XISO_SEARCH_IGNORE_CASE = 1 << 1,
+} XisoSearchFlags;
+
+typedef struct {
+    const char* path;
+    uint64_t offset;             // within the file
+    const uint8_t* match;        // matched bytes, valid during the callback
+    size_t length;
+} XisoSearchHit;
+
+typedef bool (*XisoSearchCallback)(const XisoSearchHit* hit, void* user_data);
+
+bool xiso_search(const char* iso_path, const char* pattern, unsigned flags,
+                 XisoSearchCallback callback, void* user_data);
+
+// Whole-image verification against Redump-style DAT files (Logiqx XML).
+// xiso_hash_image() reads the image once while CRC-32, MD5 and SHA-1 are
+// computed on their own threads. xiso_match_dat() looks the digest up in
+// every DAT loaded so far; the names it returns stay valid until the DATs
+// are cleared.
+typedef struct {
+    uint64_t size;
+    uint32_t crc32;
+    uint8_t md5[16];
+    uint8_t sha1[20];
+} XisoDigest;
+
+typedef enum {
+    XISO_DAT_UNKNOWN = 0,       // neither the contents nor the file name are listed
+    XISO_DAT_MATCH,             // size and every listed digest match
+    XISO_DAT_MISMATCH,          // the file name is listed with other contents
+} XisoDatStatus;
+
+typedef struct {
+    XisoDatStatus status;
+    const char* game;
+    const char* rom;
+} XisoDatMatch;
+
+bool xiso_load_dat(const char* dat_path);
+void xiso_clear_dat(void);
+bool xiso_hash_image(const char* iso_path, XisoDigest* digest);
+void xiso_match_dat(const char* iso_path, const XisoDigest* digest, XisoDatMatch* match);
+
+// Resumable extraction. xiso_extract() keeps <output_path>.xiso-resume
+// recording how much of each file is safely on disk, so an interrupted run
+// continues partial files where they stopped and a repeated run skips
+// files that are already complete. XISO_RESUME_VERIFY also compares their
+// contents with the image, and adopts files of the right size the journal
+// doesn't know about when they match.
+typedef enum {
+    XISO_RESUME_OFF = 0,
+    XISO_RESUME_SIZE,           // trust the journal and the file size
+    XISO_RESUME_VERIFY,         // also compare contents
+} XisoResumeMode;
+
+void xiso_set_resume(XisoResumeMode mode);
+
+// Single-pass extraction from a pipe, socket or other forward-only input.
+// Data that arrives before the directory entry describing it is held in a
+// temporary spill file of at most the spill limit (default 256MB).
+bool xiso_extract_stream(int fd, const char* output_path);
+void xiso_set_spill_limit(size_t bytes);
+
+// Writes the image as a tar stream to out_fd (a file, pipe or stdout)
+// instead of extracting files. A zstd_level above 0 compresses the stream,
+// using the extraction thread count as zstd workers; this needs a library
+// built with zstd.
+bool xiso_extract_tar(const char* iso_path, int out_fd, int zstd_level);
+
+// Progress of the running extract, tar export or rebuild, safe to poll from
+// another thread. Totals are counted before any data is copied; they stay
+// 0 for rebuilds. xiso_cancel() makes the running operation stop at the
+// next chunk or directory entry and fail with XISO_ERROR_CANCELLED.
+typedef struct {
+    uint64_t files_total;
+    uint64_t files_done;
+    uint64_t bytes_total;
+    uint64_t bytes_done;
+} XisoProgress;
+
+void xiso_get_progress(XisoProgress* progress);
+void xiso_cancel(void);
+
+// A cancel token outlives single operations: once installed with
+// xiso_set_cancel_token(), every operation started afterwards checks it,
+// and cancelling it (from any thread) or passing its deadline stops them
+// with XISO_ERROR_CANCELLED or XISO_ERROR_DEADLINE. Files that extraction
+// left half written are removed unless resuming is enabled.
+typedef struct XisoCancelToken XisoCancelToken;
+
+XisoCancelToken* xiso_cancel_token_create(void);
+void xiso_cancel_token_destroy(XisoCancelToken* token);
+void xiso_cancel_token_cancel(XisoCancelToken* token);
+// Counted from now; 0 removes the deadline
+void xiso_cancel_token_set_deadline(XisoCancelToken* token, uint64_t timeout_ms);
+void xiso_set_cancel_token(XisoCancelToken* token);
 
 // Optional configuration functions
 void xiso_set_debug(bool enable);
 void xiso_set_buffer_size(size_t size);
+size_t xiso_get_buffer_size(void);
+void xiso_set_io_strategy(XisoIoStrategy strategy);
+XisoIoStrategy xiso_get_io_strategy(void);
+void xiso_set_threads(unsigned threads);
+// Keeps the worker threads of extract, verify-extracted, search and diff
+// running between operations, for hosts that run many of them
+void xiso_set_keep_workers(bool enable);
+// Deepest directory nesting accepted before a walk fails (0 restores the default)
+void xiso_set_max_depth(unsigned depth);
+
+// Path filters (fnmatch, case-insensitive) applied by list, walk and
+// extract. Patterns without a '/' match the entry name at any depth.
+// Excludes prune whole directories; includes select files.
+bool xiso_add_include(const char* pattern);
+bool xiso_add_exclude(const char* pattern);
+void xiso_clear_filters(void);
+
+// Adaptive I/O tuning: sample buffer sizes and strategies during the first
+// part of an extraction and keep the fastest. When a cache path is set the
+// result is stored per device pair and reused by later runs.
+void xiso_set_auto_tune(bool enable);
+void xiso_set_tune_cache(const char* path);
+
+// Aligned I/O buffer pool shared by all operations. A limit of 0 means
+// unlimited; huge pages are requested for buffers of 2MB and up.
+void xiso_set_buffer_pool_limit(size_t bytes);
+void xiso_set_huge_pages(bool enable);
+void xiso_get_buffer_pool_stats(XisoBufferPoolStats* stats);
+
+// Bandwidth limits in bytes per second on everything the library reads and
+// writes, 0 for unlimited. They can be changed at any time, including from
+// another thread while an extraction runs, and apply within a fraction of
+// a second.
+void xiso_set_bandwidth_limit(uint64_t read_bytes_per_second, uint64_t write_bytes_per_second);
+void xiso_get_bandwidth_limit(uint64_t* read_bytes_per_second, uint64_t* write_bytes_per_second);
+
+// I/O scheduling class for the process's threads (Linux ioprio_set). The
+// values are the kernel's classes; best effort takes a level from 0
+// (highest) to 7, and idle only gets the disk when nothing else wants it.
+typedef enum {
+    XISO_IO_PRIORITY_DEFAULT = 0,
+    XISO_IO_PRIORITY_BEST_EFFORT = 2,
+    XISO_IO_PRIORITY_IDLE = 3,
+} XisoIoPriority;
+
+bool xiso_set_io_priority(XisoIoPriority priority, int level);
+
+// Event tracing. Each thread records spans into its own ring of
+// events_per_thread entries (oldest are overwritten); the dump is Chrome
+// trace JSON that loads in Perfetto or chrome://tracing. Start and dump
+// between operations, not while one is running.
+bool xiso_trace_start(size_t events_per_thread);
+void xiso_trace_stop(void);
+bool xiso_trace_dump(const char* path);
 
 #endif // XISO_H
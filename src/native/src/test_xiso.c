@@ -1,10 +1,56 @@
 #include "xiso.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+static void print_stats(void) {
+    XisoStats stats;
+    xiso_get_stats(&stats);
+
+    printf("\nStatistics:\n");
+    printf("  read calls:       %llu\n", (unsigned long long)stats.read_calls);
+    printf("  lseek calls:      %llu\n", (unsigned long long)stats.lseek_calls);
+    printf("  write calls:      %llu\n", (unsigned long long)stats.write_calls);
+    printf("  open calls:       %llu\n", (unsigned long long)stats.open_calls);
+    printf("  mkdir calls:      %llu\n", (unsigned long long)stats.mkdir_calls);
+    printf("  copy_range calls: %llu\n", (unsigned long long)stats.copy_range_calls);
+    printf("  bytes read:       %llu\n", (unsigned long long)stats.bytes_read);
+    printf("  bytes written:    %llu\n", (unsigned long long)stats.bytes_written);
+    printf("  seek distance:    %llu\n", (unsigned long long)stats.seek_distance);
+    printf("  entries parsed:   %llu\n", (unsigned long long)stats.entries_parsed);
+    printf("  files created:    %llu\n", (unsigned long long)stats.files_created);
+    printf("  dirs created:     %llu\n", (unsigned long long)stats.dirs_created);
+    printf("  header verify:    %.3f ms\n", stats.verify_ns / 1e6);
+    printf("  tree walk:        %.3f ms\n", stats.walk_ns / 1e6);
+    printf("  data copy:        %.3f ms\n", stats.copy_ns / 1e6);
+}
 
 int main(int argc, char** argv) {
+    const char* program = argv[0];
+    const char* trace_path = NULL;
+    bool show_stats = false;
+
+    while (argc > 1 && strncmp(argv[1], "--", 2) == 0) {
+        if (strcmp(argv[1], "--stats") == 0) {
+            show_stats = true;
+        } else if (strcmp(argv[1], "--trace") == 0 && argc > 2) {
+            trace_path = argv[2];
+            argv++;
+            argc--;
+        } else {
+            break;
+        }
+        argv++;
+        argc--;
+    }
+
     if (argc != 3) {
-        printf("Usage: %s <input.iso> <output_directory>\n", argv[0]);
+        printf("Usage: %s [--stats] [--trace <trace.json>] <input.iso> <output_directory>\n", program);
+        return 1;
+    }
+
+    if (trace_path && !xiso_trace_start(1 << 16)) {
+        printf("Failed to start tracing: %s\n", xiso_get_last_error());
         return 1;
     }
 
@@ -15,13 +61,21 @@ int main(int argc, char** argv) {
     }
 
     printf("Opening and verifying ISO file: %s\n", argv[1]);
-    if (!xiso_extract(argv[1], argv[2])) {
+    bool success = xiso_extract(argv[1], argv[2]);
+    if (success) {
+        printf("Test completed successfully!\n");
+    } else {
         printf("Failed to process ISO: %s\n", xiso_get_last_error());
-        xiso_cleanup();
-        return 1;
     }
 
-    printf("Test completed successfully!\n");
+    if (show_stats) print_stats();
+    if (trace_path) {
+        xiso_trace_stop();
+        if (!xiso_trace_dump(trace_path)) {
+            printf("Failed to write trace: %s\n", xiso_get_last_error());
+        }
+    }
+
     xiso_cleanup();
-    return 0;
+    return success ? 0 : 1;
 }
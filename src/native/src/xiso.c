@@ -1,93 +1,69 @@
-#include "xiso.h"
+#include "xiso_internal.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <fcntl.h>
-#include <sys/stat.h>
 #include <errno.h>
 #include <stdarg.h>
 #include <ctype.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <strings.h>
+#include <sys/file.h>
 
-#if defined(_WIN32)
-#include <io.h>
-#define mkdir(path, mode) _mkdir(path)
-#define O_BINARY _O_BINARY
-#else
-#include <unistd.h>
-#include <sys/types.h>
-#define O_BINARY 0
+#ifndef FNM_CASEFOLD
+#define FNM_CASEFOLD 0
 #endif
 
-// Constants
-#define XISO_HEADER_OFFSET           0x10000
-#define XISO_SECTOR_SIZE            2048
-#define XISO_HEADER_DATA           "MICROSOFT*XBOX*MEDIA"
-#define XISO_HEADER_DATA_LENGTH     20
-#define XISO_FILETIME_SIZE          8
-#define XISO_UNUSED_SIZE            0x7c8
-#define XISO_ROOT_DIRECTORY_SECTOR  0x108
-
-// File entry constants
-#define XISO_FILENAME_MAX_LENGTH     256
-#define XISO_ATTRIBUTE_DIR          0x10
-#define XISO_TABLE_OFFSET_SIZE       2
-#define XISO_FILENAME_LENGTH_SIZE    1
-#define XISO_SECTOR_OFFSET_SIZE      4
-#define XISO_FILESIZE_SIZE           4
-#define XISO_ATTRIBUTES_SIZE         1
-#define XISO_PAD_SHORT             0xFFFF
-
-// Additional offset checks for different formats
-#define GLOBAL_LSEEK_OFFSET        0xFD90000ull
-#define XGD3_LSEEK_OFFSET         0x2080000ull
-
-// Debug macros
-#define DEBUG_PRINT(...) printf(__VA_ARGS__)
-#define DUMP_HEX(ptr, len) { \
-    for(size_t i = 0; i < len; i++) { \
-        if(i % 16 == 0) printf("\n%04zx: ", i); \
-        printf("%02x ", ((unsigned char*)(ptr))[i]); \
-    } \
-    printf("\n"); \
-}
-
-typedef struct {
-    uint16_t left_offset;    // 2 bytes
-    uint16_t right_offset;   // 2 bytes
-    uint32_t start_sector;   // 4 bytes
-    uint32_t file_size;      // 4 bytes
-    uint8_t attributes;      // 1 byte
-    uint8_t filename_length; // 1 byte
-    char filename[XISO_FILENAME_MAX_LENGTH];
-} __attribute__((packed)) XisoEntry;
+// Called for every entry in directory order before its subdirectory
+typedef WalkAction (*WalkVisitor)(const char* rel_path, const XisoEntry* entry, unsigned depth, void* ctx);
 
 // Global variables
+bool debug_enabled = true;
 static char last_error[1024] = "";
+static pthread_mutex_t error_lock = PTHREAD_MUTEX_INITIALIZER;
 static int iso_fd = -1;
-static void* buffer = NULL;
+static int iso_direct_fd = -1;
+bool initialized = false;
+unsigned extract_threads = 1;
+static bool extract_failed = false;
+static char** include_patterns = NULL;
+size_t include_count = 0;
+static char** exclude_patterns = NULL;
+static size_t exclude_count = 0;
 static size_t buffer_size = 2 * 1024 * 1024; // 2MB buffer
+unsigned max_walk_depth = XISO_DEFAULT_MAX_DEPTH;
+static XisoIoStrategy io_strategy = XISO_IO_BUFFERED;
 static uint64_t xbox_disc_lseek = 0;
+static XisoResumeMode resume_mode = XISO_RESUME_OFF;
+static Resume* resume = NULL;
+// Shared with the thread that requests cancellation or polls progress
+static bool cancel_requested = false;
+static XisoCancelToken* cancel_token = NULL;
+static XisoErrorCode last_error_code = XISO_OK;
+static XisoProgress progress;
 static char* list_buffer = NULL;
 static size_t list_buffer_size = 0;
 static size_t list_buffer_pos = 0;
 
 // Function declarations
-static void set_error(const char* format, ...);
 static bool verify_header_at_offset(uint64_t offset, uint32_t* out_root_dir_sector, uint32_t* out_root_dir_size);
 static bool verify_xiso(const char* filename, uint32_t* out_root_dir_sector, uint32_t* out_root_dir_size);
-static bool read_entry(XisoEntry* entry, uint64_t dir_start);
-static bool extract_file(const char* output_path, const XisoEntry* entry);
-static bool extract_directory(const char* output_path, uint64_t dir_start);
-static bool list_directory(const char* current_path, uint64_t dir_start);
+static bool extract_file(int dir_fd, const char* name, const char* rel_path, uint64_t offset, uint32_t file_size);
 static void append_to_list(const char* format, ...);
 
 // Helper function implementations
-static void set_error(const char* format, ...) {
+void set_error(const char* format, ...) {
     va_list args;
-    va_start(args, format);
-    vsnprintf(last_error, sizeof(last_error) - 1, format, args);
-    va_end(args);
-    DEBUG_PRINT("Error: %s\n", last_error);
+    pthread_mutex_lock(&error_lock);
+    // Failures that follow a cancellation are consequences of it
+    if (last_error_code < XISO_ERROR_CANCELLED) {
+        va_start(args, format);
+        vsnprintf(last_error, sizeof(last_error) - 1, format, args);
+        va_end(args);
+        last_error_code = XISO_ERROR;
+        DEBUG_PRINT("Error: %s\n", last_error);
+    }
+    pthread_mutex_unlock(&error_lock);
 }
 
 static void append_to_list(const char* format, ...) {
@@ -112,13 +88,13 @@ static bool verify_header_at_offset(uint64_t offset, uint32_t* out_root_dir_sect
     
     DEBUG_PRINT("Checking for header at offset 0x%llx\n", (unsigned long long)(XISO_HEADER_OFFSET + offset));
     
-    seek_result = lseek(iso_fd, XISO_HEADER_OFFSET + offset, SEEK_SET);
+    seek_result = io_lseek(iso_fd, XISO_HEADER_OFFSET + offset, SEEK_SET);
     if (seek_result == -1) {
         DEBUG_PRINT("Failed to seek to header offset: %s\n", strerror(errno));
         return false;
     }
     
-    ssize_t bytes_read = read(iso_fd, header, XISO_HEADER_DATA_LENGTH);
+    ssize_t bytes_read = io_read(iso_fd, header, XISO_HEADER_DATA_LENGTH);
     if (bytes_read != XISO_HEADER_DATA_LENGTH) {
         DEBUG_PRINT("Failed to read header data (read %zd bytes): %s\n", bytes_read, strerror(errno));
         return false;
@@ -128,13 +104,13 @@ static bool verify_header_at_offset(uint64_t offset, uint32_t* out_root_dir_sect
     DUMP_HEX(header, XISO_HEADER_DATA_LENGTH);
     
     if (memcmp(header, XISO_HEADER_DATA, XISO_HEADER_DATA_LENGTH) == 0) {
-        bytes_read = read(iso_fd, &root_dir_sector, 4);
+        bytes_read = io_read(iso_fd, &root_dir_sector, 4);
         if (bytes_read != 4) {
             DEBUG_PRINT("Failed to read root directory sector: %s\n", strerror(errno));
             return false;
         }
         
-        bytes_read = read(iso_fd, &root_dir_size, 4);
+        bytes_read = io_read(iso_fd, &root_dir_size, 4);
         if (bytes_read != 4) {
             DEBUG_PRINT("Failed to read root directory size: %s\n", strerror(errno));
             return false;
@@ -148,14 +124,14 @@ static bool verify_header_at_offset(uint64_t offset, uint32_t* out_root_dir_sect
                    *out_root_dir_sector, *out_root_dir_size);
 
         // Skip filetime and unused data
-        seek_result = lseek(iso_fd, XISO_FILETIME_SIZE + XISO_UNUSED_SIZE, SEEK_CUR);
+        seek_result = io_lseek(iso_fd, XISO_FILETIME_SIZE + XISO_UNUSED_SIZE, SEEK_CUR);
         if (seek_result == -1) {
             DEBUG_PRINT("Failed to seek past filetime and unused data: %s\n", strerror(errno));
             return false;
         }
         
         // Verify trailing header
-        bytes_read = read(iso_fd, header, XISO_HEADER_DATA_LENGTH);
+        bytes_read = io_read(iso_fd, header, XISO_HEADER_DATA_LENGTH);
         if (bytes_read != XISO_HEADER_DATA_LENGTH) {
             DEBUG_PRINT("Failed to read trailing header: %s\n", strerror(errno));
             return false;
@@ -175,23 +151,35 @@ static bool verify_header_at_offset(uint64_t offset, uint32_t* out_root_dir_sect
     return false;
 }
 
+static bool probe_header(uint64_t offset, uint32_t* out_root_dir_sector, uint32_t* out_root_dir_size) {
+    char detail[TRACE_DETAIL_MAX];
+    uint64_t span = trace_begin();
+    bool found = verify_header_at_offset(offset, out_root_dir_sector, out_root_dir_size);
+
+    if (span) {
+        snprintf(detail, sizeof(detail), "offset 0x%llx", (unsigned long long)offset);
+        trace_end(span, "verify_header_at_offset", detail);
+    }
+    return found;
+}
+
 static bool verify_xiso(const char* filename, uint32_t* out_root_dir_sector, uint32_t* out_root_dir_size) {
     DEBUG_PRINT("Verifying XISO file: %s\n", filename);
     
     // Try standard offset
-    if (verify_header_at_offset(0, out_root_dir_sector, out_root_dir_size)) {
+    if (probe_header(0, out_root_dir_sector, out_root_dir_size)) {
         DEBUG_PRINT("Found valid XBOX ISO header at standard offset\n");
         return true;
     }
     
     // Try GLOBAL_LSEEK_OFFSET
-    if (verify_header_at_offset(GLOBAL_LSEEK_OFFSET, out_root_dir_sector, out_root_dir_size)) {
+    if (probe_header(GLOBAL_LSEEK_OFFSET, out_root_dir_sector, out_root_dir_size)) {
         DEBUG_PRINT("Found valid XBOX ISO header at global offset\n");
         return true;
     }
     
     // Try XGD3_LSEEK_OFFSET
-    if (verify_header_at_offset(XGD3_LSEEK_OFFSET, out_root_dir_sector, out_root_dir_size)) {
+    if (probe_header(XGD3_LSEEK_OFFSET, out_root_dir_sector, out_root_dir_size)) {
         DEBUG_PRINT("Found valid XBOX ISO header at XGD3 offset\n");
         return true;
     }
@@ -200,85 +188,51 @@ static bool verify_xiso(const char* filename, uint32_t* out_root_dir_sector, uin
     return false;
 }
 
-static bool read_entry(XisoEntry* entry, uint64_t dir_start) {
-    unsigned char raw_data[32];
-    size_t raw_size = 0;
-    
-    memset(entry, 0, sizeof(XisoEntry));
-
-    // Read raw data for debugging
-    if (read(iso_fd, raw_data, sizeof(raw_data)) == sizeof(raw_data)) {
-        raw_size = sizeof(raw_data);
-        DEBUG_PRINT("\nRaw directory entry data:\n");
-        DUMP_HEX(raw_data, sizeof(raw_data));
-    }
-    
-    // Return to start
-    if (lseek(iso_fd, -raw_size, SEEK_CUR) == -1) {
-        set_error("Failed to seek back to entry start");
-        return false;
-    }
-
-    // Check for sector padding
-    uint16_t pad;
-    if (read(iso_fd, &pad, 2) == 2 && pad == XISO_PAD_SHORT) {
-        // Skip to next sector
-        off_t pos = lseek(iso_fd, 0, SEEK_CUR);
-        off_t sector_offset = pos % XISO_SECTOR_SIZE;
-        if (sector_offset) {
-            if (lseek(iso_fd, XISO_SECTOR_SIZE - sector_offset, SEEK_CUR) == -1) {
-                set_error("Failed to seek to next sector");
-                return false;
-            }
-        }
-        return read_entry(entry, dir_start);
-    }
+// Parses the entry at offset in an in-memory directory table. Every 4-byte
+// slot the entry covers is marked in visited; reaching a marked slot again
+// means the table loops back on itself or entries overlap.
+static bool parse_entry(const uint8_t* table, uint32_t table_size, uint8_t* visited,
+                        uint32_t* offset_in_out, uint64_t table_start, XisoEntry* entry) {
+    uint32_t offset = *offset_in_out;
 
-    // Return to start
-    if (lseek(iso_fd, -2, SEEK_CUR) == -1) {
-        set_error("Failed to seek back after pad check");
-        return false;
+    // Sector padding: the entry continues at the next sector
+    while (offset + 2 <= table_size && table[offset] == 0xFF && table[offset + 1] == 0xFF) {
+        offset = (offset / XISO_SECTOR_SIZE + 1) * XISO_SECTOR_SIZE;
     }
 
-    // Read directory entry structure
-    uint16_t l_offset, r_offset;
-    uint32_t sector, size;
-    uint8_t attributes, filename_length;
-
-    // Read offsets
-    if (read(iso_fd, &l_offset, 2) != 2 || read(iso_fd, &r_offset, 2) != 2) {
-        set_error("Failed to read offsets");
+    if ((uint64_t)offset + XISO_ENTRY_HEADER_SIZE > table_size ||
+        (uint64_t)offset + XISO_ENTRY_HEADER_SIZE + table[offset + 13] > table_size) {
+        set_error("Corrupt directory table at 0x%llx: entry at +0x%x runs past the table",
+                  (unsigned long long)table_start, offset);
         return false;
     }
 
-    // Read sector and size
-    if (read(iso_fd, &sector, 4) != 4 || read(iso_fd, &size, 4) != 4) {
-        set_error("Failed to read sector/size");
-        return false;
+    memset(entry, 0, sizeof(XisoEntry));
+    memcpy(entry, table + offset, XISO_ENTRY_HEADER_SIZE);
+    memcpy(entry->filename, table + offset + XISO_ENTRY_HEADER_SIZE, entry->filename_length);
+    entry->filename[entry->filename_length] = '\0';
+
+    DEBUG_PRINT("\nRaw directory entry data:\n");
+    DUMP_HEX(table + offset, XISO_ENTRY_HEADER_SIZE + entry->filename_length);
+
+    uint32_t end = offset + XISO_ENTRY_HEADER_SIZE + entry->filename_length;
+    for (uint32_t slot = offset / 4; slot <= (end - 1) / 4; slot++) {
+        if (visited[slot / 8] & (1u << (slot % 8))) {
+            set_error("Corrupt directory table at 0x%llx: entry at +0x%x is reached twice",
+                      (unsigned long long)table_start, offset);
+            return false;
+        }
+        visited[slot / 8] |= 1u << (slot % 8);
     }
 
-    // Read attributes and filename length
-    if (read(iso_fd, &attributes, 1) != 1 || read(iso_fd, &filename_length, 1) != 1) {
-        set_error("Failed to read attributes/filename length");
+    if (entry->filename_length == 0) {
+        set_error("Corrupt directory table at 0x%llx: entry at +0x%x has no name",
+                  (unsigned long long)table_start, offset);
         return false;
     }
 
-    // Store values directly without endian conversion
-    entry->left_offset = l_offset;
-    entry->right_offset = r_offset;
-    entry->start_sector = sector;
-    entry->file_size = size;
-    entry->attributes = attributes;
-    entry->filename_length = filename_length;
-
-    // Read filename
-    if (entry->filename_length > 0) {
-        if (read(iso_fd, entry->filename, entry->filename_length) != entry->filename_length) {
-            set_error("Failed to read filename");
-            return false;
-        }
-        entry->filename[entry->filename_length] = '\0';
-    }
+    STAT_ADD(stats_local(), entries_parsed, 1);
+    *offset_in_out = offset;
 
     DEBUG_PRINT("Entry: name='%s', sector=%u, size=%u, attr=0x%02x\n",
                 entry->filename, entry->start_sector, entry->file_size, entry->attributes);
@@ -286,275 +240,600 @@ static bool read_entry(XisoEntry* entry, uint64_t dir_start) {
     return true;
 }
 
-static bool extract_file(const char* output_path, const XisoEntry* entry) {
-    char full_path[XISO_FILENAME_MAX_LENGTH * 2];
-    int out_fd;
-    ssize_t bytes_read, bytes_written;
-    uint32_t bytes_remaining;
-
-    snprintf(full_path, sizeof(full_path), "%s/%s", output_path, entry->filename);
+bool write_all(int fd, const void* data, size_t length) {
+    const char* p = data;
 
-    // Handle directories
-    if (entry->attributes & XISO_ATTRIBUTE_DIR) {
-        DEBUG_PRINT("Creating directory: %s\n", full_path);
-        if (mkdir(full_path, 0755) != 0 && errno != EEXIST) {
-            set_error("Failed to create directory: %s (%s)", full_path, strerror(errno));
+    while (length > 0) {
+        ssize_t written = io_write(fd, p, length);
+        if (written <= 0) {
+            if (written < 0 && errno == EINTR) continue;
             return false;
         }
-        return true;
+        p += written;
+        length -= written;
     }
+    return true;
+}
 
-    DEBUG_PRINT("Extracting file: %s (%u bytes)\n", full_path, entry->file_size);
+// Copies up to length bytes of image data at offset to out_fd using the
+// strategy in plan. Returns the number of bytes copied, 0 if the strategy is
+// not usable here (caller falls back) or -1 on error, with errno 0 when the
+// image ended before offset + length.
+static ssize_t copy_chunk(const XisoIoPlan* plan, int out_fd, uint64_t offset, size_t length) {
+    ssize_t bytes_read, result;
+    void* buffer;
+
+    switch (plan->strategy) {
+    case XISO_IO_DIRECT: {
+#if defined(O_DIRECT)
+        if (iso_direct_fd == -1) return 0;
+
+        uint64_t aligned = offset & ~(uint64_t)(XISO_IO_ALIGNMENT - 1);
+        size_t head = offset - aligned;
+        size_t span = (head + length + XISO_IO_ALIGNMENT - 1) & ~(size_t)(XISO_IO_ALIGNMENT - 1);
+
+        buffer = pool_acquire(span);
+        if (!buffer) return -1;
+
+        uint64_t read_span = trace_begin();
+        bytes_read = io_pread(iso_direct_fd, buffer, span, aligned);
+        trace_end(read_span, "read", NULL);
+        if (bytes_read < 0 && errno == EINVAL) {
+            result = 0;
+        } else if (bytes_read <= (ssize_t)head) {
+            if (bytes_read >= 0) errno = 0;
+            result = -1;
+        } else {
+            size_t n = (size_t)bytes_read - head;
+            if (n > length) n = length;
+            uint64_t write_span = trace_begin();
+            result = write_all(out_fd, (char*)buffer + head, n) ? (ssize_t)n : -1;
+            trace_end(write_span, "write", NULL);
+        }
 
-    out_fd = open(full_path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
-    if (out_fd == -1) {
-        set_error("Failed to create file: %s (%s)", full_path, strerror(errno));
-        return false;
+        pool_release(buffer, span);
+        return result;
+#else
+        return 0;
+#endif
     }
 
-    if (lseek(iso_fd, entry->start_sector * XISO_SECTOR_SIZE + xbox_disc_lseek, SEEK_SET) == -1) {
-        set_error("Failed to seek to file data");
-        close(out_fd);
-        return false;
+    case XISO_IO_COPY_RANGE: {
+#if defined(__linux__)
+        uint64_t copy_span = trace_begin();
+        ssize_t copied = io_copy_range(iso_fd, offset, out_fd, length);
+        trace_end(copy_span, "copy_file_range", NULL);
+        if (copied < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL ||
+                           errno == EOPNOTSUPP || errno == EBADF)) {
+            return 0;
+        }
+        if (copied == 0) errno = 0;
+        return copied > 0 ? copied : -1;
+#else
+        return 0;
+#endif
     }
 
-    bytes_remaining = entry->file_size;
-    while (bytes_remaining > 0) {
-        size_t to_read = bytes_remaining < buffer_size ? bytes_remaining : buffer_size;
-        
-        bytes_read = read(iso_fd, buffer, to_read);
+    case XISO_IO_BUFFERED:
+    default:
+        buffer = pool_acquire(length);
+        if (!buffer) return -1;
+
+        uint64_t read_span = trace_begin();
+        bytes_read = io_pread(iso_fd, buffer, length, offset);
+        trace_end(read_span, "read", NULL);
         if (bytes_read <= 0) {
-            set_error("Failed to read file data");
-            close(out_fd);
-            return false;
+            if (bytes_read == 0) errno = 0;
+            result = -1;
+        } else {
+            uint64_t write_span = trace_begin();
+            result = write_all(out_fd, buffer, bytes_read) ? bytes_read : -1;
+            trace_end(write_span, "write", NULL);
         }
 
-        bytes_written = write(out_fd, buffer, bytes_read);
-        if (bytes_written != bytes_read) {
-            set_error("Failed to write file data");
-            close(out_fd);
-            return false;
-        }
+        pool_release(buffer, length);
+        return result;
+    }
+}
 
-        bytes_remaining -= bytes_read;
+DirHandle* dir_new(DirHandle* parent, const char* name) {
+    size_t length = strlen(name) + 1;
+    DirHandle* dir = malloc(sizeof(DirHandle) + length);
+    if (!dir) {
+        set_error("Failed to allocate directory handle");
+        return NULL;
     }
 
-    close(out_fd);
-    return true;
+    dir->parent = parent;
+    if (parent) __atomic_add_fetch(&parent->refs, 1, __ATOMIC_RELAXED);
+    dir->fd = -1;
+    dir->refs = 1;
+    memcpy(dir->name, name, length);
+    return dir;
 }
 
-static bool process_directory_entry(const char* path, uint64_t dir_start, uint64_t entry_offset, bool is_listing) {
-    XisoEntry entry;
-    char new_path[XISO_FILENAME_MAX_LENGTH * 2];
-    bool result = true;
+void dir_release(DirHandle* dir) {
+    while (dir && __atomic_sub_fetch(&dir->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        DirHandle* parent = dir->parent;
+        if (dir->fd != -1) close(dir->fd);
+        free(dir);
+        dir = parent;
+    }
+}
+
+// Path of dir below the output directory, for error messages
+static void dir_path(const DirHandle* dir, char* out, size_t size) {
+    if (dir->parent && dir->parent->parent) {
+        dir_path(dir->parent, out, size);
+        size_t length = strlen(out);
+        snprintf(out + length, size - length, "/%s", dir->name);
+    } else {
+        snprintf(out, size, "%s", dir->name);
+    }
+}
+
+// Kept out of dir_open() so its recursion doesn't carry the path buffer
+static void dir_error(const DirHandle* dir, const char* what, int error) {
+    char path[XISO_FILENAME_MAX_LENGTH * 64];
+    dir_path(dir, path, sizeof(path));
+    set_error("Failed to %s directory: %s (%s)", what, path, strerror(error));
+}
+
+bool dir_open(DirHandle* dir) {
+    if (dir->fd != -1) return true;
+    if (!dir_open(dir->parent)) return false;
 
-    // Seek to entry
-    if (lseek(iso_fd, entry_offset, SEEK_SET) == -1) {
-        set_error("Failed to seek to entry");
+    if (io_mkdirat(dir->parent->fd, dir->name, 0755) == 0) {
+        STAT_ADD(stats_local(), dirs_created, 1);
+    } else if (errno != EEXIST) {
+        dir_error(dir, "create", errno);
         return false;
     }
 
-    // Read entry
-    if (!read_entry(&entry, dir_start)) {
+    dir->fd = io_openat(dir->parent->fd, dir->name, O_RDONLY | O_DIRECTORY, 0);
+    if (dir->fd == -1) {
+        dir_error(dir, "open", errno);
         return false;
     }
+    return true;
+}
 
-    // Process entry
-    if (is_listing) {
-        if (entry.attributes & XISO_ATTRIBUTE_DIR) {
-            append_to_list("%s%s/\n", path, entry.filename);
-        } else {
-            append_to_list("%s%s (%u bytes)\n", path, entry.filename, entry.file_size);
-        }
+struct XisoCancelToken {
+    bool cancelled;
+    uint64_t deadline;           // monotonic ns, 0 for none
+};
+
+void operation_begin(void) {
+    pthread_mutex_lock(&error_lock);
+    last_error_code = XISO_OK;
+    pthread_mutex_unlock(&error_lock);
+
+    __atomic_store_n(&cancel_requested, false, __ATOMIC_RELAXED);
+    __atomic_store_n(&progress.files_total, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&progress.bytes_total, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&progress.files_done, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&progress.bytes_done, 0, __ATOMIC_RELAXED);
+}
+
+bool operation_cancelled(void) {
+    XisoCancelToken* token = cancel_token;
+    XisoErrorCode code;
+
+    if (__atomic_load_n(&cancel_requested, __ATOMIC_RELAXED) ||
+        (token && __atomic_load_n(&token->cancelled, __ATOMIC_RELAXED))) {
+        code = XISO_ERROR_CANCELLED;
+    } else if (token && __atomic_load_n(&token->deadline, __ATOMIC_RELAXED) &&
+               xiso_now_ns() >= __atomic_load_n(&token->deadline, __ATOMIC_RELAXED)) {
+        code = XISO_ERROR_DEADLINE;
     } else {
-        if (!extract_file(path, &entry)) {
-            return false;
-        }
+        return false;
     }
 
-    // Process subdirectory
-    if ((entry.attributes & XISO_ATTRIBUTE_DIR) && entry.start_sector) {
-        if (is_listing) {
-            snprintf(new_path, sizeof(new_path), "%s%s/", path, entry.filename);
-        } else {
-            snprintf(new_path, sizeof(new_path), "%s/%s", path, entry.filename);
-        }
+    // The first thread to notice reports it
+    pthread_mutex_lock(&error_lock);
+    if (last_error_code < XISO_ERROR_CANCELLED) {
+        snprintf(last_error, sizeof(last_error), "%s",
+                 code == XISO_ERROR_CANCELLED ? "Cancelled" : "Deadline exceeded");
+        last_error_code = code;
+        DEBUG_PRINT("Error: %s\n", last_error);
+    }
+    pthread_mutex_unlock(&error_lock);
+    return true;
+}
 
-        uint64_t subdir_start = entry.start_sector * XISO_SECTOR_SIZE + xbox_disc_lseek;
-        
-        if (is_listing) {
-            result = list_directory(new_path, subdir_start);
-        } else {
-            result = extract_directory(new_path, subdir_start);
-        }
+// Copies file_size bytes of image data at offset to the current position of
+// out_fd, following the tuner's plan for each chunk
+static bool copy_extent(int out_fd, const char* rel_path, uint64_t offset, uint32_t file_size) {
+    uint32_t bytes_remaining = file_size;
 
-        if (!result) return false;
+    while (bytes_remaining > 0) {
+        if (operation_cancelled()) return false;
+
+        XisoIoPlan plan;
+        tune_current(&plan);
 
-        // Return to parent directory entry
-        if (lseek(iso_fd, entry_offset, SEEK_SET) == -1) {
-            set_error("Failed to return to parent directory");
+        size_t to_copy = bytes_remaining < plan.buffer_size ? bytes_remaining : plan.buffer_size;
+        uint64_t start = xiso_now_ns();
+        ssize_t copied = copy_chunk(&plan, out_fd, offset, to_copy);
+
+        if (copied == 0) {
+            DEBUG_PRINT("I/O strategy %d unavailable, falling back\n", (int)plan.strategy);
+            tune_reject(plan.strategy);
+            continue;
+        }
+        if (copied < 0) {
+            if (errno == 0) {
+                set_error("Failed to copy file data: %s (unexpected end of image at 0x%llx)", rel_path,
+                          (unsigned long long)offset);
+            } else {
+                set_error("Failed to copy file data: %s (%s)", rel_path, strerror(errno));
+            }
             return false;
         }
-    }
 
-    // Process left subtree
-    if (entry.left_offset) {
-        result = process_directory_entry(path, dir_start, 
-            dir_start + entry.left_offset * 4, is_listing);
-        if (!result) return false;
+        uint64_t elapsed = xiso_now_ns() - start;
+        STAT_ADD(stats_local(), copy_ns, elapsed);
+        tune_record(&plan, copied, elapsed);
+        __atomic_add_fetch(&progress.bytes_done, copied, __ATOMIC_RELAXED);
+        offset += copied;
+        bytes_remaining -= copied;
     }
+    return true;
+}
 
-    // Process right subtree
-    if (entry.right_offset) {
-        result = process_directory_entry(path, dir_start,
-            dir_start + entry.right_offset * 4, is_listing);
-        if (!result) return false;
+// Compares the first length bytes of the file with the image extent
+static bool same_contents(int dir_fd, const char* name, uint64_t offset, uint32_t length) {
+    int fd = io_openat(dir_fd, name, O_RDONLY | O_BINARY, 0);
+    if (fd == -1) return false;
+
+    void* buffer = pool_acquire(2 * buffer_size);
+    bool same = buffer != NULL;
+    uint64_t done = 0;
+    while (same && done < length) {
+        size_t n = length - done < buffer_size ? length - done : buffer_size;
+        same = io_pread(fd, buffer, n, done) == (ssize_t)n &&
+               io_pread(iso_fd, (char*)buffer + buffer_size, n, offset + done) == (ssize_t)n &&
+               memcmp(buffer, (char*)buffer + buffer_size, n) == 0;
+        done += n;
     }
 
-    return true;
+    if (buffer) pool_release(buffer, 2 * buffer_size);
+    close(fd);
+    return same;
 }
 
-static bool list_directory(const char* current_path, uint64_t dir_start) {
-    return process_directory_entry(current_path, dir_start, dir_start, true);
-}
+// How much of an existing output file can be kept, given the bytes the
+// resume journal says are on disk
+static uint32_t resumable_bytes(int dir_fd, const char* name, uint64_t offset, uint32_t file_size,
+                                uint32_t committed) {
+    struct stat st;
 
-static bool extract_directory(const char* output_path, uint64_t dir_start) {
-    DEBUG_PRINT("Processing directory at offset 0x%llx\n", (unsigned long long)dir_start);
-    return process_directory_entry(output_path, dir_start, dir_start, false);
+    if (fstatat(dir_fd, name, &st, 0) != 0 || !S_ISREG(st.st_mode)) return 0;
+    if (resume_mode == XISO_RESUME_VERIFY && !committed && (uint64_t)st.st_size == file_size) {
+        committed = file_size;
+    }
+    // Complete files must be exactly the right size; partial ones may hold
+    // unsynced data past the committed offset
+    if (committed == file_size ? (uint64_t)st.st_size != file_size : (uint64_t)st.st_size < committed) {
+        return 0;
+    }
+    if (resume_mode == XISO_RESUME_VERIFY && committed &&
+        !same_contents(dir_fd, name, offset, committed)) {
+        return 0;
+    }
+    return committed;
 }
 
-bool xiso_init(void) {
-    DEBUG_PRINT("Initializing XISO library...\n");
-    
-    if (buffer) {
-        DEBUG_PRINT("Buffer already allocated\n");
-        return true;
+static bool extract_file(int dir_fd, const char* name, const char* rel_path, uint64_t offset, uint32_t file_size) {
+    long handle = -1;
+    uint32_t done = 0;
+
+    if (resume) {
+        uint32_t committed;
+        handle = resume_start(resume, rel_path, offset, file_size, &committed);
+        if (handle < 0) return false;
+
+        done = resumable_bytes(dir_fd, name, offset, file_size, committed);
+        if (done != committed && !resume_written(resume, handle, done)) return false;
+        __atomic_add_fetch(&progress.bytes_done, done, __ATOMIC_RELAXED);
+        if (done == file_size && file_size > 0) {
+            DEBUG_PRINT("Skipping extracted file: %s\n", rel_path);
+            STAT_ADD(stats_local(), files_skipped, 1);
+            __atomic_add_fetch(&progress.files_done, 1, __ATOMIC_RELAXED);
+            return true;
+        }
     }
-    
-    buffer = malloc(buffer_size);
-    if (!buffer) {
-        set_error("Failed to allocate buffer");
+    DEBUG_PRINT("Extracting file: %s (%u bytes, from %u)\n", rel_path, file_size, done);
+
+    int flags = O_WRONLY | O_CREAT | O_BINARY | (done ? 0 : O_TRUNC);
+    int out_fd = io_openat(dir_fd, name, flags, 0644);
+    if (out_fd == -1) {
+        set_error("Failed to create file: %s (%s)", rel_path, strerror(errno));
         return false;
     }
-    
-    DEBUG_PRINT("Allocated %zu byte buffer\n", buffer_size);
-    return true;
+    if (done && (ftruncate(out_fd, done) != 0 || io_lseek(out_fd, done, SEEK_SET) != (off_t)done)) {
+        set_error("Failed to resume file: %s (%s)", rel_path, strerror(errno));
+        close(out_fd);
+        return false;
+    }
+    STAT_ADD(stats_local(), files_created, 1);
+
+    // Progress is reported per segment so large files resume part way
+    bool copied = true;
+    while (copied && done < file_size) {
+        uint32_t length = file_size - done;
+        if (resume && length > RESUME_SEGMENT_SIZE) length = RESUME_SEGMENT_SIZE;
+
+        copied = copy_extent(out_fd, rel_path, offset + done, length);
+        done += length;
+        if (copied && resume) copied = resume_written(resume, handle, done);
+    }
+    close(out_fd);
+    if (copied) {
+        __atomic_add_fetch(&progress.files_done, 1, __ATOMIC_RELAXED);
+    } else if (!resume && xiso_get_last_error_code() >= XISO_ERROR_CANCELLED) {
+        // A resumable run keeps the partial file for next time
+        unlinkat(dir_fd, name, 0);
+    }
+    return copied;
 }
 
-void xiso_cleanup(void) {
-    if (iso_fd != -1) {
-        close(iso_fd);
-        iso_fd = -1;
+static bool matches_any(char* const* patterns, size_t count, const char* rel_path) {
+    const char* base = strrchr(rel_path, '/');
+    base = base ? base + 1 : rel_path;
+
+    for (size_t i = 0; i < count; i++) {
+        // Patterns without a slash match the name at any depth
+        const char* subject = strchr(patterns[i], '/') ? rel_path : base;
+        if (fnmatch(patterns[i], subject, FNM_CASEFOLD) == 0) return true;
     }
-    free(buffer);
-    buffer = NULL;
-    DEBUG_PRINT("Cleaned up XISO library\n");
+    return false;
 }
 
-void xiso_set_debug(bool enable) {
-    // Debug is now always enabled
+// Applies the include/exclude filters. Excluded directories are pruned;
+// include patterns select files only, directories are always descended.
+WalkAction filter_entry(const char* rel_path, const XisoEntry* entry) {
+    if (matches_any(exclude_patterns, exclude_count, rel_path)) {
+        return WALK_SKIP;
+    }
+    if (!(entry->attributes & XISO_ATTRIBUTE_DIR) && include_count &&
+        !matches_any(include_patterns, include_count, rel_path)) {
+        return WALK_SKIP;
+    }
+    return WALK_CONTINUE;
 }
 
-void xiso_set_buffer_size(size_t size) {
-    if (size > 0) {
-        buffer_size = size;
-        if (buffer) {
-            free(buffer);
-            buffer = malloc(buffer_size);
-            DEBUG_PRINT("Reallocated buffer to %zu bytes\n", buffer_size);
+// Relative path of the entry being visited, grown as the walk descends
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+} PathBuffer;
+
+static bool path_append(PathBuffer* path, size_t prefix_length, const char* name) {
+    size_t name_length = strlen(name);
+    size_t needed = prefix_length + 1 + name_length + 1;
+
+    if (needed > path->capacity) {
+        size_t capacity = path->capacity ? path->capacity : 256;
+        while (capacity < needed) capacity *= 2;
+
+        char* grown = realloc(path->data, capacity);
+        if (!grown) {
+            set_error("Failed to allocate path buffer");
+            return false;
         }
+        path->data = grown;
+        path->capacity = capacity;
     }
-}
 
-const char* xiso_get_last_error(void) {
-    return last_error;
+    path->length = prefix_length;
+    if (prefix_length) path->data[path->length++] = '/';
+    memcpy(path->data + path->length, name, name_length + 1);
+    path->length += name_length;
+    return true;
 }
 
-bool xiso_list(const char* iso_path, char* output_buffer, size_t buffer_size) {
-    uint32_t root_dir_sector, root_dir_size;
-    struct stat st;
-    
-    DEBUG_PRINT("Starting XISO listing\n");
-    DEBUG_PRINT("ISO path: %s\n", iso_path);
-    
-    if (!buffer) {
-        set_error("XISO not initialized");
+bool table_init(DirTable* table, uint64_t start, uint32_t size) {
+    memset(table, 0, sizeof(*table));
+    if (size < XISO_ENTRY_HEADER_SIZE || size > XISO_MAX_TABLE_SIZE) {
+        set_error("Corrupt directory table at 0x%llx: invalid size %u",
+                  (unsigned long long)start, size);
         return false;
     }
 
-    // Check if ISO file exists and is readable
-    if (stat(iso_path, &st) != 0) {
-        set_error("Cannot access ISO file: %s (%s)", iso_path, strerror(errno));
+    table->start = start;
+    table->size = size;
+    table->data = malloc(size);
+    table->visited = calloc((size / 4 + 7) / 8 + 1, 1);
+    // Every pushed entry occupies at least one distinct slot, so this never overflows
+    table->pending = malloc((size / 4 + 1) * sizeof(uint16_t));
+    if (!table->data || !table->visited || !table->pending) {
+        set_error("Failed to allocate directory table (%u bytes)", size);
         return false;
     }
 
-    // Close any previously opened file
-    if (iso_fd != -1) {
-        close(iso_fd);
+    table->pending[table->pending_count++] = 0;
+    return true;
+}
+
+int table_next(DirTable* table, XisoEntry* entry) {
+    if (table->pending_count == 0) {
+        return 0;
     }
 
-    DEBUG_PRINT("Opening ISO file...\n");
-    
-    // Open the ISO file
-    iso_fd = open(iso_path, O_RDONLY | O_BINARY);
-    if (iso_fd == -1) {
-        set_error("Failed to open ISO file: %s (%s)", iso_path, strerror(errno));
+    uint32_t offset = (uint32_t)table->pending[--table->pending_count] * 4;
+    if (!parse_entry(table->data, table->size, table->visited, &offset, table->start, entry)) {
+        return -1;
+    }
+    table->current = offset;
+
+    // Right is pushed first so the left subtree is visited first
+    if (entry->right_offset && entry->right_offset != XISO_PAD_SHORT) {
+        table->pending[table->pending_count++] = entry->right_offset;
+    }
+    if (entry->left_offset && entry->left_offset != XISO_PAD_SHORT) {
+        table->pending[table->pending_count++] = entry->left_offset;
+    }
+    return 1;
+}
+
+void table_free(DirTable* table) {
+    free(table->data);
+    free(table->visited);
+    free(table->pending);
+    memset(table, 0, sizeof(*table));
+}
+
+// One directory being walked. Memory per level is bounded by the table
+// size, and the number of levels by max_walk_depth.
+typedef struct {
+    DirTable table;
+    size_t prefix_length;
+    uint64_t span;
+} WalkFrame;
+
+static void pop_frame(WalkFrame* frame, PathBuffer* path) {
+    if (frame->span) {
+        path->data[frame->prefix_length] = '\0';
+        trace_end(frame->span, "directory", frame->prefix_length ? path->data : "/");
+    }
+    table_free(&frame->table);
+    memset(frame, 0, sizeof(*frame));
+}
+
+static bool push_frame(WalkFrame* frames, unsigned depth, uint64_t table_start,
+                       uint32_t table_size, size_t prefix_length) {
+    WalkFrame* frame = &frames[depth];
+
+    memset(frame, 0, sizeof(*frame));
+    DEBUG_PRINT("Processing directory at offset 0x%llx\n", (unsigned long long)table_start);
+
+    for (unsigned i = 0; i < depth; i++) {
+        if (frames[i].table.start == table_start) {
+            set_error("Corrupt directory table at 0x%llx: directory contains itself",
+                      (unsigned long long)table_start);
+            return false;
+        }
+    }
+
+    frame->span = trace_begin();
+    frame->prefix_length = prefix_length;
+    if (!table_init(&frame->table, table_start, table_size)) {
         return false;
     }
 
-    DEBUG_PRINT("Verifying ISO format...\n");
-    
-    // Verify it's a valid Xbox ISO
-    if (!verify_xiso(iso_path, &root_dir_sector, &root_dir_size)) {
-        close(iso_fd);
-        iso_fd = -1;
+    if (io_pread(iso_fd, frame->table.data, table_size, table_start) != (ssize_t)table_size) {
+        set_error("Failed to read directory table at 0x%llx", (unsigned long long)table_start);
         return false;
     }
+    return true;
+}
 
-    // Set up list buffer
-    list_buffer = output_buffer;
-    list_buffer_size = buffer_size;
-    list_buffer_pos = 0;
+// Preorder walk: an entry, then the contents of its directory, then its
+// left and right subtrees - the order the old recursive walk produced
+static bool walk_tree(uint64_t root_start, uint32_t root_size, bool filtered, WalkVisitor visit, void* ctx) {
+    PathBuffer path = { NULL, 0, 0 };
+    WalkFrame* frames = calloc(max_walk_depth + 1, sizeof(WalkFrame));
+    unsigned depth = 0;
+    bool result = false;
 
-    // Start listing from root directory
-    bool success = list_directory("", 
-        root_dir_sector * XISO_SECTOR_SIZE + xbox_disc_lseek);
+    if (!frames) {
+        set_error("Failed to allocate directory stack");
+        return false;
+    }
+    if (root_size == 0) {
+        free(frames);
+        return true;
+    }
+    if (!path_append(&path, 0, "") || !push_frame(frames, 0, root_start, root_size, 0)) {
+        goto done;
+    }
 
-    close(iso_fd);
-    iso_fd = -1;
-    
-    DEBUG_PRINT("Listing %s\n", success ? "completed successfully" : "failed");
-    return success;
+    for (;;) {
+        WalkFrame* frame = &frames[depth];
+        XisoEntry entry;
+
+        if (operation_cancelled()) {
+            break;
+        }
+        int next = table_next(&frame->table, &entry);
+        if (next < 0) {
+            break;
+        }
+        if (next == 0) {
+            pop_frame(frame, &path);
+            if (depth == 0) {
+                result = true;
+                break;
+            }
+            depth--;
+            continue;
+        }
+
+        if (!path_append(&path, frame->prefix_length, entry.filename)) {
+            break;
+        }
+
+        WalkAction action = filtered ? filter_entry(path.data, &entry) : WALK_CONTINUE;
+        if (action == WALK_CONTINUE) {
+            action = visit(path.data, &entry, depth, ctx);
+        }
+        if (action == WALK_ABORT) {
+            break;
+        }
+
+        if (action == WALK_CONTINUE && (entry.attributes & XISO_ATTRIBUTE_DIR) &&
+            entry.start_sector && entry.file_size) {
+            if (depth + 1 > max_walk_depth) {
+                set_error("Directory nesting exceeds the limit of %u: %s", max_walk_depth, path.data);
+                break;
+            }
+            uint64_t subdir_start = (uint64_t)entry.start_sector * XISO_SECTOR_SIZE + xbox_disc_lseek;
+            depth++;
+            if (!push_frame(frames, depth, subdir_start, entry.file_size, path.length)) {
+                break;
+            }
+        }
+    }
+
+done:
+    if (!result) {
+        // Unwind whatever is still open after an error
+        for (unsigned i = depth + 1; i-- > 0;) {
+            pop_frame(&frames[i], &path);
+        }
+    }
+    free(frames);
+    free(path.data);
+    return result;
 }
 
-bool xiso_extract(const char* iso_path, const char* output_path) {
+// Opens and verifies an image, leaving iso_fd and xbox_disc_lseek set up
+static bool open_image(const char* iso_path, struct stat* st, uint64_t* root_start, uint32_t* root_size) {
     uint32_t root_dir_sector, root_dir_size;
-    struct stat st;
-    
-    DEBUG_PRINT("Starting XISO extraction\n");
-    DEBUG_PRINT("ISO path: %s\n", iso_path);
-    DEBUG_PRINT("Output path: %s\n", output_path);
-    
-    if (!buffer) {
+
+    operation_begin();
+    if (!initialized) {
         set_error("XISO not initialized");
         return false;
     }
 
     // Check if ISO file exists and is readable
-    if (stat(iso_path, &st) != 0) {
+    if (image_stat(iso_path, st) != 0) {
         set_error("Cannot access ISO file: %s (%s)", iso_path, strerror(errno));
         return false;
     }
 
     // Close any previously opened file
     if (iso_fd != -1) {
-        close(iso_fd);
+        image_close(iso_fd);
     }
 
     DEBUG_PRINT("Opening ISO file...\n");
     
     // Open the ISO file
-    iso_fd = open(iso_path, O_RDONLY | O_BINARY);
+    iso_fd = image_open(iso_path, O_RDONLY | O_BINARY);
     if (iso_fd == -1) {
         set_error("Failed to open ISO file: %s (%s)", iso_path, strerror(errno));
         return false;
@@ -563,31 +842,1260 @@ bool xiso_extract(const char* iso_path, const char* output_path) {
     DEBUG_PRINT("Verifying ISO format...\n");
     
     // Verify it's a valid Xbox ISO
-    if (!verify_xiso(iso_path, &root_dir_sector, &root_dir_size)) {
-        close(iso_fd);
+    uint64_t verify_start = xiso_now_ns();
+    bool verified = verify_xiso(iso_path, &root_dir_sector, &root_dir_size);
+    STAT_ADD(stats_local(), verify_ns, xiso_now_ns() - verify_start);
+    if (!verified) {
+        image_close(iso_fd);
         iso_fd = -1;
         return false;
     }
 
     DEBUG_PRINT("Root directory sector: %u, size: %u\n", root_dir_sector, root_dir_size);
-    DEBUG_PRINT("Beginning extraction at offset 0x%llx...\n", 
-           (unsigned long long)(root_dir_sector * XISO_SECTOR_SIZE + xbox_disc_lseek));
+    *root_start = (uint64_t)root_dir_sector * XISO_SECTOR_SIZE + xbox_disc_lseek;
+    *root_size = root_dir_size;
+    return true;
+}
 
-    // Create root output directory
-    if (mkdir(output_path, 0755) != 0 && errno != EEXIST) {
-        set_error("Failed to create output directory: %s (%s)", output_path, strerror(errno));
-        close(iso_fd);
+static void close_image(void) {
+    if (iso_direct_fd != -1) {
+        image_close(iso_direct_fd);
+        iso_direct_fd = -1;
+    }
+    if (iso_fd != -1) {
+        image_close(iso_fd);
         iso_fd = -1;
-        return false;
     }
+}
+
+static WalkAction count_visit(const char* rel_path, const XisoEntry* entry, unsigned depth, void* ctx) {
+    if (!(entry->attributes & XISO_ATTRIBUTE_DIR)) {
+        __atomic_add_fetch(&progress.files_total, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&progress.bytes_total, entry->file_size, __ATOMIC_RELAXED);
+    }
+    return WALK_CONTINUE;
+}
+
+// Sets the progress totals from a pass over the directory tables, which
+// are small next to the data and cached for the real walk
+static bool count_progress(uint64_t root_start, uint32_t root_size) {
+    return walk_tree(root_start, root_size, true, count_visit, NULL);
+}
 
-    // Start extraction from root directory
-    bool success = extract_directory(output_path, 
-        root_dir_sector * XISO_SECTOR_SIZE + xbox_disc_lseek);
+static bool run_walk(uint64_t root_start, uint32_t root_size, WalkVisitor visit, void* ctx) {
+    uint64_t walk_start = xiso_now_ns();
+    bool success = walk_tree(root_start, root_size, true, visit, ctx);
+    STAT_ADD(stats_local(), walk_ns, xiso_now_ns() - walk_start);
+    return success;
+}
 
-    close(iso_fd);
-    iso_fd = -1;
+bool xiso_init(void) {
+    DEBUG_PRINT("Initializing XISO library...\n");
     
-    DEBUG_PRINT("Extraction %s\n", success ? "completed successfully" : "failed");
+    if (initialized) {
+        DEBUG_PRINT("Buffer already allocated\n");
+        return true;
+    }
+    
+    // Warm the pool so the first extraction doesn't pay for the allocation
+    void* buffer = pool_acquire(buffer_size);
+    if (!buffer) {
+        return false;
+    }
+    pool_release(buffer, buffer_size);
+
+    initialized = true;
+    DEBUG_PRINT("Allocated %zu byte buffer\n", buffer_size);
+    return true;
+}
+
+void xiso_cleanup(void) {
+    close_image();
+    jobs_trim();
+    pool_trim();
+    initialized = false;
+    DEBUG_PRINT("Cleaned up XISO library\n");
+}
+
+void xiso_set_debug(bool enable) {
+    debug_enabled = enable;
+}
+
+void xiso_set_buffer_size(size_t size) {
+    if (size > 0) {
+        buffer_size = size;
+    }
+}
+
+size_t xiso_get_buffer_size(void) {
+    return buffer_size;
+}
+
+void xiso_set_io_strategy(XisoIoStrategy strategy) {
+    io_strategy = strategy;
+}
+
+XisoIoStrategy xiso_get_io_strategy(void) {
+    return io_strategy;
+}
+
+void xiso_set_threads(unsigned threads) {
+    extract_threads = threads ? threads : 1;
+}
+
+void xiso_cancel(void) {
+    __atomic_store_n(&cancel_requested, true, __ATOMIC_RELAXED);
+}
+
+XisoCancelToken* xiso_cancel_token_create(void) {
+    XisoCancelToken* token = calloc(1, sizeof(*token));
+    if (!token) set_error("Failed to allocate cancel token");
+    return token;
+}
+
+void xiso_cancel_token_destroy(XisoCancelToken* token) {
+    if (cancel_token == token) cancel_token = NULL;
+    free(token);
+}
+
+void xiso_cancel_token_cancel(XisoCancelToken* token) {
+    __atomic_store_n(&token->cancelled, true, __ATOMIC_RELAXED);
+}
+
+void xiso_cancel_token_set_deadline(XisoCancelToken* token, uint64_t timeout_ms) {
+    uint64_t deadline = timeout_ms ? xiso_now_ns() + timeout_ms * 1000000ull : 0;
+    __atomic_store_n(&token->deadline, deadline, __ATOMIC_RELAXED);
+}
+
+void xiso_set_cancel_token(XisoCancelToken* token) {
+    cancel_token = token;
+}
+
+void xiso_get_progress(XisoProgress* out) {
+    out->files_total = __atomic_load_n(&progress.files_total, __ATOMIC_RELAXED);
+    out->files_done = __atomic_load_n(&progress.files_done, __ATOMIC_RELAXED);
+    out->bytes_total = __atomic_load_n(&progress.bytes_total, __ATOMIC_RELAXED);
+    out->bytes_done = __atomic_load_n(&progress.bytes_done, __ATOMIC_RELAXED);
+}
+
+void xiso_set_resume(XisoResumeMode mode) {
+    resume_mode = mode;
+}
+
+void xiso_set_max_depth(unsigned depth) {
+    max_walk_depth = depth ? depth : XISO_DEFAULT_MAX_DEPTH;
+}
+
+static bool add_pattern(char*** patterns, size_t* count, const char* pattern) {
+    char** grown = realloc(*patterns, (*count + 1) * sizeof(char*));
+    if (!grown) return false;
+    *patterns = grown;
+
+    grown[*count] = strdup(pattern);
+    if (!grown[*count]) return false;
+    (*count)++;
+    return true;
+}
+
+bool xiso_add_include(const char* pattern) {
+    return add_pattern(&include_patterns, &include_count, pattern);
+}
+
+bool xiso_add_exclude(const char* pattern) {
+    return add_pattern(&exclude_patterns, &exclude_count, pattern);
+}
+
+void xiso_clear_filters(void) {
+    for (size_t i = 0; i < include_count; i++) free(include_patterns[i]);
+    for (size_t i = 0; i < exclude_count; i++) free(exclude_patterns[i]);
+    free(include_patterns);
+    free(exclude_patterns);
+    include_patterns = exclude_patterns = NULL;
+    include_count = exclude_count = 0;
+}
+
+XisoErrorCode xiso_get_last_error_code(void) {
+    pthread_mutex_lock(&error_lock);
+    XisoErrorCode code = last_error_code;
+    pthread_mutex_unlock(&error_lock);
+    return code;
+}
+
+const char* xiso_get_last_error(void) {
+    return last_error;
+}
+
+static WalkAction list_visit(const char* rel_path, const XisoEntry* entry, unsigned depth, void* ctx) {
+    if (entry->attributes & XISO_ATTRIBUTE_DIR) {
+        if (!include_count) append_to_list("%s/\n", rel_path);
+    } else {
+        append_to_list("%s (%u bytes)\n", rel_path, entry->file_size);
+    }
+    return WALK_CONTINUE;
+}
+
+bool xiso_list(const char* iso_path, char* output_buffer, size_t buffer_size) {
+    struct stat st;
+    uint64_t root_start;
+    uint32_t root_size;
+    
+    DEBUG_PRINT("Starting XISO listing\n");
+    stats_reset();
+    DEBUG_PRINT("ISO path: %s\n", iso_path);
+    
+    if (!open_image(iso_path, &st, &root_start, &root_size)) {
+        return false;
+    }
+
+    // Set up list buffer
+    list_buffer = output_buffer;
+    list_buffer_size = buffer_size;
+    list_buffer_pos = 0;
+    if (list_buffer && list_buffer_size) list_buffer[0] = '\0';
+
+    // Start listing from root directory
+    bool success = run_walk(root_start, root_size, list_visit, NULL);
+
+    close_image();
+    
+    DEBUG_PRINT("Listing %s\n", success ? "completed successfully" : "failed");
+    return success;
+}
+
+typedef struct {
+    XisoEntryCallback callback;
+    void* user_data;
+} PublicWalk;
+
+static WalkAction public_visit(const char* rel_path, const XisoEntry* entry, unsigned depth, void* ctx) {
+    PublicWalk* walk = ctx;
+    XisoEntryInfo info;
+
+    bool is_dir = (entry->attributes & XISO_ATTRIBUTE_DIR) != 0;
+    if (is_dir && include_count) return WALK_CONTINUE;
+
+    info.path = rel_path;
+    info.name = entry->filename;
+    info.size = entry->file_size;
+    info.start_sector = entry->start_sector;
+    info.attributes = entry->attributes;
+    info.is_directory = is_dir;
+    info.depth = depth;
+
+    if (!walk->callback(&info, walk->user_data)) {
+        // Callbacks that fail, rather than stop, have said why already
+        if (xiso_get_last_error_code() == XISO_OK) set_error("Walk stopped by callback");
+        return WALK_ABORT;
+    }
+    return WALK_CONTINUE;
+}
+
+bool xiso_walk(const char* iso_path, XisoEntryCallback callback, void* user_data) {
+    struct stat st;
+    uint64_t root_start;
+    uint32_t root_size;
+    PublicWalk walk = { callback, user_data };
+
+    stats_reset();
+    if (!open_image(iso_path, &st, &root_start, &root_size)) {
+        return false;
+    }
+
+    bool success = run_walk(root_start, root_size, public_visit, &walk);
+
+    close_image();
+    return success;
+}
+
+typedef struct {
+    XisoEntryTable* table;
+    size_t capacity;
+    size_t names_capacity;
+    uint32_t* directories;       // innermost directory at each depth
+} TableWalk;
+
+static WalkAction table_visit(const char* rel_path, const XisoEntry* entry, unsigned depth, void* ctx) {
+    TableWalk* walk = ctx;
+    XisoEntryTable* table = walk->table;
+    size_t path_length = strlen(rel_path);
+    size_t name_length = strlen(entry->filename);
+
+    if (table->count == walk->capacity) {
+        size_t capacity = walk->capacity ? walk->capacity * 2 : 1024;
+        XisoTableEntry* grown = realloc(table->entries, capacity * sizeof(XisoTableEntry));
+        if (!grown) {
+            set_error("Failed to allocate entry table");
+            return WALK_ABORT;
+        }
+        table->entries = grown;
+        walk->capacity = capacity;
+    }
+    if (table->names_size + path_length + 1 > walk->names_capacity) {
+        size_t capacity = walk->names_capacity ? walk->names_capacity : 65536;
+        while (capacity < table->names_size + path_length + 1) capacity *= 2;
+        char* grown = capacity <= UINT32_MAX ? realloc(table->names, capacity) : NULL;
+        if (!grown) {
+            set_error("Failed to allocate entry names");
+            return WALK_ABORT;
+        }
+        table->names = grown;
+        walk->names_capacity = capacity;
+    }
+
+    // Offsets rather than pointers, so the arena can move as it grows
+    uint32_t index = (uint32_t)table->count++;
+    XisoTableEntry* out = &table->entries[index];
+    out->path_offset = (uint32_t)table->names_size;
+    out->name_offset = (uint32_t)(table->names_size + path_length - name_length);
+    out->parent = depth ? walk->directories[depth - 1] : XISO_NO_PARENT;
+    out->subtree_end = index + 1;
+    out->start_sector = entry->start_sector;
+    out->size = entry->file_size;
+    out->depth = depth;
+    out->attributes = entry->attributes;
+    out->is_directory = (entry->attributes & XISO_ATTRIBUTE_DIR) != 0;
+    memcpy(table->names + table->names_size, rel_path, path_length + 1);
+    table->names_size += path_length + 1;
+
+    // The walk is preorder, so this directory's contents come next
+    if (out->is_directory) walk->directories[depth] = index;
+    return WALK_CONTINUE;
+}
+
+bool xiso_load_table(const char* iso_path, XisoEntryTable* table) {
+    struct stat st;
+    uint64_t root_start;
+    uint32_t root_size;
+    TableWalk walk = { table, 0, 0, NULL };
+
+    memset(table, 0, sizeof(*table));
+    stats_reset();
+    if (!open_image(iso_path, &st, &root_start, &root_size)) {
+        return false;
+    }
+
+    walk.directories = malloc((max_walk_depth + 1) * sizeof(uint32_t));
+    bool success = walk.directories != NULL;
+    if (!success) {
+        set_error("Failed to allocate directory stack");
+    } else {
+        success = run_walk(root_start, root_size, table_visit, &walk);
+    }
+    free(walk.directories);
+    close_image();
+
+    if (!success) {
+        xiso_free_table(table);
+        return false;
+    }
+
+    // Parents come before their children, so walking backwards finishes
+    // each subtree before it is folded into its parent
+    for (size_t i = table->count; i-- > 0;) {
+        const XisoTableEntry* entry = &table->entries[i];
+        if (entry->parent != XISO_NO_PARENT && table->entries[entry->parent].subtree_end < entry->subtree_end) {
+            table->entries[entry->parent].subtree_end = entry->subtree_end;
+        }
+    }
+    DEBUG_PRINT("Loaded %zu entries, %zu bytes of names\n", table->count, table->names_size);
+    return true;
+}
+
+void xiso_free_table(XisoEntryTable* table) {
+    free(table->entries);
+    free(table->names);
+    memset(table, 0, sizeof(*table));
+}
+
+typedef struct {
+    XisoImageInfo* info;
+    bool verify;
+} StatWalk;
+
+static bool extent_in_image(const XisoImageInfo* info, uint32_t sector, uint32_t size) {
+    uint64_t start = (uint64_t)sector * XISO_SECTOR_SIZE + info->partition_offset;
+    return start + size <= info->image_size;
+}
+
+static bool read_extent(uint64_t offset, uint32_t size) {
+    size_t chunk = buffer_size;
+    void* buffer = pool_acquire(chunk);
+    if (!buffer) return false;
+
+    bool ok = true;
+    while (size > 0) {
+        if (operation_cancelled()) {
+            ok = false;
+            break;
+        }
+        size_t want = size < chunk ? size : chunk;
+        ssize_t got = io_pread(iso_fd, buffer, want, offset);
+        if (got <= 0) {
+            ok = false;
+            break;
+        }
+        offset += got;
+        size -= got;
+    }
+
+    pool_release(buffer, chunk);
+    return ok;
+}
+
+static WalkAction stat_visit(const char* rel_path, const XisoEntry* entry, unsigned depth, void* ctx) {
+    StatWalk* walk = ctx;
+    XisoImageInfo* info = walk->info;
+
+    if (entry->attributes & XISO_ATTRIBUTE_DIR) {
+        info->dir_count++;
+    } else {
+        info->file_count++;
+        info->total_bytes += entry->file_size;
+    }
+
+    if (!walk->verify) return WALK_CONTINUE;
+
+    if (entry->start_sector && !extent_in_image(info, entry->start_sector, entry->file_size)) {
+        set_error("Extent of %s lies beyond the end of the image", rel_path);
+        return WALK_ABORT;
+    }
+    if (!(entry->attributes & XISO_ATTRIBUTE_DIR) && entry->file_size) {
+        uint64_t offset = (uint64_t)entry->start_sector * XISO_SECTOR_SIZE + xbox_disc_lseek;
+        if (!read_extent(offset, entry->file_size)) {
+            set_error("Failed to read data of %s (%s)", rel_path, strerror(errno));
+            return WALK_ABORT;
+        }
+    }
+    return WALK_CONTINUE;
+}
+
+static bool stat_image(const char* iso_path, XisoImageInfo* info, bool verify) {
+    struct stat st;
+    uint64_t root_start;
+    uint32_t root_size;
+    StatWalk walk = { info, verify };
+
+    memset(info, 0, sizeof(*info));
+    stats_reset();
+    if (!open_image(iso_path, &st, &root_start, &root_size)) {
+        return false;
+    }
+
+    info->partition_offset = xbox_disc_lseek;
+    info->layout = xbox_disc_lseek == GLOBAL_LSEEK_OFFSET ? XISO_LAYOUT_REDUMP :
+                   xbox_disc_lseek == XGD3_LSEEK_OFFSET ? XISO_LAYOUT_XGD3 : XISO_LAYOUT_XISO;
+    info->root_dir_sector = (uint32_t)((root_start - xbox_disc_lseek) / XISO_SECTOR_SIZE);
+    info->root_dir_size = root_size;
+    info->image_size = st.st_size;
+
+    bool success = true;
+    if (verify && !extent_in_image(info, info->root_dir_sector, root_size)) {
+        set_error("Root directory lies beyond the end of the image");
+        success = false;
+    }
+    if (success) {
+        success = run_walk(root_start, root_size, stat_visit, &walk);
+    }
+
+    close_image();
+    return success;
+}
+
+bool xiso_stat(const char* iso_path, XisoImageInfo* info) {
+    return stat_image(iso_path, info, false);
+}
+
+bool xiso_verify(const char* iso_path, XisoImageInfo* info) {
+    return stat_image(iso_path, info, true);
+}
+
+// Sets up the tuner for copying image data to out_dev, opening the
+// O_DIRECT descriptor if the plan may use it
+static void begin_copy(const char* iso_path, uint64_t in_dev, uint64_t out_dev) {
+    XisoIoPlan plan = { io_strategy, buffer_size };
+    tune_begin(&plan, in_dev, out_dev);
+
+#if defined(O_DIRECT)
+    tune_current(&plan);
+    if (tune_active() || plan.strategy == XISO_IO_DIRECT) {
+        iso_direct_fd = image_open(iso_path, O_RDONLY | O_BINARY | O_DIRECT);
+    }
+#endif
+}
+
+static void end_copy(void) {
+    XisoIoPlan plan;
+    if (tune_end(&plan)) {
+        io_strategy = plan.strategy;
+        buffer_size = plan.buffer_size;
+    }
+}
+
+typedef struct {
+    DirHandle* dir;
+    char* rel_path;
+    const char* name;
+    uint64_t offset;
+    uint32_t size;
+} ExtractJob;
+
+static void run_extract_job(void* arg) {
+    ExtractJob* job = arg;
+
+    if (!__atomic_load_n(&extract_failed, __ATOMIC_ACQUIRE)) {
+        uint64_t span = trace_begin();
+        bool extracted = extract_file(job->dir->fd, job->name, job->rel_path, job->offset, job->size);
+        trace_end(span, "extract_file", job->rel_path);
+        if (!extracted) {
+            __atomic_store_n(&extract_failed, true, __ATOMIC_RELEASE);
+        }
+    }
+
+    dir_release(job->dir);
+    free(job->rel_path);
+    free(job);
+}
+
+// dirs[d] is the output directory for entries at depth d. The walk visits a
+// directory's contents right after the directory itself, so replacing
+// dirs[d + 1] on each directory entry keeps the stack in step.
+typedef struct {
+    DirHandle** dirs;
+    unsigned capacity;
+    JobQueue* workers;
+} ExtractWalk;
+
+static bool set_dir(ExtractWalk* walk, unsigned depth, DirHandle* dir) {
+    if (depth >= walk->capacity) {
+        unsigned capacity = walk->capacity ? walk->capacity * 2 : 16;
+        while (capacity <= depth) capacity *= 2;
+
+        DirHandle** grown = realloc(walk->dirs, capacity * sizeof(DirHandle*));
+        if (!grown) {
+            set_error("Failed to allocate directory stack");
+            return false;
+        }
+        memset(grown + walk->capacity, 0, (capacity - walk->capacity) * sizeof(DirHandle*));
+        walk->dirs = grown;
+        walk->capacity = capacity;
+    }
+
+    dir_release(walk->dirs[depth]);
+    walk->dirs[depth] = dir;
+    return true;
+}
+
+static WalkAction extract_visit(const char* rel_path, const XisoEntry* entry, unsigned depth, void* ctx) {
+    ExtractWalk* walk = ctx;
+    DirHandle* parent = walk->dirs[depth];
+
+    if (__atomic_load_n(&extract_failed, __ATOMIC_ACQUIRE)) {
+        return WALK_ABORT;
+    }
+
+    // Handle directories; with include filters they are created on demand
+    if (entry->attributes & XISO_ATTRIBUTE_DIR) {
+        DirHandle* dir = dir_new(parent, entry->filename);
+        if (!dir || !set_dir(walk, depth + 1, dir)) {
+            dir_release(dir);
+            return WALK_ABORT;
+        }
+
+        if (!include_count) {
+            DEBUG_PRINT("Creating directory: %s\n", rel_path);
+            if (!dir_open(dir)) return WALK_ABORT;
+        }
+        return WALK_CONTINUE;
+    }
+
+    if (!dir_open(parent)) {
+        return WALK_ABORT;
+    }
+
+    uint64_t offset = (uint64_t)entry->start_sector * XISO_SECTOR_SIZE + xbox_disc_lseek;
+
+    if (walk->workers) {
+        ExtractJob* job = malloc(sizeof(*job));
+        char* job_path = strdup(rel_path);
+        if (!job || !job_path) {
+            free(job);
+            free(job_path);
+            set_error("Failed to allocate extraction job");
+            return WALK_ABORT;
+        }
+        job->dir = parent;
+        __atomic_add_fetch(&parent->refs, 1, __ATOMIC_RELAXED);
+        job->rel_path = job_path;
+        job->name = strrchr(job_path, '/') ? strrchr(job_path, '/') + 1 : job_path;
+        job->offset = offset;
+        job->size = entry->file_size;
+        jobs_submit(walk->workers, run_extract_job, job);
+        return WALK_CONTINUE;
+    }
+
+    uint64_t span = trace_begin();
+    bool extracted = extract_file(parent->fd, entry->filename, rel_path, offset, entry->file_size);
+    trace_end(span, "extract_file", rel_path);
+    return extracted ? WALK_CONTINUE : WALK_ABORT;
+}
+
+bool xiso_extract(const char* iso_path, const char* output_path) {
+    struct stat st;
+    uint64_t root_start;
+    uint32_t root_size;
+    
+    DEBUG_PRINT("Starting XISO extraction\n");
+    stats_reset();
+    DEBUG_PRINT("ISO path: %s\n", iso_path);
+    DEBUG_PRINT("Output path: %s\n", output_path);
+    
+    if (!open_image(iso_path, &st, &root_start, &root_size)) {
+        return false;
+    }
+
+    DEBUG_PRINT("Beginning extraction at offset 0x%llx...\n", (unsigned long long)root_start);
+    if (!count_progress(root_start, root_size)) {
+        close_image();
+        return false;
+    }
+
+    // Create root output directory
+    if (io_mkdir(output_path, 0755) == 0) {
+        STAT_ADD(stats_local(), dirs_created, 1);
+    } else if (errno != EEXIST) {
+        set_error("Failed to create output directory: %s (%s)", output_path, strerror(errno));
+        close_image();
+        return false;
+    }
+
+    struct stat out_st;
+    if (stat(output_path, &out_st) != 0) {
+        out_st.st_dev = 0;
+    }
+    // Past here every exit goes through done, so the tuner is always ended
+    begin_copy(iso_path, st.st_dev, out_st.st_dev);
+
+    bool success = false;
+    ExtractWalk walk = { NULL, 0, NULL };
+    DirHandle* root = dir_new(NULL, output_path);
+    if (!root || !set_dir(&walk, 0, root)) {
+        dir_release(root);
+        goto done;
+    }
+    root->fd = io_open(output_path, O_RDONLY | O_DIRECTORY, 0);
+    if (root->fd == -1) {
+        set_error("Failed to open output directory: %s (%s)", output_path, strerror(errno));
+        goto done;
+    }
+
+    // The journal sits next to the output directory, named after it
+    if (resume_mode != XISO_RESUME_OFF) {
+        size_t length = strlen(output_path);
+        while (length > 1 && output_path[length - 1] == '/') length--;
+        char* path = malloc(length + sizeof(".xiso-resume"));
+        if (path) {
+            sprintf(path, "%.*s.xiso-resume", (int)length, output_path);
+            uint64_t identity[3] = { (uint64_t)st.st_size, root_start, root_size };
+            resume = resume_open(path, root->fd, identity, sizeof(identity));
+            free(path);
+        } else {
+            set_error("Failed to allocate resume journal path");
+        }
+        if (!resume) goto done;
+    }
+
+    __atomic_store_n(&extract_failed, false, __ATOMIC_RELEASE);
+    if (extract_threads > 1) {
+        walk.workers = jobs_borrow(extract_threads, extract_threads * 4, "worker");
+        if (!walk.workers) goto done;
+    }
+
+    // Start extraction from root directory; walk time excludes the copying
+    XisoThreadStats* stats = stats_local();
+    uint64_t copy_before = stats->counters.copy_ns;
+    uint64_t walk_start = xiso_now_ns();
+    success = walk_tree(root_start, root_size, true, extract_visit, &walk);
+    STAT_ADD(stats, walk_ns, xiso_now_ns() - walk_start - (stats->counters.copy_ns - copy_before));
+
+    if (walk.workers) {
+        jobs_return(walk.workers);
+    }
+    if (__atomic_load_n(&extract_failed, __ATOMIC_ACQUIRE)) {
+        success = false;
+    }
+
+done:
+    for (unsigned i = 0; i < walk.capacity; i++) {
+        dir_release(walk.dirs[i]);
+    }
+    free(walk.dirs);
+    // Progress is saved even when the run failed, so the next one resumes
+    if (resume) {
+        if (!resume_close(resume)) success = false;
+        resume = NULL;
+    }
+
+    end_copy();
+    close_image();
+    
+    DEBUG_PRINT("Extraction %s\n", success ? "completed successfully" : "failed");
+    return success;
+}
+
+// tar output
+
+typedef struct {
+    TarWriter* tar;
+    time_t mtime;
+} TarWalk;
+
+// Compressed archives can't take copy_file_range or O_DIRECT output, so
+// data is read into a pool buffer and fed to the compressor
+static bool copy_to_tar(TarWriter* tar, const char* rel_path, uint64_t offset, uint32_t file_size) {
+    void* buffer = pool_acquire(buffer_size);
+    bool ok = buffer != NULL;
+
+    while (ok && file_size > 0) {
+        if (operation_cancelled()) {
+            ok = false;
+            break;
+        }
+        size_t to_read = file_size < buffer_size ? file_size : buffer_size;
+        uint64_t start = xiso_now_ns();
+
+        uint64_t read_span = trace_begin();
+        ssize_t bytes_read = io_pread(iso_fd, buffer, to_read, offset);
+        trace_end(read_span, "read", NULL);
+        if (bytes_read <= 0) {
+            set_error("Failed to read file data: %s (%s)", rel_path,
+                      bytes_read < 0 ? strerror(errno) : "unexpected end of image");
+            ok = false;
+            break;
+        }
+
+        uint64_t write_span = trace_begin();
+        ok = tar_write(tar, buffer, bytes_read);
+        trace_end(write_span, "compress", NULL);
+        STAT_ADD(stats_local(), copy_ns, xiso_now_ns() - start);
+        __atomic_add_fetch(&progress.bytes_done, bytes_read, __ATOMIC_RELAXED);
+        offset += bytes_read;
+        file_size -= bytes_read;
+    }
+
+    if (buffer) pool_release(buffer, buffer_size);
+    return ok;
+}
+
+static WalkAction tar_visit(const char* rel_path, const XisoEntry* entry, unsigned depth, void* ctx) {
+    TarWalk* walk = ctx;
+
+    // With include filters only the selected files are archived; tar
+    // readers create their parent directories
+    if (entry->attributes & XISO_ATTRIBUTE_DIR) {
+        if (include_count) return WALK_CONTINUE;
+        STAT_ADD(stats_local(), dirs_created, 1);
+        return tar_add_directory(walk->tar, rel_path, walk->mtime) ? WALK_CONTINUE : WALK_ABORT;
+    }
+
+    DEBUG_PRINT("Archiving file: %s (%u bytes)\n", rel_path, entry->file_size);
+    if (!tar_begin_file(walk->tar, rel_path, entry->file_size, walk->mtime)) {
+        return WALK_ABORT;
+    }
+    STAT_ADD(stats_local(), files_created, 1);
+
+    uint64_t offset = (uint64_t)entry->start_sector * XISO_SECTOR_SIZE + xbox_disc_lseek;
+    int raw_fd = tar_raw_fd(walk->tar);
+    uint64_t span = trace_begin();
+    bool copied = raw_fd != -1 ? copy_extent(raw_fd, rel_path, offset, entry->file_size)
+                               : copy_to_tar(walk->tar, rel_path, offset, entry->file_size);
+    trace_end(span, "extract_file", rel_path);
+
+    return copied && tar_end_file(walk->tar, entry->file_size) ? WALK_CONTINUE : WALK_ABORT;
+}
+
+bool xiso_extract_tar(const char* iso_path, int out_fd, int zstd_level) {
+    struct stat st, out_st;
+    uint64_t root_start;
+    uint32_t root_size;
+
+    DEBUG_PRINT("Starting tar export of %s\n", iso_path);
+    stats_reset();
+
+    if (!open_image(iso_path, &st, &root_start, &root_size)) {
+        return false;
+    }
+
+    if (!count_progress(root_start, root_size)) {
+        close_image();
+        return false;
+    }
+
+    TarWalk walk = { tar_open(out_fd, zstd_level, extract_threads), st.st_mtime };
+    if (!walk.tar) {
+        close_image();
+        return false;
+    }
+
+    if (fstat(out_fd, &out_st) != 0) {
+        out_st.st_dev = 0;
+    }
+    begin_copy(iso_path, st.st_dev, out_st.st_dev);
+
+    XisoThreadStats* stats = stats_local();
+    uint64_t copy_before = stats->counters.copy_ns;
+    uint64_t walk_start = xiso_now_ns();
+    bool success = walk_tree(root_start, root_size, true, tar_visit, &walk);
+    STAT_ADD(stats, walk_ns, xiso_now_ns() - walk_start - (stats->counters.copy_ns - copy_before));
+
+    if (!tar_close(walk.tar, success)) {
+        success = false;
+    }
+    end_copy();
+    close_image();
+
+    DEBUG_PRINT("Tar export %s\n", success ? "completed successfully" : "failed");
+    return success;
+}
+
+// Rebuilding
+
+// nodes[d] is the directory receiving entries at depth d, kept in step with
+// the walk the same way ExtractWalk keeps its output directories
+typedef struct {
+    WriteNode** nodes;
+    unsigned capacity;
+    uint64_t image_size;
+} RebuildWalk;
+
+static WalkAction rebuild_visit(const char* rel_path, const XisoEntry* entry, unsigned depth, void* ctx) {
+    RebuildWalk* walk = ctx;
+    bool is_dir = (entry->attributes & XISO_ATTRIBUTE_DIR) != 0;
+    uint64_t offset = (uint64_t)entry->start_sector * XISO_SECTOR_SIZE + xbox_disc_lseek;
+
+    if (!is_dir && offset + entry->file_size > walk->image_size) {
+        set_error("File data lies outside the image: %s", rel_path);
+        return WALK_ABORT;
+    }
+
+    WriteNode* node = write_node_new(entry->filename, is_dir);
+    if (!node) return WALK_ABORT;
+    if (!write_node_add(walk->nodes[depth], node)) {
+        write_node_free(node);
+        return WALK_ABORT;
+    }
+    if (!is_dir) {
+        node->size = entry->file_size;
+        node->source_offset = offset;
+        STAT_ADD(stats_local(), files_created, 1);
+        return WALK_CONTINUE;
+    }
+
+    if (depth + 1 >= walk->capacity) {
+        unsigned capacity = walk->capacity * 2;
+        WriteNode** grown = realloc(walk->nodes, capacity * sizeof(WriteNode*));
+        if (!grown) {
+            set_error("Failed to allocate directory stack");
+            return WALK_ABORT;
+        }
+        walk->nodes = grown;
+        walk->capacity = capacity;
+    }
+    walk->nodes[depth + 1] = node;
+    STAT_ADD(stats_local(), dirs_created, 1);
+    return WALK_CONTINUE;
+}
+
+static bool rebuild_write_data(WriteNode* file, int out_fd, void* ctx) {
+    (void)ctx;
+    uint64_t span = trace_begin();
+    bool copied = copy_extent(out_fd, file->name, file->source_offset, file->size);
+    trace_end(span, "copy_file", file->name);
+    return copied;
+}
+
+bool xiso_rebuild(const char* iso_path, const char* out_path) {
+    struct stat st, out_st;
+    uint64_t root_start;
+    uint32_t root_size;
+
+    DEBUG_PRINT("Rebuilding %s into %s\n", iso_path, out_path);
+    stats_reset();
+
+    if (!open_image(iso_path, &st, &root_start, &root_size)) {
+        return false;
+    }
+    if (stat(out_path, &out_st) == 0 && out_st.st_dev == st.st_dev && out_st.st_ino == st.st_ino) {
+        set_error("Output is the source image: %s", out_path);
+        close_image();
+        return false;
+    }
+
+    RebuildWalk walk = { malloc(16 * sizeof(WriteNode*)), 16, (uint64_t)st.st_size };
+    WriteNode* root = write_node_new("", true);
+    if (!walk.nodes || !root) {
+        if (!walk.nodes) set_error("Failed to allocate directory stack");
+        free(walk.nodes);
+        write_node_free(root);
+        close_image();
+        return false;
+    }
+    walk.nodes[0] = root;
+
+    bool success = run_walk(root_start, root_size, rebuild_visit, &walk);
+    free(walk.nodes);
+    if (success && include_count) {
+        write_node_prune(root);
+    }
+
+    ImageLayout layout;
+    if (success && !image_layout(root, file_order, &layout)) {
+        success = false;
+    }
+    if (!success) {
+        write_node_free(root);
+        close_image();
+        return false;
+    }
+    DEBUG_PRINT("Compact image: %u sectors, %zu tables, %zu extents\n",
+                layout.total_sectors, layout.dir_count, layout.file_count);
+
+    int out_fd = io_open(out_path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+    if (out_fd == -1) {
+        set_error("Failed to create image: %s (%s)", out_path, strerror(errno));
+        success = false;
+    } else {
+        if (fstat(out_fd, &out_st) != 0) {
+            out_st.st_dev = 0;
+        }
+        begin_copy(iso_path, st.st_dev, out_st.st_dev);
+        success = image_write(&layout, root, out_fd, rebuild_write_data, NULL);
+        end_copy();
+
+        if (close(out_fd) != 0 && success) {
+            set_error("Failed to write image: %s (%s)", out_path, strerror(errno));
+            success = false;
+        }
+        if (!success) {
+            unlink(out_path);
+        }
+    }
+
+    image_layout_free(&layout);
+    write_node_free(root);
+    close_image();
+
+    DEBUG_PRINT("Rebuild %s\n", success ? "completed successfully" : "failed");
+    return success;
+}
+
+// In-place replacement
+
+// Resolves a '/' separated path to its entry and the image offset of that
+// entry in its directory table. Filters don't apply here.
+static bool find_entry(uint64_t root_start, uint32_t root_size, const char* rel_path,
+                       XisoEntry* entry, uint64_t* position) {
+    uint64_t table_start = root_start;
+    uint32_t table_size = root_size;
+    const char* name = rel_path;
+
+    while (*name == '/') name++;
+    for (unsigned depth = 0;; depth++) {
+        const char* slash = strchr(name, '/');
+        size_t name_length = slash ? (size_t)(slash - name) : strlen(name);
+        DirTable table;
+        int next = 0;
+
+        if (depth > max_walk_depth) {
+            set_error("Directory nesting exceeds the limit of %u: %s", max_walk_depth, rel_path);
+            return false;
+        }
+        if (table_size == 0 || name_length == 0) {
+            set_error("No such file in image: %s", rel_path);
+            return false;
+        }
+        if (!table_init(&table, table_start, table_size)) {
+            table_free(&table);
+            return false;
+        }
+        if (io_pread(iso_fd, table.data, table_size, table_start) != (ssize_t)table_size) {
+            set_error("Failed to read directory table at 0x%llx", (unsigned long long)table_start);
+            table_free(&table);
+            return false;
+        }
+
+        while ((next = table_next(&table, entry)) > 0) {
+            if (entry->filename_length == name_length &&
+                strncasecmp(entry->filename, name, name_length) == 0) {
+                break;
+            }
+        }
+        *position = table.start + table.current;
+        table_free(&table);
+
+        if (next < 0) return false;
+        if (next == 0) {
+            set_error("No such file in image: %s", rel_path);
+            return false;
+        }
+        if (!slash) return true;
+        if (!(entry->attributes & XISO_ATTRIBUTE_DIR)) {
+            set_error("Not a directory in image: %.*s", (int)(slash - rel_path), rel_path);
+            return false;
+        }
+
+        table_start = (uint64_t)entry->start_sector * XISO_SECTOR_SIZE + xbox_disc_lseek;
+        table_size = entry->file_size;
+        name = slash + 1;
+    }
+}
+
+// Counts entries whose sectors overlap [start, end); a rebuilt image may
+// point several entries at one extent
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+    unsigned users;
+} ExtentUsers;
+
+static WalkAction count_users_visit(const char* rel_path, const XisoEntry* entry, unsigned depth, void* ctx) {
+    ExtentUsers* users = ctx;
+    uint64_t start = (uint64_t)entry->start_sector * XISO_SECTOR_SIZE;
+    uint64_t end = start + ((uint64_t)entry->file_size + XISO_SECTOR_SIZE - 1) / XISO_SECTOR_SIZE * XISO_SECTOR_SIZE;
+
+    (void)rel_path;
+    (void)depth;
+    if (entry->file_size && start < users->end && end > users->start) {
+        users->users++;
+    }
+    return WALK_CONTINUE;
+}
+
+static char* journal_path(const char* iso_path) {
+    char* path = malloc(strlen(iso_path) + sizeof(".journal"));
+    if (!path) {
+        set_error("Failed to allocate journal path");
+        return NULL;
+    }
+    sprintf(path, "%s.journal", iso_path);
+    return path;
+}
+
+static bool read_source(int fd, void* buffer, size_t length, const char* src_path) {
+    char* p = buffer;
+    while (length > 0) {
+        ssize_t n = io_read(fd, p, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            set_error("Failed to read %s (%s)", src_path, n < 0 ? strerror(errno) : "file shrank");
+            return false;
+        }
+        p += n;
+        length -= n;
+    }
+    return true;
+}
+
+// Journals the sectors of the extent at offset that differ from the new
+// data, so an unchanged prefix or a one-byte patch costs almost no I/O
+static bool journal_changes(Journal* journal, int src_fd, const char* src_path,
+                            uint64_t offset, uint32_t size, size_t* records) {
+    size_t chunk = buffer_size & ~(size_t)(XISO_SECTOR_SIZE - 1);
+    if (chunk == 0) chunk = XISO_SECTOR_SIZE;
+
+    uint8_t* fresh = pool_acquire(chunk);
+    uint8_t* old = pool_acquire(chunk);
+    bool ok = fresh && old;
+    if (!ok) set_error("Failed to allocate replacement buffers");
+
+    for (uint64_t done = 0; ok && done < size;) {
+        size_t length = size - done < chunk ? size - done : chunk;
+        if (!read_source(src_fd, fresh, length, src_path)) {
+            ok = false;
+            break;
+        }
+        if (io_pread(iso_fd, old, length, offset + done) != (ssize_t)length) {
+            set_error("Failed to read file data at 0x%llx", (unsigned long long)(offset + done));
+            ok = false;
+            break;
+        }
+
+        // Runs of changed sectors become one record each
+        size_t run_start = 0, run_length = 0;
+        for (size_t at = 0; at < length && ok; at += XISO_SECTOR_SIZE) {
+            size_t n = length - at < XISO_SECTOR_SIZE ? length - at : XISO_SECTOR_SIZE;
+            if (memcmp(fresh + at, old + at, n) != 0) {
+                if (run_length == 0) run_start = at;
+                run_length += n;
+                continue;
+            }
+            if (run_length) {
+                ok = journal_add(journal, offset + done + run_start, fresh + run_start, run_length);
+                (*records)++;
+                run_length = 0;
+            }
+        }
+        if (ok && run_length) {
+            ok = journal_add(journal, offset + done + run_start, fresh + run_start, run_length);
+            (*records)++;
+        }
+        done += length;
+    }
+
+    if (fresh) pool_release(fresh, chunk);
+    if (old) pool_release(old, chunk);
+    return ok;
+}
+
+// Writes the new data past the end of the image. Nothing references it until
+// the journaled entry update lands, so a crash here only leaves slack.
+static bool append_data(int rw_fd, int src_fd, const char* src_path, uint64_t offset, uint32_t size) {
+    static const uint8_t zeros[XISO_SECTOR_SIZE];
+    uint8_t* buffer = pool_acquire(buffer_size);
+    bool ok = buffer != NULL;
+    if (!ok) set_error("Failed to allocate replacement buffer");
+
+    for (uint64_t done = 0; ok && done < size;) {
+        size_t length = size - done < buffer_size ? size - done : buffer_size;
+        ok = read_source(src_fd, buffer, length, src_path);
+        if (ok && io_pwrite(rw_fd, buffer, length, offset + done) != (ssize_t)length) {
+            set_error("Failed to write image (%s)", strerror(errno));
+            ok = false;
+        }
+        done += length;
+    }
+    if (buffer) pool_release(buffer, buffer_size);
+
+    size_t tail = (XISO_SECTOR_SIZE - size % XISO_SECTOR_SIZE) % XISO_SECTOR_SIZE;
+    if (ok && tail && io_pwrite(rw_fd, zeros, tail, offset + size) != (ssize_t)tail) {
+        set_error("Failed to write image (%s)", strerror(errno));
+        ok = false;
+    }
+    if (ok && fsync(rw_fd) != 0) {
+        set_error("Failed to sync image (%s)", strerror(errno));
+        ok = false;
+    }
+    return ok;
+}
+
+static bool replace_entry(int rw_fd, const char* journal_file, uint64_t root_start, uint32_t root_size,
+                          uint64_t image_size, const char* file_path, int src_fd, const char* src_path,
+                          uint32_t new_size) {
+    XisoEntry entry;
+    uint64_t position;
+
+    if (!find_entry(root_start, root_size, file_path, &entry, &position)) {
+        return false;
+    }
+    if (entry.attributes & XISO_ATTRIBUTE_DIR) {
+        set_error("Is a directory in image: %s", file_path);
+        return false;
+    }
+
+    uint64_t offset = (uint64_t)entry.start_sector * XISO_SECTOR_SIZE + xbox_disc_lseek;
+    uint64_t allocated = ((uint64_t)entry.file_size + XISO_SECTOR_SIZE - 1) / XISO_SECTOR_SIZE * XISO_SECTOR_SIZE;
+    ExtentUsers users = { offset - xbox_disc_lseek, offset - xbox_disc_lseek + allocated, 0 };
+
+    if (new_size > 0 && new_size <= allocated &&
+        !walk_tree(root_start, root_size, false, count_users_visit, &users)) {
+        return false;
+    }
+
+    // Shared extents are never overwritten, the other entries keep the old data
+    bool in_place = new_size == 0 || (new_size <= allocated && users.users <= 1);
+    uint32_t new_sector = entry.start_sector;
+    if (!in_place) {
+        uint64_t append_at = (image_size + XISO_SECTOR_SIZE - 1) / XISO_SECTOR_SIZE * XISO_SECTOR_SIZE;
+        uint64_t sector = (append_at - xbox_disc_lseek) / XISO_SECTOR_SIZE;
+        if (sector + (new_size + XISO_SECTOR_SIZE - 1) / XISO_SECTOR_SIZE > UINT32_MAX) {
+            set_error("Image would exceed the XDVDFS size limit");
+            return false;
+        }
+
+        DEBUG_PRINT("Appending %u bytes at sector %llu\n", new_size, (unsigned long long)sector);
+        if (!append_data(rw_fd, src_fd, src_path, append_at, new_size)) {
+            if (ftruncate(rw_fd, image_size) != 0) {
+                DEBUG_PRINT("Failed to trim the image after an error\n");
+            }
+            return false;
+        }
+        new_sector = (uint32_t)sector;
+    }
+
+    Journal* journal = journal_create(journal_file);
+    if (!journal) return false;
+
+    size_t records = 0;
+    bool ok = true;
+    if (in_place) {
+        DEBUG_PRINT("Overwriting %u bytes in place at sector %u\n", new_size, entry.start_sector);
+        ok = journal_changes(journal, src_fd, src_path, offset, new_size, &records);
+    }
+    if (ok && (new_sector != entry.start_sector || new_size != entry.file_size)) {
+        uint8_t fields[8];
+        memcpy(fields, &new_sector, 4);
+        memcpy(fields + 4, &new_size, 4);
+        ok = journal_add(journal, position + 4, fields, sizeof(fields));
+        records++;
+    }
+
+    if (!ok || records == 0) {
+        journal_abort(journal);
+        return ok;
+    }
+    return journal_commit(journal) && journal_replay(journal_file, rw_fd);
+}
+
+bool xiso_replace(const char* iso_path, const char* file_path, const char* src_path) {
+    struct stat st, src_st;
+    uint64_t root_start;
+    uint32_t root_size;
+
+    DEBUG_PRINT("Replacing %s in %s with %s\n", file_path, iso_path, src_path);
+    stats_reset();
+    operation_begin();
+
+    int src_fd = io_open(src_path, O_RDONLY | O_BINARY, 0);
+    if (src_fd == -1 || fstat(src_fd, &src_st) != 0) {
+        set_error("Failed to open %s (%s)", src_path, strerror(errno));
+        if (src_fd != -1) close(src_fd);
+        return false;
+    }
+    if ((uint64_t)src_st.st_size > UINT32_MAX) {
+        set_error("File is too large for XDVDFS (4GB limit): %s", src_path);
+        close(src_fd);
+        return false;
+    }
+
+    // image_open() would refuse with EROFS, which reads as a read-only filesystem
+    if (image_is_split(iso_path)) {
+        set_error("Split images can't be modified in place: %s", iso_path);
+        close(src_fd);
+        return false;
+    }
+
+    char* journal_file = journal_path(iso_path);
+    int rw_fd = journal_file ? image_open(iso_path, O_RDWR | O_BINARY) : -1;
+    if (rw_fd == -1) {
+        if (journal_file) set_error("Failed to open %s for writing (%s)", iso_path, strerror(errno));
+        free(journal_file);
+        close(src_fd);
+        return false;
+    }
+
+    // Writers are serialized, and an interrupted update is finished first
+    bool success = false;
+    if (flock(rw_fd, LOCK_EX | LOCK_NB) != 0) {
+        set_error("Image is being modified by another process: %s", iso_path);
+    } else if (journal_replay(journal_file, rw_fd) && open_image(iso_path, &st, &root_start, &root_size)) {
+        success = replace_entry(rw_fd, journal_file, root_start, root_size, (uint64_t)st.st_size,
+                                file_path, src_fd, src_path, (uint32_t)src_st.st_size);
+        close_image();
+    }
+
+    close(rw_fd);
+    close(src_fd);
+    free(journal_file);
+
+    DEBUG_PRINT("Replace %s\n", success ? "completed successfully" : "failed");
     return success;
 }
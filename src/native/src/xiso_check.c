@@ -0,0 +1,266 @@
+#include "xiso_internal.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// Extracted files are compared with the image a window at a time, both
+// sides memory mapped, so a mismatch stops the comparison early and no
+// data is copied through buffers. Where mmap isn't possible the window is
+// read into pool buffers instead.
+#define CHECK_WINDOW_SIZE (16 * 1024 * 1024)
+
+typedef struct {
+    int iso_fd;
+    int root_fd;
+    uint64_t partition_offset;
+    uint64_t image_size;
+    JobQueue* workers;
+    pthread_mutex_t lock;        // serializes callbacks
+    XisoCheckCallback callback;
+    void* user_data;
+    bool stopped;
+    bool failed;
+} Check;
+
+typedef struct {
+    Check* check;
+    char* path;
+    uint64_t offset;             // absolute in the image
+    uint32_t size;
+} CheckJob;
+
+static size_t page_size(void) {
+    static size_t size = 0;
+    if (!size) size = (size_t)sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+static void report(Check* check, const XisoCheckEntry* entry) {
+    pthread_mutex_lock(&check->lock);
+    if (!check->stopped && check->callback && !check->callback(entry, check->user_data)) {
+        check->stopped = true;
+    }
+    pthread_mutex_unlock(&check->lock);
+}
+
+static void fail(Check* check, const char* format, const char* path) {
+    set_error(format, path, strerror(errno));
+    __atomic_store_n(&check->failed, true, __ATOMIC_RELEASE);
+}
+
+static size_t first_difference(const uint8_t* a, const uint8_t* b, size_t length) {
+    size_t i = 0;
+    while (i < length && a[i] == b[i]) i++;
+    return i;
+}
+
+// Maps length bytes at offset; the page-aligned base is returned for munmap
+static const uint8_t* map_range(int fd, uint64_t offset, size_t length, void** base, size_t* mapped) {
+    uint64_t aligned = offset & ~(uint64_t)(page_size() - 1);
+    *mapped = length + (size_t)(offset - aligned);
+    *base = mmap(NULL, *mapped, PROT_READ, MAP_SHARED, fd, (off_t)aligned);
+    if (*base == MAP_FAILED) return NULL;
+#if defined(MADV_SEQUENTIAL)
+    madvise(*base, *mapped, MADV_SEQUENTIAL);
+#endif
+    return (const uint8_t*)*base + (offset - aligned);
+}
+
+// Compares one window; returns the offset of the first difference within
+// it, length when equal, or -1 on a read error
+static ssize_t compare_window(Check* check, int fd, uint64_t file_offset, uint64_t image_offset,
+                              size_t length) {
+    void *file_base, *image_base;
+    size_t file_mapped, image_mapped;
+    ssize_t result;
+
+    const uint8_t* file = map_range(fd, file_offset, length, &file_base, &file_mapped);
+    // Parts of a split image can't be mapped as one
+    const uint8_t* image = file && !split_lookup(check->iso_fd) ? map_range(check->iso_fd, image_offset, length, &image_base, &image_mapped)
+                                : NULL;
+    if (image) {
+        // Mapped pages bypass the counted wrappers, so charge them here
+        throttle(THROTTLE_READ, (ssize_t)(2 * length));
+        result = memcmp(file, image, length) == 0 ? (ssize_t)length
+                                                   : (ssize_t)first_difference(file, image, length);
+        munmap(image_base, image_mapped);
+        munmap(file_base, file_mapped);
+        return result;
+    }
+    if (file) munmap(file_base, file_mapped);
+
+    uint8_t* ours = pool_acquire(length);
+    uint8_t* theirs = pool_acquire(length);
+    if (!ours || !theirs) {
+        result = -1;
+    } else if (io_pread(fd, ours, length, file_offset) != (ssize_t)length ||
+               io_pread(check->iso_fd, theirs, length, image_offset) != (ssize_t)length) {
+        result = -1;
+    } else {
+        result = memcmp(ours, theirs, length) == 0 ? (ssize_t)length
+                                                   : (ssize_t)first_difference(ours, theirs, length);
+    }
+    if (ours) pool_release(ours, length);
+    if (theirs) pool_release(theirs, length);
+    return result;
+}
+
+static void run_check_job(void* arg) {
+    CheckJob* job = arg;
+    Check* check = job->check;
+    XisoCheckEntry entry = { XISO_CHECK_MISSING, job->path, false, job->size, 0, 0 };
+    struct stat st;
+
+    if (__atomic_load_n(&check->failed, __ATOMIC_ACQUIRE) ||
+        __atomic_load_n(&check->stopped, __ATOMIC_ACQUIRE)) {
+        goto done;
+    }
+
+    // Stat before opening: a FIFO or device standing in for the file would
+    // block the open, and is reported like any other wrong-sized entry
+    uint64_t span = trace_begin();
+    if (fstatat(check->root_fd, job->path, &st, 0) != 0) {
+        if (errno == ENOENT || errno == ENOTDIR) {
+            report(check, &entry);
+        } else {
+            fail(check, "Failed to stat extracted file: %s (%s)", job->path);
+        }
+        goto done;
+    }
+    entry.actual_size = (uint64_t)st.st_size;
+    if (!S_ISREG(st.st_mode) || entry.actual_size != job->size) {
+        entry.kind = XISO_CHECK_SIZE;
+        report(check, &entry);
+        goto done;
+    }
+
+    int fd = io_openat(check->root_fd, job->path, O_RDONLY | O_BINARY, 0);
+    if (fd == -1) {
+        fail(check, "Failed to open extracted file: %s (%s)", job->path);
+        goto done;
+    }
+
+    uint64_t done = 0;
+    while (done < job->size && !__atomic_load_n(&check->failed, __ATOMIC_ACQUIRE)) {
+        if (operation_cancelled()) {
+            __atomic_store_n(&check->failed, true, __ATOMIC_RELEASE);
+            break;
+        }
+        size_t length = job->size - done < CHECK_WINDOW_SIZE ? job->size - done : CHECK_WINDOW_SIZE;
+        ssize_t same = compare_window(check, fd, done, job->offset + done, length);
+        if (same < 0) {
+            fail(check, "Failed to read extracted file: %s (%s)", job->path);
+            break;
+        }
+        if ((size_t)same < length) {
+            entry.kind = XISO_CHECK_CONTENT;
+            entry.offset = done + (uint64_t)same;
+            report(check, &entry);
+            break;
+        }
+        done += length;
+    }
+    STAT_ADD(stats_local(), bytes_read, 2 * done);
+    close(fd);
+    trace_end(span, "check_file", job->path);
+
+done:
+    free(job->path);
+    free(job);
+}
+
+static bool check_entry(const XisoEntryInfo* info, void* user_data) {
+    Check* check = user_data;
+
+    if (__atomic_load_n(&check->failed, __ATOMIC_ACQUIRE) ||
+        __atomic_load_n(&check->stopped, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
+    // Directories are checked here; with include filters only those
+    // holding selected files have to exist, and their files say so
+    if (info->is_directory) {
+        struct stat st;
+        if (!include_count && (fstatat(check->root_fd, info->path, &st, 0) != 0 || !S_ISDIR(st.st_mode))) {
+            XisoCheckEntry entry = { XISO_CHECK_MISSING, info->path, true, 0, 0, 0 };
+            report(check, &entry);
+        }
+        return true;
+    }
+
+    // Mapping past the end of a truncated image would raise SIGBUS
+    uint64_t offset = check->partition_offset + (uint64_t)info->start_sector * XISO_SECTOR_SIZE;
+    if (offset + info->size > check->image_size) {
+        set_error("File data lies outside the image: %s", info->path);
+        __atomic_store_n(&check->failed, true, __ATOMIC_RELEASE);
+        return false;
+    }
+
+    CheckJob* job = malloc(sizeof(*job));
+    char* path = strdup(info->path);
+    if (!job || !path) {
+        free(job);
+        free(path);
+        set_error("Failed to allocate check job");
+        __atomic_store_n(&check->failed, true, __ATOMIC_RELEASE);
+        return false;
+    }
+    *job = (CheckJob){ check, path, offset, (uint32_t)info->size };
+    jobs_submit(check->workers, run_check_job, job);
+    return true;
+}
+
+bool xiso_verify_extracted(const char* iso_path, const char* output_path,
+                           XisoCheckCallback callback, void* user_data) {
+    XisoImageInfo info;
+    Check check;
+
+    memset(&check, 0, sizeof(check));
+    check.iso_fd = check.root_fd = -1;
+    check.callback = callback;
+    check.user_data = user_data;
+    pthread_mutex_init(&check.lock, NULL);
+
+    DEBUG_PRINT("Checking %s against %s\n", output_path, iso_path);
+    bool success = xiso_stat(iso_path, &info);
+    if (success) {
+        check.partition_offset = info.partition_offset;
+        check.image_size = info.image_size;
+        check.iso_fd = image_open(iso_path, O_RDONLY | O_BINARY);
+        if (check.iso_fd == -1) {
+            set_error("Failed to open ISO file: %s (%s)", iso_path, strerror(errno));
+            success = false;
+        }
+    }
+    if (success) {
+        check.root_fd = io_open(output_path, O_RDONLY | O_DIRECTORY, 0);
+        if (check.root_fd == -1) {
+            set_error("Failed to open output directory: %s (%s)", output_path, strerror(errno));
+            success = false;
+        }
+    }
+    if (success) {
+        check.workers = jobs_borrow(extract_threads, extract_threads * 4, "check");
+        success = check.workers != NULL;
+    }
+
+    if (success) {
+        // xiso_walk() resets the counters, so the workers' reads are added after it starts
+        success = xiso_walk(iso_path, check_entry, &check);
+        jobs_wait(check.workers);
+        if (__atomic_load_n(&check.failed, __ATOMIC_ACQUIRE)) {
+            success = false;
+        } else if (check.stopped) {
+            set_error("Check stopped by callback");
+            success = false;
+        }
+    }
+
+    jobs_return(check.workers);
+    if (check.root_fd != -1) close(check.root_fd);
+    if (check.iso_fd != -1) image_close(check.iso_fd);
+    pthread_mutex_destroy(&check.lock);
+    return success;
+}
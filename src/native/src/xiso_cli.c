@@ -0,0 +1,1859 @@
+#include "xiso.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/inotify.h>
+#endif
+
+typedef enum {
+    FORMAT_TEXT,
+    FORMAT_JSON,
+    FORMAT_NDJSON,
+} OutputFormat;
+
+typedef struct {
+    OutputFormat format;
+    bool quiet;
+    bool show_stats;
+    const char* trace_path;
+    unsigned threads;
+    size_t buffer_size;
+    int zstd_level;
+    bool dat_loaded;
+    unsigned search_flags;
+    uint64_t timeout_ms;
+    bool resume_set;
+    unsigned jobs;
+    uint64_t settle_ms;
+} Options;
+
+static Options opts = { FORMAT_TEXT, false, false, NULL, 1, 0, 0, false, 0, 0, false, 1, 2000 };
+
+// Stops the running operation on SIGINT/SIGTERM so partial output is cleaned up
+static XisoCancelToken* cancel_token = NULL;
+
+static void handle_signal(int signal) {
+    (void)signal;
+    if (cancel_token) xiso_cancel_token_cancel(cancel_token);
+}
+
+static void usage(FILE* out, const char* program) {
+    fprintf(out,
+        "Usage: %s <command> [options] <arguments>\n"
+        "\n"
+        "Commands:\n"
+        "  list <image>                 List files in an image\n"
+        "  extract <image> <directory>  Extract an image (\"-\" streams it from stdin)\n"
+        "  tar <image> <archive>        Write the image as a tar archive (\"-\" for stdout)\n"
+        "  rebuild <image> <output>     Rewrite an image as a compact XISO\n"
+        "  create <directory> <output>  Pack a directory tree into a new XISO\n"
+        "  replace <img> <path> <file>  Replace a file inside an image in place\n"
+        "  diff <old> <new> [patch]     Compare two images, optionally writing a patch\n"
+        "  patch <old> <patch> <output> Rebuild the new image from a patch (\"-\" for stdout)\n"
+        "  stat <image>                 Show image layout and totals\n"
+        "  verify <image>               Check every extent lies in the image and is readable\n"
+        "  verify-extracted <img> <dir> Compare an extracted tree with the image\n"
+        "  search <pattern> <image>...  Find a string in the files of one or more images\n"
+        "  scan <directory>             Identify all .iso files under a directory\n"
+        "  bench <image> <scratch_dir>  Compare extraction throughput per I/O strategy\n"
+        "  watch <folder> <directory>   Extract each image copied or moved into a folder\n"
+        "\n"
+        "Options:\n"
+        "  -f, --format text|json|ndjson  Output format (default: text)\n"
+        "  -j, --threads N                Worker threads for extract, create, diff, checks and search\n"
+        "  -b, --buffer-size SIZE         Copy buffer size, e.g. 512K or 4M\n"
+        "  -s, --strategy NAME            buffered, direct, copy-range or auto\n"
+        "  -z, --zstd LEVEL               Compress tar output with zstd at LEVEL\n"
+        "      --order source|tree|size   File data order in written images (default: source)\n"
+        "      --resume[=verify]          Continue an interrupted extract, skipping finished files\n"
+        "  -E, --regex                    Search with a POSIX extended regex\n"
+        "      --ignore-case              Search case-insensitively\n"
+        "      --dat FILE                 Hash images in verify and scan and match them against\n"
+        "                                 a Redump-style DAT (repeatable)\n"
+        "      --tune-cache FILE          Persist auto-tuning results per device\n"
+        "      --max-depth N              Reject images nested deeper than N directories\n"
+        "      --spill-limit SIZE         Buffer for data that precedes its entry when streaming\n"
+        "      --timeout SECONDS          Give up once the command has run this long\n"
+        "      --limit-read RATE          Cap reads at RATE bytes per second, e.g. 50M\n"
+        "      --limit-write RATE         Cap writes at RATE bytes per second\n"
+        "      --ionice idle|best-effort[:LEVEL]  I/O scheduling class (Linux)\n"
+        "  -J, --jobs N                   Images watch extracts at once (default: 1)\n"
+        "      --settle SECONDS           How long a new image must go unchanged before\n"
+        "                                 watch extracts it (default: 2)\n"
+        "  -i, --include PATTERN          Only process matching files (repeatable)\n"
+        "  -x, --exclude PATTERN          Skip matching files and directories (repeatable)\n"
+        "  -q, --quiet                    Only print errors\n"
+        "  -v, --verbose                  Print library debug output\n"
+        "      --stats                    Print performance counters to stderr\n"
+        "      --trace FILE               Write a Chrome trace of the run\n"
+        "  -h, --help                     Show this help\n"
+        "\n"
+        "Exit status is 124 when --timeout expires and 130 when interrupted.\n",
+        program);
+}
+
+static bool parse_size(const char* text, size_t* out) {
+    char* end;
+    unsigned long long value = strtoull(text, &end, 10);
+
+    if (end == text) return false;
+    switch (*end) {
+    case 'k': case 'K': value <<= 10; end++; break;
+    case 'm': case 'M': value <<= 20; end++; break;
+    case 'g': case 'G': value <<= 30; end++; break;
+    }
+    if (*end || value == 0) return false;
+
+    *out = (size_t)value;
+    return true;
+}
+
+static const char* strategy_name(XisoIoStrategy strategy) {
+    switch (strategy) {
+    case XISO_IO_DIRECT: return "direct";
+    case XISO_IO_COPY_RANGE: return "copy-range";
+    case XISO_IO_BUFFERED:
+    default: return "buffered";
+    }
+}
+
+static const char* layout_name(XisoLayout layout) {
+    switch (layout) {
+    case XISO_LAYOUT_REDUMP: return "redump";
+    case XISO_LAYOUT_XGD3: return "xgd3";
+    case XISO_LAYOUT_XISO:
+    default: return "xiso";
+    }
+}
+
+static void json_string(FILE* out, const char* s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c == '\n') {
+            fputs("\\n", out);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static double elapsed_seconds(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void report_message(const char* what, const char* path, const char* error) {
+    if (opts.format == FORMAT_TEXT) {
+        fprintf(stderr, "%s: %s: %s\n", what, path, error);
+        return;
+    }
+
+    printf("{\"error\":");
+    json_string(stdout, error);
+    printf(",\"path\":");
+    json_string(stdout, path);
+    printf("}\n");
+}
+
+static void report_error(const char* what, const char* path) {
+    report_message(what, path, xiso_get_last_error());
+}
+
+static void print_stats(void) {
+    XisoStats stats;
+    xiso_get_stats(&stats);
+
+    fprintf(stderr,
+        "read=%llu lseek=%llu write=%llu open=%llu mkdir=%llu copy_range=%llu\n"
+        "bytes_read=%llu bytes_written=%llu seek_distance=%llu\n"
+        "entries=%llu files=%llu dirs=%llu skipped=%llu\n"
+        "verify=%.3fms walk=%.3fms copy=%.3fms\n",
+        (unsigned long long)stats.read_calls, (unsigned long long)stats.lseek_calls,
+        (unsigned long long)stats.write_calls, (unsigned long long)stats.open_calls,
+        (unsigned long long)stats.mkdir_calls, (unsigned long long)stats.copy_range_calls,
+        (unsigned long long)stats.bytes_read, (unsigned long long)stats.bytes_written,
+        (unsigned long long)stats.seek_distance, (unsigned long long)stats.entries_parsed,
+        (unsigned long long)stats.files_created, (unsigned long long)stats.dirs_created,
+        (unsigned long long)stats.files_skipped, stats.verify_ns / 1e6, stats.walk_ns / 1e6, stats.copy_ns / 1e6);
+}
+
+// list
+
+typedef struct {
+    bool first;
+} ListState;
+
+static bool list_entry(const XisoEntryInfo* entry, void* user_data) {
+    ListState* state = user_data;
+
+    switch (opts.format) {
+    case FORMAT_TEXT:
+        if (entry->is_directory) {
+            printf("%14s  %s/\n", "", entry->path);
+        } else {
+            printf("%14llu  %s\n", (unsigned long long)entry->size, entry->path);
+        }
+        break;
+
+    case FORMAT_JSON:
+    case FORMAT_NDJSON:
+        if (opts.format == FORMAT_JSON) {
+            printf("%s\n    ", state->first ? "" : ",");
+        }
+        printf("{\"path\":");
+        json_string(stdout, entry->path);
+        printf(",\"type\":\"%s\",\"size\":%llu,\"sector\":%u,\"attributes\":%u}",
+               entry->is_directory ? "directory" : "file",
+               (unsigned long long)entry->size, entry->start_sector, entry->attributes);
+        if (opts.format == FORMAT_NDJSON) printf("\n");
+        break;
+    }
+
+    state->first = false;
+    return true;
+}
+
+static int cmd_list(int argc, char** argv) {
+    ListState state = { true };
+
+    if (argc != 1) return -1;
+
+    if (opts.format == FORMAT_JSON) {
+        printf("{\"image\":");
+        json_string(stdout, argv[0]);
+        printf(",\"entries\":[");
+    }
+
+    bool ok = xiso_walk(argv[0], list_entry, &state);
+
+    if (opts.format == FORMAT_JSON) {
+        printf("%s]", state.first ? "" : "\n  ");
+        if (!ok) {
+            printf(",\"error\":");
+            json_string(stdout, xiso_get_last_error());
+        }
+        printf("}\n");
+    } else if (!ok) {
+        report_error("list", argv[0]);
+    }
+    return ok ? 0 : 1;
+}
+
+// extract
+
+static int cmd_extract(int argc, char** argv) {
+    struct timespec start;
+    XisoStats stats;
+
+    if (argc != 2) return -1;
+
+    // "-" reads the image from stdin in a single forward pass
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool ok = strcmp(argv[0], "-") == 0 ? xiso_extract_stream(STDIN_FILENO, argv[1])
+                                        : xiso_extract(argv[0], argv[1]);
+    double seconds = elapsed_seconds(&start);
+    xiso_get_stats(&stats);
+
+    if (!ok) {
+        report_error("extract", argv[0]);
+        return 1;
+    }
+
+    double mbps = seconds > 0 ? stats.bytes_written / seconds / (1024 * 1024) : 0;
+    if (opts.format == FORMAT_TEXT) {
+        if (!opts.quiet) {
+            printf("Extracted %llu files (%llu bytes) in %.2fs, %.1f MB/s [%s, %zu byte buffer]\n",
+                   (unsigned long long)stats.files_created, (unsigned long long)stats.bytes_written,
+                   seconds, mbps, strategy_name(xiso_get_io_strategy()), xiso_get_buffer_size());
+            if (stats.files_skipped) {
+                printf("Skipped %llu files already extracted\n", (unsigned long long)stats.files_skipped);
+            }
+        }
+    } else {
+        printf("{\"image\":");
+        json_string(stdout, argv[0]);
+        printf(",\"output\":");
+        json_string(stdout, argv[1]);
+        printf(",\"files\":%llu,\"directories\":%llu,\"skipped\":%llu,\"bytes\":%llu,"
+               "\"seconds\":%.3f,\"mb_per_second\":%.1f,\"strategy\":\"%s\",\"buffer_size\":%zu}\n",
+               (unsigned long long)stats.files_created, (unsigned long long)stats.dirs_created,
+               (unsigned long long)stats.files_skipped, (unsigned long long)stats.bytes_written,
+               seconds, mbps,
+               strategy_name(xiso_get_io_strategy()), xiso_get_buffer_size());
+    }
+    return 0;
+}
+
+// tar
+
+static int cmd_tar(int argc, char** argv) {
+    struct timespec start;
+    XisoStats stats;
+    bool to_stdout;
+    int fd;
+
+    if (argc != 2) return -1;
+
+    to_stdout = strcmp(argv[1], "-") == 0;
+    fd = to_stdout ? STDOUT_FILENO : open(argv[1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        fprintf(stderr, "tar: %s: %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool ok = xiso_extract_tar(argv[0], fd, opts.zstd_level);
+    double seconds = elapsed_seconds(&start);
+    xiso_get_stats(&stats);
+
+    // Data still buffered by the filesystem can fail to land on close
+    const char* close_error = NULL;
+    if (!to_stdout && close(fd) != 0 && ok) {
+        close_error = strerror(errno);
+        ok = false;
+    }
+    if (!ok) {
+        if (close_error) report_message("tar", argv[1], close_error);
+        else report_error("tar", argv[0]);
+        if (!to_stdout) unlink(argv[1]);
+        return 1;
+    }
+
+    // The archive may be on stdout, so the summary goes to stderr
+    if (!opts.quiet) {
+        fprintf(stderr, "Archived %llu files (%llu bytes written) in %.2fs%s\n",
+                (unsigned long long)stats.files_created, (unsigned long long)stats.bytes_written,
+                seconds, opts.zstd_level > 0 ? ", zstd" : "");
+    }
+    return 0;
+}
+
+// rebuild
+
+static int cmd_rebuild(int argc, char** argv) {
+    struct timespec start;
+    struct stat out_st;
+    XisoImageInfo in_info;
+    XisoStats stats;
+
+    if (argc != 2) return -1;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (!xiso_rebuild(argv[0], argv[1])) {
+        report_error("rebuild", argv[0]);
+        return 1;
+    }
+    double seconds = elapsed_seconds(&start);
+    xiso_get_stats(&stats);
+
+    // stat() would only see the first part of a split source
+    if (!xiso_stat(argv[0], &in_info)) in_info.image_size = 0;
+    if (stat(argv[1], &out_st) != 0) out_st.st_size = 0;
+
+    if (opts.quiet) return 0;
+    if (opts.format == FORMAT_TEXT) {
+        printf("Rebuilt %s -> %s: %llu files, %llu -> %lld bytes in %.2fs\n",
+               argv[0], argv[1], (unsigned long long)stats.files_created,
+               (unsigned long long)in_info.image_size, (long long)out_st.st_size, seconds);
+    } else {
+        printf("{\"image\":");
+        json_string(stdout, argv[0]);
+        printf(",\"output\":");
+        json_string(stdout, argv[1]);
+        printf(",\"files\":%llu,\"source_size\":%llu,\"output_size\":%lld,\"seconds\":%.3f}\n",
+               (unsigned long long)stats.files_created, (unsigned long long)in_info.image_size,
+               (long long)out_st.st_size, seconds);
+    }
+    return 0;
+}
+
+// create
+
+static int cmd_create(int argc, char** argv) {
+    struct timespec start;
+    struct stat out_st;
+    XisoStats stats;
+
+    if (argc != 2) return -1;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (!xiso_create(argv[0], argv[1])) {
+        report_error("create", argv[0]);
+        return 1;
+    }
+    double seconds = elapsed_seconds(&start);
+    xiso_get_stats(&stats);
+
+    if (stat(argv[1], &out_st) != 0) out_st.st_size = 0;
+    double mbps = seconds > 0 ? out_st.st_size / seconds / (1024 * 1024) : 0;
+
+    if (opts.quiet) return 0;
+    if (opts.format == FORMAT_TEXT) {
+        printf("Created %s: %llu files, %llu directories, %lld bytes in %.2fs (%.1f MB/s)\n",
+               argv[1], (unsigned long long)stats.files_created, (unsigned long long)stats.dirs_created,
+               (long long)out_st.st_size, seconds, mbps);
+    } else {
+        printf("{\"source\":");
+        json_string(stdout, argv[0]);
+        printf(",\"output\":");
+        json_string(stdout, argv[1]);
+        printf(",\"files\":%llu,\"directories\":%llu,\"output_size\":%lld,\"seconds\":%.3f,"
+               "\"mb_per_second\":%.1f}\n",
+               (unsigned long long)stats.files_created, (unsigned long long)stats.dirs_created,
+               (long long)out_st.st_size, seconds, mbps);
+    }
+    return 0;
+}
+
+// replace
+
+static int cmd_replace(int argc, char** argv) {
+    struct timespec start;
+    XisoStats stats;
+
+    if (argc != 3) return -1;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (!xiso_replace(argv[0], argv[1], argv[2])) {
+        report_error("replace", argv[0]);
+        return 1;
+    }
+    double seconds = elapsed_seconds(&start);
+    xiso_get_stats(&stats);
+
+    if (opts.quiet) return 0;
+    if (opts.format == FORMAT_TEXT) {
+        printf("Replaced %s in %s (%llu bytes written) in %.3fs\n", argv[1], argv[0],
+               (unsigned long long)stats.bytes_written, seconds);
+    } else {
+        printf("{\"image\":");
+        json_string(stdout, argv[0]);
+        printf(",\"path\":");
+        json_string(stdout, argv[1]);
+        printf(",\"bytes_written\":%llu,\"seconds\":%.3f}\n",
+               (unsigned long long)stats.bytes_written, seconds);
+    }
+    return 0;
+}
+
+// diff / patch
+
+static const char* diff_kind_name(XisoDiffKind kind) {
+    switch (kind) {
+    case XISO_DIFF_ADDED: return "added";
+    case XISO_DIFF_REMOVED: return "removed";
+    case XISO_DIFF_MOVED: return "moved";
+    case XISO_DIFF_CHANGED:
+    default: return "changed";
+    }
+}
+
+static bool diff_entry(const XisoDiffEntry* entry, void* user_data) {
+    ListState* state = user_data;
+
+    switch (opts.format) {
+    case FORMAT_TEXT:
+        if (entry->kind == XISO_DIFF_MOVED) {
+            printf("R %s -> %s\n", entry->old_path, entry->path);
+        } else if (entry->kind == XISO_DIFF_CHANGED) {
+            printf("M %s (%llu -> %llu bytes, %llu differ)\n", entry->path,
+                   (unsigned long long)entry->old_size, (unsigned long long)entry->new_size,
+                   (unsigned long long)entry->changed_bytes);
+        } else {
+            printf("%c %s\n", entry->kind == XISO_DIFF_ADDED ? 'A' : 'D', entry->path);
+        }
+        break;
+
+    case FORMAT_JSON:
+    case FORMAT_NDJSON:
+        if (opts.format == FORMAT_JSON) {
+            printf("%s\n    ", state->first ? "" : ",");
+        }
+        printf("{\"change\":\"%s\",\"path\":", diff_kind_name(entry->kind));
+        json_string(stdout, entry->path);
+        if (entry->old_path) {
+            printf(",\"old_path\":");
+            json_string(stdout, entry->old_path);
+        }
+        printf(",\"old_size\":%llu,\"new_size\":%llu,\"changed_bytes\":%llu}",
+               (unsigned long long)entry->old_size, (unsigned long long)entry->new_size,
+               (unsigned long long)entry->changed_bytes);
+        if (opts.format == FORMAT_NDJSON) printf("\n");
+        break;
+    }
+
+    state->first = false;
+    return true;
+}
+
+static int cmd_diff(int argc, char** argv) {
+    ListState state = { true };
+    const char* patch_path = argc == 3 ? argv[2] : NULL;
+
+    if (argc != 2 && argc != 3) return -1;
+
+    if (opts.format == FORMAT_JSON) {
+        printf("{\"old\":");
+        json_string(stdout, argv[0]);
+        printf(",\"new\":");
+        json_string(stdout, argv[1]);
+        printf(",\"changes\":[");
+    }
+
+    bool ok = xiso_diff(argv[0], argv[1], patch_path, opts.quiet ? NULL : diff_entry, &state);
+
+    if (opts.format == FORMAT_JSON) {
+        printf("%s]", state.first ? "" : "\n  ");
+        if (!ok) {
+            printf(",\"error\":");
+            json_string(stdout, xiso_get_last_error());
+        }
+        printf("}\n");
+    } else if (!ok) {
+        report_error("diff", argv[0]);
+    }
+    if (ok && patch_path && !opts.quiet && opts.format == FORMAT_TEXT) {
+        struct stat st;
+        if (stat(patch_path, &st) == 0) {
+            fprintf(stderr, "Wrote %s (%lld bytes)\n", patch_path, (long long)st.st_size);
+        }
+    }
+    return ok ? 0 : 1;
+}
+
+static int cmd_patch(int argc, char** argv) {
+    struct timespec start;
+    bool to_stdout;
+    int fd;
+
+    if (argc != 3) return -1;
+
+    to_stdout = strcmp(argv[2], "-") == 0;
+    fd = to_stdout ? STDOUT_FILENO : open(argv[2], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        fprintf(stderr, "patch: %s: %s\n", argv[2], strerror(errno));
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool ok = xiso_apply_patch(argv[0], argv[1], fd);
+    double seconds = elapsed_seconds(&start);
+
+    if (!to_stdout && close(fd) != 0 && ok) {
+        fprintf(stderr, "patch: %s: %s\n", argv[2], strerror(errno));
+        ok = false;
+    }
+    if (!ok) {
+        report_error("patch", argv[1]);
+        if (!to_stdout) unlink(argv[2]);
+        return 1;
+    }
+
+    // The image may be on stdout, so the summary goes to stderr
+    if (!opts.quiet) {
+        fprintf(stderr, "Patched %s with %s in %.2fs\n", argv[0], argv[1], seconds);
+    }
+    return 0;
+}
+
+// stat / verify
+
+static const char* dat_status_name(XisoDatStatus status) {
+    switch (status) {
+    case XISO_DAT_MATCH: return "match";
+    case XISO_DAT_MISMATCH: return "mismatch";
+    case XISO_DAT_UNKNOWN:
+    default: return "unknown";
+    }
+}
+
+static void hex_string(char* out, const uint8_t* bytes, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        sprintf(out + i * 2, "%02x", bytes[i]);
+    }
+}
+
+// Hashes the image and looks it up in the loaded DATs
+static bool match_image(const char* path, XisoDigest* digest, XisoDatMatch* match) {
+    if (!xiso_hash_image(path, digest)) return false;
+    xiso_match_dat(path, digest, match);
+    return true;
+}
+
+static void print_info(const char* path, const XisoImageInfo* info, const char* status,
+                       const XisoDigest* digest, const XisoDatMatch* match) {
+    char md5[33], sha1[41];
+
+    if (digest) {
+        hex_string(md5, digest->md5, sizeof(digest->md5));
+        hex_string(sha1, digest->sha1, sizeof(digest->sha1));
+    }
+
+    if (opts.format == FORMAT_TEXT) {
+        if (opts.quiet) return;
+        printf("%s\n", path);
+        if (status) printf("  status:           %s\n", status);
+        printf("  layout:           %s\n", layout_name(info->layout));
+        printf("  partition offset: 0x%llx\n", (unsigned long long)info->partition_offset);
+        printf("  root directory:   sector %u, %u bytes\n", info->root_dir_sector, info->root_dir_size);
+        printf("  image size:       %llu\n", (unsigned long long)info->image_size);
+        printf("  files:            %llu\n", (unsigned long long)info->file_count);
+        printf("  directories:      %llu\n", (unsigned long long)info->dir_count);
+        printf("  data bytes:       %llu\n", (unsigned long long)info->total_bytes);
+        if (digest) {
+            printf("  crc32:            %08x\n", digest->crc32);
+            printf("  md5:              %s\n", md5);
+            printf("  sha1:             %s\n", sha1);
+            printf("  dat:              %s", dat_status_name(match->status));
+            if (match->game) printf(" (%s: %s)", match->game, match->rom);
+            printf("\n");
+        }
+        return;
+    }
+
+    printf("{\"image\":");
+    json_string(stdout, path);
+    if (status) printf(",\"status\":\"%s\"", status);
+    printf(",\"layout\":\"%s\",\"partition_offset\":%llu,\"root_dir_sector\":%u,\"root_dir_size\":%u,"
+           "\"image_size\":%llu,\"files\":%llu,\"directories\":%llu,\"bytes\":%llu",
+           layout_name(info->layout), (unsigned long long)info->partition_offset,
+           info->root_dir_sector, info->root_dir_size, (unsigned long long)info->image_size,
+           (unsigned long long)info->file_count, (unsigned long long)info->dir_count,
+           (unsigned long long)info->total_bytes);
+    if (digest) {
+        printf(",\"crc32\":\"%08x\",\"md5\":\"%s\",\"sha1\":\"%s\",\"dat\":\"%s\"",
+               digest->crc32, md5, sha1, dat_status_name(match->status));
+        if (match->game) {
+            printf(",\"game\":");
+            json_string(stdout, match->game);
+            printf(",\"rom\":");
+            json_string(stdout, match->rom);
+        }
+    }
+    printf("}\n");
+}
+
+static int cmd_stat(int argc, char** argv) {
+    XisoImageInfo info;
+
+    if (argc != 1) return -1;
+
+    if (!xiso_stat(argv[0], &info)) {
+        report_error("stat", argv[0]);
+        return 1;
+    }
+    print_info(argv[0], &info, NULL, NULL, NULL);
+    return 0;
+}
+
+static int cmd_verify(int argc, char** argv) {
+    XisoImageInfo info;
+
+    if (argc != 1) return -1;
+
+    if (!xiso_verify(argv[0], &info)) {
+        report_error("verify", argv[0]);
+        return 1;
+    }
+    if (!opts.dat_loaded) {
+        print_info(argv[0], &info, "ok", NULL, NULL);
+        return 0;
+    }
+
+    // A known-good dump is one the DATs list
+    XisoDigest digest;
+    XisoDatMatch match;
+    if (!match_image(argv[0], &digest, &match)) {
+        report_error("verify", argv[0]);
+        return 1;
+    }
+    print_info(argv[0], &info, match.status == XISO_DAT_MATCH ? "ok" : "bad", &digest, &match);
+    return match.status == XISO_DAT_MATCH ? 0 : 1;
+}
+
+// verify-extracted
+
+typedef struct {
+    bool first;
+    unsigned long long problems;
+} CheckState;
+
+static const char* check_kind_name(XisoCheckKind kind) {
+    switch (kind) {
+    case XISO_CHECK_SIZE: return "size";
+    case XISO_CHECK_CONTENT: return "content";
+    case XISO_CHECK_MISSING:
+    default: return "missing";
+    }
+}
+
+static bool check_entry(const XisoCheckEntry* entry, void* user_data) {
+    CheckState* state = user_data;
+
+    state->problems++;
+    switch (opts.format) {
+    case FORMAT_TEXT:
+        if (entry->kind == XISO_CHECK_SIZE) {
+            printf("size     %s (%llu bytes, expected %llu)\n", entry->path,
+                   (unsigned long long)entry->actual_size, (unsigned long long)entry->expected_size);
+        } else if (entry->kind == XISO_CHECK_CONTENT) {
+            printf("content  %s (differs at byte %llu)\n", entry->path,
+                   (unsigned long long)entry->offset);
+        } else {
+            printf("missing  %s%s\n", entry->path, entry->is_directory ? "/" : "");
+        }
+        break;
+
+    case FORMAT_JSON:
+    case FORMAT_NDJSON:
+        if (opts.format == FORMAT_JSON) {
+            printf("%s\n    ", state->first ? "" : ",");
+        }
+        printf("{\"problem\":\"%s\",\"path\":", check_kind_name(entry->kind));
+        json_string(stdout, entry->path);
+        printf(",\"directory\":%s,\"expected_size\":%llu,\"actual_size\":%llu,\"offset\":%llu}",
+               entry->is_directory ? "true" : "false", (unsigned long long)entry->expected_size,
+               (unsigned long long)entry->actual_size, (unsigned long long)entry->offset);
+        if (opts.format == FORMAT_NDJSON) printf("\n");
+        break;
+    }
+
+    state->first = false;
+    return true;
+}
+
+static int cmd_verify_extracted(int argc, char** argv) {
+    CheckState state = { true, 0 };
+    struct timespec start;
+    XisoStats stats;
+
+    if (argc != 2) return -1;
+
+    if (opts.format == FORMAT_JSON) {
+        printf("{\"image\":");
+        json_string(stdout, argv[0]);
+        printf(",\"output\":");
+        json_string(stdout, argv[1]);
+        printf(",\"problems\":[");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool ok = xiso_verify_extracted(argv[0], argv[1], check_entry, &state);
+    double seconds = elapsed_seconds(&start);
+    xiso_get_stats(&stats);
+
+    if (opts.format == FORMAT_JSON) {
+        printf("%s]", state.first ? "" : "\n  ");
+        if (!ok) {
+            printf(",\"error\":");
+            json_string(stdout, xiso_get_last_error());
+        }
+        printf(",\"entries\":%llu,\"seconds\":%.3f}\n", (unsigned long long)stats.entries_parsed, seconds);
+    } else if (!ok) {
+        report_error("verify-extracted", argv[0]);
+    } else if (opts.format == FORMAT_TEXT && !opts.quiet) {
+        printf("Checked %s against %s in %.2fs: %llu problems\n", argv[1], argv[0], seconds, state.problems);
+    }
+    return ok && state.problems == 0 ? 0 : 1;
+}
+
+// search
+
+typedef struct {
+    const char* image;
+    bool show_image;
+    bool first;
+    unsigned long long hits;
+} SearchState;
+
+// Matches are binary data; show at most SEARCH_PREVIEW bytes, escaped
+#define SEARCH_PREVIEW 80
+
+static void print_preview(const uint8_t* data, size_t length) {
+    for (size_t i = 0; i < length && i < SEARCH_PREVIEW; i++) {
+        if (data[i] >= 0x20 && data[i] < 0x7f && data[i] != '\\') putchar(data[i]);
+        else printf("\\x%02x", data[i]);
+    }
+    if (length > SEARCH_PREVIEW) printf("...");
+}
+
+static bool search_hit(const XisoSearchHit* hit, void* user_data) {
+    SearchState* state = user_data;
+
+    state->hits++;
+    switch (opts.format) {
+    case FORMAT_TEXT:
+        if (state->show_image) printf("%s:", state->image);
+        printf("%s:%llu: ", hit->path, (unsigned long long)hit->offset);
+        print_preview(hit->match, hit->length);
+        printf("\n");
+        break;
+
+    case FORMAT_JSON:
+    case FORMAT_NDJSON: {
+        char* text = malloc(hit->length + 1);
+        if (opts.format == FORMAT_JSON) {
+            printf("%s\n    ", state->first ? "" : ",");
+        }
+        printf("{\"image\":");
+        json_string(stdout, state->image);
+        printf(",\"path\":");
+        json_string(stdout, hit->path);
+        printf(",\"offset\":%llu,\"length\":%zu", (unsigned long long)hit->offset, hit->length);
+        // NUL bytes would cut the string short, so they end the shown match
+        if (text) {
+            memcpy(text, hit->match, hit->length);
+            text[hit->length] = '\0';
+            printf(",\"match\":");
+            json_string(stdout, text);
+            free(text);
+        }
+        printf("}");
+        if (opts.format == FORMAT_NDJSON) printf("\n");
+        break;
+    }
+    }
+
+    state->first = false;
+    return true;
+}
+
+static int cmd_search(int argc, char** argv) {
+    SearchState state = { NULL, argc > 2, true, 0 };
+    bool ok = true;
+
+    if (argc < 2) return -1;
+
+    if (opts.format == FORMAT_JSON) {
+        printf("{\"pattern\":");
+        json_string(stdout, argv[0]);
+        printf(",\"hits\":[");
+    }
+    for (int i = 1; i < argc; i++) {
+        state.image = argv[i];
+        if (!xiso_search(argv[i], argv[0], opts.search_flags, search_hit, &state)) {
+            ok = false;
+            if (opts.format != FORMAT_JSON) report_error("search", argv[i]);
+        }
+    }
+    if (opts.format == FORMAT_JSON) {
+        printf("%s]", state.first ? "" : "\n  ");
+        if (!ok) {
+            printf(",\"error\":");
+            json_string(stdout, xiso_get_last_error());
+        }
+        printf(",\"total\":%llu}\n", state.hits);
+    }
+    // Like grep: 0 with hits, 1 without, 2 on errors
+    return !ok ? 2 : state.hits ? 0 : 1;
+}
+
+// scan
+
+typedef struct {
+    unsigned images;
+    unsigned valid;
+    bool first;
+} ScanState;
+
+static ScanState scan_state;
+
+static bool has_iso_suffix(const char* path) {
+    size_t length = strlen(path);
+    return length > 4 && strcasecmp(path + length - 4, ".iso") == 0;
+}
+
+// For a later part of a split image (name.2.iso and up) gives the path of
+// the first part, through which the library reads the whole set
+static bool split_first_part(const char* path, char* first, size_t size) {
+    size_t end = strlen(path) - 4, digits = end;
+
+    if (!has_iso_suffix(path)) return false;
+    while (digits > 0 && path[digits - 1] >= '0' && path[digits - 1] <= '9') digits--;
+    if (digits == end || digits < 2 || path[digits - 1] != '.') return false;
+    if (end - digits == 1 && path[digits] == '1') return false;
+
+    int length = snprintf(first, size, "%.*s1%s", (int)digits, path, path + end);
+    return length > 0 && (size_t)length < size;
+}
+
+static int scan_file(const char* path, const struct stat* st, int type, struct FTW* ftw) {
+    XisoImageInfo info;
+
+    if (type != FTW_F || !has_iso_suffix(path)) return 0;
+
+    // Split images are identified once, through their first part
+    char first[4096];
+    struct stat first_st;
+    if (split_first_part(path, first, sizeof(first)) && stat(first, &first_st) == 0) return 0;
+
+    XisoDigest digest;
+    XisoDatMatch match;
+    bool ok = xiso_stat(path, &info);
+    bool hashed = ok && opts.dat_loaded && match_image(path, &digest, &match);
+    // With DATs loaded only listed dumps count as valid
+    if (opts.dat_loaded && ok && !hashed) ok = false;
+    scan_state.images++;
+    if (ok && (!hashed || match.status == XISO_DAT_MATCH)) scan_state.valid++;
+
+    switch (opts.format) {
+    case FORMAT_TEXT:
+        if (ok) {
+            printf("%-6s  %8llu files  %14llu bytes  ", layout_name(info.layout),
+                   (unsigned long long)info.file_count, (unsigned long long)info.total_bytes);
+            if (hashed) printf("%-8s  ", dat_status_name(match.status));
+            printf("%s\n", path);
+        } else if (!opts.quiet) {
+            printf("%-6s  %s: %s\n", "bad", path, xiso_get_last_error());
+        }
+        break;
+
+    case FORMAT_JSON:
+    case FORMAT_NDJSON:
+        if (opts.format == FORMAT_JSON) {
+            printf("%s\n    ", scan_state.first ? "" : ",");
+        }
+        printf("{\"path\":");
+        json_string(stdout, path);
+        if (ok) {
+            printf(",\"valid\":true,\"layout\":\"%s\",\"files\":%llu,\"bytes\":%llu",
+                   layout_name(info.layout), (unsigned long long)info.file_count,
+                   (unsigned long long)info.total_bytes);
+            if (hashed) {
+                char sha1[41];
+                hex_string(sha1, digest.sha1, sizeof(digest.sha1));
+                printf(",\"sha1\":\"%s\",\"dat\":\"%s\"", sha1, dat_status_name(match.status));
+                if (match.game) {
+                    printf(",\"game\":");
+                    json_string(stdout, match.game);
+                }
+            }
+            printf("}");
+        } else {
+            printf(",\"valid\":false,\"error\":");
+            json_string(stdout, xiso_get_last_error());
+            printf("}");
+        }
+        if (opts.format == FORMAT_NDJSON) printf("\n");
+        break;
+    }
+
+    scan_state.first = false;
+    return 0;
+}
+
+static int cmd_scan(int argc, char** argv) {
+    if (argc != 1) return -1;
+
+    scan_state = (ScanState){ 0, 0, true };
+    if (opts.format == FORMAT_JSON) printf("{\"images\":[");
+
+    int result = nftw(argv[0], scan_file, 32, FTW_PHYS);
+
+    if (opts.format == FORMAT_JSON) {
+        printf("%s],\"total\":%u,\"valid\":%u}\n", scan_state.first ? "" : "\n  ",
+               scan_state.images, scan_state.valid);
+    } else if (opts.format == FORMAT_TEXT && !opts.quiet) {
+        printf("%u images, %u valid\n", scan_state.images, scan_state.valid);
+    }
+
+    if (result != 0) {
+        fprintf(stderr, "scan: %s: %s\n", argv[0], strerror(errno));
+        return 1;
+    }
+    return scan_state.valid == scan_state.images ? 0 : 1;
+}
+
+// watch
+
+#if defined(__linux__)
+
+// Images are extracted in child processes, since the library runs one
+// operation per process. Each finished image is appended to a state file
+// in the output directory along with its identity, so a restart skips it
+// unless the file has since been replaced, and picks up everything else
+// in the folder, including images that arrived while it was down.
+#define WATCH_STATE_NAME ".xiso-watch"
+// Extractions killed outright, by the OOM killer say, are retried from
+// their journals this many times before the image is given up on
+#define WATCH_MAX_KILLS  3
+
+typedef enum {
+    WATCH_PENDING,               // waiting for writes to settle
+    WATCH_QUEUED,
+    WATCH_RUNNING,
+    WATCH_DONE,
+    WATCH_FAILED,
+} WatchStatus;
+
+typedef struct {
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    uint64_t mtime_ns;
+} WatchIdentity;
+
+typedef struct {
+    char* name;
+    WatchStatus status;
+    WatchIdentity identity;      // at the last stat, or as recorded in the state file
+    uint64_t ready_at;           // when a pending image is looked at again
+    pid_t pid;
+    struct timespec started;
+    unsigned kills;              // times its extraction was killed by a signal
+} WatchImage;
+
+typedef struct {
+    const char* folder;
+    const char* output;
+    char state_path[4096];
+    int state_fd;
+    WatchImage* images;
+    size_t count;
+    size_t capacity;
+    unsigned running;
+    uint64_t settle_ns;
+    uint64_t deadline;           // from --timeout, monotonic ns, 0 for none
+    bool timed_out;
+    int notify_fd;
+    struct sigaction previous_int;
+    struct sigaction previous_term;
+} Watch;
+
+static volatile sig_atomic_t watch_stopping = 0;
+
+static uint64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+static uint64_t mtime_ns(const struct stat* st) {
+    return (uint64_t)st->st_mtim.tv_sec * 1000000000ull + (uint64_t)st->st_mtim.tv_nsec;
+}
+
+// The first part of a split image stands for the set, so its identity
+// also takes in the size and newest mtime of the later parts
+static bool watch_identity(const Watch* watch, const char* name, WatchIdentity* identity) {
+    char path[4096];
+    struct stat st;
+    size_t length = strlen(name);
+
+    snprintf(path, sizeof(path), "%s/%s", watch->folder, name);
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) return false;
+    *identity = (WatchIdentity){ (uint64_t)st.st_dev, (uint64_t)st.st_ino, (uint64_t)st.st_size, mtime_ns(&st) };
+
+    if (length > 6 && strncmp(name + length - 6, ".1", 2) == 0) {
+        for (unsigned n = 2;; n++) {
+            snprintf(path, sizeof(path), "%s/%.*s.%u%s", watch->folder, (int)(length - 6), name, n,
+                     name + length - 4);
+            if (stat(path, &st) != 0) break;
+            identity->size += (uint64_t)st.st_size;
+            if (mtime_ns(&st) > identity->mtime_ns) identity->mtime_ns = mtime_ns(&st);
+        }
+    }
+    return true;
+}
+
+static bool same_identity(const WatchIdentity* a, const WatchIdentity* b) {
+    return a->device == b->device && a->inode == b->inode && a->size == b->size && a->mtime_ns == b->mtime_ns;
+}
+
+static WatchImage* watch_find(Watch* watch, const char* name) {
+    for (size_t i = 0; i < watch->count; i++) {
+        if (strcmp(watch->images[i].name, name) == 0) return &watch->images[i];
+    }
+    return NULL;
+}
+
+static WatchImage* watch_add(Watch* watch, const char* name) {
+    WatchImage* image = watch_find(watch, name);
+    if (image) return image;
+
+    if (watch->count == watch->capacity) {
+        size_t capacity = watch->capacity ? watch->capacity * 2 : 64;
+        WatchImage* grown = realloc(watch->images, capacity * sizeof(WatchImage));
+        if (!grown) return NULL;
+        watch->images = grown;
+        watch->capacity = capacity;
+    }
+    image = &watch->images[watch->count];
+    memset(image, 0, sizeof(*image));
+    image->name = strdup(name);
+    if (!image->name) return NULL;
+    watch->count++;
+    return image;
+}
+
+static bool watch_candidate(const char* name) {
+    // Dot files are the temporaries of rsync and most copy tools
+    return name[0] != '.' && has_iso_suffix(name);
+}
+
+static bool watch_record(Watch* watch, const WatchImage* image) {
+    char line[1024];
+    int length = snprintf(line, sizeof(line), "%s %llu %llu %llu %llu %s\n",
+                          image->status == WATCH_DONE ? "done" : "failed",
+                          (unsigned long long)image->identity.device, (unsigned long long)image->identity.inode,
+                          (unsigned long long)image->identity.size, (unsigned long long)image->identity.mtime_ns,
+                          image->name);
+    if (length < 0 || (size_t)length >= sizeof(line)) return false;
+    return write(watch->state_fd, line, (size_t)length) == length && fdatasync(watch->state_fd) == 0;
+}
+
+// Loads the state file, then rewrites it without the images no longer in
+// the folder so it doesn't grow forever
+static bool watch_load_state(Watch* watch) {
+    char temp_path[4200];
+    struct stat st;
+    FILE* in;
+
+    snprintf(watch->state_path, sizeof(watch->state_path), "%s/" WATCH_STATE_NAME, watch->output);
+    in = fopen(watch->state_path, "r");
+    if (in) {
+        char line[1024];
+        while (fgets(line, sizeof(line), in)) {
+            char status[8];
+            unsigned long long device, inode, size, mtime_ns;
+            int name_offset = 0;
+            size_t length = strlen(line);
+            // A line cut short by a crash is ignored
+            if (length == 0 || line[length - 1] != '\n') continue;
+            line[length - 1] = '\0';
+            if (sscanf(line, "%7s %llu %llu %llu %llu %n", status, &device, &inode, &size, &mtime_ns,
+                       &name_offset) != 5 || name_offset == 0) {
+                continue;
+            }
+            WatchImage* image = watch_add(watch, line + name_offset);
+            if (!image) break;
+            image->status = strcmp(status, "done") == 0 ? WATCH_DONE : WATCH_FAILED;
+            image->identity = (WatchIdentity){ device, inode, size, mtime_ns };
+        }
+        fclose(in);
+    }
+
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", watch->state_path);
+    watch->state_fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (watch->state_fd == -1) {
+        fprintf(stderr, "watch: %s: %s\n", temp_path, strerror(errno));
+        return false;
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < watch->count; i++) {
+        WatchImage* image = &watch->images[i];
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", watch->folder, image->name);
+        if (stat(path, &st) != 0) {
+            free(image->name);
+            continue;
+        }
+        watch->images[kept++] = *image;
+        if (!watch_record(watch, image)) {
+            fprintf(stderr, "watch: %s: %s\n", temp_path, strerror(errno));
+            return false;
+        }
+    }
+    watch->count = kept;
+    if (rename(temp_path, watch->state_path) != 0) {
+        fprintf(stderr, "watch: %s: %s\n", watch->state_path, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// Something happened to an image: (re)start its settle timer
+static void watch_touch(Watch* watch, const char* name) {
+    char first[1024];
+    WatchIdentity identity;
+
+    if (!watch_candidate(name)) return;
+    // Parts of a split image keep its first part from settling, and the
+    // whole set is extracted through that
+    if (split_first_part(name, first, sizeof(first))) name = first;
+    if (!watch_identity(watch, name, &identity)) return;
+
+    WatchImage* image = watch_add(watch, name);
+    if (!image || image->status == WATCH_RUNNING) return;
+    // Finished images only come back if the file is a different one now
+    if ((image->status == WATCH_DONE || image->status == WATCH_FAILED) &&
+        same_identity(&identity, &image->identity)) {
+        return;
+    }
+    image->identity = identity;
+    image->status = WATCH_PENDING;
+    image->ready_at = monotonic_ns() + watch->settle_ns;
+    image->kills = 0;
+}
+
+static void watch_scan(Watch* watch) {
+    DIR* dir = opendir(watch->folder);
+    struct dirent* entry;
+
+    if (!dir) return;
+    while ((entry = readdir(dir))) {
+        WatchImage* image = watch_find(watch, entry->d_name);
+        if (!image || image->status == WATCH_DONE || image->status == WATCH_FAILED) {
+            watch_touch(watch, entry->d_name);
+        }
+    }
+    closedir(dir);
+}
+
+// Pending images whose size and mtime held still through the settle time
+// are queued; anything still changing waits another round
+static void watch_settle(Watch* watch, uint64_t now) {
+    for (size_t i = 0; i < watch->count; i++) {
+        WatchImage* image = &watch->images[i];
+        if (image->status != WATCH_PENDING || image->ready_at > now) continue;
+
+        WatchIdentity identity;
+        if (!watch_identity(watch, image->name, &identity)) {
+            image->status = WATCH_FAILED;
+            image->identity = (WatchIdentity){ 0, 0, 0, 0 };
+            continue;
+        }
+        if (!same_identity(&identity, &image->identity)) {
+            image->identity = identity;
+            image->ready_at = now + watch->settle_ns;
+            continue;
+        }
+        image->status = WATCH_QUEUED;
+    }
+}
+
+// name.iso extracts to name, as does name.1.iso
+static void watch_output_path(const Watch* watch, const WatchImage* image, char* out, size_t size) {
+    size_t length = strlen(image->name) - 4;
+    if (length > 2 && strncmp(image->name + length - 2, ".1", 2) == 0) length -= 2;
+    snprintf(out, size, "%s/%.*s", watch->output, (int)length, image->name);
+}
+
+// Starts queued images, oldest first, while there is room
+static void watch_dispatch(Watch* watch) {
+    for (size_t i = 0; i < watch->count && watch->running < opts.jobs; i++) {
+        WatchImage* image = &watch->images[i];
+        if (image->status != WATCH_QUEUED) continue;
+
+        char path[4096], output[4096];
+        snprintf(path, sizeof(path), "%s/%s", watch->folder, image->name);
+        watch_output_path(watch, image, output, sizeof(output));
+
+        fflush(stdout);
+        fflush(stderr);
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(watch->notify_fd);
+            close(watch->state_fd);
+            sigaction(SIGINT, &watch->previous_int, NULL);
+            sigaction(SIGTERM, &watch->previous_term, NULL);
+            bool ok = xiso_extract(path, output);
+            if (!ok) report_error("extract", path);
+            fflush(stdout);
+            fflush(stderr);
+            XisoErrorCode code = xiso_get_last_error_code();
+            _exit(ok ? 0 : code >= XISO_ERROR_CANCELLED ? 128 + code : 1);
+        }
+        if (pid == -1) {
+            fprintf(stderr, "watch: %s: %s\n", path, strerror(errno));
+            return;
+        }
+        image->status = WATCH_RUNNING;
+        image->pid = pid;
+        clock_gettime(CLOCK_MONOTONIC, &image->started);
+        watch->running++;
+    }
+}
+
+static void watch_report(const Watch* watch, const WatchImage* image, bool ok, double seconds) {
+    char output[4096];
+    watch_output_path(watch, image, output, sizeof(output));
+
+    if (opts.format == FORMAT_TEXT) {
+        if (!opts.quiet && ok) printf("Extracted %s to %s in %.2fs\n", image->name, output, seconds);
+    } else {
+        printf("{\"image\":");
+        json_string(stdout, image->name);
+        printf(",\"output\":");
+        json_string(stdout, output);
+        printf(",\"ok\":%s,\"seconds\":%.3f}\n", ok ? "true" : "false", seconds);
+    }
+    fflush(stdout);
+}
+
+static bool watch_reap(Watch* watch) {
+    int status;
+    pid_t pid;
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        WatchImage* image = NULL;
+        for (size_t i = 0; i < watch->count && !image; i++) {
+            if (watch->images[i].status == WATCH_RUNNING && watch->images[i].pid == pid) image = &watch->images[i];
+        }
+        if (!image) continue;
+        watch->running--;
+
+        int code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+        double seconds = elapsed_seconds(&image->started);
+        // Children share the --timeout deadline, so once one has hit it
+        // every later one would too
+        if (code == 128 + XISO_ERROR_DEADLINE) watch->timed_out = true;
+        if (code >= 128 + XISO_ERROR_CANCELLED || watch_stopping) {
+            // Interrupted: left unrecorded so the next run resumes it
+            image->status = WATCH_QUEUED;
+            continue;
+        }
+        if (!WIFEXITED(status)) {
+            // Killed: never recorded, so even once given up on here the
+            // next run resumes it from its journal
+            if (++image->kills < WATCH_MAX_KILLS) {
+                image->status = WATCH_QUEUED;
+                continue;
+            }
+            fprintf(stderr, "watch: %s: killed by signal %d\n", image->name, WTERMSIG(status));
+            image->status = WATCH_FAILED;
+            watch_report(watch, image, false, seconds);
+            continue;
+        }
+
+        // An image rewritten while it was extracted goes round again
+        WatchIdentity identity;
+        if (watch_identity(watch, image->name, &identity) && !same_identity(&identity, &image->identity)) {
+            image->identity = identity;
+            image->status = WATCH_PENDING;
+            image->ready_at = monotonic_ns() + watch->settle_ns;
+            continue;
+        }
+
+        image->status = code == 0 ? WATCH_DONE : WATCH_FAILED;
+        watch_report(watch, image, code == 0, seconds);
+        if (!watch_record(watch, image)) {
+            fprintf(stderr, "watch: %s: %s\n", watch->state_path, strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
+
+static void watch_stop(int signal) {
+    (void)signal;
+    watch_stopping = 1;
+}
+
+static int cmd_watch(int argc, char** argv) {
+    Watch watch;
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int result = 0;
+
+    if (argc != 2) return -1;
+
+    memset(&watch, 0, sizeof(watch));
+    watch.folder = argv[0];
+    watch.output = argv[1];
+    watch.state_fd = -1;
+    watch.settle_ns = opts.settle_ms * 1000000ull;
+    watch.deadline = opts.timeout_ms ? monotonic_ns() + opts.timeout_ms * 1000000ull : 0;
+
+    if (mkdir(watch.output, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "watch: %s: %s\n", watch.output, strerror(errno));
+        return 1;
+    }
+    watch.notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch.notify_fd == -1 ||
+        inotify_add_watch(watch.notify_fd, watch.folder,
+                          IN_CLOSE_WRITE | IN_MOVED_TO | IN_MODIFY | IN_CREATE | IN_ONLYDIR) == -1) {
+        fprintf(stderr, "watch: %s: %s\n", watch.folder, strerror(errno));
+        if (watch.notify_fd != -1) close(watch.notify_fd);
+        return 1;
+    }
+    if (!watch_load_state(&watch)) {
+        close(watch.notify_fd);
+        if (watch.state_fd != -1) close(watch.state_fd);
+        return 1;
+    }
+
+    // Interrupted extractions continue where they stopped next time
+    if (!opts.resume_set) xiso_set_resume(XISO_RESUME_SIZE);
+
+    // The parent only waits; children put back the handler that cancels
+    // their extraction, so they clean up after themselves
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = watch_stop;
+    sigaction(SIGINT, &action, &watch.previous_int);
+    sigaction(SIGTERM, &action, &watch.previous_term);
+
+    watch_scan(&watch);
+    if (opts.format == FORMAT_TEXT && !opts.quiet) {
+        printf("Watching %s, extracting to %s\n", watch.folder, watch.output);
+        fflush(stdout);
+    }
+
+    while (!watch_stopping) {
+        uint64_t now = monotonic_ns();
+        if (watch.deadline && now >= watch.deadline) watch.timed_out = true;
+        if (watch.timed_out) {
+            fprintf(stderr, "watch: Deadline exceeded\n");
+            result = 124;
+            break;
+        }
+        watch_settle(&watch, now);
+        watch_dispatch(&watch);
+
+        // Sleep until the next image settles, waking up for events and
+        // finished children along the way
+        uint64_t wake = now + 250 * 1000000ull;
+        if (watch.deadline && watch.deadline < wake) wake = watch.deadline;
+        for (size_t i = 0; i < watch.count; i++) {
+            if (watch.images[i].status == WATCH_PENDING && watch.images[i].ready_at < wake) {
+                wake = watch.images[i].ready_at;
+            }
+        }
+        struct pollfd pfd = { watch.notify_fd, POLLIN, 0 };
+        int timeout = wake > now ? (int)((wake - now + 999999) / 1000000) : 0;
+        if (poll(&pfd, 1, timeout) > 0) {
+            ssize_t length;
+            while ((length = read(watch.notify_fd, buffer, sizeof(buffer))) > 0) {
+                for (char* p = buffer; p < buffer + length;) {
+                    const struct inotify_event* event = (const struct inotify_event*)p;
+                    if (event->mask & IN_Q_OVERFLOW) {
+                        watch_scan(&watch);
+                    } else if (event->len > 0 && !(event->mask & IN_ISDIR)) {
+                        watch_touch(&watch, event->name);
+                    }
+                    p += sizeof(struct inotify_event) + event->len;
+                }
+            }
+        }
+        if (!watch_reap(&watch)) {
+            result = 1;
+            break;
+        }
+    }
+
+    // Running extractions stop and keep their resume journals
+    for (size_t i = 0; i < watch.count; i++) {
+        if (watch.images[i].status == WATCH_RUNNING) kill(watch.images[i].pid, SIGTERM);
+    }
+    while (watch.running > 0 && wait(NULL) > 0) watch.running--;
+
+    sigaction(SIGINT, &watch.previous_int, NULL);
+    sigaction(SIGTERM, &watch.previous_term, NULL);
+    close(watch.notify_fd);
+    close(watch.state_fd);
+    for (size_t i = 0; i < watch.count; i++) {
+        free(watch.images[i].name);
+    }
+    free(watch.images);
+    return result;
+}
+
+#else
+
+static int cmd_watch(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    fprintf(stderr, "watch: not supported on this platform\n");
+    return 1;
+}
+
+#endif
+
+// bench
+
+static int remove_entry(const char* path, const struct stat* st, int type, struct FTW* ftw) {
+    return remove(path);
+}
+
+static void remove_tree(const char* path) {
+    nftw(path, remove_entry, 32, FTW_DEPTH | FTW_PHYS);
+}
+
+static int cmd_bench(int argc, char** argv) {
+    static const XisoIoStrategy strategies[] = { XISO_IO_BUFFERED, XISO_IO_DIRECT, XISO_IO_COPY_RANGE };
+    static const size_t default_sizes[] = { 256 * 1024, 1024 * 1024, 4 * 1024 * 1024 };
+    char target[4096];
+    const size_t* sizes = default_sizes;
+    size_t num_sizes = sizeof(default_sizes) / sizeof(default_sizes[0]);
+    bool first = true;
+
+    if (argc != 2) return -1;
+
+    if (opts.buffer_size) {
+        sizes = &opts.buffer_size;
+        num_sizes = 1;
+    }
+
+    snprintf(target, sizeof(target), "%s/xiso-bench", argv[1]);
+
+    // Warm-up run so every candidate sees the same page cache state
+    remove_tree(target);
+    if (!xiso_extract(argv[0], target)) {
+        report_error("bench", argv[0]);
+        remove_tree(target);
+        return 1;
+    }
+    remove_tree(target);
+
+    if (opts.format == FORMAT_JSON) {
+        printf("{\"image\":");
+        json_string(stdout, argv[0]);
+        printf(",\"results\":[");
+    }
+    for (size_t s = 0; s < sizeof(strategies) / sizeof(strategies[0]); s++) {
+        for (size_t b = 0; b < num_sizes; b++) {
+            struct timespec start;
+            XisoStats stats;
+
+            xiso_set_io_strategy(strategies[s]);
+            xiso_set_buffer_size(sizes[b]);
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            bool ok = xiso_extract(argv[0], target);
+            double seconds = elapsed_seconds(&start);
+            xiso_get_stats(&stats);
+            remove_tree(target);
+
+            double mbps = ok && seconds > 0 ? stats.bytes_written / seconds / (1024 * 1024) : 0;
+            if (opts.format == FORMAT_TEXT) {
+                printf("%-10s  %8zuK  %8.1f MB/s%s\n", strategy_name(strategies[s]), sizes[b] / 1024,
+                       mbps, ok ? "" : "  (failed)");
+            } else {
+                if (opts.format == FORMAT_JSON) printf("%s\n    ", first ? "" : ",");
+                printf("{\"strategy\":\"%s\",\"buffer_size\":%zu,\"ok\":%s,\"seconds\":%.3f,"
+                       "\"bytes\":%llu,\"mb_per_second\":%.1f}",
+                       strategy_name(strategies[s]), sizes[b], ok ? "true" : "false", seconds,
+                       (unsigned long long)stats.bytes_written, mbps);
+                if (opts.format == FORMAT_NDJSON) printf("\n");
+            }
+            first = false;
+        }
+    }
+    if (opts.format == FORMAT_JSON) printf("\n  ]}\n");
+    return 0;
+}
+
+typedef struct {
+    const char* name;
+    int (*run)(int argc, char** argv);
+} Command;
+
+static const Command commands[] = {
+    { "list", cmd_list },
+    { "extract", cmd_extract },
+    { "tar", cmd_tar },
+    { "rebuild", cmd_rebuild },
+    { "create", cmd_create },
+    { "replace", cmd_replace },
+    { "diff", cmd_diff },
+    { "patch", cmd_patch },
+    { "stat", cmd_stat },
+    { "verify", cmd_verify },
+    { "verify-extracted", cmd_verify_extracted },
+    { "search", cmd_search },
+    { "scan", cmd_scan },
+    { "bench", cmd_bench },
+    { "watch", cmd_watch },
+};
+
+int main(int argc, char** argv) {
+    static const struct option long_options[] = {
+        { "format", required_argument, NULL, 'f' },
+        { "threads", required_argument, NULL, 'j' },
+        { "buffer-size", required_argument, NULL, 'b' },
+        { "strategy", required_argument, NULL, 's' },
+        { "zstd", required_argument, NULL, 'z' },
+        { "order", required_argument, NULL, 'O' },
+        { "resume", optional_argument, NULL, 'R' },
+        { "dat", required_argument, NULL, 'd' },
+        { "regex", no_argument, NULL, 'E' },
+        { "ignore-case", no_argument, NULL, 'C' },
+        { "tune-cache", required_argument, NULL, 'T' },
+        { "max-depth", required_argument, NULL, 'D' },
+        { "spill-limit", required_argument, NULL, 'L' },
+        { "timeout", required_argument, NULL, 'W' },
+        { "limit-read", required_argument, NULL, 'A' },
+        { "limit-write", required_argument, NULL, 'B' },
+        { "ionice", required_argument, NULL, 'N' },
+        { "jobs", required_argument, NULL, 'J' },
+        { "settle", required_argument, NULL, 'G' },
+        { "include", required_argument, NULL, 'i' },
+        { "exclude", required_argument, NULL, 'x' },
+        { "quiet", no_argument, NULL, 'q' },
+        { "verbose", no_argument, NULL, 'v' },
+        { "stats", no_argument, NULL, 'S' },
+        { "trace", required_argument, NULL, 't' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    const Command* command = NULL;
+    bool verbose = false;
+    size_t read_limit = 0, write_limit = 0;
+    XisoIoPriority io_priority = XISO_IO_PRIORITY_DEFAULT;
+    int io_level = 0;
+    int c;
+
+    if (argc < 2) {
+        usage(stderr, argv[0]);
+        return 2;
+    }
+    if (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
+        usage(stdout, argv[0]);
+        return 0;
+    }
+
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+        if (strcmp(argv[1], commands[i].name) == 0) command = &commands[i];
+    }
+    if (!command) {
+        fprintf(stderr, "Unknown command: %s\n\n", argv[1]);
+        usage(stderr, argv[0]);
+        return 2;
+    }
+
+    // Options may appear anywhere after the command
+    argv[1] = argv[0];
+    argc--;
+    argv++;
+
+    xiso_set_debug(false);
+    while ((c = getopt_long(argc, argv, "f:j:J:b:s:z:i:x:Eqvh", long_options, NULL)) != -1) {
+        switch (c) {
+        case 'f':
+            if (strcmp(optarg, "text") == 0) opts.format = FORMAT_TEXT;
+            else if (strcmp(optarg, "json") == 0) opts.format = FORMAT_JSON;
+            else if (strcmp(optarg, "ndjson") == 0) opts.format = FORMAT_NDJSON;
+            else {
+                fprintf(stderr, "Unknown format: %s\n", optarg);
+                return 2;
+            }
+            break;
+        case 'j':
+            opts.threads = (unsigned)strtoul(optarg, NULL, 10);
+            if (opts.threads == 0) {
+                fprintf(stderr, "Invalid thread count: %s\n", optarg);
+                return 2;
+            }
+            xiso_set_threads(opts.threads);
+            break;
+        case 'b':
+            if (!parse_size(optarg, &opts.buffer_size)) {
+                fprintf(stderr, "Invalid buffer size: %s\n", optarg);
+                return 2;
+            }
+            xiso_set_buffer_size(opts.buffer_size);
+            break;
+        case 's':
+            if (strcmp(optarg, "auto") == 0) xiso_set_auto_tune(true);
+            else if (strcmp(optarg, "buffered") == 0) xiso_set_io_strategy(XISO_IO_BUFFERED);
+            else if (strcmp(optarg, "direct") == 0) xiso_set_io_strategy(XISO_IO_DIRECT);
+            else if (strcmp(optarg, "copy-range") == 0) xiso_set_io_strategy(XISO_IO_COPY_RANGE);
+            else {
+                fprintf(stderr, "Unknown strategy: %s\n", optarg);
+                return 2;
+            }
+            break;
+        case 'z':
+            opts.zstd_level = atoi(optarg);
+            if (opts.zstd_level <= 0) {
+                fprintf(stderr, "Invalid zstd level: %s\n", optarg);
+                return 2;
+            }
+            break;
+        case 'O':
+            if (strcmp(optarg, "source") == 0) xiso_set_file_order(XISO_ORDER_SOURCE);
+            else if (strcmp(optarg, "tree") == 0) xiso_set_file_order(XISO_ORDER_TREE);
+            else if (strcmp(optarg, "size") == 0) xiso_set_file_order(XISO_ORDER_SIZE);
+            else {
+                fprintf(stderr, "Unknown order: %s\n", optarg);
+                return 2;
+            }
+            break;
+        case 'R':
+            opts.resume_set = true;
+            if (!optarg) xiso_set_resume(XISO_RESUME_SIZE);
+            else if (strcmp(optarg, "verify") == 0) xiso_set_resume(XISO_RESUME_VERIFY);
+            else {
+                fprintf(stderr, "Unknown resume mode: %s\n", optarg);
+                return 2;
+            }
+            break;
+        case 'E':
+            opts.search_flags |= XISO_SEARCH_REGEX;
+            break;
+        case 'C':
+            opts.search_flags |= XISO_SEARCH_IGNORE_CASE;
+            break;
+        case 'd':
+            if (!xiso_load_dat(optarg)) {
+                fprintf(stderr, "%s\n", xiso_get_last_error());
+                return 2;
+            }
+            opts.dat_loaded = true;
+            break;
+        case 'T':
+            xiso_set_tune_cache(optarg);
+            break;
+        case 'L': {
+            size_t limit;
+            if (!parse_size(optarg, &limit)) {
+                fprintf(stderr, "Invalid spill limit: %s\n", optarg);
+                return 2;
+            }
+            xiso_set_spill_limit(limit);
+            break;
+        }
+        case 'W': {
+            char* end;
+            double seconds = strtod(optarg, &end);
+            if (end == optarg || *end || seconds <= 0) {
+                fprintf(stderr, "Invalid timeout: %s\n", optarg);
+                return 2;
+            }
+            opts.timeout_ms = (uint64_t)(seconds * 1000);
+            if (opts.timeout_ms == 0) opts.timeout_ms = 1;
+            break;
+        }
+        case 'A':
+        case 'B':
+            if (!parse_size(optarg, c == 'A' ? &read_limit : &write_limit)) {
+                fprintf(stderr, "Invalid rate: %s\n", optarg);
+                return 2;
+            }
+            break;
+        case 'N': {
+            char* level = strchr(optarg, ':');
+            size_t length = level ? (size_t)(level - optarg) : strlen(optarg);
+            if (length == 4 && strncmp(optarg, "idle", 4) == 0 && !level) {
+                io_priority = XISO_IO_PRIORITY_IDLE;
+            } else if (length == 11 && strncmp(optarg, "best-effort", 11) == 0) {
+                io_priority = XISO_IO_PRIORITY_BEST_EFFORT;
+                io_level = level ? atoi(level + 1) : 7;
+            } else {
+                fprintf(stderr, "Invalid I/O class: %s\n", optarg);
+                return 2;
+            }
+            break;
+        }
+        case 'J':
+            opts.jobs = (unsigned)strtoul(optarg, NULL, 10);
+            if (opts.jobs == 0) {
+                fprintf(stderr, "Invalid job count: %s\n", optarg);
+                return 2;
+            }
+            break;
+        case 'G': {
+            char* end;
+            double seconds = strtod(optarg, &end);
+            if (end == optarg || *end || seconds < 0) {
+                fprintf(stderr, "Invalid settle time: %s\n", optarg);
+                return 2;
+            }
+            opts.settle_ms = (uint64_t)(seconds * 1000);
+            break;
+        }
+        case 'D': {
+            unsigned depth = (unsigned)strtoul(optarg, NULL, 10);
+            if (depth == 0) {
+                fprintf(stderr, "Invalid depth: %s\n", optarg);
+                return 2;
+            }
+            xiso_set_max_depth(depth);
+            break;
+        }
+        case 'i':
+            xiso_add_include(optarg);
+            break;
+        case 'x':
+            xiso_add_exclude(optarg);
+            break;
+        case 'q':
+            opts.quiet = true;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        case 'S':
+            opts.show_stats = true;
+            break;
+        case 't':
+            opts.trace_path = optarg;
+            break;
+        case 'h':
+            usage(stdout, argv[0]);
+            return 0;
+        default:
+            usage(stderr, argv[0]);
+            return 2;
+        }
+    }
+    xiso_set_debug(verbose);
+    xiso_set_bandwidth_limit(read_limit, write_limit);
+    if (io_priority != XISO_IO_PRIORITY_DEFAULT && !xiso_set_io_priority(io_priority, io_level)) {
+        fprintf(stderr, "%s\n", xiso_get_last_error());
+        return 2;
+    }
+
+    if (opts.trace_path && !xiso_trace_start(1 << 16)) {
+        fprintf(stderr, "Failed to start tracing: %s\n", xiso_get_last_error());
+        return 1;
+    }
+
+    if (!xiso_init()) {
+        fprintf(stderr, "Failed to initialize: %s\n", xiso_get_last_error());
+        return 1;
+    }
+
+    cancel_token = xiso_cancel_token_create();
+    if (cancel_token) {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = handle_signal;
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGINT, &action, NULL);
+        sigaction(SIGTERM, &action, NULL);
+        if (opts.timeout_ms) xiso_cancel_token_set_deadline(cancel_token, opts.timeout_ms);
+        xiso_set_cancel_token(cancel_token);
+    }
+
+    int result = command->run(argc - optind, argv + optind);
+    if (result < 0) {
+        usage(stderr, argv[0]);
+        result = 2;
+    } else if (result != 0) {
+        XisoErrorCode code = xiso_get_last_error_code();
+        if (code == XISO_ERROR_DEADLINE) result = 124;
+        if (code == XISO_ERROR_CANCELLED) result = 130;
+    }
+
+    if (opts.show_stats) print_stats();
+    if (opts.trace_path) {
+        xiso_trace_stop();
+        if (!xiso_trace_dump(opts.trace_path)) {
+            fprintf(stderr, "Failed to write trace: %s\n", xiso_get_last_error());
+        }
+    }
+
+    xiso_cleanup();
+    xiso_clear_filters();
+    xiso_cancel_token_destroy(cancel_token);
+    return result;
+}
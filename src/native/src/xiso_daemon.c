@@ -0,0 +1,889 @@
+// Extraction daemon, installed as "xiso-daemon".
+//
+// The library stays initialized for the life of the process, so its buffer
+// pool and worker threads stay warm, and parsed directory tables are kept
+// in an index cache so listing an image a second time never touches it.
+// Jobs arrive over a local Unix socket. The library runs one operation at a time, so jobs
+// that need it take turns in arrival order; --max-jobs caps how many may
+// be admitted (running or waiting) before new ones are turned away.
+//
+// Every message is a frame: u32 little-endian payload length, u8 type, then
+// the payload, whose fields are separated by NUL bytes.
+//   'Q' request    command, arguments...
+//   'E' entry      path, size, start sector, "d" or "f"        (list)
+//   'X' problem    kind, path, offset                         (verify-extracted)
+//   'P' progress   files done, files total, bytes done, bytes total
+//   'T' text       Prometheus metrics                         (metrics)
+//   'D' done       "ok", or "error", error code, message
+// Commands: list <image>, extract <image> <dir>, verify <image>,
+// verify-extracted <image> <dir>, limit <read B/s> <write B/s>, metrics.
+// Closing the connection cancels its job. A connection that opens with
+// "GET " is answered with the metrics as plain HTTP instead, so
+// "curl --unix-socket" and socket-aware scrapers work unchanged.
+
+#include "xiso.h"
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DAEMON_MAX_REQUEST      65536
+#define DAEMON_MAX_FIELDS       8
+#define DAEMON_MAX_CONNECTIONS  256
+#define DAEMON_OUT_BUFFER       65536
+#define DAEMON_PROGRESS_MS      250
+
+typedef enum {
+    JOB_LIST,
+    JOB_EXTRACT,
+    JOB_VERIFY,
+    JOB_VERIFY_EXTRACTED,
+    NUM_JOB_KINDS,
+} JobKind;
+
+static const char* const job_names[NUM_JOB_KINDS] = { "list", "extract", "verify", "verify-extracted" };
+
+typedef enum {
+    RESULT_OK,
+    RESULT_ERROR,
+    RESULT_CANCELLED,
+    RESULT_REJECTED,
+    NUM_RESULTS,
+} JobResult;
+
+static const char* const result_names[NUM_RESULTS] = { "ok", "error", "cancelled", "rejected" };
+
+typedef struct {
+    const char* socket_path;
+    unsigned max_jobs;
+    unsigned threads;
+    size_t memory;
+    size_t cache_budget;
+} Options;
+
+static Options opts = { "/tmp/xiso.sock", 16, 1, 0, 64 * 1024 * 1024 };
+
+// Metrics, updated with relaxed atomics
+static struct {
+    uint64_t jobs[NUM_JOB_KINDS][NUM_RESULTS];
+    uint64_t job_ns[NUM_JOB_KINDS];
+    uint64_t bytes_extracted;
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+    uint64_t connections;
+    unsigned admitted;
+    unsigned running;
+    unsigned open_connections;
+} metrics;
+
+static volatile sig_atomic_t stopping = 0;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Turns at the library, served in the order they were taken
+
+static pthread_mutex_t turn_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t turn_changed = PTHREAD_COND_INITIALIZER;
+static uint64_t next_ticket = 0;
+static uint64_t now_serving = 0;
+
+static void turn_acquire(void) {
+    pthread_mutex_lock(&turn_lock);
+    uint64_t ticket = next_ticket++;
+    while (ticket != now_serving) {
+        pthread_cond_wait(&turn_changed, &turn_lock);
+    }
+    pthread_mutex_unlock(&turn_lock);
+}
+
+static void turn_release(void) {
+    pthread_mutex_lock(&turn_lock);
+    now_serving++;
+    pthread_cond_broadcast(&turn_changed);
+    pthread_mutex_unlock(&turn_lock);
+}
+
+// Index cache. Entries are keyed by path and checked against the file's
+// identity on every lookup; readers hold a reference, so eviction only
+// unlinks an entry and the last reader frees it.
+
+typedef struct CacheEntry {
+    char* path;
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    struct timespec mtime;
+    XisoEntryTable table;
+    size_t bytes;
+    unsigned refs;
+    bool cached;
+    uint64_t last_used;
+    struct CacheEntry* next;
+} CacheEntry;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static CacheEntry* cache_head = NULL;
+static size_t cache_bytes = 0;
+static size_t cache_count = 0;
+
+static void cache_free(CacheEntry* entry) {
+    xiso_free_table(&entry->table);
+    free(entry->path);
+    free(entry);
+}
+
+// Called with cache_lock held
+static void cache_unlink(CacheEntry* entry) {
+    for (CacheEntry** link = &cache_head; *link; link = &(*link)->next) {
+        if (*link == entry) {
+            *link = entry->next;
+            break;
+        }
+    }
+    entry->cached = false;
+    cache_bytes -= entry->bytes;
+    cache_count--;
+    if (entry->refs == 0) cache_free(entry);
+}
+
+static bool same_file(const CacheEntry* entry, const struct stat* st) {
+    return entry->device == st->st_dev && entry->inode == st->st_ino && entry->size == st->st_size &&
+           entry->mtime.tv_sec == st->st_mtim.tv_sec && entry->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static CacheEntry* cache_lookup(const char* path, const struct stat* st) {
+    pthread_mutex_lock(&cache_lock);
+    CacheEntry* entry = cache_head;
+    while (entry && strcmp(entry->path, path) != 0) entry = entry->next;
+    if (entry && !same_file(entry, st)) {
+        cache_unlink(entry);
+        entry = NULL;
+    }
+    if (entry) {
+        entry->refs++;
+        entry->last_used = now_ns();
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return entry;
+}
+
+static void cache_release(CacheEntry* entry) {
+    pthread_mutex_lock(&cache_lock);
+    if (--entry->refs == 0 && !entry->cached) cache_free(entry);
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// Takes ownership of a freshly loaded entry, returned with a reference
+static CacheEntry* cache_insert(CacheEntry* entry) {
+    pthread_mutex_lock(&cache_lock);
+    entry->refs = 1;
+    entry->last_used = now_ns();
+    if (entry->bytes <= opts.cache_budget) {
+        // Make room, least recently used first, skipping the busy ones
+        while (cache_bytes + entry->bytes > opts.cache_budget) {
+            CacheEntry* victim = NULL;
+            for (CacheEntry* e = cache_head; e; e = e->next) {
+                if (e->refs == 0 && (!victim || e->last_used < victim->last_used)) victim = e;
+            }
+            if (!victim) break;
+            cache_unlink(victim);
+        }
+        if (cache_bytes + entry->bytes <= opts.cache_budget) {
+            entry->cached = true;
+            entry->next = cache_head;
+            cache_head = entry;
+            cache_bytes += entry->bytes;
+            cache_count++;
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return entry;
+}
+
+// Connections
+
+typedef struct {
+    int fd;
+    pthread_mutex_t lock;        // serializes frames from the job and monitor threads
+    uint8_t* out;
+    size_t out_length;
+    bool broken;
+} Connection;
+
+static bool read_exact(int fd, void* data, size_t length) {
+    uint8_t* p = data;
+    while (length > 0) {
+        ssize_t n = read(fd, p, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        length -= (size_t)n;
+    }
+    return true;
+}
+
+// Called with conn->lock held
+static bool flush_locked(Connection* conn) {
+    size_t done = 0;
+    while (!conn->broken && done < conn->out_length) {
+        ssize_t n = send(conn->fd, conn->out + done, conn->out_length - done, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) conn->broken = true;
+        else done += (size_t)n;
+    }
+    conn->out_length = 0;
+    return !conn->broken;
+}
+
+static bool flush(Connection* conn) {
+    pthread_mutex_lock(&conn->lock);
+    bool ok = flush_locked(conn);
+    pthread_mutex_unlock(&conn->lock);
+    return ok;
+}
+
+// Queues a frame; frames are sent when the buffer fills or on flush()
+static bool put_frame(Connection* conn, char type, const char* const* fields, size_t count) {
+    size_t length = 0;
+    for (size_t i = 0; i < count; i++) length += strlen(fields[i]) + (i + 1 < count);
+
+    pthread_mutex_lock(&conn->lock);
+    if (conn->out_length + 5 + length > DAEMON_OUT_BUFFER) flush_locked(conn);
+    if (5 + length > DAEMON_OUT_BUFFER) {
+        // Only metrics text gets this large; it goes out on its own
+        uint8_t header[5] = { (uint8_t)length, (uint8_t)(length >> 8), (uint8_t)(length >> 16),
+                              (uint8_t)(length >> 24), (uint8_t)type };
+        memcpy(conn->out, header, sizeof(header));
+        conn->out_length = sizeof(header);
+        flush_locked(conn);
+        for (size_t i = 0; i < count && !conn->broken; i++) {
+            size_t n = strlen(fields[i]) + (i + 1 < count);
+            if (send(conn->fd, fields[i], n, MSG_NOSIGNAL) != (ssize_t)n) conn->broken = true;
+        }
+    } else {
+        uint8_t* p = conn->out + conn->out_length;
+        p[0] = (uint8_t)length;
+        p[1] = (uint8_t)(length >> 8);
+        p[2] = (uint8_t)(length >> 16);
+        p[3] = (uint8_t)(length >> 24);
+        p[4] = (uint8_t)type;
+        p += 5;
+        for (size_t i = 0; i < count; i++) {
+            size_t n = strlen(fields[i]) + (i + 1 < count);
+            memcpy(p, fields[i], n);
+            p += n;
+        }
+        conn->out_length = (size_t)(p - conn->out);
+    }
+    bool ok = !conn->broken;
+    pthread_mutex_unlock(&conn->lock);
+    return ok;
+}
+
+static void send_done(Connection* conn, bool ok, XisoErrorCode code, const char* message) {
+    char code_text[16];
+    snprintf(code_text, sizeof(code_text), "%d", (int)code);
+    const char* fields[] = { ok ? "ok" : "error", code_text, message };
+    put_frame(conn, 'D', fields, ok ? 1 : 3);
+    flush(conn);
+}
+
+// Metrics
+
+static void append(char** text, size_t* length, size_t* capacity, const char* format, ...) {
+    va_list args;
+    for (;;) {
+        va_start(args, format);
+        int n = vsnprintf(*text + *length, *capacity - *length, format, args);
+        va_end(args);
+        if (n < 0) return;
+        if ((size_t)n < *capacity - *length) {
+            *length += (size_t)n;
+            return;
+        }
+        size_t grown_capacity = (*capacity + (size_t)n) * 2;
+        char* grown = realloc(*text, grown_capacity);
+        if (!grown) return;
+        *text = grown;
+        *capacity = grown_capacity;
+    }
+}
+
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+
+static char* render_metrics(void) {
+    size_t length = 0, capacity = 4096;
+    char* text = malloc(capacity);
+    XisoBufferPoolStats pool;
+    uint64_t read_limit, write_limit;
+
+    if (!text) return NULL;
+    text[0] = '\0';
+
+    append(&text, &length, &capacity,
+           "# HELP xiso_daemon_jobs_total Jobs finished, by command and result.\n"
+           "# TYPE xiso_daemon_jobs_total counter\n");
+    for (int k = 0; k < NUM_JOB_KINDS; k++) {
+        for (int r = 0; r < NUM_RESULTS; r++) {
+            append(&text, &length, &capacity, "xiso_daemon_jobs_total{command=\"%s\",result=\"%s\"} %" PRIu64 "\n",
+                   job_names[k], result_names[r], LOAD(metrics.jobs[k][r]));
+        }
+    }
+    append(&text, &length, &capacity,
+           "# HELP xiso_daemon_job_seconds_total Time spent running jobs, by command.\n"
+           "# TYPE xiso_daemon_job_seconds_total counter\n");
+    for (int k = 0; k < NUM_JOB_KINDS; k++) {
+        append(&text, &length, &capacity, "xiso_daemon_job_seconds_total{command=\"%s\"} %.3f\n",
+               job_names[k], LOAD(metrics.job_ns[k]) / 1e9);
+    }
+
+    unsigned admitted = LOAD(metrics.admitted), running = LOAD(metrics.running);
+    pthread_mutex_lock(&cache_lock);
+    size_t cached_bytes = cache_bytes, cached_count = cache_count;
+    pthread_mutex_unlock(&cache_lock);
+    xiso_get_buffer_pool_stats(&pool);
+    xiso_get_bandwidth_limit(&read_limit, &write_limit);
+
+    append(&text, &length, &capacity,
+           "# HELP xiso_daemon_jobs_running Jobs using the library now.\n"
+           "# TYPE xiso_daemon_jobs_running gauge\n"
+           "xiso_daemon_jobs_running %u\n"
+           "# HELP xiso_daemon_jobs_waiting Admitted jobs waiting for their turn.\n"
+           "# TYPE xiso_daemon_jobs_waiting gauge\n"
+           "xiso_daemon_jobs_waiting %u\n"
+           "# HELP xiso_daemon_jobs_limit Most jobs admitted at once.\n"
+           "# TYPE xiso_daemon_jobs_limit gauge\n"
+           "xiso_daemon_jobs_limit %u\n"
+           "# HELP xiso_daemon_connections_total Connections accepted.\n"
+           "# TYPE xiso_daemon_connections_total counter\n"
+           "xiso_daemon_connections_total %" PRIu64 "\n"
+           "# HELP xiso_daemon_extracted_bytes_total File data written by extract jobs.\n"
+           "# TYPE xiso_daemon_extracted_bytes_total counter\n"
+           "xiso_daemon_extracted_bytes_total %" PRIu64 "\n"
+           "# HELP xiso_daemon_index_cache_hits_total Listings served from the index cache.\n"
+           "# TYPE xiso_daemon_index_cache_hits_total counter\n"
+           "xiso_daemon_index_cache_hits_total %" PRIu64 "\n"
+           "# HELP xiso_daemon_index_cache_misses_total Listings that had to read the image.\n"
+           "# TYPE xiso_daemon_index_cache_misses_total counter\n"
+           "xiso_daemon_index_cache_misses_total %" PRIu64 "\n"
+           "# HELP xiso_daemon_index_cache_images Images in the index cache.\n"
+           "# TYPE xiso_daemon_index_cache_images gauge\n"
+           "xiso_daemon_index_cache_images %zu\n"
+           "# HELP xiso_daemon_index_cache_bytes Memory held by the index cache.\n"
+           "# TYPE xiso_daemon_index_cache_bytes gauge\n"
+           "xiso_daemon_index_cache_bytes %zu\n"
+           "# HELP xiso_buffer_pool_bytes Memory held by the I/O buffer pool.\n"
+           "# TYPE xiso_buffer_pool_bytes gauge\n"
+           "xiso_buffer_pool_bytes %zu\n"
+           "# HELP xiso_buffer_pool_cached_bytes Pool memory in free buffers.\n"
+           "# TYPE xiso_buffer_pool_cached_bytes gauge\n"
+           "xiso_buffer_pool_cached_bytes %zu\n"
+           "# HELP xiso_buffer_pool_limit_bytes Pool memory budget, 0 if unlimited.\n"
+           "# TYPE xiso_buffer_pool_limit_bytes gauge\n"
+           "xiso_buffer_pool_limit_bytes %zu\n"
+           "# HELP xiso_buffer_pool_allocations_total Buffers obtained from the system.\n"
+           "# TYPE xiso_buffer_pool_allocations_total counter\n"
+           "xiso_buffer_pool_allocations_total %" PRIu64 "\n"
+           "# HELP xiso_buffer_pool_checkouts_total Buffers handed out.\n"
+           "# TYPE xiso_buffer_pool_checkouts_total counter\n"
+           "xiso_buffer_pool_checkouts_total %" PRIu64 "\n"
+           "# HELP xiso_bandwidth_limit_bytes_per_second Throttle setting, 0 if unlimited.\n"
+           "# TYPE xiso_bandwidth_limit_bytes_per_second gauge\n"
+           "xiso_bandwidth_limit_bytes_per_second{direction=\"read\"} %" PRIu64 "\n"
+           "xiso_bandwidth_limit_bytes_per_second{direction=\"write\"} %" PRIu64 "\n",
+           running, admitted - running, opts.max_jobs, LOAD(metrics.connections),
+           LOAD(metrics.bytes_extracted), LOAD(metrics.cache_hits), LOAD(metrics.cache_misses),
+           cached_count, cached_bytes, pool.bytes_allocated, pool.bytes_cached, pool.limit,
+           pool.allocations, pool.checkouts, read_limit, write_limit);
+    return text;
+}
+
+// Jobs
+
+typedef struct {
+    Connection* conn;
+    XisoCancelToken* token;
+    bool report_progress;
+    bool done;
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+} Monitor;
+
+// Watches for the client going away and streams progress while a job runs
+static void* run_monitor(void* arg) {
+    Monitor* monitor = arg;
+    XisoProgress last = { 0, 0, 0, 0 };
+
+    pthread_mutex_lock(&monitor->lock);
+    while (!monitor->done) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += DAEMON_PROGRESS_MS * 1000000l;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000l;
+        deadline.tv_nsec %= 1000000000l;
+        pthread_cond_timedwait(&monitor->finished, &monitor->lock, &deadline);
+        if (monitor->done) break;
+        pthread_mutex_unlock(&monitor->lock);
+
+        struct pollfd pfd = { monitor->conn->fd, POLLIN, 0 };
+        char scratch[256];
+        if (stopping || (poll(&pfd, 1, 0) > 0 &&
+                         ((pfd.revents & (POLLHUP | POLLERR)) ||
+                          recv(monitor->conn->fd, scratch, sizeof(scratch), MSG_DONTWAIT) == 0))) {
+            xiso_cancel_token_cancel(monitor->token);
+        }
+
+        if (monitor->report_progress) {
+            XisoProgress progress;
+            xiso_get_progress(&progress);
+            if (memcmp(&progress, &last, sizeof(progress)) != 0) {
+                char values[4][24];
+                snprintf(values[0], sizeof(values[0]), "%" PRIu64, progress.files_done);
+                snprintf(values[1], sizeof(values[1]), "%" PRIu64, progress.files_total);
+                snprintf(values[2], sizeof(values[2]), "%" PRIu64, progress.bytes_done);
+                snprintf(values[3], sizeof(values[3]), "%" PRIu64, progress.bytes_total);
+                const char* fields[] = { values[0], values[1], values[2], values[3] };
+                if (put_frame(monitor->conn, 'P', fields, 4) && !flush(monitor->conn)) {
+                    xiso_cancel_token_cancel(monitor->token);
+                }
+                last = progress;
+            }
+        }
+        pthread_mutex_lock(&monitor->lock);
+    }
+    pthread_mutex_unlock(&monitor->lock);
+    return NULL;
+}
+
+static bool send_entries(Connection* conn, const XisoEntryTable* table) {
+    for (size_t i = 0; i < table->count; i++) {
+        const XisoTableEntry* entry = &table->entries[i];
+        char size[24], sector[16];
+        snprintf(size, sizeof(size), "%u", entry->size);
+        snprintf(sector, sizeof(sector), "%u", entry->start_sector);
+        const char* fields[] = { table->names + entry->path_offset, size, sector, entry->is_directory ? "d" : "f" };
+        if (!put_frame(conn, 'E', fields, 4)) return false;
+    }
+    return true;
+}
+
+static bool send_problem(const XisoCheckEntry* entry, void* user_data) {
+    static const char* const kinds[] = { "missing", "size", "content" };
+    char offset[24];
+    snprintf(offset, sizeof(offset), "%" PRIu64, entry->offset);
+    const char* fields[] = { kinds[entry->kind], entry->path, offset };
+    return put_frame(user_data, 'X', fields, 3);
+}
+
+// name.1.iso of a split set: its own stat() says nothing of the other parts
+static bool split_first_part(const char* path) {
+    size_t length = strlen(path);
+    char second[4096];
+    struct stat st;
+
+    if (length < 7 || strcasecmp(path + length - 6, ".1.iso") != 0 || length >= sizeof(second)) return false;
+    memcpy(second, path, length + 1);
+    second[length - 5] = '2';
+    return stat(second, &st) == 0;
+}
+
+static void run_job(Connection* conn, JobKind kind, char** args) {
+    CacheEntry* cached = NULL;
+    struct stat st;
+    uint64_t start = now_ns();
+    bool ok = true;
+    bool cacheable = false;
+
+    // Listings the cache can answer don't need a turn at the library. A
+    // split image has no one file to key it by, since any of its parts may
+    // be replaced, so it is listed afresh each time.
+    if (kind == JOB_LIST) {
+        cacheable = stat(args[0], &st) == 0 && !split_first_part(args[0]);
+        cached = cacheable ? cache_lookup(args[0], &st) : NULL;
+        if (cached) {
+            __atomic_add_fetch(&metrics.cache_hits, 1, __ATOMIC_RELAXED);
+            send_entries(conn, &cached->table);
+            cache_release(cached);
+            __atomic_add_fetch(&metrics.jobs[kind][RESULT_OK], 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&metrics.job_ns[kind], now_ns() - start, __ATOMIC_RELAXED);
+            send_done(conn, true, XISO_OK, NULL);
+            return;
+        }
+        __atomic_add_fetch(&metrics.cache_misses, 1, __ATOMIC_RELAXED);
+    }
+
+    XisoCancelToken* token = xiso_cancel_token_create();
+    if (!token) {
+        __atomic_add_fetch(&metrics.jobs[kind][RESULT_ERROR], 1, __ATOMIC_RELAXED);
+        send_done(conn, false, XISO_ERROR, "Failed to allocate cancel token");
+        return;
+    }
+    Monitor monitor = { conn, token, kind == JOB_EXTRACT, false };
+    pthread_mutex_init(&monitor.lock, NULL);
+    pthread_cond_init(&monitor.finished, NULL);
+
+    turn_acquire();
+    __atomic_add_fetch(&metrics.running, 1, __ATOMIC_RELAXED);
+    xiso_set_cancel_token(token);
+    pthread_t monitor_thread;
+    bool monitoring = pthread_create(&monitor_thread, NULL, run_monitor, &monitor) == 0;
+
+    // Failures of the daemon's own, which the library knows nothing of
+    const char* failure = NULL;
+    switch (kind) {
+    case JOB_LIST:
+        cached = calloc(1, sizeof(*cached));
+        if (cached && (cached->path = strdup(args[0]))) {
+            ok = xiso_load_table(args[0], &cached->table);
+        } else {
+            failure = "Out of memory";
+            ok = false;
+        }
+        break;
+    case JOB_EXTRACT:
+        ok = xiso_extract(args[0], args[1]);
+        break;
+    case JOB_VERIFY: {
+        XisoImageInfo info;
+        ok = xiso_verify(args[0], &info);
+        break;
+    }
+    case JOB_VERIFY_EXTRACTED:
+        ok = xiso_verify_extracted(args[0], args[1], send_problem, conn);
+        break;
+    default:
+        break;
+    }
+    XisoErrorCode code = ok ? XISO_OK : failure ? XISO_ERROR : xiso_get_last_error_code();
+    char message[1024];
+    snprintf(message, sizeof(message), "%s", ok ? "" : failure ? failure : xiso_get_last_error());
+    if (kind == JOB_EXTRACT) {
+        XisoProgress progress;
+        xiso_get_progress(&progress);
+        __atomic_add_fetch(&metrics.bytes_extracted, progress.bytes_done, __ATOMIC_RELAXED);
+    }
+
+    if (monitoring) {
+        pthread_mutex_lock(&monitor.lock);
+        monitor.done = true;
+        pthread_cond_signal(&monitor.finished);
+        pthread_mutex_unlock(&monitor.lock);
+        pthread_join(monitor_thread, NULL);
+    }
+    xiso_set_cancel_token(NULL);
+    __atomic_sub_fetch(&metrics.running, 1, __ATOMIC_RELAXED);
+    turn_release();
+    xiso_cancel_token_destroy(token);
+    pthread_cond_destroy(&monitor.finished);
+    pthread_mutex_destroy(&monitor.lock);
+
+    if (kind == JOB_LIST) {
+        if (ok && cacheable) {
+            cached->device = st.st_dev;
+            cached->inode = st.st_ino;
+            cached->size = st.st_size;
+            cached->mtime = st.st_mtim;
+            cached->bytes = sizeof(*cached) + strlen(cached->path) + cached->table.count * sizeof(XisoTableEntry) +
+                            cached->table.names_size;
+            cached = cache_insert(cached);
+            send_entries(conn, &cached->table);
+            cache_release(cached);
+        } else if (cached) {
+            if (ok) send_entries(conn, &cached->table);
+            cache_free(cached);
+        }
+    }
+
+    JobResult result = ok ? RESULT_OK : code >= XISO_ERROR_CANCELLED ? RESULT_CANCELLED : RESULT_ERROR;
+    __atomic_add_fetch(&metrics.jobs[kind][result], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&metrics.job_ns[kind], now_ns() - start, __ATOMIC_RELAXED);
+    send_done(conn, ok, code, message);
+}
+
+static void serve_http(Connection* conn) {
+    char request[4096];
+    size_t length = 4;
+
+    // Read the rest of the request head so the client sees a clean reply
+    memcpy(request, "GET ", 4);
+    while (length < sizeof(request) - 1) {
+        ssize_t n = recv(conn->fd, request + length, sizeof(request) - 1 - length, 0);
+        if (n <= 0) break;
+        length += (size_t)n;
+        request[length] = '\0';
+        if (strstr(request, "\r\n\r\n")) break;
+    }
+
+    char* text = render_metrics();
+    char header[160];
+    int n = snprintf(header, sizeof(header),
+                     "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n",
+                     text ? strlen(text) : 0);
+    send(conn->fd, header, (size_t)n, MSG_NOSIGNAL);
+    if (text) send(conn->fd, text, strlen(text), MSG_NOSIGNAL);
+    free(text);
+}
+
+static void serve(Connection* conn) {
+    uint8_t header[5];
+    char* fields[DAEMON_MAX_FIELDS];
+    size_t count = 0;
+
+    if (!read_exact(conn->fd, header, 4)) return;
+    if (memcmp(header, "GET ", 4) == 0) {
+        serve_http(conn);
+        return;
+    }
+
+    uint32_t length = header[0] | header[1] << 8 | header[2] << 16 | (uint32_t)header[3] << 24;
+    if (length > DAEMON_MAX_REQUEST || !read_exact(conn->fd, header + 4, 1) || header[4] != 'Q') {
+        send_done(conn, false, XISO_ERROR, "Malformed request");
+        return;
+    }
+    char* payload = malloc(length + 1);
+    if (!payload || !read_exact(conn->fd, payload, length)) {
+        free(payload);
+        return;
+    }
+    payload[length] = '\0';
+    for (char* p = payload; p < payload + length && count < DAEMON_MAX_FIELDS; p += strlen(p) + 1) {
+        fields[count++] = p;
+    }
+
+    static const struct {
+        const char* name;
+        int kind;
+        size_t args;
+    } commands[] = {
+        { "list", JOB_LIST, 1 },
+        { "extract", JOB_EXTRACT, 2 },
+        { "verify", JOB_VERIFY, 1 },
+        { "verify-extracted", JOB_VERIFY_EXTRACTED, 2 },
+        { "limit", -1, 2 },
+        { "metrics", -2, 0 },
+    };
+    int index = -1;
+    for (size_t i = 0; count > 0 && i < sizeof(commands) / sizeof(commands[0]); i++) {
+        if (strcmp(fields[0], commands[i].name) == 0 && count - 1 == commands[i].args) index = (int)i;
+    }
+
+    if (index < 0) {
+        send_done(conn, false, XISO_ERROR, "Unknown command or wrong number of arguments");
+    } else if (commands[index].kind == -1) {
+        // Applies straight away, including to the job running now
+        xiso_set_bandwidth_limit(strtoull(fields[1], NULL, 10), strtoull(fields[2], NULL, 10));
+        send_done(conn, true, XISO_OK, NULL);
+    } else if (commands[index].kind == -2) {
+        char* text = render_metrics();
+        const char* text_fields[] = { text ? text : "" };
+        put_frame(conn, 'T', text_fields, 1);
+        free(text);
+        send_done(conn, true, XISO_OK, NULL);
+    } else {
+        JobKind kind = (JobKind)commands[index].kind;
+        unsigned admitted = __atomic_add_fetch(&metrics.admitted, 1, __ATOMIC_RELAXED);
+        if (admitted > opts.max_jobs) {
+            __atomic_add_fetch(&metrics.jobs[kind][RESULT_REJECTED], 1, __ATOMIC_RELAXED);
+            send_done(conn, false, XISO_ERROR, "Too many jobs, try again later");
+        } else {
+            run_job(conn, kind, fields + 1);
+        }
+        __atomic_sub_fetch(&metrics.admitted, 1, __ATOMIC_RELAXED);
+    }
+    free(payload);
+}
+
+static void* run_connection(void* arg) {
+    Connection* conn = arg;
+
+    serve(conn);
+    close(conn->fd);
+    pthread_mutex_destroy(&conn->lock);
+    free(conn->out);
+    free(conn);
+    __atomic_sub_fetch(&metrics.open_connections, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+static void handle_signal(int signal) {
+    (void)signal;
+    stopping = 1;
+}
+
+static bool parse_size(const char* text, size_t* out) {
+    char* end;
+    unsigned long long value = strtoull(text, &end, 10);
+
+    if (end == text) return false;
+    switch (*end) {
+    case 'k': case 'K': value <<= 10; end++; break;
+    case 'm': case 'M': value <<= 20; end++; break;
+    case 'g': case 'G': value <<= 30; end++; break;
+    }
+    if (*end || value == 0) return false;
+
+    *out = (size_t)value;
+    return true;
+}
+
+static void usage(FILE* out, const char* program) {
+    fprintf(out,
+        "Usage: %s [options]\n"
+        "\n"
+        "Runs list, extract and verify jobs sent over a Unix socket.\n"
+        "\n"
+        "Options:\n"
+        "  -s, --socket PATH      Socket to listen on (default: /tmp/xiso.sock)\n"
+        "  -J, --max-jobs N       Jobs admitted at once, running or waiting (default: 16)\n"
+        "  -j, --threads N        Worker threads per job (default: 1)\n"
+        "  -m, --memory SIZE      Cap on I/O buffer memory, e.g. 256M (default: unlimited)\n"
+        "  -c, --cache SIZE       Memory for cached directory indexes (default: 64M)\n"
+        "  -v, --verbose          Print library debug output\n"
+        "  -h, --help             Show this help\n",
+        program);
+}
+
+int main(int argc, char** argv) {
+    static const struct option long_options[] = {
+        { "socket", required_argument, NULL, 's' },
+        { "max-jobs", required_argument, NULL, 'J' },
+        { "threads", required_argument, NULL, 'j' },
+        { "memory", required_argument, NULL, 'm' },
+        { "cache", required_argument, NULL, 'c' },
+        { "verbose", no_argument, NULL, 'v' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    bool verbose = false;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "s:J:j:m:c:vh", long_options, NULL)) != -1) {
+        switch (c) {
+        case 's':
+            opts.socket_path = optarg;
+            break;
+        case 'J':
+        case 'j': {
+            unsigned value = (unsigned)strtoul(optarg, NULL, 10);
+            if (value == 0) {
+                fprintf(stderr, "Invalid count: %s\n", optarg);
+                return 2;
+            }
+            if (c == 'J') opts.max_jobs = value;
+            else opts.threads = value;
+            break;
+        }
+        case 'm':
+        case 'c':
+            if (!parse_size(optarg, c == 'm' ? &opts.memory : &opts.cache_budget)) {
+                fprintf(stderr, "Invalid size: %s\n", optarg);
+                return 2;
+            }
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        case 'h':
+            usage(stdout, argv[0]);
+            return 0;
+        default:
+            usage(stderr, argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc) {
+        usage(stderr, argv[0]);
+        return 2;
+    }
+
+    xiso_set_debug(verbose);
+    xiso_set_threads(opts.threads);
+    xiso_set_keep_workers(true);
+    xiso_set_buffer_pool_limit(opts.memory);
+    if (!xiso_init()) {
+        fprintf(stderr, "Failed to initialize: %s\n", xiso_get_last_error());
+        return 1;
+    }
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(opts.socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", opts.socket_path);
+        return 2;
+    }
+    strcpy(address.sun_path, opts.socket_path);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(opts.socket_path);
+    if (listen_fd == -1 || bind(listen_fd, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(listen_fd, 64) != 0) {
+        fprintf(stderr, "Failed to listen on %s (%s)\n", opts.socket_path, strerror(errno));
+        return 1;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    fprintf(stderr, "Listening on %s\n", opts.socket_path);
+    while (!stopping) {
+        struct pollfd pfd = { listen_fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 500) <= 0) continue;
+
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd == -1) continue;
+        if (__atomic_add_fetch(&metrics.open_connections, 1, __ATOMIC_RELAXED) > DAEMON_MAX_CONNECTIONS) {
+            __atomic_sub_fetch(&metrics.open_connections, 1, __ATOMIC_RELAXED);
+            close(fd);
+            continue;
+        }
+        __atomic_add_fetch(&metrics.connections, 1, __ATOMIC_RELAXED);
+
+        Connection* conn = calloc(1, sizeof(*conn));
+        pthread_t thread;
+        pthread_attr_t attr;
+        if (conn && (conn->out = malloc(DAEMON_OUT_BUFFER))) {
+            conn->fd = fd;
+            pthread_mutex_init(&conn->lock, NULL);
+            pthread_attr_init(&attr);
+            pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+            bool started = pthread_create(&thread, &attr, run_connection, conn) == 0;
+            pthread_attr_destroy(&attr);
+            if (started) continue;
+            pthread_mutex_destroy(&conn->lock);
+        }
+        if (conn) free(conn->out);
+        free(conn);
+        close(fd);
+        __atomic_sub_fetch(&metrics.open_connections, 1, __ATOMIC_RELAXED);
+    }
+
+    // Running jobs see the flag through their monitor and stop
+    fprintf(stderr, "Shutting down\n");
+    close(listen_fd);
+    unlink(opts.socket_path);
+    xiso_cancel();
+    turn_acquire();
+    xiso_cleanup();
+    return 0;
+}
@@ -0,0 +1,461 @@
+#include "xiso_internal.h"
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// Image hashing reads chunks of this size; each hasher may fall this many
+// chunks behind the reader before it blocks
+#define HASH_CHUNK_SIZE  (4 * 1024 * 1024)
+#define HASH_QUEUE_DEPTH 8
+
+typedef struct {
+    char* game;
+    char* rom;
+    uint64_t size;
+    uint32_t crc32;
+    uint8_t md5[16];
+    uint8_t sha1[20];
+    bool has_md5;
+    bool has_sha1;
+} DatEntry;
+
+// Entries from every loaded DAT, indexed by (size, CRC-32) and by file
+// name. Slots hold the entry index + 1.
+static DatEntry* dat_entries = NULL;
+static size_t dat_count = 0;
+static size_t dat_capacity = 0;
+static size_t* digest_slots = NULL;
+static size_t* name_slots = NULL;
+static size_t dat_slot_count = 0;
+
+static uint64_t digest_key(uint64_t size, uint32_t crc32) {
+    uint64_t key[2] = { size, crc32 };
+    return hash64(key, sizeof(key));
+}
+
+static uint64_t name_key(const char* name) {
+    Hash64 state;
+    hash64_init(&state);
+    for (; *name; name++) {
+        char c = (char)tolower((unsigned char)*name);
+        hash64_update(&state, &c, 1);
+    }
+    return hash64_final(&state);
+}
+
+static void index_entry(size_t index) {
+    const DatEntry* entry = &dat_entries[index];
+    size_t mask = dat_slot_count - 1;
+
+    size_t slot = digest_key(entry->size, entry->crc32) & mask;
+    while (digest_slots[slot]) slot = (slot + 1) & mask;
+    digest_slots[slot] = index + 1;
+
+    slot = name_key(entry->rom) & mask;
+    while (name_slots[slot]) slot = (slot + 1) & mask;
+    name_slots[slot] = index + 1;
+}
+
+static bool reindex(size_t slot_count) {
+    size_t* digests = calloc(slot_count, sizeof(size_t));
+    size_t* names = calloc(slot_count, sizeof(size_t));
+    if (!digests || !names) {
+        free(digests);
+        free(names);
+        set_error("Failed to allocate DAT index");
+        return false;
+    }
+
+    free(digest_slots);
+    free(name_slots);
+    digest_slots = digests;
+    name_slots = names;
+    dat_slot_count = slot_count;
+    for (size_t i = 0; i < dat_count; i++) {
+        index_entry(i);
+    }
+    return true;
+}
+
+static bool add_entry(const DatEntry* entry) {
+    if ((dat_count + 1) * 2 > dat_slot_count &&
+        !reindex(dat_slot_count ? dat_slot_count * 2 : 4096)) {
+        return false;
+    }
+    if (dat_count == dat_capacity) {
+        size_t capacity = dat_capacity ? dat_capacity * 2 : 1024;
+        DatEntry* grown = realloc(dat_entries, capacity * sizeof(DatEntry));
+        if (!grown) {
+            set_error("Failed to allocate DAT entries");
+            return false;
+        }
+        dat_entries = grown;
+        dat_capacity = capacity;
+    }
+
+    dat_entries[dat_count] = *entry;
+    index_entry(dat_count++);
+    return true;
+}
+
+// XML parsing, just enough for Logiqx DATs: <game name="..."> (or
+// <machine>) around <rom name="..." size="..." crc="..." md5="..." sha1="..."/>
+
+static char* decode_entities(const char* text, size_t length) {
+    static const struct { const char* name; char c; } entities[] = {
+        { "&amp;", '&' }, { "&lt;", '<' }, { "&gt;", '>' }, { "&quot;", '"' }, { "&apos;", '\'' },
+    };
+    char* out = malloc(length + 1);
+    size_t n = 0;
+
+    if (!out) return NULL;
+    for (size_t i = 0; i < length; i++) {
+        out[n] = text[i];
+        if (text[i] == '&') {
+            for (size_t e = 0; e < sizeof(entities) / sizeof(entities[0]); e++) {
+                size_t entity_length = strlen(entities[e].name);
+                if (length - i >= entity_length && memcmp(text + i, entities[e].name, entity_length) == 0) {
+                    out[n] = entities[e].c;
+                    i += entity_length - 1;
+                    break;
+                }
+            }
+        }
+        n++;
+    }
+    out[n] = '\0';
+    return out;
+}
+
+// Finds attribute name in the tag between start and end
+static bool find_attribute(const char* start, const char* end, const char* name,
+                           const char** value, size_t* length) {
+    size_t name_length = strlen(name);
+    const char* p = start;
+
+    while (p < end) {
+        while (p < end && isspace((unsigned char)*p)) p++;
+        const char* key = p;
+        while (p < end && *p != '=' && !isspace((unsigned char)*p)) p++;
+        size_t key_length = p - key;
+        while (p < end && isspace((unsigned char)*p)) p++;
+        if (p >= end || *p != '=') {
+            if (p == key) p++;
+            continue;
+        }
+        p++;
+        while (p < end && isspace((unsigned char)*p)) p++;
+        if (p >= end || (*p != '"' && *p != '\'')) continue;
+
+        char quote = *p++;
+        const char* text = p;
+        while (p < end && *p != quote) p++;
+        if (key_length == name_length && memcmp(key, name, name_length) == 0) {
+            *value = text;
+            *length = p - text;
+            return true;
+        }
+        p++;
+    }
+    return false;
+}
+
+static bool parse_hex(const char* text, size_t length, uint8_t* out, size_t bytes) {
+    if (length != bytes * 2) return false;
+    for (size_t i = 0; i < bytes; i++) {
+        char pair[3] = { text[i * 2], text[i * 2 + 1], '\0' };
+        if (!isxdigit((unsigned char)pair[0]) || !isxdigit((unsigned char)pair[1])) return false;
+        out[i] = (uint8_t)strtoul(pair, NULL, 16);
+    }
+    return true;
+}
+
+// Adds one <rom> tag; roms without a size and CRC can't be matched and are skipped
+static bool parse_rom(const char* start, const char* end, const char* game, size_t* added) {
+    DatEntry entry = { 0 };
+    const char* value;
+    size_t length;
+    uint8_t crc[4];
+
+    if (!find_attribute(start, end, "name", &value, &length)) return true;
+    const char* name = value;
+    size_t name_length = length;
+
+    if (!find_attribute(start, end, "size", &value, &length)) return true;
+    entry.size = strtoull(value, NULL, 10);
+    if (!find_attribute(start, end, "crc", &value, &length) || !parse_hex(value, length, crc, 4)) {
+        return true;
+    }
+    entry.crc32 = (uint32_t)crc[0] << 24 | (uint32_t)crc[1] << 16 | (uint32_t)crc[2] << 8 | crc[3];
+    entry.has_md5 = find_attribute(start, end, "md5", &value, &length) &&
+                    parse_hex(value, length, entry.md5, sizeof(entry.md5));
+    entry.has_sha1 = find_attribute(start, end, "sha1", &value, &length) &&
+                     parse_hex(value, length, entry.sha1, sizeof(entry.sha1));
+
+    entry.rom = decode_entities(name, name_length);
+    entry.game = strdup(game ? game : "");
+    if (!entry.rom || !entry.game || !add_entry(&entry)) {
+        free(entry.rom);
+        free(entry.game);
+        set_error("Failed to allocate DAT entry");
+        return false;
+    }
+    (*added)++;
+    return true;
+}
+
+static bool parse_dat(const char* text, size_t text_length, size_t* added) {
+    const char* p = text;
+    const char* end = text + text_length;
+    char* game = NULL;
+    bool ok = true;
+
+    while (ok && (p = memchr(p, '<', end - p)) != NULL) {
+        const char* tag = ++p;
+        const char* close = memchr(p, '>', end - p);
+        if (!close) break;
+        p = close + 1;
+
+        const char* name_end = tag;
+        while (name_end < close && !isspace((unsigned char)*name_end) && *name_end != '/') name_end++;
+        size_t name_length = name_end - tag;
+
+        if ((name_length == 4 && memcmp(tag, "game", 4) == 0) ||
+            (name_length == 7 && memcmp(tag, "machine", 7) == 0)) {
+            const char* value;
+            size_t length;
+            free(game);
+            game = find_attribute(name_end, close, "name", &value, &length)
+                 ? decode_entities(value, length) : NULL;
+        } else if (name_length == 3 && memcmp(tag, "rom", 3) == 0) {
+            ok = parse_rom(name_end, close, game, added);
+        }
+    }
+
+    free(game);
+    return ok;
+}
+
+bool xiso_load_dat(const char* dat_path) {
+    struct stat st;
+    operation_begin();
+    int fd = io_open(dat_path, O_RDONLY | O_BINARY, 0);
+
+    if (fd == -1 || fstat(fd, &st) != 0) {
+        set_error("Failed to open DAT: %s (%s)", dat_path, strerror(errno));
+        if (fd != -1) close(fd);
+        return false;
+    }
+
+    char* text = malloc((size_t)st.st_size + 1);
+    size_t length = 0;
+    if (!text) {
+        set_error("Failed to allocate DAT buffer");
+        close(fd);
+        return false;
+    }
+    while (length < (size_t)st.st_size) {
+        ssize_t n = io_read(fd, text + length, (size_t)st.st_size - length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        length += n;
+    }
+    close(fd);
+    text[length] = '\0';
+
+    size_t added = 0;
+    bool ok = parse_dat(text, length, &added);
+    free(text);
+    if (ok && added == 0) {
+        set_error("No entries found in DAT: %s", dat_path);
+        ok = false;
+    }
+    DEBUG_PRINT("Loaded %zu DAT entries from %s\n", added, dat_path);
+    return ok;
+}
+
+void xiso_clear_dat(void) {
+    for (size_t i = 0; i < dat_count; i++) {
+        free(dat_entries[i].game);
+        free(dat_entries[i].rom);
+    }
+    free(dat_entries);
+    free(digest_slots);
+    free(name_slots);
+    dat_entries = NULL;
+    digest_slots = name_slots = NULL;
+    dat_count = dat_capacity = dat_slot_count = 0;
+}
+
+static bool digest_matches(const DatEntry* entry, const XisoDigest* digest) {
+    return entry->size == digest->size && entry->crc32 == digest->crc32 &&
+           (!entry->has_md5 || memcmp(entry->md5, digest->md5, sizeof(entry->md5)) == 0) &&
+           (!entry->has_sha1 || memcmp(entry->sha1, digest->sha1, sizeof(entry->sha1)) == 0);
+}
+
+void xiso_match_dat(const char* iso_path, const XisoDigest* digest, XisoDatMatch* match) {
+    match->status = XISO_DAT_UNKNOWN;
+    match->game = NULL;
+    match->rom = NULL;
+    if (!dat_count) return;
+
+    size_t mask = dat_slot_count - 1;
+    for (size_t slot = digest_key(digest->size, digest->crc32) & mask; digest_slots[slot];
+         slot = (slot + 1) & mask) {
+        const DatEntry* entry = &dat_entries[digest_slots[slot] - 1];
+        if (digest_matches(entry, digest)) {
+            match->status = XISO_DAT_MATCH;
+            match->game = entry->game;
+            match->rom = entry->rom;
+            return;
+        }
+    }
+
+    // A listed name with other contents is a bad or modified dump
+    const char* base = strrchr(iso_path, '/');
+    base = base ? base + 1 : iso_path;
+    for (size_t slot = name_key(base) & mask; name_slots[slot]; slot = (slot + 1) & mask) {
+        const DatEntry* entry = &dat_entries[name_slots[slot] - 1];
+        if (strcasecmp(entry->rom, base) == 0) {
+            match->status = XISO_DAT_MISMATCH;
+            match->game = entry->game;
+            match->rom = entry->rom;
+            return;
+        }
+    }
+}
+
+// Image hashing. The calling thread reads; CRC-32, MD5 and SHA-1 each run
+// on a single-thread queue, so every hasher sees the chunks in order.
+
+typedef struct {
+    uint32_t crc32;
+    DigestState md5;
+    DigestState sha1;
+} HashRun;
+
+typedef struct {
+    HashRun* run;
+    uint8_t* data;
+    size_t length;
+    int refs;
+} HashChunk;
+
+static void chunk_release(HashChunk* chunk) {
+    if (__atomic_sub_fetch(&chunk->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        pool_release(chunk->data, HASH_CHUNK_SIZE);
+        free(chunk);
+    }
+}
+
+static void run_crc32(void* arg) {
+    HashChunk* chunk = arg;
+    uint64_t span = trace_begin();
+    chunk->run->crc32 = crc32_update(chunk->run->crc32, chunk->data, chunk->length);
+    trace_end(span, "crc32", NULL);
+    chunk_release(chunk);
+}
+
+static void run_md5(void* arg) {
+    HashChunk* chunk = arg;
+    uint64_t span = trace_begin();
+    md5_update(&chunk->run->md5, chunk->data, chunk->length);
+    trace_end(span, "md5", NULL);
+    chunk_release(chunk);
+}
+
+static void run_sha1(void* arg) {
+    HashChunk* chunk = arg;
+    uint64_t span = trace_begin();
+    sha1_update(&chunk->run->sha1, chunk->data, chunk->length);
+    trace_end(span, "sha1", NULL);
+    chunk_release(chunk);
+}
+
+bool xiso_hash_image(const char* iso_path, XisoDigest* digest) {
+    static const JobFunc hashers[] = { run_crc32, run_md5, run_sha1 };
+    static const char* const names[] = { "crc32", "md5", "sha1" };
+    enum { NUM_HASHERS = sizeof(hashers) / sizeof(hashers[0]) };
+    JobQueue* queues[NUM_HASHERS] = { NULL };
+    HashRun run = { 0 };
+    bool ok = true;
+
+    stats_reset();
+    operation_begin();
+    memset(digest, 0, sizeof(*digest));
+
+    int fd = image_open(iso_path, O_RDONLY | O_BINARY);
+    if (fd == -1) {
+        set_error("Failed to open image: %s (%s)", iso_path, strerror(errno));
+        return false;
+    }
+#if defined(POSIX_FADV_SEQUENTIAL)
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    for (unsigned i = 0; i < NUM_HASHERS && ok; i++) {
+        queues[i] = jobs_create(1, HASH_QUEUE_DEPTH, names[i]);
+        ok = queues[i] != NULL;
+    }
+    md5_init(&run.md5);
+    sha1_init(&run.sha1);
+
+    while (ok) {
+        if (operation_cancelled()) {
+            ok = false;
+            break;
+        }
+
+        HashChunk* chunk = malloc(sizeof(*chunk));
+        uint8_t* data = pool_acquire(HASH_CHUNK_SIZE);
+        if (!chunk || !data) {
+            free(chunk);
+            if (data) pool_release(data, HASH_CHUNK_SIZE);
+            set_error("Failed to allocate hash buffer");
+            ok = false;
+            break;
+        }
+
+        // Fill the whole chunk so only the last one is short
+        size_t length = 0;
+        uint64_t span = trace_begin();
+        while (length < HASH_CHUNK_SIZE) {
+            ssize_t n = io_read(fd, data + length, HASH_CHUNK_SIZE - length);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) {
+                set_error("Failed to read image: %s (%s)", iso_path, strerror(errno));
+                ok = false;
+            }
+            if (n <= 0) break;
+            length += n;
+        }
+        trace_end(span, "read", NULL);
+
+        if (!ok || length == 0) {
+            pool_release(data, HASH_CHUNK_SIZE);
+            free(chunk);
+            break;
+        }
+        digest->size += length;
+
+        *chunk = (HashChunk){ &run, data, length, NUM_HASHERS };
+        for (unsigned i = 0; i < NUM_HASHERS; i++) {
+            jobs_submit(queues[i], hashers[i], chunk);
+        }
+    }
+
+    for (unsigned i = 0; i < NUM_HASHERS; i++) {
+        if (!queues[i]) continue;
+        jobs_wait(queues[i]);
+        jobs_destroy(queues[i]);
+    }
+    image_close(fd);
+    if (!ok) return false;
+
+    digest->crc32 = run.crc32;
+    md5_final(&run.md5, digest->md5);
+    sha1_final(&run.sha1, digest->sha1);
+    return true;
+}
@@ -0,0 +1,753 @@
+#include "xiso_internal.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// Patch layout: magic, u64 source size, u64 target size, then ops writing
+// the target front to back until PATCH_END. Each op is a u8 type and a u64
+// length; COPY adds the u64 source offset and the XXH64 of the bytes, so a
+// patch applied to the wrong source image fails instead of producing a
+// corrupt target. DATA is followed by the bytes themselves.
+#define PATCH_MAGIC        "XISOPAT1"
+#define PATCH_MAGIC_LENGTH 8
+
+enum {
+    PATCH_END = 0,
+    PATCH_COPY,
+    PATCH_DATA,
+    PATCH_ZERO,
+};
+
+// Comparison granularity, and the most one job compares
+#define DIFF_BLOCK_SIZE (64 * 1024)
+#define DIFF_PIECE_SIZE (32 * 1024 * 1024)
+
+typedef struct {
+    char* path;
+    uint64_t offset;             // absolute in the image
+    uint32_t size;
+    long match;                  // paired file in the other image, or -1
+    bool moved;
+    bool need_hash;
+    uint64_t hash;
+    long owner;                  // new image: file whose extent covers this one
+    uint64_t changed;            // new image: bytes the patch carries
+} DiffFile;
+
+typedef struct {
+    DiffFile* files;
+    size_t count;
+    size_t capacity;
+    uint64_t partition_offset;
+    uint64_t size;
+    int fd;
+} DiffImage;
+
+typedef struct {
+    uint8_t type;
+    uint64_t length;
+    uint64_t source_offset;
+    uint64_t hash;
+} PatchOp;
+
+typedef struct Diff Diff;
+
+// A stretch of the new image compared block by block against source_length
+// bytes of the old image at source_offset
+typedef struct {
+    Diff* diff;
+    uint64_t target_offset;
+    uint64_t length;
+    uint64_t source_offset;
+    uint64_t source_length;
+    long file;                   // new file index, or -1 between files
+    PatchOp* ops;
+    size_t op_count;
+    size_t op_capacity;
+    uint64_t changed;
+} DiffPiece;
+
+struct Diff {
+    DiffImage old_image;
+    DiffImage new_image;
+    DiffPiece* pieces;
+    size_t piece_count;
+    size_t piece_capacity;
+    bool failed;
+};
+
+static bool collect_file(const XisoEntryInfo* entry, void* user_data) {
+    DiffImage* image = user_data;
+
+    if (entry->is_directory) return true;
+    if (image->count == image->capacity) {
+        size_t capacity = image->capacity ? image->capacity * 2 : 256;
+        DiffFile* grown = realloc(image->files, capacity * sizeof(DiffFile));
+        if (!grown) {
+            set_error("Failed to allocate file list");
+            return false;
+        }
+        image->files = grown;
+        image->capacity = capacity;
+    }
+
+    DiffFile* file = &image->files[image->count];
+    memset(file, 0, sizeof(*file));
+    file->path = strdup(entry->path);
+    if (!file->path) {
+        set_error("Failed to allocate file list");
+        return false;
+    }
+    file->offset = image->partition_offset + (uint64_t)entry->start_sector * XISO_SECTOR_SIZE;
+    file->size = (uint32_t)entry->size;
+    file->match = -1;
+    file->owner = (long)image->count;
+    image->count++;
+    return true;
+}
+
+static bool load_image(const char* iso_path, DiffImage* image) {
+    XisoImageInfo info;
+
+    if (!xiso_stat(iso_path, &info)) return false;
+    image->partition_offset = info.partition_offset;
+    image->size = info.image_size;
+
+    if (!xiso_walk(iso_path, collect_file, image)) {
+        // set_error() can't format its own buffer into itself
+        char message[1024];
+        snprintf(message, sizeof(message), "%s", xiso_get_last_error());
+        set_error("Failed to list %s: %s", iso_path, message);
+        return false;
+    }
+
+    image->fd = image_open(iso_path, O_RDONLY | O_BINARY);
+    if (image->fd == -1) {
+        set_error("Failed to open ISO file: %s (%s)", iso_path, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+static void free_image(DiffImage* image) {
+    for (size_t i = 0; i < image->count; i++) {
+        free(image->files[i].path);
+    }
+    free(image->files);
+    if (image->fd != -1) image_close(image->fd);
+}
+
+static bool read_exact(int fd, void* buffer, size_t length, uint64_t offset) {
+    return io_pread(fd, buffer, length, offset) == (ssize_t)length;
+}
+
+static bool is_zero(const uint8_t* data, size_t length) {
+    return length == 0 || (data[0] == 0 && memcmp(data, data + 1, length - 1) == 0);
+}
+
+// Hashing, for matching moved files and checking files that share an extent
+
+typedef struct {
+    Diff* diff;
+    const DiffImage* image;
+    DiffFile* file;
+} HashJob;
+
+static void run_hash_job(void* arg) {
+    HashJob* job = arg;
+    uint8_t* buffer = pool_acquire(DIFF_BLOCK_SIZE);
+    Hash64 state;
+
+    hash64_init(&state);
+    for (uint64_t done = 0; buffer && done < job->file->size;) {
+        size_t n = job->file->size - done < DIFF_BLOCK_SIZE ? job->file->size - done : DIFF_BLOCK_SIZE;
+        if (operation_cancelled()) {
+            __atomic_store_n(&job->diff->failed, true, __ATOMIC_RELEASE);
+            break;
+        }
+        if (!read_exact(job->image->fd, buffer, n, job->file->offset + done)) {
+            set_error("Failed to read %s (%s)", job->file->path, strerror(errno));
+            __atomic_store_n(&job->diff->failed, true, __ATOMIC_RELEASE);
+            break;
+        }
+        hash64_update(&state, buffer, n);
+        done += n;
+    }
+    if (!buffer) __atomic_store_n(&job->diff->failed, true, __ATOMIC_RELEASE);
+    job->file->hash = hash64_final(&state);
+
+    if (buffer) pool_release(buffer, DIFF_BLOCK_SIZE);
+    free(job);
+}
+
+static bool submit_hashes(Diff* diff, JobQueue* workers, const DiffImage* image) {
+    for (size_t i = 0; i < image->count; i++) {
+        if (!image->files[i].need_hash) continue;
+
+        HashJob* job = malloc(sizeof(*job));
+        if (!job) {
+            set_error("Failed to allocate hash job");
+            return false;
+        }
+        job->diff = diff;
+        job->image = image;
+        job->file = &image->files[i];
+        jobs_submit(workers, run_hash_job, job);
+    }
+    return true;
+}
+
+// Block comparison
+
+static PatchOp* push_op(DiffPiece* piece, uint8_t type, uint64_t source_offset) {
+    if (piece->op_count == piece->op_capacity) {
+        size_t capacity = piece->op_capacity ? piece->op_capacity * 2 : 8;
+        PatchOp* grown = realloc(piece->ops, capacity * sizeof(PatchOp));
+        if (!grown) return NULL;
+        piece->ops = grown;
+        piece->op_capacity = capacity;
+    }
+
+    PatchOp* op = &piece->ops[piece->op_count++];
+    op->type = type;
+    op->length = 0;
+    op->source_offset = source_offset;
+    op->hash = 0;
+    return op;
+}
+
+static void run_compare_job(void* arg) {
+    DiffPiece* piece = arg;
+    Diff* diff = piece->diff;
+    uint8_t* fresh = pool_acquire(DIFF_BLOCK_SIZE);
+    uint8_t* old = pool_acquire(DIFF_BLOCK_SIZE);
+    PatchOp* op = NULL;
+    Hash64 copy_hash;
+    bool ok = fresh && old;
+
+    uint64_t span = trace_begin();
+    for (uint64_t at = 0; ok && at < piece->length;) {
+        size_t n = piece->length - at < DIFF_BLOCK_SIZE ? piece->length - at : DIFF_BLOCK_SIZE;
+        uint64_t source = piece->source_offset + at;
+        uint8_t type;
+
+        if (__atomic_load_n(&diff->failed, __ATOMIC_ACQUIRE) || operation_cancelled() ||
+            !read_exact(diff->new_image.fd, fresh, n, piece->target_offset + at)) {
+            ok = false;
+            break;
+        }
+        if (at + n <= piece->source_length) {
+            if (!read_exact(diff->old_image.fd, old, n, source)) {
+                ok = false;
+                break;
+            }
+            type = memcmp(fresh, old, n) == 0 ? PATCH_COPY : is_zero(fresh, n) ? PATCH_ZERO : PATCH_DATA;
+        } else {
+            type = is_zero(fresh, n) ? PATCH_ZERO : PATCH_DATA;
+        }
+
+        bool extends = op && op->type == type &&
+                       (type != PATCH_COPY || op->source_offset + op->length == source);
+        if (!extends) {
+            if (op && op->type == PATCH_COPY) op->hash = hash64_final(&copy_hash);
+            op = push_op(piece, type, source);
+            if (!op) {
+                ok = false;
+                break;
+            }
+            if (type == PATCH_COPY) hash64_init(&copy_hash);
+        }
+
+        op->length += n;
+        if (type == PATCH_COPY) {
+            hash64_update(&copy_hash, fresh, n);
+        } else {
+            piece->changed += n;
+        }
+        at += n;
+    }
+    if (ok && op && op->type == PATCH_COPY) op->hash = hash64_final(&copy_hash);
+    trace_end(span, "compare", NULL);
+
+    if (!ok) {
+        if (!__atomic_exchange_n(&diff->failed, true, __ATOMIC_ACQ_REL)) {
+            set_error("Failed to compare images at 0x%llx (%s)",
+                      (unsigned long long)piece->target_offset, strerror(errno));
+        }
+    }
+    if (fresh) pool_release(fresh, DIFF_BLOCK_SIZE);
+    if (old) pool_release(old, DIFF_BLOCK_SIZE);
+}
+
+static bool add_region(Diff* diff, uint64_t target, uint64_t length,
+                       uint64_t source, uint64_t source_length, long file) {
+    for (uint64_t at = 0; at < length; at += DIFF_PIECE_SIZE) {
+        if (diff->piece_count == diff->piece_capacity) {
+            size_t capacity = diff->piece_capacity ? diff->piece_capacity * 2 : 256;
+            DiffPiece* grown = realloc(diff->pieces, capacity * sizeof(DiffPiece));
+            if (!grown) {
+                set_error("Failed to allocate comparison");
+                return false;
+            }
+            diff->pieces = grown;
+            diff->piece_capacity = capacity;
+        }
+
+        DiffPiece* piece = &diff->pieces[diff->piece_count++];
+        memset(piece, 0, sizeof(*piece));
+        piece->diff = diff;
+        piece->target_offset = target + at;
+        piece->length = length - at < DIFF_PIECE_SIZE ? length - at : DIFF_PIECE_SIZE;
+        piece->source_offset = source + at;
+        piece->source_length = source_length > at ? source_length - at : 0;
+        piece->file = file;
+    }
+    return true;
+}
+
+// Pairing files between the images
+
+static const DiffImage* sort_image;
+
+static int compare_paths(const void* a, const void* b) {
+    return strcasecmp(sort_image->files[*(const long*)a].path, sort_image->files[*(const long*)b].path);
+}
+
+static int compare_offsets(const void* a, const void* b) {
+    const DiffFile* x = &sort_image->files[*(const long*)a];
+    const DiffFile* y = &sort_image->files[*(const long*)b];
+    if (x->offset != y->offset) return x->offset < y->offset ? -1 : 1;
+    return x->size < y->size ? 1 : x->size > y->size ? -1 : 0;
+}
+
+static long* sorted_index(const DiffImage* image, int (*compare)(const void*, const void*)) {
+    long* index = malloc((image->count + 1) * sizeof(long));
+    if (!index) {
+        set_error("Failed to allocate file index");
+        return NULL;
+    }
+    for (size_t i = 0; i < image->count; i++) index[i] = (long)i;
+    sort_image = image;
+    qsort(index, image->count, sizeof(long), compare);
+    return index;
+}
+
+static void match_paths(Diff* diff) {
+    DiffImage* old_image = &diff->old_image;
+    DiffImage* new_image = &diff->new_image;
+    long* by_path = sorted_index(old_image, compare_paths);
+    if (!by_path) return;
+
+    for (size_t i = 0; i < new_image->count; i++) {
+        size_t low = 0, high = old_image->count;
+        while (low < high) {
+            size_t mid = (low + high) / 2;
+            int order = strcasecmp(new_image->files[i].path, old_image->files[by_path[mid]].path);
+            if (order == 0) {
+                new_image->files[i].match = by_path[mid];
+                old_image->files[by_path[mid]].match = (long)i;
+                break;
+            }
+            if (order < 0) high = mid;
+            else low = mid + 1;
+        }
+    }
+    free(by_path);
+}
+
+// New files without a counterpart are compared by size and hash with old
+// files that lost theirs, so renames and moves become copies
+static void mark_move_candidates(Diff* diff) {
+    DiffImage* old_image = &diff->old_image;
+    DiffImage* new_image = &diff->new_image;
+
+    for (size_t i = 0; i < new_image->count; i++) {
+        DiffFile* file = &new_image->files[i];
+        if (file->match != -1 || file->size == 0 || file->owner != (long)i) continue;
+
+        for (size_t j = 0; j < old_image->count; j++) {
+            DiffFile* old = &old_image->files[j];
+            if (old->match == -1 && old->size == file->size) {
+                old->need_hash = true;
+                file->need_hash = true;
+            }
+        }
+    }
+}
+
+static void pair_moves(Diff* diff) {
+    DiffImage* old_image = &diff->old_image;
+    DiffImage* new_image = &diff->new_image;
+
+    for (size_t i = 0; i < new_image->count; i++) {
+        DiffFile* file = &new_image->files[i];
+        if (file->match != -1 || !file->need_hash) continue;
+
+        for (size_t j = 0; j < old_image->count; j++) {
+            DiffFile* old = &old_image->files[j];
+            if (old->match == -1 && old->need_hash && old->size == file->size && old->hash == file->hash) {
+                file->match = (long)j;
+                file->moved = true;
+                old->match = (long)i;
+                old->moved = true;
+                break;
+            }
+        }
+    }
+}
+
+// Splits the new image into file extents and the stretches between them.
+// Entries sharing (or overlapping) an extent are compared once, through
+// the entry that starts it.
+static bool assign_owners(Diff* diff, long** order) {
+    DiffImage* new_image = &diff->new_image;
+    uint64_t cursor = 0;
+    long last = -1;
+
+    *order = sorted_index(new_image, compare_offsets);
+    if (!*order) return false;
+
+    for (size_t k = 0; k < new_image->count; k++) {
+        long i = (*order)[k];
+        DiffFile* file = &new_image->files[i];
+        if (file->size == 0) continue;
+
+        if (file->offset < cursor && last != -1) {
+            file->owner = last;
+            // Judged by hash against its own counterpart instead
+            if (file->match != -1) {
+                file->need_hash = true;
+                diff->old_image.files[file->match].need_hash = true;
+            }
+            continue;
+        }
+        cursor = file->offset + file->size;
+        last = i;
+    }
+    return true;
+}
+
+static bool build_pieces(Diff* diff, const long* order) {
+    DiffImage* new_image = &diff->new_image;
+    uint64_t old_size = diff->old_image.size;
+    uint64_t cursor = 0;
+
+    for (size_t k = 0; k <= new_image->count; k++) {
+        DiffFile* file = k < new_image->count ? &new_image->files[order[k]] : NULL;
+        if (file && (file->size == 0 || file->owner != order[k] || file->offset >= new_image->size)) continue;
+
+        // Data between files is compared with the old image at the same offset
+        uint64_t gap_end = file ? file->offset : new_image->size;
+        if (gap_end > cursor &&
+            !add_region(diff, cursor, gap_end - cursor, cursor, old_size > cursor ? old_size - cursor : 0, -1)) {
+            return false;
+        }
+        if (!file) break;
+
+        const DiffFile* old = file->match != -1 ? &diff->old_image.files[file->match] : NULL;
+        uint64_t length = file->offset + file->size <= new_image->size ? file->size : new_image->size - file->offset;
+        if (!add_region(diff, file->offset, length, old ? old->offset : 0, old ? old->size : 0, order[k])) {
+            return false;
+        }
+        cursor = file->offset + length;
+    }
+    return true;
+}
+
+// Patch output
+
+static bool write_op_header(int fd, uint8_t type, uint64_t length) {
+    uint8_t header[9];
+    header[0] = type;
+    memcpy(header + 1, &length, 8);
+    return write_all(fd, header, sizeof(header));
+}
+
+static bool write_patch(Diff* diff, const char* patch_path) {
+    int fd = io_open(patch_path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+    if (fd == -1) {
+        set_error("Failed to create patch: %s (%s)", patch_path, strerror(errno));
+        return false;
+    }
+
+    uint8_t* buffer = pool_acquire(DIFF_BLOCK_SIZE);
+    uint8_t header[PATCH_MAGIC_LENGTH + 16];
+    memcpy(header, PATCH_MAGIC, PATCH_MAGIC_LENGTH);
+    memcpy(header + PATCH_MAGIC_LENGTH, &diff->old_image.size, 8);
+    memcpy(header + PATCH_MAGIC_LENGTH + 8, &diff->new_image.size, 8);
+    bool ok = buffer && write_all(fd, header, sizeof(header));
+
+    uint64_t span = trace_begin();
+    for (size_t p = 0; ok && p < diff->piece_count; p++) {
+        const DiffPiece* piece = &diff->pieces[p];
+        uint64_t target = piece->target_offset;
+
+        for (size_t i = 0; ok && i < piece->op_count; i++) {
+            const PatchOp* op = &piece->ops[i];
+            ok = write_op_header(fd, op->type, op->length);
+
+            if (ok && op->type == PATCH_COPY) {
+                ok = write_all(fd, &op->source_offset, 8) && write_all(fd, &op->hash, 8);
+            }
+            for (uint64_t done = 0; ok && op->type == PATCH_DATA && done < op->length;) {
+                size_t n = op->length - done < DIFF_BLOCK_SIZE ? op->length - done : DIFF_BLOCK_SIZE;
+                ok = read_exact(diff->new_image.fd, buffer, n, target + done) && write_all(fd, buffer, n);
+                done += n;
+            }
+            target += op->length;
+        }
+    }
+    ok = ok && write_op_header(fd, PATCH_END, 0);
+    trace_end(span, "write_patch", NULL);
+
+    if (!ok) set_error("Failed to write patch: %s (%s)", patch_path, strerror(errno));
+    if (close(fd) != 0 && ok) {
+        set_error("Failed to write patch: %s (%s)", patch_path, strerror(errno));
+        ok = false;
+    }
+    if (!ok) unlink(patch_path);
+    if (buffer) pool_release(buffer, DIFF_BLOCK_SIZE);
+    return ok;
+}
+
+static bool report(const Diff* diff, XisoDiffCallback callback, void* user_data) {
+    const DiffImage* old_image = &diff->old_image;
+    const DiffImage* new_image = &diff->new_image;
+    XisoDiffEntry entry;
+
+    for (size_t i = 0; i < new_image->count; i++) {
+        const DiffFile* file = &new_image->files[i];
+        const DiffFile* old = file->match != -1 ? &old_image->files[file->match] : NULL;
+        bool shared = file->owner != (long)i;
+
+        memset(&entry, 0, sizeof(entry));
+        entry.path = file->path;
+        entry.new_size = file->size;
+        entry.changed_bytes = shared ? 0 : file->changed;
+        if (!old) {
+            entry.kind = XISO_DIFF_ADDED;
+        } else {
+            entry.old_size = old->size;
+            if (file->moved) {
+                entry.kind = XISO_DIFF_MOVED;
+                entry.old_path = old->path;
+            } else if (old->size == file->size &&
+                       (shared ? old->hash == file->hash : file->changed == 0)) {
+                continue;
+            } else {
+                entry.kind = XISO_DIFF_CHANGED;
+            }
+        }
+        if (!callback(&entry, user_data)) return false;
+    }
+
+    for (size_t i = 0; i < old_image->count; i++) {
+        const DiffFile* old = &old_image->files[i];
+        if (old->match != -1) continue;
+
+        memset(&entry, 0, sizeof(entry));
+        entry.kind = XISO_DIFF_REMOVED;
+        entry.path = old->path;
+        entry.old_size = old->size;
+        if (!callback(&entry, user_data)) return false;
+    }
+    return true;
+}
+
+static bool run_phase(Diff* diff, JobQueue* workers) {
+    jobs_wait(workers);
+    return !__atomic_load_n(&diff->failed, __ATOMIC_ACQUIRE);
+}
+
+bool xiso_diff(const char* old_iso, const char* new_iso, const char* patch_path,
+               XisoDiffCallback callback, void* user_data) {
+    Diff diff;
+    long* order = NULL;
+    JobQueue* workers = NULL;
+    bool success = false;
+
+    memset(&diff, 0, sizeof(diff));
+    diff.old_image.fd = -1;
+    diff.new_image.fd = -1;
+
+    DEBUG_PRINT("Comparing %s with %s\n", old_iso, new_iso);
+    if (!load_image(old_iso, &diff.old_image) || !load_image(new_iso, &diff.new_image)) {
+        goto done;
+    }
+    stats_reset();
+    operation_begin();
+
+    workers = jobs_borrow(extract_threads, extract_threads * 4, "diff");
+    if (!workers) goto done;
+
+    match_paths(&diff);
+    if (!assign_owners(&diff, &order)) goto done;
+    mark_move_candidates(&diff);
+    if (!submit_hashes(&diff, workers, &diff.old_image) ||
+        !submit_hashes(&diff, workers, &diff.new_image) || !run_phase(&diff, workers)) {
+        goto done;
+    }
+    pair_moves(&diff);
+
+    if (!build_pieces(&diff, order)) goto done;
+    for (size_t p = 0; p < diff.piece_count; p++) {
+        jobs_submit(workers, run_compare_job, &diff.pieces[p]);
+    }
+    if (!run_phase(&diff, workers)) goto done;
+
+    for (size_t p = 0; p < diff.piece_count; p++) {
+        if (diff.pieces[p].file != -1) {
+            diff.new_image.files[diff.pieces[p].file].changed += diff.pieces[p].changed;
+        }
+    }
+
+    if (patch_path && !write_patch(&diff, patch_path)) goto done;
+    if (callback && !report(&diff, callback, user_data)) {
+        set_error("Diff stopped by callback");
+        goto done;
+    }
+    success = true;
+
+done:
+    jobs_return(workers);
+    for (size_t p = 0; p < diff.piece_count; p++) {
+        free(diff.pieces[p].ops);
+    }
+    free(diff.pieces);
+    free(order);
+    free_image(&diff.old_image);
+    free_image(&diff.new_image);
+    DEBUG_PRINT("Diff %s\n", success ? "completed successfully" : "failed");
+    return success;
+}
+
+// Applying a patch
+
+static bool read_patch(FILE* patch, void* data, size_t length) {
+    if (fread(data, 1, length, patch) != length) {
+        set_error("Patch is truncated or unreadable");
+        return false;
+    }
+    return true;
+}
+
+static bool apply_op(FILE* patch, int source_fd, int out_fd, uint8_t type, uint64_t length, uint8_t* buffer) {
+    uint64_t source_offset = 0, expected = 0;
+    Hash64 state;
+
+    if (type == PATCH_COPY) {
+        if (!read_patch(patch, &source_offset, 8) || !read_patch(patch, &expected, 8)) return false;
+        hash64_init(&state);
+    }
+
+    for (uint64_t done = 0; done < length;) {
+        size_t n = length - done < DIFF_BLOCK_SIZE ? length - done : DIFF_BLOCK_SIZE;
+
+        if (type == PATCH_COPY) {
+            if (!read_exact(source_fd, buffer, n, source_offset + done)) {
+                set_error("Failed to read source image at 0x%llx", (unsigned long long)(source_offset + done));
+                return false;
+            }
+            hash64_update(&state, buffer, n);
+        } else if (type == PATCH_DATA) {
+            if (!read_patch(patch, buffer, n)) return false;
+        } else {
+            memset(buffer, 0, n);
+        }
+
+        if (!write_all(out_fd, buffer, n)) {
+            set_error("Failed to write image (%s)", strerror(errno));
+            return false;
+        }
+        done += n;
+    }
+
+    if (type == PATCH_COPY && hash64_final(&state) != expected) {
+        set_error("Source image does not match the patch at 0x%llx", (unsigned long long)source_offset);
+        return false;
+    }
+    return true;
+}
+
+bool xiso_apply_patch(const char* old_iso, const char* patch_path, int out_fd) {
+    struct stat st;
+    uint8_t header[PATCH_MAGIC_LENGTH + 16];
+    uint64_t source_size, target_size, written = 0;
+
+    DEBUG_PRINT("Applying %s to %s\n", patch_path, old_iso);
+    stats_reset();
+    operation_begin();
+
+    if (!initialized) {
+        set_error("XISO not initialized");
+        return false;
+    }
+
+    FILE* patch = fopen(patch_path, "rb");
+    if (!patch) {
+        set_error("Failed to open patch: %s (%s)", patch_path, strerror(errno));
+        return false;
+    }
+    int source_fd = image_open(old_iso, O_RDONLY | O_BINARY);
+    if (source_fd == -1 || image_fstat(source_fd, &st) != 0) {
+        set_error("Failed to open ISO file: %s (%s)", old_iso, strerror(errno));
+        if (source_fd != -1) image_close(source_fd);
+        fclose(patch);
+        return false;
+    }
+
+    uint8_t* buffer = pool_acquire(DIFF_BLOCK_SIZE);
+    bool ok = buffer && read_patch(patch, header, sizeof(header));
+    if (ok && memcmp(header, PATCH_MAGIC, PATCH_MAGIC_LENGTH) != 0) {
+        set_error("Not an xiso patch: %s", patch_path);
+        ok = false;
+    }
+    if (ok) {
+        memcpy(&source_size, header + PATCH_MAGIC_LENGTH, 8);
+        memcpy(&target_size, header + PATCH_MAGIC_LENGTH + 8, 8);
+        if ((uint64_t)st.st_size != source_size) {
+            set_error("Patch was made for a %llu byte image, %s is %llu bytes",
+                      (unsigned long long)source_size, old_iso, (unsigned long long)st.st_size);
+            ok = false;
+        }
+    }
+
+    uint64_t span = trace_begin();
+    while (ok) {
+        uint8_t op[9];
+        uint64_t length;
+
+        if (operation_cancelled()) {
+            ok = false;
+            break;
+        }
+        if (!read_patch(patch, op, sizeof(op))) {
+            ok = false;
+            break;
+        }
+        memcpy(&length, op + 1, 8);
+        if (op[0] == PATCH_END) break;
+        if (op[0] > PATCH_ZERO || length > target_size - written) {
+            set_error("Corrupt patch at op %u", op[0]);
+            ok = false;
+            break;
+        }
+
+        ok = apply_op(patch, source_fd, out_fd, op[0], length, buffer);
+        written += length;
+    }
+    trace_end(span, "apply_patch", NULL);
+
+    if (ok && written != target_size) {
+        set_error("Patch is truncated: wrote %llu of %llu bytes",
+                  (unsigned long long)written, (unsigned long long)target_size);
+        ok = false;
+    }
+
+    if (buffer) pool_release(buffer, DIFF_BLOCK_SIZE);
+    image_close(source_fd);
+    fclose(patch);
+    DEBUG_PRINT("Patch %s\n", ok ? "applied successfully" : "failed");
+    return ok;
+}
@@ -0,0 +1,397 @@
+#include "xiso_internal.h"
+#include <pthread.h>
+#include <string.h>
+
+// XXH64, streamed. Matches the reference implementation for any split of
+// the input across hash64_update() calls.
+#define PRIME64_1 0x9E3779B185EBCA87ull
+#define PRIME64_2 0xC2B2AE3D27D4EB4Full
+#define PRIME64_3 0x165667B19E3779F9ull
+#define PRIME64_4 0x85EBCA77C2B2AE63ull
+#define PRIME64_5 0x27D4EB2F165667C5ull
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t value) {
+    acc ^= xxh_round(0, value);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+void hash64_init(Hash64* state) {
+    memset(state, 0, sizeof(*state));
+    state->v[0] = PRIME64_1 + PRIME64_2;
+    state->v[1] = PRIME64_2;
+    state->v[2] = 0;
+    state->v[3] = 0 - PRIME64_1;
+}
+
+void hash64_update(Hash64* state, const void* data, size_t length) {
+    const uint8_t* p = data;
+    const uint8_t* end = p + length;
+
+    state->total += length;
+
+    if (state->fill + length < sizeof(state->stripe)) {
+        memcpy(state->stripe + state->fill, p, length);
+        state->fill += length;
+        return;
+    }
+
+    if (state->fill) {
+        size_t n = sizeof(state->stripe) - state->fill;
+        memcpy(state->stripe + state->fill, p, n);
+        p += n;
+        for (int i = 0; i < 4; i++) {
+            state->v[i] = xxh_round(state->v[i], read64(state->stripe + i * 8));
+        }
+        state->fill = 0;
+    }
+
+    while (end - p >= 32) {
+        for (int i = 0; i < 4; i++) {
+            state->v[i] = xxh_round(state->v[i], read64(p + i * 8));
+        }
+        p += 32;
+    }
+
+    state->fill = end - p;
+    memcpy(state->stripe, p, state->fill);
+}
+
+uint64_t hash64_final(const Hash64* state) {
+    const uint8_t* p = state->stripe;
+    const uint8_t* end = p + state->fill;
+    uint64_t h;
+
+    if (state->total >= 32) {
+        h = rotl64(state->v[0], 1) + rotl64(state->v[1], 7) +
+            rotl64(state->v[2], 12) + rotl64(state->v[3], 18);
+        for (int i = 0; i < 4; i++) {
+            h = xxh_merge(h, state->v[i]);
+        }
+    } else {
+        h = state->v[2] + PRIME64_5;
+    }
+    h += state->total;
+
+    for (; end - p >= 8; p += 8) {
+        h ^= xxh_round(0, read64(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (end - p >= 4) {
+        h ^= (uint64_t)read32(p) * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= *p * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t hash64(const void* data, size_t length) {
+    Hash64 state;
+    hash64_init(&state);
+    hash64_update(&state, data, length);
+    return hash64_final(&state);
+}
+
+// CRC-32 (IEEE, as in zlib and DAT files), slicing by eight bytes
+static uint32_t crc32_table[8][256];
+static pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
+
+static void crc32_build(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = c & 1 ? (c >> 1) ^ 0xEDB88320u : c >> 1;
+        }
+        crc32_table[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++) {
+            uint32_t c = crc32_table[t - 1][i];
+            crc32_table[t][i] = (c >> 8) ^ crc32_table[0][c & 0xff];
+        }
+    }
+}
+
+uint32_t crc32_update(uint32_t crc, const void* data, size_t length) {
+    const uint8_t* p = data;
+
+    pthread_once(&crc32_once, crc32_build);
+    crc = ~crc;
+    while (length >= 8) {
+        uint32_t lo = read32(p) ^ crc;
+        uint32_t hi = read32(p + 4);
+        crc = crc32_table[7][lo & 0xff] ^ crc32_table[6][(lo >> 8) & 0xff] ^
+              crc32_table[5][(lo >> 16) & 0xff] ^ crc32_table[4][lo >> 24] ^
+              crc32_table[3][hi & 0xff] ^ crc32_table[2][(hi >> 8) & 0xff] ^
+              crc32_table[1][(hi >> 16) & 0xff] ^ crc32_table[0][hi >> 24];
+        p += 8;
+        length -= 8;
+    }
+    while (length--) {
+        crc = (crc >> 8) ^ crc32_table[0][(crc ^ *p++) & 0xff];
+    }
+    return ~crc;
+}
+
+// MD5 and SHA-1 share the 64-byte block buffering; only the compression
+// function and the byte order of the length and digest differ
+static inline uint32_t rotl32(uint32_t x, int r) {
+    return (x << r) | (x >> (32 - r));
+}
+
+static inline uint32_t read32_be(const uint8_t* p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+// The rounds are unrolled with macros; a loop with the round function
+// chosen per step runs at a fraction of the speed
+#define MD5_STEP(f, a, b, c, d, m, k, r) \
+    a += f(b, c, d) + (m) + (k);        \
+    a = rotl32(a, r) + b
+
+#define MD5_F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define MD5_G(x, y, z) ((y) ^ ((z) & ((x) ^ (y))))
+#define MD5_H(x, y, z) ((x) ^ (y) ^ (z))
+#define MD5_I(x, y, z) ((y) ^ ((x) | ~(z)))
+
+static void md5_block(uint32_t* h, const uint8_t* block) {
+    uint32_t m[16];
+    for (int i = 0; i < 16; i++) m[i] = read32(block + i * 4);
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+
+    MD5_STEP(MD5_F, a, b, c, d, m[0], 0xd76aa478, 7);
+    MD5_STEP(MD5_F, d, a, b, c, m[1], 0xe8c7b756, 12);
+    MD5_STEP(MD5_F, c, d, a, b, m[2], 0x242070db, 17);
+    MD5_STEP(MD5_F, b, c, d, a, m[3], 0xc1bdceee, 22);
+    MD5_STEP(MD5_F, a, b, c, d, m[4], 0xf57c0faf, 7);
+    MD5_STEP(MD5_F, d, a, b, c, m[5], 0x4787c62a, 12);
+    MD5_STEP(MD5_F, c, d, a, b, m[6], 0xa8304613, 17);
+    MD5_STEP(MD5_F, b, c, d, a, m[7], 0xfd469501, 22);
+    MD5_STEP(MD5_F, a, b, c, d, m[8], 0x698098d8, 7);
+    MD5_STEP(MD5_F, d, a, b, c, m[9], 0x8b44f7af, 12);
+    MD5_STEP(MD5_F, c, d, a, b, m[10], 0xffff5bb1, 17);
+    MD5_STEP(MD5_F, b, c, d, a, m[11], 0x895cd7be, 22);
+    MD5_STEP(MD5_F, a, b, c, d, m[12], 0x6b901122, 7);
+    MD5_STEP(MD5_F, d, a, b, c, m[13], 0xfd987193, 12);
+    MD5_STEP(MD5_F, c, d, a, b, m[14], 0xa679438e, 17);
+    MD5_STEP(MD5_F, b, c, d, a, m[15], 0x49b40821, 22);
+
+    MD5_STEP(MD5_G, a, b, c, d, m[1], 0xf61e2562, 5);
+    MD5_STEP(MD5_G, d, a, b, c, m[6], 0xc040b340, 9);
+    MD5_STEP(MD5_G, c, d, a, b, m[11], 0x265e5a51, 14);
+    MD5_STEP(MD5_G, b, c, d, a, m[0], 0xe9b6c7aa, 20);
+    MD5_STEP(MD5_G, a, b, c, d, m[5], 0xd62f105d, 5);
+    MD5_STEP(MD5_G, d, a, b, c, m[10], 0x02441453, 9);
+    MD5_STEP(MD5_G, c, d, a, b, m[15], 0xd8a1e681, 14);
+    MD5_STEP(MD5_G, b, c, d, a, m[4], 0xe7d3fbc8, 20);
+    MD5_STEP(MD5_G, a, b, c, d, m[9], 0x21e1cde6, 5);
+    MD5_STEP(MD5_G, d, a, b, c, m[14], 0xc33707d6, 9);
+    MD5_STEP(MD5_G, c, d, a, b, m[3], 0xf4d50d87, 14);
+    MD5_STEP(MD5_G, b, c, d, a, m[8], 0x455a14ed, 20);
+    MD5_STEP(MD5_G, a, b, c, d, m[13], 0xa9e3e905, 5);
+    MD5_STEP(MD5_G, d, a, b, c, m[2], 0xfcefa3f8, 9);
+    MD5_STEP(MD5_G, c, d, a, b, m[7], 0x676f02d9, 14);
+    MD5_STEP(MD5_G, b, c, d, a, m[12], 0x8d2a4c8a, 20);
+
+    MD5_STEP(MD5_H, a, b, c, d, m[5], 0xfffa3942, 4);
+    MD5_STEP(MD5_H, d, a, b, c, m[8], 0x8771f681, 11);
+    MD5_STEP(MD5_H, c, d, a, b, m[11], 0x6d9d6122, 16);
+    MD5_STEP(MD5_H, b, c, d, a, m[14], 0xfde5380c, 23);
+    MD5_STEP(MD5_H, a, b, c, d, m[1], 0xa4beea44, 4);
+    MD5_STEP(MD5_H, d, a, b, c, m[4], 0x4bdecfa9, 11);
+    MD5_STEP(MD5_H, c, d, a, b, m[7], 0xf6bb4b60, 16);
+    MD5_STEP(MD5_H, b, c, d, a, m[10], 0xbebfbc70, 23);
+    MD5_STEP(MD5_H, a, b, c, d, m[13], 0x289b7ec6, 4);
+    MD5_STEP(MD5_H, d, a, b, c, m[0], 0xeaa127fa, 11);
+    MD5_STEP(MD5_H, c, d, a, b, m[3], 0xd4ef3085, 16);
+    MD5_STEP(MD5_H, b, c, d, a, m[6], 0x04881d05, 23);
+    MD5_STEP(MD5_H, a, b, c, d, m[9], 0xd9d4d039, 4);
+    MD5_STEP(MD5_H, d, a, b, c, m[12], 0xe6db99e5, 11);
+    MD5_STEP(MD5_H, c, d, a, b, m[15], 0x1fa27cf8, 16);
+    MD5_STEP(MD5_H, b, c, d, a, m[2], 0xc4ac5665, 23);
+
+    MD5_STEP(MD5_I, a, b, c, d, m[0], 0xf4292244, 6);
+    MD5_STEP(MD5_I, d, a, b, c, m[7], 0x432aff97, 10);
+    MD5_STEP(MD5_I, c, d, a, b, m[14], 0xab9423a7, 15);
+    MD5_STEP(MD5_I, b, c, d, a, m[5], 0xfc93a039, 21);
+    MD5_STEP(MD5_I, a, b, c, d, m[12], 0x655b59c3, 6);
+    MD5_STEP(MD5_I, d, a, b, c, m[3], 0x8f0ccc92, 10);
+    MD5_STEP(MD5_I, c, d, a, b, m[10], 0xffeff47d, 15);
+    MD5_STEP(MD5_I, b, c, d, a, m[1], 0x85845dd1, 21);
+    MD5_STEP(MD5_I, a, b, c, d, m[8], 0x6fa87e4f, 6);
+    MD5_STEP(MD5_I, d, a, b, c, m[15], 0xfe2ce6e0, 10);
+    MD5_STEP(MD5_I, c, d, a, b, m[6], 0xa3014314, 15);
+    MD5_STEP(MD5_I, b, c, d, a, m[13], 0x4e0811a1, 21);
+    MD5_STEP(MD5_I, a, b, c, d, m[4], 0xf7537e82, 6);
+    MD5_STEP(MD5_I, d, a, b, c, m[11], 0xbd3af235, 10);
+    MD5_STEP(MD5_I, c, d, a, b, m[2], 0x2ad7d2bb, 15);
+    MD5_STEP(MD5_I, b, c, d, a, m[9], 0xeb86d391, 21);
+
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+}
+
+// SHA-1 keeps only the last 16 schedule words, and rotates the roles of
+// the working variables instead of shifting them
+#define SHA1_W(i) \
+    (w[(i) & 15] = rotl32(w[((i) + 13) & 15] ^ w[((i) + 8) & 15] ^ w[((i) + 2) & 15] ^ w[(i) & 15], 1))
+
+#define SHA1_STEP(f, k, a, b, c, d, e, x) \
+    e += rotl32(a, 5) + f(b, c, d) + (k) + (x); \
+    b = rotl32(b, 30)
+
+#define SHA1_CH(x, y, z)  ((z) ^ ((x) & ((y) ^ (z))))
+#define SHA1_PAR(x, y, z) ((x) ^ (y) ^ (z))
+#define SHA1_MAJ(x, y, z) (((x) & (y)) | ((z) & ((x) | (y))))
+
+#define SHA1_FIVE(f, k, i, x)                     \
+    SHA1_STEP(f, k, a, b, c, d, e, x(i));         \
+    SHA1_STEP(f, k, e, a, b, c, d, x((i) + 1));   \
+    SHA1_STEP(f, k, d, e, a, b, c, x((i) + 2));   \
+    SHA1_STEP(f, k, c, d, e, a, b, x((i) + 3));   \
+    SHA1_STEP(f, k, b, c, d, e, a, x((i) + 4))
+
+#define SHA1_INPUT(i) w[i]
+
+static void sha1_block(uint32_t* h, const uint8_t* block) {
+    uint32_t w[16];
+    for (int i = 0; i < 16; i++) w[i] = read32_be(block + i * 4);
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+
+    SHA1_FIVE(SHA1_CH, 0x5A827999, 0, SHA1_INPUT);
+    SHA1_FIVE(SHA1_CH, 0x5A827999, 5, SHA1_INPUT);
+    SHA1_FIVE(SHA1_CH, 0x5A827999, 10, SHA1_INPUT);
+    SHA1_STEP(SHA1_CH, 0x5A827999, a, b, c, d, e, w[15]);
+    SHA1_STEP(SHA1_CH, 0x5A827999, e, a, b, c, d, SHA1_W(16));
+    SHA1_STEP(SHA1_CH, 0x5A827999, d, e, a, b, c, SHA1_W(17));
+    SHA1_STEP(SHA1_CH, 0x5A827999, c, d, e, a, b, SHA1_W(18));
+    SHA1_STEP(SHA1_CH, 0x5A827999, b, c, d, e, a, SHA1_W(19));
+
+    for (int i = 20; i < 40; i += 5) {
+        SHA1_FIVE(SHA1_PAR, 0x6ED9EBA1, i, SHA1_W);
+    }
+    for (int i = 40; i < 60; i += 5) {
+        SHA1_FIVE(SHA1_MAJ, 0x8F1BBCDC, i, SHA1_W);
+    }
+    for (int i = 60; i < 80; i += 5) {
+        SHA1_FIVE(SHA1_PAR, 0xCA62C1D6, i, SHA1_W);
+    }
+
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+}
+
+static void digest_update(DigestState* state, const void* data, size_t length,
+                          void (*block)(uint32_t*, const uint8_t*)) {
+    const uint8_t* p = data;
+
+    state->total += length;
+    if (state->fill) {
+        size_t n = sizeof(state->block) - state->fill;
+        if (n > length) n = length;
+        memcpy(state->block + state->fill, p, n);
+        state->fill += n;
+        p += n;
+        length -= n;
+        if (state->fill < sizeof(state->block)) return;
+        block(state->h, state->block);
+        state->fill = 0;
+    }
+    for (; length >= sizeof(state->block); p += sizeof(state->block), length -= sizeof(state->block)) {
+        block(state->h, p);
+    }
+    memcpy(state->block, p, length);
+    state->fill = length;
+}
+
+// Pads with 0x80, zeros and the bit length, in the given byte order
+static void digest_pad(DigestState* state, bool big_endian, void (*block)(uint32_t*, const uint8_t*)) {
+    uint64_t bits = state->total * 8;
+    uint8_t length[8];
+    static const uint8_t pad[64] = { 0x80 };
+
+    for (int i = 0; i < 8; i++) {
+        length[i] = (uint8_t)(bits >> (big_endian ? 56 - i * 8 : i * 8));
+    }
+    size_t n = state->fill < 56 ? 56 - state->fill : 120 - state->fill;
+    digest_update(state, pad, n, block);
+    digest_update(state, length, 8, block);
+}
+
+void md5_init(DigestState* state) {
+    memset(state, 0, sizeof(*state));
+    state->h[0] = 0x67452301;
+    state->h[1] = 0xefcdab89;
+    state->h[2] = 0x98badcfe;
+    state->h[3] = 0x10325476;
+}
+
+void md5_update(DigestState* state, const void* data, size_t length) {
+    digest_update(state, data, length, md5_block);
+}
+
+void md5_final(DigestState* state, uint8_t digest[16]) {
+    digest_pad(state, false, md5_block);
+    memcpy(digest, state->h, 16);
+}
+
+void sha1_init(DigestState* state) {
+    memset(state, 0, sizeof(*state));
+    state->h[0] = 0x67452301;
+    state->h[1] = 0xEFCDAB89;
+    state->h[2] = 0x98BADCFE;
+    state->h[3] = 0x10325476;
+    state->h[4] = 0xC3D2E1F0;
+}
+
+void sha1_update(DigestState* state, const void* data, size_t length) {
+    digest_update(state, data, length, sha1_block);
+}
+
+void sha1_final(DigestState* state, uint8_t digest[20]) {
+    digest_pad(state, true, sha1_block);
+    for (int i = 0; i < 5; i++) {
+        digest[i * 4] = (uint8_t)(state->h[i] >> 24);
+        digest[i * 4 + 1] = (uint8_t)(state->h[i] >> 16);
+        digest[i * 4 + 2] = (uint8_t)(state->h[i] >> 8);
+        digest[i * 4 + 3] = (uint8_t)state->h[i];
+    }
+}
@@ -0,0 +1,475 @@
+#ifndef XISO_INTERNAL_H
+#define XISO_INTERNAL_H
+
+#include "xiso.h"
+#include <stdio.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+#include <io.h>
+#define mkdir(path, mode) _mkdir(path)
+#define O_BINARY _O_BINARY
+#else
+#include <unistd.h>
+#include <sys/types.h>
+#define O_BINARY 0
+#endif
+
+// Constants
+#define XISO_HEADER_OFFSET           0x10000
+#define XISO_SECTOR_SIZE            2048
+#define XISO_HEADER_DATA           "MICROSOFT*XBOX*MEDIA"
+#define XISO_HEADER_DATA_LENGTH     20
+#define XISO_FILETIME_SIZE          8
+#define XISO_UNUSED_SIZE            0x7c8
+#define XISO_ROOT_DIRECTORY_SECTOR  0x108
+
+// File entry constants
+#define XISO_FILENAME_MAX_LENGTH     256
+#define XISO_ATTRIBUTE_DIR          0x10
+#define XISO_ATTRIBUTE_ARC          0x20
+#define XISO_TABLE_OFFSET_SIZE       2
+#define XISO_FILENAME_LENGTH_SIZE    1
+#define XISO_SECTOR_OFFSET_SIZE      4
+#define XISO_FILESIZE_SIZE           4
+#define XISO_ATTRIBUTES_SIZE         1
+#define XISO_PAD_SHORT             0xFFFF
+#define XISO_ENTRY_HEADER_SIZE      14
+
+// Entry offsets are 16-bit multiples of 4, so real tables stay well under this
+#define XISO_MAX_TABLE_SIZE         (1u << 20)
+#define XISO_DEFAULT_MAX_DEPTH      64
+
+// Additional offset checks for different formats
+#define GLOBAL_LSEEK_OFFSET        0xFD90000ull
+#define XGD3_LSEEK_OFFSET         0x2080000ull
+
+// Alignment of I/O buffers, large enough for O_DIRECT on any block device
+#define XISO_IO_ALIGNMENT           4096
+
+// Debug macros
+extern bool debug_enabled;
+
+#define DEBUG_PRINT(...) do { if (debug_enabled) printf(__VA_ARGS__); } while (0)
+#define DUMP_HEX(ptr, len) if (debug_enabled) { \
+    for(size_t i = 0; i < len; i++) { \
+        if(i % 16 == 0) printf("\n%04zx: ", i); \
+        printf("%02x ", ((unsigned char*)(ptr))[i]); \
+    } \
+    printf("\n"); \
+}
+
+typedef struct {
+    uint16_t left_offset;    // 2 bytes
+    uint16_t right_offset;   // 2 bytes
+    uint32_t start_sector;   // 4 bytes
+    uint32_t file_size;      // 4 bytes
+    uint8_t attributes;      // 1 byte
+    uint8_t filename_length; // 1 byte
+    char filename[XISO_FILENAME_MAX_LENGTH];
+} __attribute__((packed)) XisoEntry;
+
+// Shared helpers (xiso.c)
+void set_error(const char* format, ...);
+bool write_all(int fd, const void* data, size_t length);
+
+// Cancellation (xiso.c). operation_begin() clears the error code, progress
+// and xiso_cancel() flag; public operations call it before anything that
+// can fail, or a stale cancellation would mask their errors. Long loops
+// poll operation_cancelled(); once it returns true the error is set and
+// later set_error() calls keep the cancellation as the reason.
+void operation_begin(void);
+bool operation_cancelled(void);
+
+extern bool initialized;
+extern size_t include_count;
+extern unsigned extract_threads;
+extern unsigned max_walk_depth;
+
+typedef enum {
+    WALK_CONTINUE,  // keep going, descending into directories
+    WALK_SKIP,      // don't descend into this directory
+    WALK_ABORT,     // stop the walk with an error
+} WalkAction;
+
+// Applies the include/exclude filters to an entry's path in the image
+WalkAction filter_entry(const char* rel_path, const XisoEntry* entry);
+
+// An in-memory directory table, iterated in AVL preorder. Every 4-byte slot
+// a parsed entry covers is marked in visited, so loops and overlapping
+// entries are reported as errors instead of being followed.
+typedef struct {
+    uint8_t* data;
+    uint32_t size;
+    uint64_t start;
+    uint8_t* visited;
+    uint16_t* pending;
+    size_t pending_count;
+    uint32_t current;            // offset of the entry table_next() returned last
+} DirTable;
+
+// Allocates data for size bytes; the caller fills it before table_next().
+// table_next() returns 1 for an entry, 0 at the end and -1 on corruption.
+bool table_init(DirTable* table, uint64_t start, uint32_t size);
+int table_next(DirTable* table, XisoEntry* entry);
+void table_free(DirTable* table);
+
+// Output directory, opened once and shared by the entries created in it.
+// With include filters a directory is only created once a file needs it.
+typedef struct DirHandle {
+    struct DirHandle* parent;
+    int fd;
+    unsigned refs;
+    char name[];
+} DirHandle;
+
+DirHandle* dir_new(DirHandle* parent, const char* name);
+void dir_release(DirHandle* dir);
+// Creates the directory (and any missing parents) and opens it
+bool dir_open(DirHandle* dir);
+
+static inline uint64_t xiso_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Per-thread performance counters (xiso_stats.c). Each thread only ever
+// writes its own block, so updates are plain relaxed loads and stores.
+typedef struct XisoThreadStats {
+    XisoStats counters;
+    uint64_t position;               // image offset after the last read/seek
+    bool active;
+    struct XisoThreadStats* next;
+} XisoThreadStats;
+
+extern _Thread_local XisoThreadStats* stats_tls;
+XisoThreadStats* stats_register(void);
+void stats_reset(void);
+
+static inline XisoThreadStats* stats_local(void) {
+    XisoThreadStats* t = stats_tls;
+    return t ? t : stats_register();
+}
+
+#define STAT_ADD(t, field, n) \
+    __atomic_store_n(&(t)->counters.field, \
+        __atomic_load_n(&(t)->counters.field, __ATOMIC_RELAXED) + (uint64_t)(n), __ATOMIC_RELAXED)
+
+static inline void stats_move_to(XisoThreadStats* t, uint64_t offset) {
+    STAT_ADD(t, seek_distance, offset > t->position ? offset - t->position : t->position - offset);
+    t->position = offset;
+}
+
+// Bandwidth limits (xiso_throttle.c). throttle() is free while no limit is
+// set; otherwise it charges the bytes and sleeps while over the limit.
+typedef enum {
+    THROTTLE_READ,
+    THROTTLE_WRITE,
+} ThrottleKind;
+
+extern bool throttle_enabled;
+void throttle_charge(ThrottleKind kind, size_t length);
+
+static inline void throttle(ThrottleKind kind, ssize_t length) {
+    if (length > 0 && __atomic_load_n(&throttle_enabled, __ATOMIC_RELAXED)) {
+        throttle_charge(kind, (size_t)length);
+    }
+}
+
+// Split images (xiso_split.c). image_open() and friends stand in for
+// open(), stat(), fstat() and close() on image paths, so a set of numbered
+// parts reads as one image. Descriptors of split sets are looked up by the
+// io_ wrappers, which is free while none are open.
+typedef struct SplitImage SplitImage;
+
+extern unsigned split_open_count;
+bool image_is_split(const char* path);
+int image_open(const char* path, int flags);
+int image_stat(const char* path, struct stat* st);
+int image_fstat(int fd, struct stat* st);
+void image_close(int fd);
+SplitImage* split_find(int fd);
+ssize_t split_pread(SplitImage* image, void* buf, size_t length, uint64_t offset);
+ssize_t split_read(SplitImage* image, void* buf, size_t length);
+off_t split_lseek(SplitImage* image, off_t offset, int whence);
+#if defined(__linux__)
+ssize_t split_copy_range(SplitImage* image, uint64_t offset, int fd_out, size_t length);
+#endif
+
+static inline SplitImage* split_lookup(int fd) {
+    return __atomic_load_n(&split_open_count, __ATOMIC_RELAXED) ? split_find(fd) : NULL;
+}
+
+// Counted (and throttled) wrappers for every syscall the library makes on
+// the hot paths
+static inline ssize_t io_read(int fd, void* buf, size_t length) {
+    XisoThreadStats* t = stats_local();
+    SplitImage* image = split_lookup(fd);
+    ssize_t n = image ? split_read(image, buf, length) : read(fd, buf, length);
+    STAT_ADD(t, read_calls, 1);
+    if (n > 0) {
+        STAT_ADD(t, bytes_read, n);
+        t->position += n;
+    }
+    throttle(THROTTLE_READ, n);
+    return n;
+}
+
+static inline ssize_t io_pread(int fd, void* buf, size_t length, uint64_t offset) {
+    XisoThreadStats* t = stats_local();
+    SplitImage* image = split_lookup(fd);
+    ssize_t n = image ? split_pread(image, buf, length, offset) : pread(fd, buf, length, offset);
+    STAT_ADD(t, read_calls, 1);
+    stats_move_to(t, offset);
+    if (n > 0) {
+        STAT_ADD(t, bytes_read, n);
+        t->position += n;
+    }
+    throttle(THROTTLE_READ, n);
+    return n;
+}
+
+static inline off_t io_lseek(int fd, off_t offset, int whence) {
+    XisoThreadStats* t = stats_local();
+    SplitImage* image = split_lookup(fd);
+    off_t pos = image ? split_lseek(image, offset, whence) : lseek(fd, offset, whence);
+    STAT_ADD(t, lseek_calls, 1);
+    if (pos != -1) {
+        stats_move_to(t, pos);
+    }
+    return pos;
+}
+
+static inline ssize_t io_write(int fd, const void* buf, size_t length) {
+    XisoThreadStats* t = stats_local();
+    ssize_t n = write(fd, buf, length);
+    STAT_ADD(t, write_calls, 1);
+    if (n > 0) {
+        STAT_ADD(t, bytes_written, n);
+    }
+    throttle(THROTTLE_WRITE, n);
+    return n;
+}
+
+static inline ssize_t io_pwrite(int fd, const void* buf, size_t length, uint64_t offset) {
+    XisoThreadStats* t = stats_local();
+    ssize_t n = pwrite(fd, buf, length, offset);
+    STAT_ADD(t, write_calls, 1);
+    if (n > 0) {
+        STAT_ADD(t, bytes_written, n);
+    }
+    throttle(THROTTLE_WRITE, n);
+    return n;
+}
+
+#if defined(__linux__)
+static inline ssize_t io_copy_range(int fd_in, uint64_t offset, int fd_out, size_t length) {
+    XisoThreadStats* t = stats_local();
+    SplitImage* image = split_lookup(fd_in);
+    loff_t off_in = offset;
+    ssize_t n = image ? split_copy_range(image, offset, fd_out, length)
+                      : copy_file_range(fd_in, &off_in, fd_out, NULL, length, 0);
+    STAT_ADD(t, copy_range_calls, 1);
+    stats_move_to(t, offset);
+    if (n > 0) {
+        STAT_ADD(t, bytes_read, n);
+        STAT_ADD(t, bytes_written, n);
+        t->position += n;
+    }
+    throttle(THROTTLE_READ, n);
+    throttle(THROTTLE_WRITE, n);
+    return n;
+}
+#endif
+
+static inline int io_open(const char* path, int flags, int mode) {
+    STAT_ADD(stats_local(), open_calls, 1);
+    return open(path, flags, mode);
+}
+
+static inline int io_mkdir(const char* path, int mode) {
+    STAT_ADD(stats_local(), mkdir_calls, 1);
+    return mkdir(path, mode);
+}
+
+static inline int io_openat(int dir_fd, const char* name, int flags, int mode) {
+    STAT_ADD(stats_local(), open_calls, 1);
+    return openat(dir_fd, name, flags, mode);
+}
+
+static inline int io_mkdirat(int dir_fd, const char* name, int mode) {
+    STAT_ADD(stats_local(), mkdir_calls, 1);
+    return mkdirat(dir_fd, name, mode);
+}
+
+// Event tracing (xiso_trace.c). Spans are timed with trace_begin() and
+// recorded into the calling thread's ring by trace_end(); both are no-ops
+// while tracing is off.
+#define TRACE_DETAIL_MAX 64
+
+extern bool trace_enabled;
+
+static inline uint64_t trace_begin(void) {
+    return __atomic_load_n(&trace_enabled, __ATOMIC_RELAXED) ? xiso_now_ns() : 0;
+}
+
+void trace_end(uint64_t start_ns, const char* name, const char* detail);
+void trace_set_thread_name(const char* name);
+
+// Worker threads fed from a bounded queue (xiso_jobs.c)
+typedef struct JobQueue JobQueue;
+typedef void (*JobFunc)(void* arg);
+
+JobQueue* jobs_create(unsigned threads, size_t max_pending, const char* name);
+void jobs_submit(JobQueue* queue, JobFunc func, void* arg);
+void jobs_wait(JobQueue* queue);
+void jobs_destroy(JobQueue* queue);
+// Operations take their workers through these, so a queue kept by
+// xiso_set_keep_workers() is reused; jobs_trim() drops it
+JobQueue* jobs_borrow(unsigned threads, size_t max_pending, const char* name);
+void jobs_return(JobQueue* queue);
+void jobs_trim(void);
+
+// Aligned I/O buffer pool (xiso_pool.c)
+void* pool_acquire(size_t size);
+void pool_release(void* buf, size_t size);
+void pool_trim(void);
+
+// I/O auto-tuning (xiso_tune.c)
+typedef struct {
+    XisoIoStrategy strategy;
+    size_t buffer_size;
+} XisoIoPlan;
+
+void tune_begin(const XisoIoPlan* fallback, uint64_t in_dev, uint64_t out_dev);
+bool tune_active(void);
+void tune_current(XisoIoPlan* plan);
+void tune_record(const XisoIoPlan* plan, size_t bytes, uint64_t elapsed_ns);
+void tune_reject(XisoIoStrategy strategy);
+bool tune_end(XisoIoPlan* chosen);
+size_t tune_max_buffer_size(void);
+
+// tar archive writer, optionally zstd-compressed (xiso_tar.c). When the
+// archive is uncompressed tar_raw_fd() returns the output descriptor so
+// file data can be copied into it directly; otherwise it returns -1.
+typedef struct TarWriter TarWriter;
+
+TarWriter* tar_open(int fd, int zstd_level, unsigned threads);
+int tar_raw_fd(const TarWriter* tar);
+bool tar_write(TarWriter* tar, const void* data, size_t length);
+bool tar_add_directory(TarWriter* tar, const char* path, time_t mtime);
+bool tar_begin_file(TarWriter* tar, const char* path, uint64_t size, time_t mtime);
+bool tar_end_file(TarWriter* tar, uint64_t size);
+// Writes the end-of-archive marker and flushes when finish is set
+bool tar_close(TarWriter* tar, bool finish);
+
+// Streaming XXH64 (xiso_hash.c)
+typedef struct {
+    uint64_t v[4];
+    uint64_t total;
+    uint8_t stripe[32];
+    size_t fill;
+} Hash64;
+
+void hash64_init(Hash64* state);
+void hash64_update(Hash64* state, const void* data, size_t length);
+uint64_t hash64_final(const Hash64* state);
+uint64_t hash64(const void* data, size_t length);
+
+// The digests DAT files list (xiso_hash.c). crc32_update() starts from 0.
+typedef struct {
+    uint32_t h[5];
+    uint64_t total;
+    uint8_t block[64];
+    size_t fill;
+} DigestState;
+
+uint32_t crc32_update(uint32_t crc, const void* data, size_t length);
+void md5_init(DigestState* state);
+void md5_update(DigestState* state, const void* data, size_t length);
+void md5_final(DigestState* state, uint8_t digest[16]);
+void sha1_init(DigestState* state);
+void sha1_update(DigestState* state, const void* data, size_t length);
+void sha1_final(DigestState* state, uint8_t digest[20]);
+
+// Redo journal for in-place image updates (xiso_journal.c). Records are
+// streamed to the journal file, which is synced before journal_replay()
+// writes them to the image. A journal found on the next open is replayed
+// if complete and discarded if torn, since then the image wasn't touched.
+typedef struct Journal Journal;
+
+Journal* journal_create(const char* path);
+bool journal_add(Journal* journal, uint64_t offset, const void* data, uint32_t length);
+// Seals and syncs the journal; it is freed either way
+bool journal_commit(Journal* journal);
+void journal_abort(Journal* journal);
+// Applies a committed journal to image_fd, syncs the image and removes the
+// journal. Succeeds without doing anything when there is no journal.
+bool journal_replay(const char* path, int image_fd);
+
+// Resume journal for extraction (xiso_resume.c). Records how much of each
+// file is known to be on disk; checkpoints sync the output filesystem before
+// journaling, so a rerun after a crash can trust every recorded byte.
+typedef struct Resume Resume;
+
+// Files are copied and their progress noted in segments of this size
+#define RESUME_SEGMENT_SIZE (64u * 1024 * 1024)
+
+// identity is compared with the journal's; a mismatch starts a fresh one
+Resume* resume_open(const char* path, int sync_fd, const void* identity, size_t identity_length);
+// Returns a handle for rel_path and the bytes of it already durable, or -1
+long resume_start(Resume* resume, const char* rel_path, uint64_t offset, uint32_t size,
+                  uint32_t* committed);
+// Notes progress on a file, checkpointing when enough has piled up
+bool resume_written(Resume* resume, long index, uint32_t written);
+// Takes a final checkpoint and frees the journal
+bool resume_close(Resume* resume);
+
+// XISO image writer (xiso_write.c). Callers build a tree of WriteNodes,
+// image_layout() sorts it, assigns sectors and serializes the tables, and
+// image_write() emits the image front to back, so out_fd may be a pipe.
+typedef struct WriteNode {
+    char* name;
+    bool is_directory;
+    uint32_t size;               // file data size
+    uint32_t sector;             // assigned by image_layout()
+    uint64_t source_offset;      // data offset in the source image (rebuild)
+                                 // or inode number (create)
+    uint64_t source_device;      // device of that inode (create)
+    char* source_path;           // data file on disk (create)
+    struct WriteNode** children;
+    size_t child_count;
+    size_t child_capacity;
+    uint32_t entry_offset;       // offset of this entry in its parent's table
+    uint32_t table_size;         // directories: whole sectors, 0 when empty
+    uint8_t* table;
+} WriteNode;
+
+typedef struct {
+    WriteNode** dirs;            // non-empty directories in table order
+    size_t dir_count;
+    WriteNode** files;           // files in data order; shared extents once
+    size_t file_count;
+    uint32_t total_sectors;
+} ImageLayout;
+
+// Writes file's size bytes of data at the current position of out_fd
+typedef bool (*WriteData)(WriteNode* file, int out_fd, void* ctx);
+
+WriteNode* write_node_new(const char* name, bool is_directory);
+bool write_node_add(WriteNode* dir, WriteNode* child);
+void write_node_free(WriteNode* node);
+// Drops directories left without files, for runs with include filters
+void write_node_prune(WriteNode* dir);
+int xdvdfs_compare(const char* a, const char* b);
+extern XisoFileOrder file_order;
+
+bool image_layout(WriteNode* root, XisoFileOrder order, ImageLayout* layout);
+void image_layout_free(ImageLayout* layout);
+bool image_write(const ImageLayout* layout, const WriteNode* root, int out_fd,
+                 WriteData write_data, void* ctx);
+
+#endif // XISO_INTERNAL_H
@@ -0,0 +1,199 @@
+#include "xiso_internal.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    JobFunc func;
+    void* arg;
+} Job;
+
+struct JobQueue {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    pthread_cond_t idle;
+    Job* jobs;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    size_t running;
+    bool stopping;
+    pthread_t* threads;
+    unsigned num_threads;
+    char name[24];
+};
+
+typedef struct {
+    JobQueue* queue;
+    unsigned index;
+} WorkerStart;
+
+// A queue handed back by an operation while keep_workers is set waits
+// here, threads idle, for the next operation to borrow
+static pthread_mutex_t kept_lock = PTHREAD_MUTEX_INITIALIZER;
+static JobQueue* kept = NULL;
+static bool keep_workers = false;
+
+static void* worker_main(void* arg) {
+    WorkerStart start = *(WorkerStart*)arg;
+    JobQueue* q = start.queue;
+    char thread_name[48];
+
+    free(arg);
+    snprintf(thread_name, sizeof(thread_name), "%s %u", q->name, start.index);
+    trace_set_thread_name(thread_name);
+
+    pthread_mutex_lock(&q->lock);
+    for (;;) {
+        uint64_t idle_span = trace_begin();
+        while (q->count == 0 && !q->stopping) {
+            pthread_cond_wait(&q->not_empty, &q->lock);
+        }
+        if (q->count == 0) {
+            break;
+        }
+
+        Job job = q->jobs[q->head];
+        q->head = (q->head + 1) % q->capacity;
+        q->count--;
+        q->running++;
+        pthread_cond_signal(&q->not_full);
+        pthread_mutex_unlock(&q->lock);
+
+        trace_end(idle_span, "idle", NULL);
+        job.func(job.arg);
+
+        pthread_mutex_lock(&q->lock);
+        q->running--;
+        if (q->count == 0 && q->running == 0) {
+            pthread_cond_broadcast(&q->idle);
+        }
+    }
+    pthread_mutex_unlock(&q->lock);
+    return NULL;
+}
+
+JobQueue* jobs_create(unsigned threads, size_t max_pending, const char* name) {
+    JobQueue* q = calloc(1, sizeof(*q));
+    if (!q) {
+        set_error("Failed to allocate job queue");
+        return NULL;
+    }
+
+    q->capacity = max_pending ? max_pending : 1;
+    q->jobs = calloc(q->capacity, sizeof(Job));
+    q->threads = calloc(threads, sizeof(pthread_t));
+    if (!q->jobs || !q->threads) {
+        free(q->jobs);
+        free(q->threads);
+        free(q);
+        set_error("Failed to allocate job queue");
+        return NULL;
+    }
+
+    snprintf(q->name, sizeof(q->name), "%s", name);
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+    pthread_cond_init(&q->idle, NULL);
+
+    for (unsigned i = 0; i < threads; i++) {
+        WorkerStart* start = malloc(sizeof(*start));
+        if (start) {
+            start->queue = q;
+            start->index = i;
+        }
+        if (!start || pthread_create(&q->threads[i], NULL, worker_main, start) != 0) {
+            free(start);
+            set_error("Failed to start worker thread");
+            jobs_destroy(q);
+            return NULL;
+        }
+        q->num_threads++;
+    }
+
+    return q;
+}
+
+void jobs_submit(JobQueue* q, JobFunc func, void* arg) {
+    pthread_mutex_lock(&q->lock);
+    while (q->count == q->capacity) {
+        pthread_cond_wait(&q->not_full, &q->lock);
+    }
+    q->jobs[(q->head + q->count) % q->capacity] = (Job){ func, arg };
+    q->count++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+void jobs_wait(JobQueue* q) {
+    pthread_mutex_lock(&q->lock);
+    while (q->count > 0 || q->running > 0) {
+        pthread_cond_wait(&q->idle, &q->lock);
+    }
+    pthread_mutex_unlock(&q->lock);
+}
+
+void jobs_destroy(JobQueue* q) {
+    if (!q) return;
+
+    pthread_mutex_lock(&q->lock);
+    q->stopping = true;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+
+    for (unsigned i = 0; i < q->num_threads; i++) {
+        pthread_join(q->threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_cond_destroy(&q->not_full);
+    pthread_cond_destroy(&q->idle);
+    free(q->jobs);
+    free(q->threads);
+    free(q);
+}
+
+JobQueue* jobs_borrow(unsigned threads, size_t max_pending, const char* name) {
+    pthread_mutex_lock(&kept_lock);
+    JobQueue* q = kept;
+    kept = NULL;
+    pthread_mutex_unlock(&kept_lock);
+
+    // A change of xiso_set_threads() since it was kept
+    if (q && (q->num_threads != threads || q->capacity != max_pending)) {
+        jobs_destroy(q);
+        q = NULL;
+    }
+    // Kept threads serve every kind of operation, so they get a shared name
+    return q ? q : jobs_create(threads, max_pending, keep_workers ? "worker" : name);
+}
+
+void jobs_return(JobQueue* q) {
+    if (!q) return;
+
+    // Jobs still queued point into the caller's frame
+    jobs_wait(q);
+    pthread_mutex_lock(&kept_lock);
+    if (keep_workers && !kept) {
+        kept = q;
+        q = NULL;
+    }
+    pthread_mutex_unlock(&kept_lock);
+    jobs_destroy(q);
+}
+
+void jobs_trim(void) {
+    pthread_mutex_lock(&kept_lock);
+    JobQueue* q = kept;
+    kept = NULL;
+    pthread_mutex_unlock(&kept_lock);
+    jobs_destroy(q);
+}
+
+void xiso_set_keep_workers(bool enable) {
+    __atomic_store_n(&keep_workers, enable, __ATOMIC_RELAXED);
+    if (!enable) jobs_trim();
+}
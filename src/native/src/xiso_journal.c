@@ -0,0 +1,207 @@
+#include "xiso_internal.h"
+#include <errno.h>
+#include <libgen.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Layout: magic, then records of { u64 offset, u32 length, data }, then an
+// end record { JOURNAL_END, 0 } followed by an FNV-1a hash of all the
+// bytes before it. Integers are little-endian, like the image itself.
+#define JOURNAL_MAGIC        "XISOJNL1"
+#define JOURNAL_MAGIC_LENGTH 8
+#define JOURNAL_RECORD_SIZE  12
+#define JOURNAL_END          UINT64_MAX
+#define JOURNAL_CHUNK_SIZE   (256 * 1024)
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ull
+#define FNV_PRIME        0x100000001b3ull
+
+struct Journal {
+    int fd;
+    uint64_t hash;
+    char path[];
+};
+
+static uint64_t fnv1a(uint64_t hash, const void* data, size_t length) {
+    const uint8_t* p = data;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ p[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+static bool journal_write(Journal* journal, const void* data, size_t length) {
+    journal->hash = fnv1a(journal->hash, data, length);
+    if (!write_all(journal->fd, data, length)) {
+        set_error("Failed to write journal: %s (%s)", journal->path, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+static bool write_record_header(Journal* journal, uint64_t offset, uint32_t length) {
+    uint8_t header[JOURNAL_RECORD_SIZE];
+    memcpy(header, &offset, 8);
+    memcpy(header + 8, &length, 4);
+    return journal_write(journal, header, sizeof(header));
+}
+
+// The journal's directory entry must be durable before the image changes
+static bool sync_parent(const char* path) {
+    char* copy = strdup(path);
+    if (!copy) return false;
+
+    int dir_fd = open(dirname(copy), O_RDONLY | O_DIRECTORY);
+    free(copy);
+    if (dir_fd == -1) return false;
+
+    bool synced = fsync(dir_fd) == 0;
+    close(dir_fd);
+    return synced;
+}
+
+Journal* journal_create(const char* path) {
+    size_t length = strlen(path) + 1;
+    Journal* journal = malloc(sizeof(Journal) + length);
+    if (!journal) {
+        set_error("Failed to allocate journal");
+        return NULL;
+    }
+    memcpy(journal->path, path, length);
+    journal->hash = FNV_OFFSET_BASIS;
+
+    journal->fd = io_open(path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+    if (journal->fd == -1) {
+        set_error("Failed to create journal: %s (%s)", path, strerror(errno));
+        free(journal);
+        return NULL;
+    }
+    if (!journal_write(journal, JOURNAL_MAGIC, JOURNAL_MAGIC_LENGTH)) {
+        journal_abort(journal);
+        return NULL;
+    }
+    return journal;
+}
+
+bool journal_add(Journal* journal, uint64_t offset, const void* data, uint32_t length) {
+    return write_record_header(journal, offset, length) && journal_write(journal, data, length);
+}
+
+bool journal_commit(Journal* journal) {
+    bool ok = write_record_header(journal, JOURNAL_END, 0);
+    if (ok) {
+        uint64_t hash = journal->hash;
+        ok = journal_write(journal, &hash, sizeof(hash));
+    }
+    if (ok && (fsync(journal->fd) != 0 || !sync_parent(journal->path))) {
+        set_error("Failed to sync journal: %s (%s)", journal->path, strerror(errno));
+        ok = false;
+    }
+
+    if (!ok) {
+        journal_abort(journal);
+        return false;
+    }
+    close(journal->fd);
+    free(journal);
+    return true;
+}
+
+void journal_abort(Journal* journal) {
+    close(journal->fd);
+    unlink(journal->path);
+    free(journal);
+}
+
+static bool read_full(int fd, void* data, size_t length) {
+    char* p = data;
+    while (length > 0) {
+        ssize_t n = io_read(fd, p, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        length -= n;
+    }
+    return true;
+}
+
+// Walks the records once, hashing them or writing them to image_fd. With
+// image_fd -1 this only checks the journal is complete.
+static bool journal_scan(int fd, uint8_t* buffer, int image_fd, bool* complete) {
+    uint8_t header[JOURNAL_RECORD_SIZE];
+    uint64_t hash = FNV_OFFSET_BASIS;
+
+    *complete = false;
+    if (io_lseek(fd, 0, SEEK_SET) != 0 || !read_full(fd, buffer, JOURNAL_MAGIC_LENGTH) ||
+        memcmp(buffer, JOURNAL_MAGIC, JOURNAL_MAGIC_LENGTH) != 0) {
+        return true;
+    }
+    hash = fnv1a(hash, buffer, JOURNAL_MAGIC_LENGTH);
+
+    for (;;) {
+        uint64_t offset;
+        uint32_t length;
+
+        if (!read_full(fd, header, sizeof(header))) return true;
+        hash = fnv1a(hash, header, sizeof(header));
+        memcpy(&offset, header, 8);
+        memcpy(&length, header + 8, 4);
+        if (offset == JOURNAL_END) break;
+
+        while (length > 0) {
+            uint32_t n = length < JOURNAL_CHUNK_SIZE ? length : JOURNAL_CHUNK_SIZE;
+            if (!read_full(fd, buffer, n)) return true;
+            hash = fnv1a(hash, buffer, n);
+
+            if (image_fd != -1 && io_pwrite(image_fd, buffer, n, offset) != (ssize_t)n) {
+                set_error("Failed to apply journal (%s)", strerror(errno));
+                return false;
+            }
+            offset += n;
+            length -= n;
+        }
+    }
+
+    uint64_t stored;
+    if (!read_full(fd, &stored, sizeof(stored))) return true;
+    *complete = stored == hash;
+    return true;
+}
+
+bool journal_replay(const char* path, int image_fd) {
+    int fd = io_open(path, O_RDONLY | O_BINARY, 0);
+    if (fd == -1) {
+        if (errno == ENOENT) return true;
+        set_error("Failed to open journal: %s (%s)", path, strerror(errno));
+        return false;
+    }
+
+    uint8_t* buffer = malloc(JOURNAL_CHUNK_SIZE);
+    if (!buffer) {
+        set_error("Failed to allocate journal buffer");
+        close(fd);
+        return false;
+    }
+
+    bool complete;
+    bool ok = journal_scan(fd, buffer, -1, &complete);
+    if (ok && complete) {
+        DEBUG_PRINT("Replaying journal %s\n", path);
+        uint64_t span = trace_begin();
+        ok = journal_scan(fd, buffer, image_fd, &complete);
+        if (ok && fsync(image_fd) != 0) {
+            set_error("Failed to sync image (%s)", strerror(errno));
+            ok = false;
+        }
+        trace_end(span, "journal_replay", NULL);
+    } else if (ok) {
+        // Torn while being written, so nothing reached the image yet
+        DEBUG_PRINT("Discarding incomplete journal %s\n", path);
+    }
+
+    free(buffer);
+    close(fd);
+    // A journal that failed to apply stays behind for the next attempt
+    if (ok) unlink(path);
+    return ok;
+}
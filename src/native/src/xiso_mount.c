@@ -0,0 +1,404 @@
+// Read-only FUSE mount of an XISO image, installed as "xiso-mount".
+//
+// The directory tree is parsed once at mount time and kept in memory, so
+// lookup, getattr and readdir never touch the image. Reads are answered by
+// splicing straight from the file's extent in the image.
+
+#define FUSE_USE_VERSION 31
+
+#include "xiso.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <fuse_lowlevel.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MOUNT_SECTOR_SIZE 2048
+
+// The image never changes while mounted, so the kernel may cache freely
+#define MOUNT_CACHE_TIMEOUT 86400.0
+
+typedef struct {
+    char* name;
+    uint64_t offset;        // byte offset of the data in the image
+    uint64_t size;
+    bool is_directory;
+    fuse_ino_t parent;
+    fuse_ino_t* children;   // directories only, in image order
+    size_t child_count;
+    size_t child_capacity;
+} MountNode;
+
+// Node i has inode i + 1, so the root is FUSE_ROOT_ID
+typedef struct {
+    int image_fd;
+    uint64_t partition_offset;
+    time_t mtime;
+    MountNode* nodes;
+    size_t node_count;
+    size_t node_capacity;
+    fuse_ino_t* dir_stack;  // directory inode per walk depth
+    size_t dir_stack_size;
+} MountTree;
+
+static MountNode* node_get(MountTree* tree, fuse_ino_t ino) {
+    if (ino < FUSE_ROOT_ID || ino > tree->node_count) return NULL;
+    return &tree->nodes[ino - 1];
+}
+
+static fuse_ino_t node_add(MountTree* tree, const char* name, bool is_directory) {
+    if (tree->node_count == tree->node_capacity) {
+        size_t capacity = tree->node_capacity ? tree->node_capacity * 2 : 256;
+        MountNode* grown = realloc(tree->nodes, capacity * sizeof(MountNode));
+        if (!grown) return 0;
+        tree->nodes = grown;
+        tree->node_capacity = capacity;
+    }
+
+    MountNode* node = &tree->nodes[tree->node_count];
+    memset(node, 0, sizeof(*node));
+    node->name = strdup(name);
+    node->is_directory = is_directory;
+    if (!node->name) return 0;
+    return ++tree->node_count;
+}
+
+static bool child_add(MountNode* dir, fuse_ino_t child) {
+    if (dir->child_count == dir->child_capacity) {
+        size_t capacity = dir->child_capacity ? dir->child_capacity * 2 : 16;
+        fuse_ino_t* grown = realloc(dir->children, capacity * sizeof(fuse_ino_t));
+        if (!grown) return false;
+        dir->children = grown;
+        dir->child_capacity = capacity;
+    }
+    dir->children[dir->child_count++] = child;
+    return true;
+}
+
+// The walk visits a directory's contents right after the directory, so
+// dir_stack[depth] is always the parent of an entry at that depth
+static bool build_visit(const XisoEntryInfo* entry, void* user_data) {
+    MountTree* tree = user_data;
+
+    if (entry->depth + 2 > tree->dir_stack_size) {
+        size_t size = tree->dir_stack_size * 2;
+        fuse_ino_t* grown = realloc(tree->dir_stack, size * sizeof(fuse_ino_t));
+        if (!grown) return false;
+        tree->dir_stack = grown;
+        tree->dir_stack_size = size;
+    }
+
+    fuse_ino_t parent = tree->dir_stack[entry->depth];
+    fuse_ino_t ino = node_add(tree, entry->name, entry->is_directory);
+    if (!ino || !child_add(node_get(tree, parent), ino)) return false;
+
+    MountNode* node = node_get(tree, ino);
+    node->parent = parent;
+    node->size = entry->is_directory ? 0 : entry->size;
+    node->offset = (uint64_t)entry->start_sector * MOUNT_SECTOR_SIZE + tree->partition_offset;
+    if (entry->is_directory) {
+        tree->dir_stack[entry->depth + 1] = ino;
+    }
+    return true;
+}
+
+static bool tree_load(MountTree* tree, const char* image_path) {
+    XisoImageInfo info;
+    struct stat st;
+
+    if (!xiso_stat(image_path, &info)) {
+        fprintf(stderr, "xiso-mount: %s: %s\n", image_path, xiso_get_last_error());
+        return false;
+    }
+
+    tree->image_fd = open(image_path, O_RDONLY);
+    if (tree->image_fd == -1 || fstat(tree->image_fd, &st) != 0) {
+        fprintf(stderr, "xiso-mount: %s: %s\n", image_path, strerror(errno));
+        return false;
+    }
+    // Files are served straight from the image file, which a split image
+    // doesn't have
+    if ((uint64_t)st.st_size != info.image_size) {
+        fprintf(stderr, "xiso-mount: %s: split images can't be mounted, join the parts first\n", image_path);
+        return false;
+    }
+    tree->partition_offset = info.partition_offset;
+    tree->mtime = st.st_mtime;
+
+    tree->dir_stack_size = 16;
+    tree->dir_stack = malloc(tree->dir_stack_size * sizeof(fuse_ino_t));
+    if (!tree->dir_stack || node_add(tree, "", true) != FUSE_ROOT_ID) {
+        fprintf(stderr, "xiso-mount: out of memory\n");
+        return false;
+    }
+    tree->nodes[0].parent = FUSE_ROOT_ID;
+    tree->dir_stack[0] = FUSE_ROOT_ID;
+
+    if (!xiso_walk(image_path, build_visit, tree)) {
+        fprintf(stderr, "xiso-mount: %s: %s\n", image_path, xiso_get_last_error());
+        return false;
+    }
+    return true;
+}
+
+static void tree_free(MountTree* tree) {
+    for (size_t i = 0; i < tree->node_count; i++) {
+        free(tree->nodes[i].name);
+        free(tree->nodes[i].children);
+    }
+    free(tree->nodes);
+    free(tree->dir_stack);
+    if (tree->image_fd != -1) close(tree->image_fd);
+}
+
+static void fill_stat(const MountTree* tree, fuse_ino_t ino, const MountNode* node, struct stat* st) {
+    memset(st, 0, sizeof(*st));
+    st->st_ino = ino;
+    st->st_mode = node->is_directory ? S_IFDIR | 0555 : S_IFREG | 0444;
+    st->st_nlink = node->is_directory ? 2 : 1;
+    st->st_size = node->size;
+    st->st_blksize = MOUNT_SECTOR_SIZE;
+    st->st_blocks = (node->size + 511) / 512;
+    st->st_uid = getuid();
+    st->st_gid = getgid();
+    st->st_atime = st->st_mtime = st->st_ctime = tree->mtime;
+}
+
+// Operations
+
+static void mount_lookup(fuse_req_t req, fuse_ino_t parent, const char* name) {
+    MountTree* tree = fuse_req_userdata(req);
+    MountNode* dir = node_get(tree, parent);
+
+    if (!dir || !dir->is_directory) {
+        fuse_reply_err(req, ENOTDIR);
+        return;
+    }
+
+    // XDVDFS names are case-insensitive
+    for (size_t i = 0; i < dir->child_count; i++) {
+        MountNode* child = node_get(tree, dir->children[i]);
+        if (strcasecmp(child->name, name) == 0) {
+            struct fuse_entry_param e;
+            memset(&e, 0, sizeof(e));
+            e.ino = dir->children[i];
+            e.attr_timeout = MOUNT_CACHE_TIMEOUT;
+            e.entry_timeout = MOUNT_CACHE_TIMEOUT;
+            fill_stat(tree, e.ino, child, &e.attr);
+            fuse_reply_entry(req, &e);
+            return;
+        }
+    }
+    fuse_reply_err(req, ENOENT);
+}
+
+static void mount_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    MountTree* tree = fuse_req_userdata(req);
+    MountNode* node = node_get(tree, ino);
+    struct stat st;
+
+    (void)fi;
+    if (!node) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    fill_stat(tree, ino, node, &st);
+    fuse_reply_attr(req, &st, MOUNT_CACHE_TIMEOUT);
+}
+
+static void mount_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                          struct fuse_file_info* fi) {
+    MountTree* tree = fuse_req_userdata(req);
+    MountNode* dir = node_get(tree, ino);
+
+    (void)fi;
+    if (!dir || !dir->is_directory) {
+        fuse_reply_err(req, ENOTDIR);
+        return;
+    }
+
+    char* buffer = malloc(size);
+    if (!buffer) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+
+    // Offsets 0 and 1 are "." and "..", then one per child
+    size_t used = 0;
+    for (off_t i = off; i < (off_t)dir->child_count + 2; i++) {
+        struct stat st;
+        const char* name;
+        fuse_ino_t child;
+
+        if (i == 0) {
+            name = ".";
+            child = ino;
+        } else if (i == 1) {
+            name = "..";
+            child = dir->parent;
+        } else {
+            child = dir->children[i - 2];
+            name = node_get(tree, child)->name;
+        }
+
+        memset(&st, 0, sizeof(st));
+        st.st_ino = child;
+        st.st_mode = node_get(tree, child)->is_directory ? S_IFDIR : S_IFREG;
+
+        size_t entry_size = fuse_add_direntry(req, buffer + used, size - used, name, &st, i + 1);
+        if (entry_size > size - used) break;
+        used += entry_size;
+    }
+
+    fuse_reply_buf(req, buffer, used);
+    free(buffer);
+}
+
+static void mount_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    MountTree* tree = fuse_req_userdata(req);
+    MountNode* node = node_get(tree, ino);
+
+    if (!node) {
+        fuse_reply_err(req, ENOENT);
+    } else if (node->is_directory) {
+        fuse_reply_err(req, EISDIR);
+    } else if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+        fuse_reply_err(req, EROFS);
+    } else {
+        fi->keep_cache = 1;
+        fuse_reply_open(req, fi);
+    }
+}
+
+static void mount_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                       struct fuse_file_info* fi) {
+    MountTree* tree = fuse_req_userdata(req);
+    MountNode* node = node_get(tree, ino);
+
+    (void)fi;
+    if (!node || node->is_directory) {
+        fuse_reply_err(req, EISDIR);
+        return;
+    }
+
+    if ((uint64_t)off >= node->size) {
+        fuse_reply_buf(req, NULL, 0);
+        return;
+    }
+    if (size > node->size - off) size = node->size - off;
+
+    // Let libfuse splice from the image instead of copying through us
+    struct fuse_bufvec buf = FUSE_BUFVEC_INIT(size);
+    buf.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+    buf.buf[0].fd = tree->image_fd;
+    buf.buf[0].pos = node->offset + off;
+    fuse_reply_data(req, &buf, FUSE_BUF_SPLICE_MOVE);
+}
+
+static void mount_statfs(fuse_req_t req, fuse_ino_t ino) {
+    MountTree* tree = fuse_req_userdata(req);
+    struct statvfs st;
+    uint64_t blocks = 0;
+
+    (void)ino;
+    for (size_t i = 0; i < tree->node_count; i++) {
+        blocks += (tree->nodes[i].size + MOUNT_SECTOR_SIZE - 1) / MOUNT_SECTOR_SIZE;
+    }
+
+    memset(&st, 0, sizeof(st));
+    st.f_bsize = MOUNT_SECTOR_SIZE;
+    st.f_frsize = MOUNT_SECTOR_SIZE;
+    st.f_blocks = blocks;
+    st.f_files = tree->node_count;
+    st.f_namemax = 255;
+    fuse_reply_statfs(req, &st);
+}
+
+static const struct fuse_lowlevel_ops mount_ops = {
+    .lookup = mount_lookup,
+    .getattr = mount_getattr,
+    .readdir = mount_readdir,
+    .open = mount_open,
+    .read = mount_read,
+    .statfs = mount_statfs,
+};
+
+// The first non-option argument is the image; the rest go to libfuse
+static int parse_arg(void* data, const char* arg, int key, struct fuse_args* outargs) {
+    const char** image_path = data;
+
+    (void)outargs;
+    if (key == FUSE_OPT_KEY_NONOPT && !*image_path) {
+        *image_path = arg;
+        return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    struct fuse_cmdline_opts opts;
+    const char* image_path = NULL;
+    MountTree tree;
+    int result = 1;
+
+    memset(&tree, 0, sizeof(tree));
+    tree.image_fd = -1;
+
+    if (fuse_opt_parse(&args, &image_path, NULL, parse_arg) != 0 ||
+        fuse_parse_cmdline(&args, &opts) != 0) {
+        return 2;
+    }
+    if (opts.show_help || !image_path || !opts.mountpoint) {
+        printf("Usage: %s [options] <image> <mountpoint>\n\n", argv[0]);
+        fuse_cmdline_help();
+        fuse_lowlevel_help();
+        result = opts.show_help ? 0 : 2;
+        goto out_args;
+    }
+    if (opts.show_version) {
+        fuse_lowlevel_version();
+        result = 0;
+        goto out_args;
+    }
+
+    xiso_set_debug(false);
+    if (!xiso_init()) {
+        fprintf(stderr, "xiso-mount: %s\n", xiso_get_last_error());
+        goto out_tree;
+    }
+    if (!tree_load(&tree, image_path)) {
+        xiso_cleanup();
+        goto out_tree;
+    }
+    xiso_cleanup();
+
+    fuse_opt_add_arg(&args, "-oro");
+    fuse_opt_add_arg(&args, "-ofsname=xiso");
+    struct fuse_session* se = fuse_session_new(&args, &mount_ops, sizeof(mount_ops), &tree);
+    if (!se) goto out_tree;
+
+    if (fuse_set_signal_handlers(se) == 0) {
+        if (fuse_session_mount(se, opts.mountpoint) == 0) {
+            fuse_daemonize(opts.foreground);
+            result = opts.singlethread ? fuse_session_loop(se)
+                                       : fuse_session_loop_mt(se, opts.clone_fd);
+            result = result ? 1 : 0;
+            fuse_session_unmount(se);
+        }
+        fuse_remove_signal_handlers(se);
+    }
+    fuse_session_destroy(se);
+
+out_tree:
+    tree_free(&tree);
+out_args:
+    free(opts.mountpoint);
+    fuse_opt_free_args(&args);
+    return result;
+}
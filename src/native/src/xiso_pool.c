@@ -0,0 +1,180 @@
+#include "xiso_internal.h"
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+// Size classes are powers of two from 64KB up to 64MB
+#define POOL_MIN_SHIFT      16
+#define POOL_NUM_CLASSES    11
+#define POOL_SLOTS          32
+#define POOL_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+typedef struct {
+    _Atomic(void*) slots[POOL_SLOTS];
+} PoolClass;
+
+static PoolClass classes[POOL_NUM_CLASSES];
+static atomic_size_t pool_limit = 0;
+static atomic_bool huge_pages = false;
+
+static atomic_size_t bytes_allocated = 0;
+static atomic_size_t bytes_cached = 0;
+static atomic_size_t high_water = 0;
+static atomic_size_t in_use = 0;
+static atomic_uint_fast64_t allocations = 0;
+static atomic_uint_fast64_t checkouts = 0;
+
+static int size_class(size_t size) {
+    size_t class_size = (size_t)1 << POOL_MIN_SHIFT;
+    for (int i = 0; i < POOL_NUM_CLASSES; i++, class_size <<= 1) {
+        if (size <= class_size) return i;
+    }
+    return -1;
+}
+
+static size_t class_bytes(int cls, size_t size) {
+    return cls < 0 ? size : (size_t)1 << (POOL_MIN_SHIFT + cls);
+}
+
+static void* take_cached(int cls) {
+    for (int i = 0; i < POOL_SLOTS; i++) {
+        if (!atomic_load_explicit(&classes[cls].slots[i], memory_order_relaxed)) continue;
+
+        void* buf = atomic_exchange(&classes[cls].slots[i], NULL);
+        if (buf) return buf;
+    }
+    return NULL;
+}
+
+static bool put_cached(int cls, void* buf) {
+    for (int i = 0; i < POOL_SLOTS; i++) {
+        void* expected = NULL;
+        if (atomic_compare_exchange_strong(&classes[cls].slots[i], &expected, buf)) return true;
+    }
+    return false;
+}
+
+static void free_buffer(void* buf, size_t bytes) {
+    free(buf);
+    atomic_fetch_sub(&bytes_allocated, bytes);
+}
+
+// Drops cached buffers until at least want bytes are released (0 drops all)
+static size_t drop_cached(size_t want) {
+    size_t released = 0;
+
+    for (int cls = POOL_NUM_CLASSES - 1; cls >= 0; cls--) {
+        size_t bytes = class_bytes(cls, 0);
+        void* buf;
+        while ((buf = take_cached(cls)) != NULL) {
+            atomic_fetch_sub(&bytes_cached, bytes);
+            free_buffer(buf, bytes);
+            released += bytes;
+            if (want && released >= want) return released;
+        }
+    }
+    return released;
+}
+
+static bool reserve(size_t bytes) {
+    size_t limit = atomic_load(&pool_limit);
+    size_t total = atomic_fetch_add(&bytes_allocated, bytes) + bytes;
+
+    if (limit && total > limit) {
+        drop_cached(total - limit);
+        total = atomic_load(&bytes_allocated);
+        if (total > limit) {
+            atomic_fetch_sub(&bytes_allocated, bytes);
+            return false;
+        }
+    }
+
+    size_t peak = atomic_load(&high_water);
+    while (total > peak && !atomic_compare_exchange_weak(&high_water, &peak, total)) {
+    }
+    return true;
+}
+
+void* pool_acquire(size_t size) {
+    int cls = size_class(size);
+    size_t bytes = class_bytes(cls, size);
+    void* buf = NULL;
+
+    atomic_fetch_add_explicit(&checkouts, 1, memory_order_relaxed);
+
+    if (cls >= 0 && (buf = take_cached(cls)) != NULL) {
+        atomic_fetch_sub(&bytes_cached, bytes);
+        atomic_fetch_add(&in_use, 1);
+        return buf;
+    }
+
+    if (!reserve(bytes)) {
+        set_error("Buffer pool limit of %zu bytes reached", atomic_load(&pool_limit));
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    bool huge = atomic_load(&huge_pages) && bytes >= POOL_HUGE_PAGE_SIZE;
+    size_t alignment = huge ? POOL_HUGE_PAGE_SIZE : XISO_IO_ALIGNMENT;
+    if (posix_memalign(&buf, alignment, bytes) != 0) {
+        atomic_fetch_sub(&bytes_allocated, bytes);
+        set_error("Failed to allocate %zu byte buffer", bytes);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (huge) {
+        madvise(buf, bytes, MADV_HUGEPAGE);
+    }
+#endif
+
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    atomic_fetch_add(&in_use, 1);
+    return buf;
+}
+
+void pool_release(void* buf, size_t size) {
+    if (!buf) return;
+
+    int cls = size_class(size);
+    size_t bytes = class_bytes(cls, size);
+
+    atomic_fetch_sub(&in_use, 1);
+    if (cls >= 0 && put_cached(cls, buf)) {
+        atomic_fetch_add(&bytes_cached, bytes);
+        return;
+    }
+    free_buffer(buf, bytes);
+}
+
+void pool_trim(void) {
+    drop_cached(0);
+}
+
+void xiso_set_buffer_pool_limit(size_t bytes) {
+    atomic_store(&pool_limit, bytes);
+    if (bytes && atomic_load(&bytes_allocated) > bytes) {
+        drop_cached(atomic_load(&bytes_allocated) - bytes);
+    }
+}
+
+void xiso_set_huge_pages(bool enable) {
+    atomic_store(&huge_pages, enable);
+}
+
+void xiso_get_buffer_pool_stats(XisoBufferPoolStats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->limit = atomic_load(&pool_limit);
+    stats->bytes_allocated = atomic_load(&bytes_allocated);
+    stats->bytes_cached = atomic_load(&bytes_cached);
+    stats->high_water = atomic_load(&high_water);
+    stats->in_use = atomic_load(&in_use);
+    stats->allocations = atomic_load(&allocations);
+    stats->checkouts = atomic_load(&checkouts);
+}
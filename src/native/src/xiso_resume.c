@@ -0,0 +1,356 @@
+#include "xiso_internal.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The journal starts with the magic and the identity of the image being
+// extracted, then holds batches of records, one per checkpoint:
+//   u8 RESUME_RECORD, u64 offset, u32 size, u32 committed, u16 length, path
+// closed by u8 RESUME_COMMIT and the XXH64 of the batch. A batch cut short
+// by a crash fails the check and is dropped along with anything after it.
+#define RESUME_MAGIC        "XISORSM1"
+#define RESUME_MAGIC_LENGTH 8
+#define RESUME_RECORD_SIZE  19
+
+enum {
+    RESUME_RECORD = 1,
+    RESUME_COMMIT,
+};
+
+// Written data is synced and journaled once this much has accumulated, or
+// this long has passed
+#define RESUME_CHECKPOINT_BYTES (256ull * 1024 * 1024)
+#define RESUME_CHECKPOINT_NS    (2ull * 1000000000)
+
+typedef struct {
+    char* path;
+    uint64_t offset;             // extent in the image
+    uint32_t size;
+    uint32_t committed;          // bytes synced and journaled
+    uint32_t written;            // bytes written so far
+} ResumeEntry;
+
+struct Resume {
+    pthread_mutex_t lock;
+    int fd;
+    int sync_fd;
+    ResumeEntry* entries;
+    size_t count;
+    size_t capacity;
+    size_t* slots;               // open addressing over entries, index + 1
+    size_t slot_count;
+    uint64_t unsynced;
+    uint64_t last_checkpoint;
+};
+
+static size_t find_slot(const Resume* resume, const char* path, size_t length) {
+    size_t mask = resume->slot_count - 1;
+    size_t slot = (size_t)hash64(path, length) & mask;
+
+    while (resume->slots[slot] &&
+           strcmp(resume->entries[resume->slots[slot] - 1].path, path) != 0) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static bool grow_slots(Resume* resume) {
+    size_t slot_count = resume->slot_count ? resume->slot_count * 2 : 1024;
+    size_t* slots = calloc(slot_count, sizeof(size_t));
+    if (!slots) return false;
+
+    free(resume->slots);
+    resume->slots = slots;
+    resume->slot_count = slot_count;
+    for (size_t i = 0; i < resume->count; i++) {
+        const char* path = resume->entries[i].path;
+        resume->slots[find_slot(resume, path, strlen(path))] = i + 1;
+    }
+    return true;
+}
+
+// Finds or adds the entry for path
+static long lookup(Resume* resume, const char* path) {
+    size_t length = strlen(path);
+
+    if ((resume->count + 1) * 2 > resume->slot_count && !grow_slots(resume)) {
+        return -1;
+    }
+    size_t slot = find_slot(resume, path, length);
+    if (resume->slots[slot]) {
+        return (long)resume->slots[slot] - 1;
+    }
+
+    if (resume->count == resume->capacity) {
+        size_t capacity = resume->capacity ? resume->capacity * 2 : 1024;
+        ResumeEntry* grown = realloc(resume->entries, capacity * sizeof(ResumeEntry));
+        if (!grown) return -1;
+        resume->entries = grown;
+        resume->capacity = capacity;
+    }
+
+    ResumeEntry* entry = &resume->entries[resume->count];
+    memset(entry, 0, sizeof(*entry));
+    entry->path = strdup(path);
+    if (!entry->path) return -1;
+    resume->slots[slot] = resume->count + 1;
+    return (long)resume->count++;
+}
+
+// Journal traffic goes around the io_ wrappers, so the byte counters only
+// cover file data
+static bool read_full(int fd, void* data, size_t length) {
+    char* p = data;
+    while (length > 0) {
+        ssize_t n = read(fd, p, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        length -= n;
+    }
+    return true;
+}
+
+static bool journal_write(int fd, const void* data, size_t length) {
+    const char* p = data;
+    while (length > 0) {
+        ssize_t n = write(fd, p, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        length -= n;
+    }
+    return true;
+}
+
+// Reads one batch into a scratch list, only applying it once its hash checks out
+static bool load_batch(Resume* resume, int fd) {
+    uint8_t header[RESUME_RECORD_SIZE];
+    char path[XISO_FILENAME_MAX_LENGTH * 64];
+    ResumeEntry* batch = NULL;
+    size_t count = 0, capacity = 0;
+    Hash64 state;
+    bool ok = false;
+
+    hash64_init(&state);
+    for (;;) {
+        if (!read_full(fd, header, 1)) break;
+        if (header[0] == RESUME_COMMIT) {
+            uint64_t stored;
+            ok = read_full(fd, &stored, sizeof(stored)) && stored == hash64_final(&state);
+            break;
+        }
+        if (header[0] != RESUME_RECORD || !read_full(fd, header + 1, sizeof(header) - 1)) break;
+
+        uint16_t length;
+        memcpy(&length, header + 17, 2);
+        if (length >= sizeof(path) || !read_full(fd, path, length)) break;
+        path[length] = '\0';
+        hash64_update(&state, header, sizeof(header));
+        hash64_update(&state, path, length);
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            ResumeEntry* grown = realloc(batch, capacity * sizeof(ResumeEntry));
+            if (!grown) break;
+            batch = grown;
+        }
+        ResumeEntry* entry = &batch[count];
+        memcpy(&entry->offset, header + 1, 8);
+        memcpy(&entry->size, header + 9, 4);
+        memcpy(&entry->committed, header + 13, 4);
+        entry->path = strdup(path);
+        if (!entry->path) break;
+        count++;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        long index = ok ? lookup(resume, batch[i].path) : -1;
+        if (index >= 0) {
+            ResumeEntry* entry = &resume->entries[index];
+            entry->offset = batch[i].offset;
+            entry->size = batch[i].size;
+            entry->committed = entry->written = batch[i].committed;
+        }
+        free(batch[i].path);
+    }
+    free(batch);
+    return ok;
+}
+
+Resume* resume_open(const char* path, int sync_fd, const void* identity, size_t identity_length) {
+    Resume* resume = calloc(1, sizeof(*resume));
+    uint8_t* header = malloc(RESUME_MAGIC_LENGTH + identity_length);
+    if (!resume || !header) {
+        free(resume);
+        free(header);
+        set_error("Failed to allocate resume journal");
+        return NULL;
+    }
+    pthread_mutex_init(&resume->lock, NULL);
+    resume->last_checkpoint = xiso_now_ns();
+
+    // Kept for syncfs(), which only needs some file on the output filesystem
+    resume->sync_fd = dup(sync_fd);
+    resume->fd = resume->sync_fd == -1 ? -1 : io_open(path, O_RDWR | O_CREAT | O_BINARY, 0644);
+    if (resume->fd == -1) {
+        set_error("Failed to open resume journal: %s (%s)", path, strerror(errno));
+        free(header);
+        resume_close(resume);
+        return NULL;
+    }
+
+    // A journal for another image (or none) starts over
+    uint64_t valid = 0;
+    if (read_full(resume->fd, header, RESUME_MAGIC_LENGTH + identity_length) &&
+        memcmp(header, RESUME_MAGIC, RESUME_MAGIC_LENGTH) == 0 &&
+        memcmp(header + RESUME_MAGIC_LENGTH, identity, identity_length) == 0) {
+        valid = RESUME_MAGIC_LENGTH + identity_length;
+        while (load_batch(resume, resume->fd)) {
+            valid = (uint64_t)io_lseek(resume->fd, 0, SEEK_CUR);
+        }
+        DEBUG_PRINT("Resume journal lists %zu files\n", resume->count);
+    } else {
+        memcpy(header, RESUME_MAGIC, RESUME_MAGIC_LENGTH);
+        memcpy(header + RESUME_MAGIC_LENGTH, identity, identity_length);
+    }
+
+    // Later writes append after the last intact batch
+    bool ok = ftruncate(resume->fd, valid) == 0 && io_lseek(resume->fd, valid, SEEK_SET) == (off_t)valid;
+    if (ok && valid == 0) {
+        ok = journal_write(resume->fd, header, RESUME_MAGIC_LENGTH + identity_length);
+    }
+    free(header);
+    if (!ok) {
+        set_error("Failed to write resume journal: %s (%s)", path, strerror(errno));
+        resume_close(resume);
+        return NULL;
+    }
+    return resume;
+}
+
+long resume_start(Resume* resume, const char* rel_path, uint64_t offset, uint32_t size, uint32_t* committed) {
+    pthread_mutex_lock(&resume->lock);
+    long index = lookup(resume, rel_path);
+    if (index >= 0) {
+        ResumeEntry* entry = &resume->entries[index];
+        // Progress recorded for a different extent doesn't apply
+        if (entry->offset != offset || entry->size != size) {
+            entry->offset = offset;
+            entry->size = size;
+            entry->committed = entry->written = 0;
+        }
+        *committed = entry->committed;
+    }
+    pthread_mutex_unlock(&resume->lock);
+
+    if (index < 0) set_error("Failed to allocate resume journal entry");
+    return index;
+}
+
+// Called with the lock held. Everything written so far is made durable
+// first, so the journal never claims more than the disk has.
+static bool checkpoint(Resume* resume) {
+    uint8_t* batch = NULL;
+    size_t length = 0, capacity = 0;
+    Hash64 state;
+
+    uint64_t span = trace_begin();
+#if defined(__linux__)
+    if (syncfs(resume->sync_fd) != 0) {
+        set_error("Failed to sync extracted files (%s)", strerror(errno));
+        return false;
+    }
+#else
+    sync();
+#endif
+
+    hash64_init(&state);
+    for (size_t i = 0; i < resume->count; i++) {
+        ResumeEntry* entry = &resume->entries[i];
+        if (entry->written == entry->committed) continue;
+
+        uint16_t path_length = (uint16_t)strlen(entry->path);
+        size_t need = length + RESUME_RECORD_SIZE + path_length + 1 + sizeof(uint64_t);
+        if (need > capacity) {
+            capacity = need * 2 > 65536 ? need * 2 : 65536;
+            uint8_t* grown = realloc(batch, capacity);
+            if (!grown) {
+                free(batch);
+                set_error("Failed to allocate resume journal batch");
+                return false;
+            }
+            batch = grown;
+        }
+
+        uint8_t* record = batch + length;
+        record[0] = RESUME_RECORD;
+        memcpy(record + 1, &entry->offset, 8);
+        memcpy(record + 9, &entry->size, 4);
+        memcpy(record + 13, &entry->written, 4);
+        memcpy(record + 17, &path_length, 2);
+        memcpy(record + RESUME_RECORD_SIZE, entry->path, path_length);
+        hash64_update(&state, record, RESUME_RECORD_SIZE + path_length);
+        length += RESUME_RECORD_SIZE + path_length;
+        entry->committed = entry->written;
+    }
+
+    bool ok = true;
+    if (length) {
+        uint64_t hash = hash64_final(&state);
+        batch[length] = RESUME_COMMIT;
+        memcpy(batch + length + 1, &hash, sizeof(hash));
+        length += 1 + sizeof(hash);
+
+        ok = journal_write(resume->fd, batch, length) && fdatasync(resume->fd) == 0;
+        if (!ok) set_error("Failed to write resume journal (%s)", strerror(errno));
+    }
+    free(batch);
+
+    resume->unsynced = 0;
+    resume->last_checkpoint = xiso_now_ns();
+    trace_end(span, "checkpoint", NULL);
+    return ok;
+}
+
+bool resume_written(Resume* resume, long index, uint32_t written) {
+    bool ok = true;
+
+    pthread_mutex_lock(&resume->lock);
+    ResumeEntry* entry = &resume->entries[index];
+    if (written > entry->written) {
+        resume->unsynced += written - entry->written;
+    }
+    entry->written = written;
+
+    // Data the journal vouches for is about to be rewritten, so it has to
+    // stop vouching for it first
+    if (written < entry->committed || resume->unsynced >= RESUME_CHECKPOINT_BYTES ||
+        xiso_now_ns() - resume->last_checkpoint >= RESUME_CHECKPOINT_NS) {
+        ok = checkpoint(resume);
+    }
+    pthread_mutex_unlock(&resume->lock);
+    return ok;
+}
+
+bool resume_close(Resume* resume) {
+    bool ok = true;
+
+    if (resume->fd != -1) {
+        pthread_mutex_lock(&resume->lock);
+        ok = checkpoint(resume);
+        pthread_mutex_unlock(&resume->lock);
+        close(resume->fd);
+    }
+    if (resume->sync_fd != -1) close(resume->sync_fd);
+
+    for (size_t i = 0; i < resume->count; i++) {
+        free(resume->entries[i].path);
+    }
+    free(resume->entries);
+    free(resume->slots);
+    pthread_mutex_destroy(&resume->lock);
+    free(resume);
+    return ok;
+}
@@ -0,0 +1,288 @@
+#include "xiso_internal.h"
+#include <errno.h>
+#include <pthread.h>
+#include <regex.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Files are searched in pieces so large files spread over the workers too.
+// Each piece is read with some context on either side: matches are
+// reported by the piece holding their first byte, and a regex sees up to
+// SEARCH_CONTEXT bytes before the piece so it doesn't restart mid-match.
+#define SEARCH_PIECE_SIZE (4 * 1024 * 1024)
+#define SEARCH_CONTEXT    4096
+
+typedef struct {
+    int iso_fd;
+    uint64_t partition_offset;
+    const char* pattern;
+    size_t pattern_length;
+    bool use_regex;
+    regex_t regex;
+    JobQueue* workers;
+    pthread_mutex_t lock;        // serializes callbacks
+    XisoSearchCallback callback;
+    void* user_data;
+    bool stopped;
+    bool failed;
+} Search;
+
+typedef struct {
+    Search* search;
+    char* path;                  // shared by a file's pieces, freed by the last
+    int* path_refs;
+    uint64_t extent;             // absolute offset of the file in the image
+    uint32_t file_size;
+    uint32_t start;              // piece within the file
+    uint32_t end;
+} SearchJob;
+
+static bool report(Search* search, const char* path, uint64_t offset, const uint8_t* match, size_t length) {
+    XisoSearchHit hit = { path, offset, match, length };
+
+    pthread_mutex_lock(&search->lock);
+    if (!search->stopped && !search->callback(&hit, search->user_data)) {
+        search->stopped = true;
+    }
+    bool more = !search->stopped;
+    pthread_mutex_unlock(&search->lock);
+    return more;
+}
+
+// Literal search leans on memmem(), which libc implementations vectorize
+static bool search_literal(SearchJob* job, const uint8_t* data, size_t length, uint64_t base) {
+    Search* search = job->search;
+    const uint8_t* p = data;
+    const uint8_t* end = data + length;
+
+    while ((size_t)(end - p) >= search->pattern_length) {
+        const uint8_t* hit = memmem(p, end - p, search->pattern, search->pattern_length);
+        if (!hit) break;
+        uint64_t offset = base + (uint64_t)(hit - data);
+        if (offset >= job->end) break;
+        if (offset >= job->start && !report(search, job->path, offset, hit, search->pattern_length)) {
+            return false;
+        }
+        p = hit + 1;
+    }
+    return true;
+}
+
+// Runs the regex over data[from, to), which must be NUL-terminated at to
+// unless REG_STARTEND lets the engine step over NUL bytes itself
+static bool search_span(SearchJob* job, const uint8_t* data, size_t from, size_t to, uint64_t base) {
+    Search* search = job->search;
+    regmatch_t match;
+
+    while (from < to) {
+        int flags = from > 0 && data[from - 1] != '\n' ? REG_NOTBOL : 0;
+#if defined(REG_STARTEND)
+        match.rm_so = 0;
+        match.rm_eo = (regoff_t)(to - from);
+        flags |= REG_STARTEND;
+#endif
+        if (regexec(&search->regex, (const char*)data + from, 1, &match, flags) != 0) break;
+
+        uint64_t offset = base + from + (uint64_t)match.rm_so;
+        if (offset >= job->end) return true;
+        size_t length = (size_t)(match.rm_eo - match.rm_so);
+        if (offset >= job->start && !report(search, job->path, offset, data + from + match.rm_so, length)) {
+            return false;
+        }
+        // Empty matches still have to move the search along
+        from += (size_t)match.rm_eo + (length == 0);
+    }
+    return true;
+}
+
+static bool search_regex(SearchJob* job, uint8_t* data, size_t length, uint64_t base) {
+    data[length] = '\0';
+#if defined(REG_STARTEND)
+    return search_span(job, data, 0, length, base);
+#else
+    // Without REG_STARTEND each NUL-terminated run is searched on its own
+    for (size_t from = 0; from < length;) {
+        size_t to = from + strlen((const char*)data + from);
+        if (to > from && !search_span(job, data, from, to, base)) return false;
+        from = to + 1;
+    }
+    return true;
+#endif
+}
+
+static void run_search_job(void* arg) {
+    SearchJob* job = arg;
+    Search* search = job->search;
+
+    if (__atomic_load_n(&search->failed, __ATOMIC_ACQUIRE) ||
+        __atomic_load_n(&search->stopped, __ATOMIC_ACQUIRE)) {
+        goto done;
+    }
+    if (operation_cancelled()) {
+        __atomic_store_n(&search->failed, true, __ATOMIC_RELEASE);
+        goto done;
+    }
+
+    uint64_t span = trace_begin();
+    size_t before = search->use_regex ? SEARCH_CONTEXT : 0;
+    size_t after = search->use_regex ? SEARCH_CONTEXT : search->pattern_length - 1;
+    uint64_t from = job->start > before ? job->start - before : 0;
+    uint64_t to = (uint64_t)job->end + after < job->file_size ? (uint64_t)job->end + after : job->file_size;
+    size_t length = (size_t)(to - from);
+
+    // One spare byte for the regex terminator
+    uint8_t* buffer = pool_acquire(length + 1);
+    if (!buffer) {
+        set_error("Failed to allocate search buffer");
+        __atomic_store_n(&search->failed, true, __ATOMIC_RELEASE);
+        goto done;
+    }
+    ssize_t bytes_read = io_pread(search->iso_fd, buffer, length, job->extent + from);
+    if (bytes_read != (ssize_t)length) {
+        if (bytes_read < 0) {
+            set_error("Failed to read file data: %s (%s)", job->path, strerror(errno));
+        } else {
+            set_error("Failed to read file data: %s (unexpected end of image at 0x%llx)", job->path,
+                      (unsigned long long)(job->extent + from + (uint64_t)bytes_read));
+        }
+        __atomic_store_n(&search->failed, true, __ATOMIC_RELEASE);
+    } else if (search->use_regex) {
+        search_regex(job, buffer, length, from);
+    } else {
+        search_literal(job, buffer, length, from);
+    }
+    pool_release(buffer, length + 1);
+    trace_end(span, "search", job->path);
+
+done:
+    if (__atomic_sub_fetch(job->path_refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(job->path);
+        free(job->path_refs);
+    }
+    free(job);
+}
+
+static bool search_entry(const XisoEntryInfo* info, void* user_data) {
+    Search* search = user_data;
+
+    if (__atomic_load_n(&search->failed, __ATOMIC_ACQUIRE) ||
+        __atomic_load_n(&search->stopped, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    if (info->is_directory || info->size == 0) return true;
+
+    uint32_t size = (uint32_t)info->size;
+    // Rounded up in 64 bits: sizes near 4GB would wrap in 32
+    uint32_t pieces = (uint32_t)(((uint64_t)size + SEARCH_PIECE_SIZE - 1) / SEARCH_PIECE_SIZE);
+    char* path = strdup(info->path);
+    int* refs = malloc(sizeof(int));
+    if (!path || !refs) {
+        free(path);
+        free(refs);
+        set_error("Failed to allocate search job");
+        __atomic_store_n(&search->failed, true, __ATOMIC_RELEASE);
+        return false;
+    }
+    *refs = (int)pieces;
+
+    uint64_t extent = search->partition_offset + (uint64_t)info->start_sector * XISO_SECTOR_SIZE;
+    for (uint32_t p = 0; p < pieces; p++) {
+        SearchJob* job = malloc(sizeof(*job));
+        if (!job) {
+            // The pieces never submitted still hold references
+            if (__atomic_sub_fetch(refs, (int)(pieces - p), __ATOMIC_ACQ_REL) == 0) {
+                free(path);
+                free(refs);
+            }
+            set_error("Failed to allocate search job");
+            __atomic_store_n(&search->failed, true, __ATOMIC_RELEASE);
+            return false;
+        }
+        uint32_t start = p * SEARCH_PIECE_SIZE;
+        uint32_t end = size - start > SEARCH_PIECE_SIZE ? start + SEARCH_PIECE_SIZE : size;
+        *job = (SearchJob){ search, path, refs, extent, size, start, end };
+        jobs_submit(search->workers, run_search_job, job);
+    }
+    return true;
+}
+
+bool xiso_search(const char* iso_path, const char* pattern, unsigned flags,
+                 XisoSearchCallback callback, void* user_data) {
+    XisoImageInfo info;
+    Search search;
+
+    operation_begin();
+    if (!pattern[0]) {
+        set_error("Empty search pattern");
+        return false;
+    }
+
+    memset(&search, 0, sizeof(search));
+    search.iso_fd = -1;
+    search.pattern = pattern;
+    search.pattern_length = strlen(pattern);
+    search.callback = callback;
+    search.user_data = user_data;
+
+    // Case-insensitive literals go through the regex engine, escaped
+    search.use_regex = (flags & (XISO_SEARCH_REGEX | XISO_SEARCH_IGNORE_CASE)) != 0;
+    if (search.use_regex) {
+        char* expression = (char*)pattern;
+        if (!(flags & XISO_SEARCH_REGEX)) {
+            expression = malloc(search.pattern_length * 2 + 1);
+            if (!expression) {
+                set_error("Failed to allocate search pattern");
+                return false;
+            }
+            char* out = expression;
+            for (const char* p = pattern; *p; p++) {
+                if (strchr("\\^$.[]|()*+?{}", *p)) *out++ = '\\';
+                *out++ = *p;
+            }
+            *out = '\0';
+        }
+
+        int cflags = REG_EXTENDED | REG_NEWLINE | (flags & XISO_SEARCH_IGNORE_CASE ? REG_ICASE : 0);
+        int result = regcomp(&search.regex, expression, cflags);
+        if (expression != pattern) free(expression);
+        if (result != 0) {
+            char message[256];
+            regerror(result, &search.regex, message, sizeof(message));
+            set_error("Invalid pattern: %s (%s)", pattern, message);
+            return false;
+        }
+    }
+    pthread_mutex_init(&search.lock, NULL);
+
+    DEBUG_PRINT("Searching %s for %s\n", iso_path, pattern);
+    bool success = xiso_stat(iso_path, &info);
+    if (success) {
+        search.partition_offset = info.partition_offset;
+        search.iso_fd = image_open(iso_path, O_RDONLY | O_BINARY);
+        if (search.iso_fd == -1) {
+            set_error("Failed to open ISO file: %s (%s)", iso_path, strerror(errno));
+            success = false;
+        }
+    }
+    if (success) {
+        search.workers = jobs_borrow(extract_threads, extract_threads * 4, "search");
+        success = search.workers != NULL;
+    }
+
+    if (success) {
+        success = xiso_walk(iso_path, search_entry, &search);
+        jobs_wait(search.workers);
+        if (__atomic_load_n(&search.failed, __ATOMIC_ACQUIRE)) {
+            success = false;
+        } else if (search.stopped) {
+            // Stopping early is how callers cap the number of hits
+            success = true;
+        }
+    }
+
+    jobs_return(search.workers);
+    if (search.iso_fd != -1) image_close(search.iso_fd);
+    if (search.use_regex) regfree(&search.regex);
+    pthread_mutex_destroy(&search.lock);
+    return success;
+}
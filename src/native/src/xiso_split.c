@@ -0,0 +1,269 @@
+#include "xiso_internal.h"
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// Images copied off FATX volumes, or anything else that caps files at 4GB,
+// come in numbered parts: name.1.iso, name.2.iso and so on. Opening the
+// first part, or the name without a number, yields one descriptor for the
+// whole set. It is the first part's own descriptor, registered here so the
+// io_ wrappers can tell it apart and send each read to the part holding it.
+#define SPLIT_MAX_PARTS 64
+#define SPLIT_MAX_OPEN  16
+
+struct SplitImage {
+    int fds[SPLIT_MAX_PARTS];
+    uint64_t starts[SPLIT_MAX_PARTS + 1];  // starts[count] is the whole size
+    unsigned count;
+    uint64_t position;                     // for io_read() and io_lseek()
+};
+
+// Slots hold fd + 1 so the zeroed table is empty
+static struct {
+    int key;
+    SplitImage* image;
+} open_images[SPLIT_MAX_OPEN];
+static pthread_mutex_t split_lock = PTHREAD_MUTEX_INITIALIZER;
+unsigned split_open_count = 0;
+
+// Path of part n, false if it doesn't fit
+static bool part_path(char* out, size_t size, const char* prefix, unsigned n, const char* extension) {
+    int length = snprintf(out, size, "%s.%u%s", prefix, n, extension);
+    return length > 0 && (size_t)length < size;
+}
+
+// Works out the part naming for path: the prefix before ".N" and the
+// extension after it. Returns false for anything that isn't a split set.
+static bool split_prefix(const char* path, char* prefix, size_t size, const char** extension) {
+    struct stat st;
+    char part[PATH_MAX];
+    size_t length = strlen(path);
+
+    if (length < 5 || strcasecmp(path + length - 4, ".iso") != 0 || length >= size) return false;
+    *extension = path + length - 4;
+    length -= 4;
+
+    if (length > 2 && strncmp(path + length - 2, ".1", 2) == 0) {
+        // name.1.iso is only the first of several if name.2.iso is there
+        snprintf(prefix, size, "%.*s", (int)(length - 2), path);
+        return part_path(part, sizeof(part), prefix, 2, *extension) && stat(part, &st) == 0;
+    }
+
+    // name.iso stands for the set only when there is no such file
+    if (stat(path, &st) == 0) return false;
+    snprintf(prefix, size, "%.*s", (int)length, path);
+    return part_path(part, sizeof(part), prefix, 1, *extension) && stat(part, &st) == 0;
+}
+
+static void split_free(SplitImage* image) {
+    for (unsigned i = 0; i < image->count; i++) {
+        close(image->fds[i]);
+    }
+    free(image);
+}
+
+static SplitImage* split_load(const char* prefix, const char* extension, int flags) {
+    SplitImage* image = calloc(1, sizeof(*image));
+    char part[PATH_MAX];
+    struct stat st;
+
+    if (!image) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    for (unsigned n = 1;; n++) {
+        if (!part_path(part, sizeof(part), prefix, n, extension)) {
+            errno = ENAMETOOLONG;
+            goto fail;
+        }
+        int fd = io_open(part, flags, 0);
+        if (fd == -1) {
+            if (errno == ENOENT && n > 1) break;
+            goto fail;
+        }
+        if (image->count == SPLIT_MAX_PARTS) {
+            close(fd);
+            errno = EFBIG;
+            goto fail;
+        }
+        image->fds[image->count++] = fd;
+        if (fstat(fd, &st) != 0) goto fail;
+        image->starts[image->count] = image->starts[image->count - 1] + (uint64_t)st.st_size;
+    }
+
+    DEBUG_PRINT("Split image %s.*%s: %u parts, %llu bytes\n", prefix, extension, image->count,
+                (unsigned long long)image->starts[image->count]);
+    return image;
+
+fail: {
+        int saved = errno;
+        split_free(image);
+        errno = saved;
+        return NULL;
+    }
+}
+
+bool image_is_split(const char* path) {
+    char prefix[PATH_MAX];
+    const char* extension;
+    return split_prefix(path, prefix, sizeof(prefix), &extension);
+}
+
+int image_open(const char* path, int flags) {
+    char prefix[PATH_MAX];
+    const char* extension;
+
+    if (!split_prefix(path, prefix, sizeof(prefix), &extension)) {
+        return io_open(path, flags, 0);
+    }
+    if ((flags & O_ACCMODE) != O_RDONLY) {
+        errno = EROFS;
+        return -1;
+    }
+
+    SplitImage* image = split_load(prefix, extension, flags);
+    if (!image) return -1;
+
+    pthread_mutex_lock(&split_lock);
+    int fd = -1;
+    for (unsigned i = 0; i < SPLIT_MAX_OPEN; i++) {
+        if (open_images[i].key == 0) {
+            fd = image->fds[0];
+            open_images[i].image = image;
+            __atomic_store_n(&open_images[i].key, fd + 1, __ATOMIC_RELEASE);
+            __atomic_add_fetch(&split_open_count, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&split_lock);
+
+    if (fd == -1) {
+        split_free(image);
+        errno = EMFILE;
+    }
+    return fd;
+}
+
+int image_stat(const char* path, struct stat* st) {
+    char prefix[PATH_MAX];
+    const char* extension;
+
+    if (!split_prefix(path, prefix, sizeof(prefix), &extension)) {
+        return stat(path, st);
+    }
+
+    // The first part stands in for the set, with the size of the whole
+    char part[PATH_MAX];
+    struct stat part_st;
+    if (!part_path(part, sizeof(part), prefix, 1, extension) || stat(part, st) != 0) return -1;
+    for (unsigned n = 2; n <= SPLIT_MAX_PARTS; n++) {
+        if (!part_path(part, sizeof(part), prefix, n, extension) || stat(part, &part_st) != 0) break;
+        st->st_size += part_st.st_size;
+    }
+    return 0;
+}
+
+int image_fstat(int fd, struct stat* st) {
+    if (fstat(fd, st) != 0) return -1;
+
+    SplitImage* image = split_lookup(fd);
+    if (image) st->st_size = (off_t)image->starts[image->count];
+    return 0;
+}
+
+void image_close(int fd) {
+    SplitImage* image = NULL;
+
+    if (__atomic_load_n(&split_open_count, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&split_lock);
+        for (unsigned i = 0; i < SPLIT_MAX_OPEN; i++) {
+            if (open_images[i].key == fd + 1) {
+                image = open_images[i].image;
+                __atomic_store_n(&open_images[i].key, 0, __ATOMIC_RELEASE);
+                __atomic_sub_fetch(&split_open_count, 1, __ATOMIC_RELAXED);
+                break;
+            }
+        }
+        pthread_mutex_unlock(&split_lock);
+    }
+
+    if (image) split_free(image);
+    else close(fd);
+}
+
+SplitImage* split_find(int fd) {
+    for (unsigned i = 0; i < SPLIT_MAX_OPEN; i++) {
+        if (__atomic_load_n(&open_images[i].key, __ATOMIC_ACQUIRE) == fd + 1) {
+            return open_images[i].image;
+        }
+    }
+    return NULL;
+}
+
+// Index of the part holding offset; the last part if it lies beyond the end
+static unsigned split_part(const SplitImage* image, uint64_t offset) {
+    unsigned low = 0, high = image->count - 1;
+
+    while (low < high) {
+        unsigned mid = (low + high + 1) / 2;
+        if (image->starts[mid] <= offset) low = mid;
+        else high = mid - 1;
+    }
+    return low;
+}
+
+ssize_t split_pread(SplitImage* image, void* buf, size_t length, uint64_t offset) {
+    uint8_t* p = buf;
+    size_t done = 0;
+
+    // Reads that cross a boundary carry on into the next part, so callers
+    // only see a short count at the end of the image
+    while (done < length && offset < image->starts[image->count]) {
+        unsigned i = split_part(image, offset);
+        uint64_t available = image->starts[i + 1] - offset;
+        size_t want = length - done < available ? length - done : (size_t)available;
+
+        ssize_t n = pread(image->fds[i], p + done, want, (off_t)(offset - image->starts[i]));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return done ? (ssize_t)done : -1;
+        if (n == 0) break;
+        done += (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return (ssize_t)done;
+}
+
+ssize_t split_read(SplitImage* image, void* buf, size_t length) {
+    ssize_t n = split_pread(image, buf, length, image->position);
+    if (n > 0) image->position += (uint64_t)n;
+    return n;
+}
+
+off_t split_lseek(SplitImage* image, off_t offset, int whence) {
+    int64_t base = whence == SEEK_SET ? 0 :
+                   whence == SEEK_CUR ? (int64_t)image->position :
+                   whence == SEEK_END ? (int64_t)image->starts[image->count] : -1;
+
+    if (base < 0 || (whence != SEEK_SET && whence != SEEK_CUR && whence != SEEK_END) || base + offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    image->position = (uint64_t)(base + offset);
+    return (off_t)image->position;
+}
+
+#if defined(__linux__)
+ssize_t split_copy_range(SplitImage* image, uint64_t offset, int fd_out, size_t length) {
+    if (offset >= image->starts[image->count]) return 0;
+
+    // Stops at the end of the part; callers come back for the rest
+    unsigned i = split_part(image, offset);
+    uint64_t available = image->starts[i + 1] - offset;
+    loff_t off_in = (loff_t)(offset - image->starts[i]);
+    return copy_file_range(image->fds[i], &off_in, fd_out, NULL,
+                           length < available ? length : (size_t)available, 0);
+}
+#endif
@@ -0,0 +1,85 @@
+#include "xiso_internal.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STATS_NUM_FIELDS (sizeof(XisoStats) / sizeof(uint64_t))
+
+_Thread_local XisoThreadStats* stats_tls = NULL;
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t stats_key;
+static XisoThreadStats* stats_head = NULL;
+static XisoStats stats_baseline;
+
+// Blocks of exited threads are kept, with their counts, for the next thread
+static void stats_thread_exit(void* block) {
+    pthread_mutex_lock(&stats_lock);
+    ((XisoThreadStats*)block)->active = false;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+static void stats_init_key(void) {
+    pthread_key_create(&stats_key, stats_thread_exit);
+}
+
+XisoThreadStats* stats_register(void) {
+    XisoThreadStats* t;
+
+    pthread_once(&stats_once, stats_init_key);
+    pthread_mutex_lock(&stats_lock);
+
+    for (t = stats_head; t; t = t->next) {
+        if (!t->active) break;
+    }
+    if (!t) {
+        t = calloc(1, sizeof(*t));
+        if (!t) {
+            // Counting is best effort; park the thread on a shared block
+            static XisoThreadStats overflow;
+            pthread_mutex_unlock(&stats_lock);
+            stats_tls = &overflow;
+            return &overflow;
+        }
+        t->next = stats_head;
+        stats_head = t;
+    }
+    t->active = true;
+
+    pthread_mutex_unlock(&stats_lock);
+
+    pthread_setspecific(stats_key, t);
+    stats_tls = t;
+    return t;
+}
+
+static void stats_sum(XisoStats* total) {
+    uint64_t* out = (uint64_t*)total;
+
+    memset(total, 0, sizeof(*total));
+    for (XisoThreadStats* t = stats_head; t; t = t->next) {
+        const uint64_t* in = (const uint64_t*)&t->counters;
+        for (size_t i = 0; i < STATS_NUM_FIELDS; i++) {
+            out[i] += __atomic_load_n(&in[i], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void stats_reset(void) {
+    pthread_mutex_lock(&stats_lock);
+    stats_sum(&stats_baseline);
+    pthread_mutex_unlock(&stats_lock);
+}
+
+void xiso_get_stats(XisoStats* stats) {
+    uint64_t* out = (uint64_t*)stats;
+    const uint64_t* base = (const uint64_t*)&stats_baseline;
+
+    pthread_mutex_lock(&stats_lock);
+    stats_sum(stats);
+    for (size_t i = 0; i < STATS_NUM_FIELDS; i++) {
+        out[i] -= base[i];
+    }
+    pthread_mutex_unlock(&stats_lock);
+}
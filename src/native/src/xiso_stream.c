@@ -0,0 +1,556 @@
+#include "xiso_internal.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Forward-only extraction from a pipe or other non-seekable input.
+//
+// Extents (directory tables and files) become known only once the table
+// listing them has been read, so the stream is consumed strictly in order
+// and every byte is routed to whichever known extents cover it. Bytes no
+// extent claims yet are kept in a bounded spill file while directory tables
+// are still outstanding, for images where data precedes the entry that
+// describes it. Once every table has been parsed nothing more is spilled.
+
+typedef struct {
+    uint64_t start;
+    uint32_t size;
+    uint32_t received;
+    bool is_table;
+    unsigned depth;
+    DirHandle* dir;     // table: the directory itself, file: its parent
+    char* rel_path;
+    const char* name;   // points into rel_path
+    DirTable table;     // tables only
+    int out_fd;         // files only
+} StreamExtent;
+
+// A run of skipped image bytes saved in the spill file. Runs are appended
+// in image order and merged when contiguous.
+typedef struct {
+    uint64_t image_offset;
+    uint64_t spill_offset;
+    uint64_t length;
+} SpillRun;
+
+typedef struct {
+    int in_fd;
+    uint64_t position;          // image offset of the next unconsumed byte
+    uint64_t lseek;             // partition offset of the header found
+    StreamExtent** heap;        // extents not reached yet, ordered by start
+    size_t heap_count;
+    size_t heap_capacity;
+    StreamExtent** active;      // extents the stream is currently inside
+    size_t active_count;
+    size_t active_capacity;
+    size_t tables_outstanding;
+    FILE* spill;
+    SpillRun* runs;
+    size_t run_count;
+    size_t run_capacity;
+    uint64_t spill_used;
+    bool spill_full;
+} Stream;
+
+static size_t spill_limit = 256 * 1024 * 1024; // 256MB
+
+void xiso_set_spill_limit(size_t bytes) {
+    spill_limit = bytes;
+}
+
+static ssize_t read_full(int fd, void* buffer, size_t length) {
+    size_t total = 0;
+
+    while (total < length) {
+        ssize_t n = io_read(fd, (char*)buffer + total, length - total);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) break;
+        total += n;
+    }
+    return (ssize_t)total;
+}
+
+static bool grow(void** array, size_t* capacity, size_t count, size_t item_size) {
+    if (count < *capacity) return true;
+
+    size_t new_capacity = *capacity ? *capacity * 2 : 64;
+    void* grown = realloc(*array, new_capacity * item_size);
+    if (!grown) {
+        set_error("Failed to allocate stream state");
+        return false;
+    }
+    *array = grown;
+    *capacity = new_capacity;
+    return true;
+}
+
+// Binary min-heap on start offset
+
+static bool heap_push(Stream* s, StreamExtent* e) {
+    if (!grow((void**)&s->heap, &s->heap_capacity, s->heap_count, sizeof(StreamExtent*))) {
+        return false;
+    }
+
+    size_t i = s->heap_count++;
+    while (i > 0 && s->heap[(i - 1) / 2]->start > e->start) {
+        s->heap[i] = s->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    s->heap[i] = e;
+    return true;
+}
+
+static StreamExtent* heap_pop(Stream* s) {
+    StreamExtent* top = s->heap[0];
+    StreamExtent* last = s->heap[--s->heap_count];
+    size_t i = 0;
+
+    for (;;) {
+        size_t child = i * 2 + 1;
+        if (child >= s->heap_count) break;
+        if (child + 1 < s->heap_count && s->heap[child + 1]->start < s->heap[child]->start) child++;
+        if (s->heap[child]->start >= last->start) break;
+        s->heap[i] = s->heap[child];
+        i = child;
+    }
+    if (s->heap_count) s->heap[i] = last;
+    return top;
+}
+
+static bool activate(Stream* s, StreamExtent* e) {
+    if (!grow((void**)&s->active, &s->active_capacity, s->active_count, sizeof(StreamExtent*))) {
+        return false;
+    }
+    s->active[s->active_count++] = e;
+    return true;
+}
+
+static void extent_free(StreamExtent* e) {
+    if (e->out_fd != -1) close(e->out_fd);
+    table_free(&e->table);
+    dir_release(e->dir);
+    free(e->rel_path);
+    free(e);
+}
+
+// Spill file
+
+static bool spill_store(Stream* s, const uint8_t* data, size_t length, uint64_t image_offset) {
+    if (s->tables_outstanding == 0 || s->spill_full) {
+        return true;
+    }
+    if (s->spill_used + length > spill_limit) {
+        DEBUG_PRINT("Spill limit of %zu bytes reached at 0x%llx\n",
+                    spill_limit, (unsigned long long)image_offset);
+        s->spill_full = true;
+        return true;
+    }
+    if (!s->spill && !(s->spill = tmpfile())) {
+        set_error("Failed to create spill file (%s)", strerror(errno));
+        return false;
+    }
+
+    // Scratch traffic, kept out of the bytes-written counters
+    if (pwrite(fileno(s->spill), data, length, s->spill_used) != (ssize_t)length) {
+        set_error("Failed to write spill file (%s)", strerror(errno));
+        return false;
+    }
+
+    SpillRun* last = s->run_count ? &s->runs[s->run_count - 1] : NULL;
+    if (last && last->image_offset + last->length == image_offset) {
+        last->length += length;
+    } else {
+        if (!grow((void**)&s->runs, &s->run_capacity, s->run_count, sizeof(SpillRun))) {
+            return false;
+        }
+        s->runs[s->run_count++] = (SpillRun){ image_offset, s->spill_used, length };
+    }
+    s->spill_used += length;
+    return true;
+}
+
+// Finds the spill offset of [offset, offset + length), which must lie in one run
+static bool spill_find(const Stream* s, uint64_t offset, uint64_t length, uint64_t* spill_offset) {
+    size_t low = 0, high = s->run_count;
+
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        if (s->runs[mid].image_offset + s->runs[mid].length <= offset) low = mid + 1;
+        else high = mid;
+    }
+    if (low == s->run_count) return false;
+
+    const SpillRun* run = &s->runs[low];
+    if (run->image_offset > offset || run->image_offset + run->length < offset + length) {
+        return false;
+    }
+    *spill_offset = run->spill_offset + (offset - run->image_offset);
+    return true;
+}
+
+// Extents
+
+static bool feed(StreamExtent* e, const uint8_t* data, size_t length) {
+    if (e->is_table) {
+        memcpy(e->table.data + e->received, data, length);
+        e->received += length;
+        return true;
+    }
+
+    if (e->out_fd == -1) {
+        if (!dir_open(e->dir)) return false;
+
+        DEBUG_PRINT("Extracting file: %s (%u bytes)\n", e->rel_path, e->size);
+        e->out_fd = io_openat(e->dir->fd, e->name, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+        if (e->out_fd == -1) {
+            set_error("Failed to create file: %s (%s)", e->rel_path, strerror(errno));
+            return false;
+        }
+        STAT_ADD(stats_local(), files_created, 1);
+    }
+
+    uint64_t start = xiso_now_ns();
+    if (length && !write_all(e->out_fd, data, length)) {
+        set_error("Failed to write file data: %s (%s)", e->rel_path, strerror(errno));
+        return false;
+    }
+    STAT_ADD(stats_local(), copy_ns, xiso_now_ns() - start);
+    e->received += length;
+    return true;
+}
+
+static bool schedule(Stream* s, StreamExtent* e);
+
+static bool finish_table(Stream* s, StreamExtent* dir) {
+    uint64_t span = trace_begin();
+    size_t prefix_length = dir->rel_path ? strlen(dir->rel_path) : 0;
+    XisoEntry entry;
+    int next;
+
+    s->tables_outstanding--;
+    while ((next = table_next(&dir->table, &entry)) > 0) {
+        StreamExtent* e = calloc(1, sizeof(*e));
+        char* rel_path = malloc(prefix_length + entry.filename_length + 2);
+        if (!e || !rel_path) {
+            free(e);
+            free(rel_path);
+            set_error("Failed to allocate stream state");
+            return false;
+        }
+
+        if (prefix_length) {
+            memcpy(rel_path, dir->rel_path, prefix_length);
+            rel_path[prefix_length] = '/';
+            strcpy(rel_path + prefix_length + 1, entry.filename);
+        } else {
+            strcpy(rel_path, entry.filename);
+        }
+
+        e->start = (uint64_t)entry.start_sector * XISO_SECTOR_SIZE + s->lseek;
+        e->size = entry.file_size;
+        e->rel_path = rel_path;
+        e->name = rel_path + (prefix_length ? prefix_length + 1 : 0);
+        e->depth = dir->depth + 1;
+        e->out_fd = -1;
+
+        if (filter_entry(rel_path, &entry) != WALK_CONTINUE) {
+            extent_free(e);
+            continue;
+        }
+
+        if (entry.attributes & XISO_ATTRIBUTE_DIR) {
+            e->is_table = true;
+            e->dir = dir_new(dir->dir, entry.filename);
+            if (!e->dir || (!include_count && !dir_open(e->dir))) {
+                extent_free(e);
+                return false;
+            }
+            if (!entry.start_sector || !entry.file_size) {
+                extent_free(e);
+                continue;
+            }
+            if (e->depth > max_walk_depth) {
+                set_error("Directory nesting exceeds the limit of %u: %s", max_walk_depth, rel_path);
+                extent_free(e);
+                return false;
+            }
+            if (!table_init(&e->table, e->start, e->size)) {
+                extent_free(e);
+                return false;
+            }
+            s->tables_outstanding++;
+        } else {
+            e->dir = dir->dir;
+            __atomic_add_fetch(&e->dir->refs, 1, __ATOMIC_RELAXED);
+        }
+
+        if (!schedule(s, e)) {
+            return false;
+        }
+    }
+
+    trace_end(span, "directory", prefix_length ? dir->rel_path : "/");
+    return next == 0;
+}
+
+static bool finish(Stream* s, StreamExtent* e) {
+    bool ok = e->is_table ? finish_table(s, e) : true;
+    extent_free(e);
+    return ok;
+}
+
+// Queues an extent, first replaying any part the stream has already passed
+static bool schedule(Stream* s, StreamExtent* e) {
+    if (e->start < s->position && e->size) {
+        uint64_t length = s->position - e->start;
+        uint64_t spill_offset;
+        if (length > e->size) length = e->size;
+
+        if (!spill_find(s, e->start, length, &spill_offset)) {
+            set_error("Data for %s at 0x%llx preceded its directory entry and was not kept%s",
+                      e->rel_path ? e->rel_path : "/", (unsigned long long)e->start,
+                      s->spill_full ? " (spill limit reached)" : "");
+            extent_free(e);
+            return false;
+        }
+
+        size_t chunk = length < XISO_MAX_TABLE_SIZE ? length : XISO_MAX_TABLE_SIZE;
+        uint8_t* buffer = pool_acquire(chunk);
+        if (!buffer) {
+            set_error("Failed to allocate spill buffer");
+            extent_free(e);
+            return false;
+        }
+        while (e->received < length) {
+            size_t n = length - e->received < chunk ? length - e->received : chunk;
+            if (io_pread(fileno(s->spill), buffer, n, spill_offset + e->received) != (ssize_t)n) {
+                set_error("Failed to read spill file (%s)", strerror(errno));
+                break;
+            }
+            if (!feed(e, buffer, n)) break;
+        }
+        pool_release(buffer, chunk);
+        if (e->received < length) {
+            extent_free(e);
+            return false;
+        }
+    }
+
+    if (e->received == e->size) {
+        // Empty files still need creating
+        if (!e->is_table && !feed(e, NULL, 0)) {
+            extent_free(e);
+            return false;
+        }
+        return finish(s, e);
+    }
+
+    bool queued = e->received ? activate(s, e) : heap_push(s, e);
+    if (!queued) extent_free(e);
+    return queued;
+}
+
+// Routes one chunk of the stream, splitting it wherever an extent starts or
+// ends so the set of extents covering each piece is constant
+static bool process_chunk(Stream* s, const uint8_t* data, size_t length) {
+    uint64_t base = s->position;
+    uint64_t end = base + length;
+
+    while (s->position < end) {
+        while (s->heap_count && s->heap[0]->start <= s->position) {
+            if (!activate(s, heap_pop(s))) return false;
+        }
+
+        uint64_t next = end;
+        if (s->heap_count && s->heap[0]->start < next) next = s->heap[0]->start;
+        for (size_t i = 0; i < s->active_count; i++) {
+            uint64_t extent_end = s->active[i]->start + s->active[i]->size;
+            if (extent_end < next) next = extent_end;
+        }
+
+        const uint8_t* piece = data + (s->position - base);
+        size_t piece_length = next - s->position;
+        for (size_t i = 0; i < s->active_count; i++) {
+            if (!feed(s->active[i], piece, piece_length)) return false;
+        }
+        if (s->active_count == 0 && !spill_store(s, piece, piece_length, s->position)) {
+            return false;
+        }
+        s->position = next;
+
+        for (size_t i = s->active_count; i-- > 0;) {
+            StreamExtent* e = s->active[i];
+            if (e->received < e->size) continue;
+            s->active[i] = s->active[--s->active_count];
+            if (!finish(s, e)) return false;
+        }
+    }
+    return true;
+}
+
+static bool header_valid(const uint8_t* sector, uint32_t* root_sector, uint32_t* root_size) {
+    const size_t trailer = XISO_HEADER_DATA_LENGTH + 8 + XISO_FILETIME_SIZE + XISO_UNUSED_SIZE;
+
+    if (memcmp(sector, XISO_HEADER_DATA, XISO_HEADER_DATA_LENGTH) != 0 ||
+        memcmp(sector + trailer, XISO_HEADER_DATA, XISO_HEADER_DATA_LENGTH) != 0) {
+        return false;
+    }
+    memcpy(root_sector, sector + XISO_HEADER_DATA_LENGTH, 4);
+    memcpy(root_size, sector + XISO_HEADER_DATA_LENGTH + 4, 4);
+    return true;
+}
+
+// Reads forward to each candidate header position in turn
+static bool find_header(Stream* s, uint8_t* buffer, size_t buffer_length,
+                        uint32_t* root_sector, uint32_t* root_size) {
+    static const uint64_t offsets[] = { 0, XGD3_LSEEK_OFFSET, GLOBAL_LSEEK_OFFSET };
+
+    for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+        uint64_t header = XISO_HEADER_OFFSET + offsets[i];
+
+        while (s->position < header) {
+            uint64_t gap = header - s->position;
+            ssize_t n = read_full(s->in_fd, buffer, gap < buffer_length ? gap : buffer_length);
+            if (n <= 0) goto not_found;
+            s->position += n;
+        }
+
+        ssize_t n = read_full(s->in_fd, buffer, XISO_SECTOR_SIZE);
+        if (n < 0) goto not_found;
+        s->position += n;
+        if (n == XISO_SECTOR_SIZE && header_valid(buffer, root_sector, root_size)) {
+            s->lseek = offsets[i];
+            DEBUG_PRINT("Found valid header in stream. Xbox disc offset: 0x%llx\n",
+                        (unsigned long long)s->lseek);
+            return true;
+        }
+        if (n < XISO_SECTOR_SIZE) break;
+    }
+
+not_found:
+    set_error("No valid XBOX ISO header found");
+    return false;
+}
+
+static void stream_free(Stream* s) {
+    bool cancelled = xiso_get_last_error_code() >= XISO_ERROR_CANCELLED;
+
+    for (size_t i = 0; i < s->heap_count; i++) extent_free(s->heap[i]);
+    for (size_t i = 0; i < s->active_count; i++) {
+        // Files still being written when the run was cancelled are incomplete
+        StreamExtent* e = s->active[i];
+        if (cancelled && e->out_fd != -1) unlinkat(e->dir->fd, e->name, 0);
+        extent_free(e);
+    }
+    free(s->heap);
+    free(s->active);
+    free(s->runs);
+    if (s->spill) fclose(s->spill);
+}
+
+bool xiso_extract_stream(int fd, const char* output_path) {
+    uint32_t root_sector, root_size;
+    Stream s;
+
+    stats_reset();
+    operation_begin();
+
+    if (!initialized) {
+        set_error("XISO not initialized");
+        return false;
+    }
+    memset(&s, 0, sizeof(s));
+    s.in_fd = fd;
+
+    size_t chunk = xiso_get_buffer_size();
+    uint8_t* buffer = pool_acquire(chunk);
+    if (!buffer) {
+        set_error("Failed to allocate stream buffer");
+        return false;
+    }
+
+    XisoThreadStats* stats = stats_local();
+    uint64_t copy_before = stats->counters.copy_ns;
+    uint64_t walk_start = xiso_now_ns();
+    bool success = false;
+    StreamExtent* root = calloc(1, sizeof(*root));
+    if (!root) {
+        set_error("Failed to allocate stream state");
+        goto done;
+    }
+    root->out_fd = -1;
+    root->is_table = true;
+    root->dir = dir_new(NULL, output_path);
+    if (!root->dir) {
+        extent_free(root);
+        goto done;
+    }
+    if (io_mkdir(output_path, 0755) == 0) {
+        STAT_ADD(stats_local(), dirs_created, 1);
+    } else if (errno != EEXIST) {
+        set_error("Failed to create output directory: %s (%s)", output_path, strerror(errno));
+        extent_free(root);
+        goto done;
+    }
+    root->dir->fd = io_open(output_path, O_RDONLY | O_DIRECTORY, 0);
+    if (root->dir->fd == -1) {
+        set_error("Failed to open output directory: %s (%s)", output_path, strerror(errno));
+        extent_free(root);
+        goto done;
+    }
+
+    uint64_t verify_start = xiso_now_ns();
+    bool found = find_header(&s, buffer, chunk, &root_sector, &root_size);
+    STAT_ADD(stats_local(), verify_ns, xiso_now_ns() - verify_start);
+    if (!found) {
+        extent_free(root);
+        goto done;
+    }
+
+    DEBUG_PRINT("Root directory sector: %u, size: %u\n", root_sector, root_size);
+    root->start = (uint64_t)root_sector * XISO_SECTOR_SIZE + s.lseek;
+    root->size = root_size;
+    if (root_size == 0) {
+        extent_free(root);
+    } else {
+        if (!table_init(&root->table, root->start, root_size)) {
+            extent_free(root);
+            goto done;
+        }
+        s.tables_outstanding = 1;
+        if (!schedule(&s, root)) goto done;
+    }
+
+    while (s.heap_count || s.active_count) {
+        if (operation_cancelled()) goto done;
+
+        uint64_t span = trace_begin();
+        ssize_t n = read_full(fd, buffer, chunk);
+        trace_end(span, "read", NULL);
+        if (n < 0) {
+            set_error("Failed to read input stream (%s)", strerror(errno));
+            goto done;
+        }
+        if (n == 0) {
+            set_error("Input ended at 0x%llx with %zu entries still unread",
+                      (unsigned long long)s.position, s.heap_count + s.active_count);
+            goto done;
+        }
+        if (!process_chunk(&s, buffer, n)) goto done;
+    }
+
+    // Drain the rest so the producer isn't cut off mid-write
+    while (read_full(fd, buffer, chunk) > 0) {
+    }
+    success = true;
+
+done:
+    // Walk time excludes the copying, as for xiso_extract()
+    STAT_ADD(stats, walk_ns, xiso_now_ns() - walk_start - (stats->counters.copy_ns - copy_before));
+    DEBUG_PRINT("Stream finished at 0x%llx, %llu bytes spilled\n",
+                (unsigned long long)s.position, (unsigned long long)s.spill_used);
+    stream_free(&s);
+    pool_release(buffer, chunk);
+    return success;
+}
@@ -0,0 +1,263 @@
+#include "xiso_internal.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(XISO_HAVE_ZSTD)
+#include <zstd.h>
+#endif
+
+#define TAR_BLOCK_SIZE 512
+
+// POSIX ustar header
+typedef struct {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char checksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char padding[12];
+} TarHeader;
+
+struct TarWriter {
+    int fd;
+#if defined(XISO_HAVE_ZSTD)
+    ZSTD_CCtx* zstd;
+    uint8_t* out;
+    size_t out_size;
+#endif
+};
+
+TarWriter* tar_open(int fd, int zstd_level, unsigned threads) {
+#if !defined(XISO_HAVE_ZSTD)
+    (void)threads;
+    if (zstd_level > 0) {
+        set_error("zstd compression is not available in this build");
+        return NULL;
+    }
+#endif
+
+    TarWriter* tar = calloc(1, sizeof(*tar));
+    if (!tar) {
+        set_error("Failed to allocate tar writer");
+        return NULL;
+    }
+    tar->fd = fd;
+
+#if defined(XISO_HAVE_ZSTD)
+    if (zstd_level > 0) {
+        tar->zstd = ZSTD_createCCtx();
+        tar->out_size = ZSTD_CStreamOutSize();
+        tar->out = malloc(tar->out_size);
+        if (!tar->zstd || !tar->out) {
+            set_error("Failed to allocate zstd stream");
+            ZSTD_freeCCtx(tar->zstd);
+            free(tar->out);
+            free(tar);
+            return NULL;
+        }
+        ZSTD_CCtx_setParameter(tar->zstd, ZSTD_c_compressionLevel, zstd_level);
+        ZSTD_CCtx_setParameter(tar->zstd, ZSTD_c_checksumFlag, 1);
+        // Fails harmlessly when libzstd was built without threading
+        if (threads > 1) {
+            ZSTD_CCtx_setParameter(tar->zstd, ZSTD_c_nbWorkers, (int)threads);
+        }
+    }
+#endif
+    return tar;
+}
+
+int tar_raw_fd(const TarWriter* tar) {
+#if defined(XISO_HAVE_ZSTD)
+    if (tar->zstd) return -1;
+#endif
+    return tar->fd;
+}
+
+#if defined(XISO_HAVE_ZSTD)
+static bool zstd_drain(TarWriter* tar, ZSTD_inBuffer* in, ZSTD_EndDirective mode) {
+    size_t remaining;
+
+    do {
+        ZSTD_outBuffer out = { tar->out, tar->out_size, 0 };
+        remaining = ZSTD_compressStream2(tar->zstd, &out, in, mode);
+        if (ZSTD_isError(remaining)) {
+            set_error("zstd compression failed: %s", ZSTD_getErrorName(remaining));
+            return false;
+        }
+        if (!write_all(tar->fd, tar->out, out.pos)) {
+            set_error("Failed to write archive (%s)", strerror(errno));
+            return false;
+        }
+    } while (mode == ZSTD_e_end ? remaining != 0 : in->pos < in->size);
+    return true;
+}
+#endif
+
+bool tar_write(TarWriter* tar, const void* data, size_t length) {
+#if defined(XISO_HAVE_ZSTD)
+    if (tar->zstd) {
+        ZSTD_inBuffer in = { data, length, 0 };
+        return length == 0 || zstd_drain(tar, &in, ZSTD_e_continue);
+    }
+#endif
+    if (!write_all(tar->fd, data, length)) {
+        set_error("Failed to write archive (%s)", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+static bool write_padding(TarWriter* tar, uint64_t length) {
+    static const char zeros[TAR_BLOCK_SIZE];
+    size_t pad = (TAR_BLOCK_SIZE - length % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+    return tar_write(tar, zeros, pad);
+}
+
+// Zero-padded octal filling all but the field's terminating NUL. Callers
+// keep values in range; sizes here are at most 32 bits.
+static void octal(char* field, size_t width, uint64_t value) {
+    char digits[24];
+    snprintf(digits, sizeof(digits), "%0*llo", (int)width - 1, (unsigned long long)value);
+    memcpy(field, digits + strlen(digits) - (width - 1), width);
+}
+
+static bool write_header(TarWriter* tar, const char* path, char typeflag, uint64_t size, time_t mtime);
+
+static size_t decimal_digits(size_t value) {
+    size_t digits = 1;
+    while (value >= 10) {
+        value /= 10;
+        digits++;
+    }
+    return digits;
+}
+
+// Paths that don't fit the ustar name/prefix split go in a pax record
+static bool write_pax_path(TarWriter* tar, const char* path, time_t mtime) {
+    size_t body = strlen(path) + sizeof(" path=\n") - 1;
+    char* record;
+
+    // The record length counts its own digits
+    size_t record_length = body + 1;
+    while (record_length != body + decimal_digits(record_length)) {
+        record_length = body + decimal_digits(record_length);
+    }
+
+    record = malloc(record_length + 1);
+    if (!record) {
+        set_error("Failed to allocate tar header");
+        return false;
+    }
+    snprintf(record, record_length + 1, "%zu path=%s\n", record_length, path);
+
+    bool ok = write_header(tar, "././@PaxHeader", 'x', record_length, mtime) &&
+              tar_write(tar, record, record_length) &&
+              write_padding(tar, record_length);
+    free(record);
+    return ok;
+}
+
+static bool write_header(TarWriter* tar, const char* path, char typeflag, uint64_t size, time_t mtime) {
+    TarHeader header;
+    size_t length = strlen(path);
+
+    memset(&header, 0, sizeof(header));
+    if (length <= sizeof(header.name)) {
+        memcpy(header.name, path, length);
+    } else {
+        // Split at a '/' so the tail fits name and the head fits prefix
+        const char* split = NULL;
+        for (const char* p = path; (p = strchr(p, '/')); p++) {
+            if ((size_t)(p - path) > sizeof(header.prefix)) break;
+            if (length - (p - path) - 1 <= sizeof(header.name)) {
+                split = p;
+                break;
+            }
+        }
+
+        if (!split) {
+            if (!write_pax_path(tar, path, mtime)) return false;
+            length = sizeof(header.name);
+            memcpy(header.name, path, length);
+        } else {
+            memcpy(header.prefix, path, split - path);
+            memcpy(header.name, split + 1, length - (split - path) - 1);
+        }
+    }
+
+    octal(header.mode, sizeof(header.mode), typeflag == '5' ? 0755 : 0644);
+    octal(header.uid, sizeof(header.uid), 0);
+    octal(header.gid, sizeof(header.gid), 0);
+    octal(header.size, sizeof(header.size), size);
+    octal(header.mtime, sizeof(header.mtime), mtime > 0 ? (uint64_t)mtime : 0);
+    header.typeflag = typeflag;
+    memcpy(header.magic, "ustar", 6);
+    memcpy(header.version, "00", 2);
+
+    unsigned checksum = 0;
+    memset(header.checksum, ' ', sizeof(header.checksum));
+    for (size_t i = 0; i < sizeof(header); i++) {
+        checksum += ((unsigned char*)&header)[i];
+    }
+    snprintf(header.checksum, sizeof(header.checksum), "%06o", checksum);
+    header.checksum[7] = ' ';
+
+    return tar_write(tar, &header, sizeof(header));
+}
+
+bool tar_add_directory(TarWriter* tar, const char* path, time_t mtime) {
+    size_t length = strlen(path);
+    char* name = malloc(length + 2);
+    if (!name) {
+        set_error("Failed to allocate tar header");
+        return false;
+    }
+
+    memcpy(name, path, length);
+    memcpy(name + length, "/", 2);
+    bool ok = write_header(tar, name, '5', 0, mtime);
+    free(name);
+    return ok;
+}
+
+bool tar_begin_file(TarWriter* tar, const char* path, uint64_t size, time_t mtime) {
+    return write_header(tar, path, '0', size, mtime);
+}
+
+bool tar_end_file(TarWriter* tar, uint64_t size) {
+    return write_padding(tar, size);
+}
+
+bool tar_close(TarWriter* tar, bool finish) {
+    static const char end[TAR_BLOCK_SIZE * 2];
+    bool ok = true;
+
+    if (finish) {
+        ok = tar_write(tar, end, sizeof(end));
+#if defined(XISO_HAVE_ZSTD)
+        if (ok && tar->zstd) {
+            ZSTD_inBuffer in = { NULL, 0, 0 };
+            ok = zstd_drain(tar, &in, ZSTD_e_end);
+        }
+#endif
+    }
+
+#if defined(XISO_HAVE_ZSTD)
+    ZSTD_freeCCtx(tar->zstd);
+    free(tar->out);
+#endif
+    free(tar);
+    return ok;
+}
@@ -0,0 +1,140 @@
+#include "xiso_internal.h"
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+// Token buckets shared by every thread. Bytes are charged after the I/O,
+// running the balance into debt that the caller then sleeps off, so a
+// single read larger than the burst still goes through. Sleeps are cut
+// into slices so a limit raised or lifted mid-run takes effect promptly.
+#define THROTTLE_BURST_NS  (100ull * 1000000)
+#define THROTTLE_SLICE_NS  (50ull * 1000000)
+
+typedef struct {
+    pthread_mutex_t lock;
+    uint64_t rate;               // bytes per second, 0 for unlimited
+    double tokens;
+    uint64_t last_refill;
+} Bucket;
+
+static Bucket buckets[2] = {
+    { PTHREAD_MUTEX_INITIALIZER, 0, 0, 0 },
+    { PTHREAD_MUTEX_INITIALIZER, 0, 0, 0 },
+};
+bool throttle_enabled = false;
+
+static void refill(Bucket* bucket) {
+    uint64_t now = xiso_now_ns();
+    double burst = (double)bucket->rate * THROTTLE_BURST_NS / 1e9;
+
+    bucket->tokens += (double)(now - bucket->last_refill) * bucket->rate / 1e9;
+    if (bucket->tokens > burst) bucket->tokens = burst;
+    bucket->last_refill = now;
+}
+
+void throttle_charge(ThrottleKind kind, size_t length) {
+    Bucket* bucket = &buckets[kind];
+
+    pthread_mutex_lock(&bucket->lock);
+    if (!bucket->rate) {
+        pthread_mutex_unlock(&bucket->lock);
+        return;
+    }
+    refill(bucket);
+    bucket->tokens -= (double)length;
+
+    uint64_t span = bucket->tokens < 0 ? trace_begin() : 0;
+    while (bucket->rate && bucket->tokens < 0) {
+        uint64_t wait = (uint64_t)(-bucket->tokens * 1e9 / bucket->rate);
+        if (wait > THROTTLE_SLICE_NS) wait = THROTTLE_SLICE_NS;
+        pthread_mutex_unlock(&bucket->lock);
+
+        // A cancelled run shouldn't sit out its debt
+        if (operation_cancelled()) return;
+        struct timespec ts = { (time_t)(wait / 1000000000ull), (long)(wait % 1000000000ull) };
+        nanosleep(&ts, NULL);
+
+        pthread_mutex_lock(&bucket->lock);
+        if (bucket->rate) refill(bucket);
+    }
+    pthread_mutex_unlock(&bucket->lock);
+    if (span) trace_end(span, kind == THROTTLE_READ ? "throttle_read" : "throttle_write", NULL);
+}
+
+static void set_rate(Bucket* bucket, uint64_t rate) {
+    pthread_mutex_lock(&bucket->lock);
+    if (rate && !bucket->rate) {
+        bucket->tokens = 0;
+        bucket->last_refill = xiso_now_ns();
+    }
+    bucket->rate = rate;
+    pthread_mutex_unlock(&bucket->lock);
+}
+
+void xiso_set_bandwidth_limit(uint64_t read_bytes_per_second, uint64_t write_bytes_per_second) {
+    set_rate(&buckets[THROTTLE_READ], read_bytes_per_second);
+    set_rate(&buckets[THROTTLE_WRITE], write_bytes_per_second);
+    __atomic_store_n(&throttle_enabled, read_bytes_per_second || write_bytes_per_second, __ATOMIC_RELAXED);
+    DEBUG_PRINT("Bandwidth limit: read %llu B/s, write %llu B/s\n",
+                (unsigned long long)read_bytes_per_second, (unsigned long long)write_bytes_per_second);
+}
+
+void xiso_get_bandwidth_limit(uint64_t* read_bytes_per_second, uint64_t* write_bytes_per_second) {
+    *read_bytes_per_second = __atomic_load_n(&buckets[THROTTLE_READ].rate, __ATOMIC_RELAXED);
+    *write_bytes_per_second = __atomic_load_n(&buckets[THROTTLE_WRITE].rate, __ATOMIC_RELAXED);
+}
+
+#if defined(__linux__) && defined(SYS_ioprio_set)
+#define IOPRIO_CLASS_SHIFT  13
+#define IOPRIO_WHO_PROCESS  1
+
+// ioprio_set() with IOPRIO_WHO_PROCESS only changes the thread it names,
+// so every existing thread is visited; threads started later inherit it
+bool xiso_set_io_priority(XisoIoPriority priority, int level) {
+    if (priority != XISO_IO_PRIORITY_BEST_EFFORT) {
+        level = 0;
+    } else if (level < 0 || level > 7) {
+        set_error("Invalid best-effort I/O priority level: %d", level);
+        return false;
+    }
+    int value = ((int)priority << IOPRIO_CLASS_SHIFT) | level;
+
+    DIR* tasks = opendir("/proc/self/task");
+    if (!tasks) {
+        if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, value) != 0) {
+            set_error("Failed to set I/O priority (%s)", strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
+    bool ok = true;
+    struct dirent* task;
+    while ((task = readdir(tasks)) != NULL) {
+        if (task->d_name[0] == '.') continue;
+        int tid = atoi(task->d_name);
+        // Threads that exit meanwhile are no concern
+        if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, value) != 0 && errno != ESRCH) {
+            set_error("Failed to set I/O priority (%s)", strerror(errno));
+            ok = false;
+            break;
+        }
+    }
+    closedir(tasks);
+    DEBUG_PRINT("I/O priority class %d, level %d\n", (int)priority, level);
+    return ok;
+}
+#else
+bool xiso_set_io_priority(XisoIoPriority priority, int level) {
+    (void)level;
+    if (priority == XISO_IO_PRIORITY_DEFAULT) return true;
+    set_error("I/O priority classes are not supported on this platform");
+    return false;
+}
+#endif
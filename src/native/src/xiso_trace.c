@@ -0,0 +1,186 @@
+#include "xiso_internal.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    const char* name;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    char detail[TRACE_DETAIL_MAX];
+} TraceEvent;
+
+// One ring per thread. Only the owning thread writes events and advances
+// head; the dump reads the last capacity events up to head.
+typedef struct TraceRing {
+    TraceEvent* events;
+    size_t capacity;
+    uint64_t head;
+    uint32_t tid;
+    char thread_name[32];
+    struct TraceRing* next;
+} TraceRing;
+
+bool trace_enabled = false;
+
+// Rings are freed when a new trace starts, so the thread-local pointer is
+// only trusted while its generation matches
+static _Thread_local TraceRing* trace_tls = NULL;
+static _Thread_local uint32_t trace_tls_generation = 0;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static TraceRing* trace_rings = NULL;
+static size_t trace_capacity = 0;
+static uint32_t trace_generation = 0;
+static uint32_t trace_next_tid = 1;
+static uint64_t trace_origin_ns = 0;
+
+static TraceRing* trace_register(void) {
+    TraceRing* ring = calloc(1, sizeof(*ring));
+    if (!ring) return NULL;
+
+    pthread_mutex_lock(&trace_lock);
+    ring->capacity = trace_capacity;
+    ring->events = calloc(ring->capacity, sizeof(TraceEvent));
+    if (!ring->events) {
+        pthread_mutex_unlock(&trace_lock);
+        free(ring);
+        return NULL;
+    }
+    ring->tid = trace_next_tid++;
+    trace_tls_generation = trace_generation;
+    snprintf(ring->thread_name, sizeof(ring->thread_name), "thread %u", ring->tid);
+    ring->next = trace_rings;
+    trace_rings = ring;
+    pthread_mutex_unlock(&trace_lock);
+
+    trace_tls = ring;
+    return ring;
+}
+
+static TraceRing* trace_local(void) {
+    if (trace_tls && trace_tls_generation == __atomic_load_n(&trace_generation, __ATOMIC_ACQUIRE)) {
+        return trace_tls;
+    }
+    return trace_register();
+}
+
+void trace_end(uint64_t start_ns, const char* name, const char* detail) {
+    if (!start_ns) return;
+
+    uint64_t end_ns = xiso_now_ns();
+    TraceRing* ring = trace_local();
+    if (!ring) return;
+
+    uint64_t head = ring->head;
+    TraceEvent* ev = &ring->events[head % ring->capacity];
+    ev->name = name;
+    ev->start_ns = start_ns;
+    ev->duration_ns = end_ns - start_ns;
+    if (detail) {
+        snprintf(ev->detail, sizeof(ev->detail), "%s", detail);
+    } else {
+        ev->detail[0] = '\0';
+    }
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void trace_set_thread_name(const char* name) {
+    if (!__atomic_load_n(&trace_enabled, __ATOMIC_RELAXED)) return;
+
+    TraceRing* ring = trace_local();
+    if (ring) {
+        snprintf(ring->thread_name, sizeof(ring->thread_name), "%s", name);
+    }
+}
+
+static void free_rings(void) {
+    while (trace_rings) {
+        TraceRing* next = trace_rings->next;
+        free(trace_rings->events);
+        free(trace_rings);
+        trace_rings = next;
+    }
+}
+
+bool xiso_trace_start(size_t events_per_thread) {
+    if (events_per_thread == 0) {
+        set_error("Trace buffer must hold at least one event");
+        return false;
+    }
+
+    pthread_mutex_lock(&trace_lock);
+    free_rings();
+    trace_capacity = events_per_thread;
+    trace_next_tid = 1;
+    trace_origin_ns = xiso_now_ns();
+    __atomic_add_fetch(&trace_generation, 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&trace_enabled, true, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&trace_lock);
+    return true;
+}
+
+void xiso_trace_stop(void) {
+    __atomic_store_n(&trace_enabled, false, __ATOMIC_RELEASE);
+}
+
+static void write_json_string(FILE* f, const char* s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            fprintf(f, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(f, "\\u%04x", c);
+        } else {
+            fputc(c, f);
+        }
+    }
+    fputc('"', f);
+}
+
+bool xiso_trace_dump(const char* path) {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        set_error("Failed to create trace file: %s", path);
+        return false;
+    }
+
+    bool first = true;
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    pthread_mutex_lock(&trace_lock);
+    for (TraceRing* ring = trace_rings; ring; ring = ring->next) {
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t begin = head > ring->capacity ? head - ring->capacity : 0;
+
+        fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":",
+                first ? "" : ",\n", ring->tid);
+        write_json_string(f, ring->thread_name);
+        fprintf(f, "}}");
+        first = false;
+
+        for (uint64_t i = begin; i < head; i++) {
+            const TraceEvent* ev = &ring->events[i % ring->capacity];
+            uint64_t start = ev->start_ns > trace_origin_ns ? ev->start_ns - trace_origin_ns : 0;
+
+            fprintf(f, ",\n{\"name\":");
+            write_json_string(f, ev->name);
+            fprintf(f, ",\"cat\":\"xiso\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+                    ring->tid, start / 1e3, ev->duration_ns / 1e3);
+            if (ev->detail[0]) {
+                fprintf(f, ",\"args\":{\"detail\":");
+                write_json_string(f, ev->detail);
+                fprintf(f, "}");
+            }
+            fprintf(f, "}");
+        }
+    }
+    pthread_mutex_unlock(&trace_lock);
+
+    fprintf(f, "\n]}\n");
+    if (fclose(f) != 0) {
+        set_error("Failed to write trace file: %s", path);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,262 @@
+#include "xiso_internal.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Bytes copied with each candidate before moving on to the next one
+#define TUNE_SAMPLE_BYTES   (16ull * 1024 * 1024)
+#define TUNE_CACHE_LINE_MAX 128
+
+static const size_t tune_buffer_sizes[] = {
+    256 * 1024, 1024 * 1024, 2 * 1024 * 1024, 4 * 1024 * 1024, 8 * 1024 * 1024,
+};
+static const XisoIoStrategy tune_strategies[] = {
+    XISO_IO_BUFFERED, XISO_IO_DIRECT, XISO_IO_COPY_RANGE,
+};
+
+#define TUNE_NUM_SIZES      (sizeof(tune_buffer_sizes) / sizeof(tune_buffer_sizes[0]))
+#define TUNE_NUM_STRATEGIES (sizeof(tune_strategies) / sizeof(tune_strategies[0]))
+#define TUNE_NUM_CANDIDATES (TUNE_NUM_SIZES * TUNE_NUM_STRATEGIES)
+
+typedef struct {
+    XisoIoPlan plan;
+    uint64_t bytes;
+    uint64_t elapsed_ns;
+    bool rejected;
+} TuneCandidate;
+
+static bool auto_tune = false;
+static char* tune_cache_path = NULL;
+
+// State of the tuning run in progress; copy workers share it under tune_lock.
+// tuning is also polled without the lock by tune_active(), so it is only
+// ever written atomically.
+static pthread_mutex_t tune_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool tuning = false;
+static bool tune_from_cache = false;
+static size_t tune_index = 0;
+static char tune_key[64];
+static XisoIoPlan tune_fallback;
+static TuneCandidate candidates[TUNE_NUM_CANDIDATES];
+
+// Last completed result, so repeated runs in one process skip re-tuning
+static char tuned_key[sizeof(tune_key)] = "";
+static XisoIoPlan tuned_plan;
+
+static bool candidate_done(const TuneCandidate* c) {
+    return c->rejected || c->bytes >= TUNE_SAMPLE_BYTES;
+}
+
+static void advance(void) {
+    while (tune_index < TUNE_NUM_CANDIDATES && candidate_done(&candidates[tune_index])) {
+        tune_index++;
+    }
+    if (tune_index == TUNE_NUM_CANDIDATES) {
+        __atomic_store_n(&tuning, false, __ATOMIC_RELAXED);
+    }
+}
+
+static const TuneCandidate* fastest(void) {
+    const TuneCandidate* best = NULL;
+    double best_rate = 0;
+
+    for (size_t i = 0; i < TUNE_NUM_CANDIDATES; i++) {
+        const TuneCandidate* c = &candidates[i];
+        if (c->rejected || !c->bytes || !c->elapsed_ns) continue;
+
+        double rate = (double)c->bytes / (double)c->elapsed_ns;
+        if (!best || rate > best_rate) {
+            best = c;
+            best_rate = rate;
+        }
+    }
+    return best;
+}
+
+static bool load_cached(XisoIoPlan* plan) {
+    char line[TUNE_CACHE_LINE_MAX];
+    char key[sizeof(tune_key)];
+    unsigned strategy;
+    size_t size;
+    bool found = false;
+
+    if (!tune_cache_path) return false;
+
+    FILE* f = fopen(tune_cache_path, "r");
+    if (!f) return false;
+
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%63s %u %zu", key, &strategy, &size) != 3) continue;
+        if (strcmp(key, tune_key) != 0) continue;
+        if (strategy > XISO_IO_COPY_RANGE || size == 0) continue;
+
+        plan->strategy = (XisoIoStrategy)strategy;
+        plan->buffer_size = size;
+        found = true;
+    }
+
+    fclose(f);
+    return found;
+}
+
+static void store_cached(const XisoIoPlan* plan) {
+    char line[TUNE_CACHE_LINE_MAX];
+    char key[sizeof(tune_key)];
+    char tmp_path[1024];
+
+    if (!tune_cache_path) return;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", tune_cache_path);
+    FILE* out = fopen(tmp_path, "w");
+    if (!out) {
+        DEBUG_PRINT("Failed to write tune cache %s\n", tmp_path);
+        return;
+    }
+
+    // Carry over entries for other devices
+    FILE* in = fopen(tune_cache_path, "r");
+    if (in) {
+        while (fgets(line, sizeof(line), in)) {
+            if (sscanf(line, "%63s", key) == 1 && strcmp(key, tune_key) != 0) {
+                fputs(line, out);
+            }
+        }
+        fclose(in);
+    }
+
+    fprintf(out, "%s %u %zu\n", tune_key, (unsigned)plan->strategy, plan->buffer_size);
+
+    if (fclose(out) != 0 || rename(tmp_path, tune_cache_path) != 0) {
+        DEBUG_PRINT("Failed to update tune cache %s\n", tune_cache_path);
+        unlink(tmp_path);
+    }
+}
+
+void tune_begin(const XisoIoPlan* fallback, uint64_t in_dev, uint64_t out_dev) {
+    XisoIoPlan cached;
+
+    __atomic_store_n(&tuning, false, __ATOMIC_RELAXED);
+    tune_from_cache = false;
+    tune_fallback = *fallback;
+    if (!auto_tune) return;
+
+    snprintf(tune_key, sizeof(tune_key), "%llx:%llx",
+             (unsigned long long)in_dev, (unsigned long long)out_dev);
+
+    if (tuned_key[0] && strcmp(tuned_key, tune_key) == 0) {
+        tune_fallback = tuned_plan;
+        tune_from_cache = true;
+        return;
+    }
+
+    if (load_cached(&cached)) {
+        DEBUG_PRINT("Using cached I/O plan for %s: strategy %d, %zu byte buffer\n",
+                    tune_key, (int)cached.strategy, cached.buffer_size);
+        tune_fallback = cached;
+        tune_from_cache = true;
+        return;
+    }
+
+    for (size_t s = 0; s < TUNE_NUM_STRATEGIES; s++) {
+        for (size_t b = 0; b < TUNE_NUM_SIZES; b++) {
+            TuneCandidate* c = &candidates[s * TUNE_NUM_SIZES + b];
+            c->plan.strategy = tune_strategies[s];
+            c->plan.buffer_size = tune_buffer_sizes[b];
+            c->bytes = 0;
+            c->elapsed_ns = 0;
+            c->rejected = false;
+        }
+    }
+
+    tune_index = 0;
+    __atomic_store_n(&tuning, true, __ATOMIC_RELAXED);
+}
+
+bool tune_active(void) {
+    return __atomic_load_n(&tuning, __ATOMIC_RELAXED);
+}
+
+void tune_current(XisoIoPlan* plan) {
+    pthread_mutex_lock(&tune_lock);
+    *plan = tuning ? candidates[tune_index].plan : tune_fallback;
+    pthread_mutex_unlock(&tune_lock);
+}
+
+void tune_record(const XisoIoPlan* plan, size_t bytes, uint64_t elapsed_ns) {
+    pthread_mutex_lock(&tune_lock);
+    if (!tuning) {
+        pthread_mutex_unlock(&tune_lock);
+        return;
+    }
+
+    TuneCandidate* c = &candidates[tune_index];
+    if (c->plan.strategy != plan->strategy || c->plan.buffer_size != plan->buffer_size) {
+        pthread_mutex_unlock(&tune_lock);
+        return;
+    }
+
+    c->bytes += bytes;
+    c->elapsed_ns += elapsed_ns;
+    advance();
+
+    if (!tuning) {
+        const TuneCandidate* best = fastest();
+        if (best) tune_fallback = best->plan;
+        DEBUG_PRINT("I/O tuning finished: strategy %d, %zu byte buffer\n",
+                    (int)tune_fallback.strategy, tune_fallback.buffer_size);
+    }
+    pthread_mutex_unlock(&tune_lock);
+}
+
+void tune_reject(XisoIoStrategy strategy) {
+    pthread_mutex_lock(&tune_lock);
+    if (!tuning) {
+        if (tune_fallback.strategy == strategy) {
+            tune_fallback.strategy = XISO_IO_BUFFERED;
+        }
+    } else {
+        for (size_t i = 0; i < TUNE_NUM_CANDIDATES; i++) {
+            if (candidates[i].plan.strategy == strategy) {
+                candidates[i].rejected = true;
+            }
+        }
+        advance();
+    }
+    pthread_mutex_unlock(&tune_lock);
+}
+
+bool tune_end(XisoIoPlan* chosen) {
+    if (!auto_tune) return false;
+
+    if (tuning) {
+        // Extraction ended before every candidate was sampled; keep the best
+        // so far for this process but don't persist a partial measurement.
+        const TuneCandidate* best = fastest();
+        __atomic_store_n(&tuning, false, __ATOMIC_RELAXED);
+        if (!best) return false;
+        *chosen = best->plan;
+        return true;
+    }
+
+    *chosen = tune_fallback;
+    if (!tune_from_cache) {
+        store_cached(chosen);
+    }
+    strcpy(tuned_key, tune_key);
+    tuned_plan = *chosen;
+    return true;
+}
+
+size_t tune_max_buffer_size(void) {
+    return tune_buffer_sizes[TUNE_NUM_SIZES - 1];
+}
+
+void xiso_set_auto_tune(bool enable) {
+    auto_tune = enable;
+}
+
+void xiso_set_tune_cache(const char* path) {
+    free(tune_cache_path);
+    tune_cache_path = path ? strdup(path) : NULL;
+}
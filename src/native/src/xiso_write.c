@@ -0,0 +1,697 @@
+#include "xiso_internal.h"
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Images are padded to a multiple of this, as extract-xiso does
+#define XISO_FILE_MODULUS 0x10000
+
+// Seconds between the FILETIME epoch (1601) and the Unix epoch
+#define FILETIME_UNIX_OFFSET 11644473600ull
+
+XisoFileOrder file_order = XISO_ORDER_SOURCE;
+
+void xiso_set_file_order(XisoFileOrder order) {
+    file_order = order;
+}
+
+WriteNode* write_node_new(const char* name, bool is_directory) {
+    WriteNode* node = calloc(1, sizeof(*node));
+    if (node) node->name = strdup(name);
+    if (!node || !node->name) {
+        free(node);
+        set_error("Failed to allocate image node");
+        return NULL;
+    }
+    node->is_directory = is_directory;
+    return node;
+}
+
+bool write_node_add(WriteNode* dir, WriteNode* child) {
+    if (dir->child_count == dir->child_capacity) {
+        size_t capacity = dir->child_capacity ? dir->child_capacity * 2 : 16;
+        WriteNode** grown = realloc(dir->children, capacity * sizeof(WriteNode*));
+        if (!grown) {
+            set_error("Failed to allocate image node");
+            return false;
+        }
+        dir->children = grown;
+        dir->child_capacity = capacity;
+    }
+    dir->children[dir->child_count++] = child;
+    return true;
+}
+
+void write_node_free(WriteNode* node) {
+    if (!node) return;
+    for (size_t i = 0; i < node->child_count; i++) {
+        write_node_free(node->children[i]);
+    }
+    free(node->children);
+    free(node->table);
+    free(node->source_path);
+    free(node->name);
+    free(node);
+}
+
+void write_node_prune(WriteNode* dir) {
+    size_t kept = 0;
+
+    for (size_t i = 0; i < dir->child_count; i++) {
+        WriteNode* child = dir->children[i];
+        if (child->is_directory) {
+            write_node_prune(child);
+            if (child->child_count == 0) {
+                write_node_free(child);
+                continue;
+            }
+        }
+        dir->children[kept++] = child;
+    }
+    dir->child_count = kept;
+}
+
+// XDVDFS orders names by comparing ASCII-uppercased bytes
+int xdvdfs_compare(const char* a, const char* b) {
+    for (;; a++, b++) {
+        unsigned char ca = (unsigned char)*a, cb = (unsigned char)*b;
+        if (ca >= 'a' && ca <= 'z') ca -= 'a' - 'A';
+        if (cb >= 'a' && cb <= 'z') cb -= 'a' - 'A';
+        if (ca != cb || !ca) return (int)ca - (int)cb;
+    }
+}
+
+static int compare_nodes(const void* a, const void* b) {
+    return xdvdfs_compare((*(WriteNode* const*)a)->name, (*(WriteNode* const*)b)->name);
+}
+
+static size_t entry_length(const WriteNode* node) {
+    return (XISO_ENTRY_HEADER_SIZE + strlen(node->name) + 3) & ~(size_t)3;
+}
+
+// Assigns each child its table offset. Children are sorted, so the middle
+// of each range is a balanced subtree root; entries are placed in preorder
+// so the tree root is at offset 0, and none may straddle a sector.
+static void place_entries(WriteNode* dir, size_t low, size_t high, uint32_t* position) {
+    if (low >= high) return;
+
+    size_t mid = low + (high - low) / 2;
+    WriteNode* node = dir->children[mid];
+    size_t length = entry_length(node);
+
+    if (*position % XISO_SECTOR_SIZE + length > XISO_SECTOR_SIZE) {
+        *position += XISO_SECTOR_SIZE - *position % XISO_SECTOR_SIZE;
+    }
+    node->entry_offset = *position;
+    *position += length;
+
+    place_entries(dir, low, mid, position);
+    place_entries(dir, mid + 1, high, position);
+}
+
+static void serialize_entries(WriteNode* dir, size_t low, size_t high) {
+    if (low >= high) return;
+
+    size_t mid = low + (high - low) / 2;
+    size_t left_mid = low + (mid - low) / 2;
+    size_t right_mid = mid + 1 + (high - mid - 1) / 2;
+    const WriteNode* node = dir->children[mid];
+    uint8_t* entry = dir->table + node->entry_offset;
+    size_t name_length = strlen(node->name);
+
+    uint16_t left = mid > low ? dir->children[left_mid]->entry_offset / 4 : 0;
+    uint16_t right = high > mid + 1 ? dir->children[right_mid]->entry_offset / 4 : 0;
+    uint32_t size = node->is_directory ? node->table_size : node->size;
+    uint8_t attributes = node->is_directory ? XISO_ATTRIBUTE_DIR : XISO_ATTRIBUTE_ARC;
+
+    memcpy(entry, &left, 2);
+    memcpy(entry + 2, &right, 2);
+    memcpy(entry + 4, &node->sector, 4);
+    memcpy(entry + 8, &size, 4);
+    entry[12] = attributes;
+    entry[13] = (uint8_t)name_length;
+    memcpy(entry + XISO_ENTRY_HEADER_SIZE, node->name, name_length);
+
+    serialize_entries(dir, low, mid);
+    serialize_entries(dir, mid + 1, high);
+}
+
+static bool list_append(WriteNode*** list, size_t* count, size_t* capacity, WriteNode* node) {
+    if (*count == *capacity) {
+        size_t new_capacity = *capacity ? *capacity * 2 : 256;
+        WriteNode** grown = realloc(*list, new_capacity * sizeof(WriteNode*));
+        if (!grown) {
+            set_error("Failed to allocate image layout");
+            return false;
+        }
+        *list = grown;
+        *capacity = new_capacity;
+    }
+    (*list)[(*count)++] = node;
+    return true;
+}
+
+// Sorts every table, sizes it and collects tables and files in tree order
+static bool collect(WriteNode* dir, unsigned depth, ImageLayout* layout,
+                    size_t* dir_capacity, size_t* file_capacity) {
+    if (depth > max_walk_depth) {
+        set_error("Directory nesting exceeds the limit of %u: %s", max_walk_depth, dir->name);
+        return false;
+    }
+
+    qsort(dir->children, dir->child_count, sizeof(WriteNode*), compare_nodes);
+    for (size_t i = 0; i + 1 < dir->child_count; i++) {
+        if (xdvdfs_compare(dir->children[i]->name, dir->children[i + 1]->name) == 0) {
+            set_error("Names differ only in case: %s and %s",
+                      dir->children[i]->name, dir->children[i + 1]->name);
+            return false;
+        }
+    }
+
+    uint32_t position = 0;
+    place_entries(dir, 0, dir->child_count, &position);
+    dir->table_size = (position + XISO_SECTOR_SIZE - 1) / XISO_SECTOR_SIZE * XISO_SECTOR_SIZE;
+    if (dir->table_size > XISO_MAX_TABLE_SIZE) {
+        set_error("Directory has too many entries for one table: %s", dir->name);
+        return false;
+    }
+    if (dir->table_size && !list_append(&layout->dirs, &layout->dir_count, dir_capacity, dir)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < dir->child_count; i++) {
+        WriteNode* child = dir->children[i];
+        bool ok = child->is_directory
+            ? collect(child, depth + 1, layout, dir_capacity, file_capacity)
+            : list_append(&layout->files, &layout->file_count, file_capacity, child);
+        if (!ok) return false;
+    }
+    return true;
+}
+
+static int compare_source(const void* a, const void* b) {
+    const WriteNode* x = *(WriteNode* const*)a;
+    const WriteNode* y = *(WriteNode* const*)b;
+    if (x->source_device != y->source_device) return x->source_device < y->source_device ? -1 : 1;
+    if (x->source_offset != y->source_offset) return x->source_offset < y->source_offset ? -1 : 1;
+    return x->size < y->size ? -1 : x->size > y->size;
+}
+
+static int compare_size(const void* a, const void* b) {
+    const WriteNode* x = *(WriteNode* const*)a;
+    const WriteNode* y = *(WriteNode* const*)b;
+    if (x->size != y->size) return x->size < y->size ? -1 : 1;
+    return compare_source(a, b);
+}
+
+bool image_layout(WriteNode* root, XisoFileOrder order, ImageLayout* layout) {
+    size_t dir_capacity = 0, file_capacity = 0;
+
+    memset(layout, 0, sizeof(*layout));
+    if (!collect(root, 0, layout, &dir_capacity, &file_capacity)) {
+        image_layout_free(layout);
+        return false;
+    }
+
+    // Tables first, starting at the conventional root sector
+    uint64_t sector = XISO_ROOT_DIRECTORY_SECTOR;
+    for (size_t i = 0; i < layout->dir_count; i++) {
+        layout->dirs[i]->sector = (uint32_t)sector;
+        sector += layout->dirs[i]->table_size / XISO_SECTOR_SIZE;
+    }
+
+    if (order == XISO_ORDER_SOURCE) {
+        qsort(layout->files, layout->file_count, sizeof(WriteNode*), compare_source);
+    } else if (order == XISO_ORDER_SIZE) {
+        qsort(layout->files, layout->file_count, sizeof(WriteNode*), compare_size);
+    }
+
+    // Then file data back to back. Entries sharing one source extent (or
+    // hard links to one inode) keep sharing it; empty files get no sectors.
+    size_t kept = 0;
+    for (size_t i = 0; i < layout->file_count; i++) {
+        WriteNode* file = layout->files[i];
+        WriteNode* previous = kept ? layout->files[kept - 1] : NULL;
+
+        if (file->size == 0) {
+            file->sector = 0;
+            continue;
+        }
+        if (order == XISO_ORDER_SOURCE && previous &&
+            previous->source_device == file->source_device &&
+            previous->source_offset == file->source_offset && previous->size == file->size) {
+            file->sector = previous->sector;
+            continue;
+        }
+
+        file->sector = (uint32_t)sector;
+        sector += (file->size + XISO_SECTOR_SIZE - 1) / XISO_SECTOR_SIZE;
+        layout->files[kept++] = file;
+    }
+    layout->file_count = kept;
+
+    if (sector > UINT32_MAX) {
+        set_error("Image would exceed the XDVDFS size limit");
+        image_layout_free(layout);
+        return false;
+    }
+    layout->total_sectors = (uint32_t)sector;
+
+    // Sectors are known, so the tables can be filled in
+    for (size_t i = 0; i < layout->dir_count; i++) {
+        WriteNode* dir = layout->dirs[i];
+        dir->table = malloc(dir->table_size);
+        if (!dir->table) {
+            set_error("Failed to allocate directory table (%u bytes)", dir->table_size);
+            image_layout_free(layout);
+            return false;
+        }
+        memset(dir->table, 0xFF, dir->table_size);
+        serialize_entries(dir, 0, dir->child_count);
+    }
+    return true;
+}
+
+void image_layout_free(ImageLayout* layout) {
+    free(layout->dirs);
+    free(layout->files);
+    memset(layout, 0, sizeof(*layout));
+}
+
+static bool write_zeros(int out_fd, uint64_t length) {
+    static const uint8_t zeros[XISO_SECTOR_SIZE * 16];
+
+    while (length > 0) {
+        size_t n = length < sizeof(zeros) ? length : sizeof(zeros);
+        if (!write_all(out_fd, zeros, n)) return false;
+        length -= n;
+    }
+    return true;
+}
+
+// Pads the output from position up to the start of sector
+static bool seek_sector(int out_fd, uint64_t* position, uint32_t sector) {
+    uint64_t target = (uint64_t)sector * XISO_SECTOR_SIZE;
+    if (!write_zeros(out_fd, target - *position)) return false;
+    *position = target;
+    return true;
+}
+
+bool image_write(const ImageLayout* layout, const WriteNode* root, int out_fd,
+                 WriteData write_data, void* ctx) {
+    uint8_t header[XISO_SECTOR_SIZE];
+    uint64_t position = 0;
+    uint64_t filetime = ((uint64_t)time(NULL) + FILETIME_UNIX_OFFSET) * 10000000ull;
+    uint32_t root_sector = root->table_size ? root->sector : 0;
+
+    memset(header, 0, sizeof(header));
+    memcpy(header, XISO_HEADER_DATA, XISO_HEADER_DATA_LENGTH);
+    memcpy(header + XISO_HEADER_DATA_LENGTH, &root_sector, 4);
+    memcpy(header + XISO_HEADER_DATA_LENGTH + 4, &root->table_size, 4);
+    memcpy(header + XISO_HEADER_DATA_LENGTH + 8, &filetime, XISO_FILETIME_SIZE);
+    memcpy(header + XISO_SECTOR_SIZE - XISO_HEADER_DATA_LENGTH, XISO_HEADER_DATA, XISO_HEADER_DATA_LENGTH);
+
+    if (!seek_sector(out_fd, &position, XISO_HEADER_OFFSET / XISO_SECTOR_SIZE) ||
+        !write_all(out_fd, header, sizeof(header))) {
+        goto write_failed;
+    }
+    position += sizeof(header);
+
+    uint64_t span = trace_begin();
+    for (size_t i = 0; i < layout->dir_count; i++) {
+        const WriteNode* dir = layout->dirs[i];
+        if (!seek_sector(out_fd, &position, dir->sector) ||
+            !write_all(out_fd, dir->table, dir->table_size)) {
+            goto write_failed;
+        }
+        position += dir->table_size;
+    }
+    trace_end(span, "write_tables", NULL);
+
+    for (size_t i = 0; i < layout->file_count; i++) {
+        WriteNode* file = layout->files[i];
+        if (!seek_sector(out_fd, &position, file->sector)) {
+            goto write_failed;
+        }
+        if (!write_data(file, out_fd, ctx)) {
+            return false;
+        }
+        position += file->size;
+    }
+
+    uint64_t end = (uint64_t)layout->total_sectors * XISO_SECTOR_SIZE;
+    end = (end + XISO_FILE_MODULUS - 1) / XISO_FILE_MODULUS * XISO_FILE_MODULUS;
+    if (!write_zeros(out_fd, end - position)) {
+        goto write_failed;
+    }
+    return true;
+
+write_failed:
+    set_error("Failed to write image (%s)", strerror(errno));
+    return false;
+}
+
+// Creating images from a directory tree
+
+typedef struct {
+    const char* root;
+    dev_t out_dev;
+    ino_t out_ino;
+} Scan;
+
+static bool scan_directory(const Scan* scan, int dir_fd, WriteNode* dir, const char* rel_dir, unsigned depth);
+
+static bool scan_entry(const Scan* scan, int parent_fd, WriteNode* parent, const char* rel_path,
+                       const char* name, unsigned depth) {
+    struct stat st;
+
+    if (fstatat(parent_fd, name, &st, 0) != 0) {
+        set_error("Cannot access %s (%s)", rel_path, strerror(errno));
+        return false;
+    }
+
+    bool is_dir = S_ISDIR(st.st_mode);
+    if (!is_dir && !S_ISREG(st.st_mode)) {
+        DEBUG_PRINT("Skipping special file: %s\n", rel_path);
+        return true;
+    }
+    if (st.st_dev == scan->out_dev && st.st_ino == scan->out_ino) {
+        DEBUG_PRINT("Skipping the output image: %s\n", rel_path);
+        return true;
+    }
+
+    XisoEntry entry = { .attributes = is_dir ? XISO_ATTRIBUTE_DIR : 0 };
+    if (filter_entry(rel_path, &entry) == WALK_SKIP) {
+        return true;
+    }
+
+    if (strlen(name) > UINT8_MAX) {
+        set_error("Name is longer than %u bytes: %s", UINT8_MAX, rel_path);
+        return false;
+    }
+    if (!is_dir && (uint64_t)st.st_size > UINT32_MAX) {
+        set_error("File is too large for XDVDFS (4GB limit): %s", rel_path);
+        return false;
+    }
+    if (is_dir && depth + 1 > max_walk_depth) {
+        set_error("Directory nesting exceeds the limit of %u: %s", max_walk_depth, rel_path);
+        return false;
+    }
+
+    WriteNode* node = write_node_new(name, is_dir);
+    if (!node) return false;
+    if (!write_node_add(parent, node)) {
+        write_node_free(node);
+        return false;
+    }
+
+    if (!is_dir) {
+        size_t root_length = strlen(scan->root);
+        node->source_path = malloc(root_length + strlen(rel_path) + 2);
+        if (!node->source_path) {
+            set_error("Failed to allocate image node");
+            return false;
+        }
+        sprintf(node->source_path, "%s/%s", scan->root, rel_path);
+        node->size = (uint32_t)st.st_size;
+        node->source_offset = st.st_ino;
+        node->source_device = st.st_dev;
+        STAT_ADD(stats_local(), files_created, 1);
+        return true;
+    }
+
+    int dir_fd = io_openat(parent_fd, name, O_RDONLY | O_DIRECTORY, 0);
+    if (dir_fd == -1) {
+        set_error("Failed to open directory: %s (%s)", rel_path, strerror(errno));
+        return false;
+    }
+    STAT_ADD(stats_local(), dirs_created, 1);
+    return scan_directory(scan, dir_fd, node, rel_path, depth + 1);
+}
+
+// Adds the contents of dir_fd to dir; takes ownership of dir_fd
+static bool scan_directory(const Scan* scan, int dir_fd, WriteNode* dir, const char* rel_dir, unsigned depth) {
+    DIR* handle = fdopendir(dir_fd);
+    if (!handle) {
+        set_error("Failed to read directory: %s (%s)", *rel_dir ? rel_dir : scan->root, strerror(errno));
+        close(dir_fd);
+        return false;
+    }
+
+    bool ok = true;
+    struct dirent* ent;
+    while (ok && (errno = 0, ent = readdir(handle)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) continue;
+
+        char* rel_path = malloc(strlen(rel_dir) + strlen(ent->d_name) + 2);
+        if (!rel_path) {
+            set_error("Failed to allocate path");
+            ok = false;
+            break;
+        }
+        sprintf(rel_path, "%s%s%s", rel_dir, *rel_dir ? "/" : "", ent->d_name);
+        ok = scan_entry(scan, dirfd(handle), dir, rel_path, ent->d_name, depth);
+        free(rel_path);
+    }
+    if (ok && errno != 0) {
+        set_error("Failed to read directory: %s (%s)", *rel_dir ? rel_dir : scan->root, strerror(errno));
+        ok = false;
+    }
+
+    closedir(handle);
+    return ok;
+}
+
+// Source files are read by a pool of readers into a ring of chunk buffers
+// while the writer drains the ring in image order. Chunk k always lands in
+// slot k % slot_count, and a slot is only resubmitted once it was written,
+// so the ring bounds memory at slot_count buffers.
+typedef struct {
+    WriteNode* file;
+    uint64_t offset;
+    size_t length;
+    void* buffer;
+    ssize_t result;
+    int error;
+    bool ready;
+    struct Prefetch* prefetch;
+} PrefetchSlot;
+
+typedef struct Prefetch {
+    JobQueue* readers;
+    PrefetchSlot* slots;
+    size_t slot_count;
+    size_t chunk_size;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    const ImageLayout* layout;
+    size_t next_file;           // next chunk to schedule
+    uint64_t next_offset;
+    uint64_t scheduled;
+    uint64_t consumed;
+} Prefetch;
+
+static void run_read_job(void* arg) {
+    PrefetchSlot* slot = arg;
+    Prefetch* prefetch = slot->prefetch;
+    ssize_t result = -1;
+    int error = 0;
+
+    uint64_t span = trace_begin();
+    slot->buffer = pool_acquire(slot->length);
+    int fd = slot->buffer ? io_open(slot->file->source_path, O_RDONLY | O_BINARY, 0) : -1;
+    if (fd == -1) {
+        error = slot->buffer ? errno : ENOMEM;
+    } else {
+        size_t done = 0;
+        while (done < slot->length) {
+            ssize_t n = io_pread(fd, (char*)slot->buffer + done, slot->length - done, slot->offset + done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                error = n < 0 ? errno : 0;
+                break;
+            }
+            done += n;
+        }
+        result = (ssize_t)done;
+        close(fd);
+    }
+    trace_end(span, "read", NULL);
+
+    pthread_mutex_lock(&prefetch->lock);
+    slot->result = result;
+    slot->error = error;
+    slot->ready = true;
+    pthread_cond_broadcast(&prefetch->ready);
+    pthread_mutex_unlock(&prefetch->lock);
+}
+
+// Queues chunks until every slot is in flight or all data is scheduled
+static void prefetch_schedule(Prefetch* prefetch) {
+    const ImageLayout* layout = prefetch->layout;
+
+    while (prefetch->scheduled - prefetch->consumed < prefetch->slot_count &&
+           prefetch->next_file < layout->file_count) {
+        WriteNode* file = layout->files[prefetch->next_file];
+        uint64_t remaining = file->size - prefetch->next_offset;
+        PrefetchSlot* slot = &prefetch->slots[prefetch->scheduled % prefetch->slot_count];
+
+        slot->file = file;
+        slot->offset = prefetch->next_offset;
+        slot->length = remaining < prefetch->chunk_size ? remaining : prefetch->chunk_size;
+        slot->buffer = NULL;
+        slot->ready = false;
+
+        prefetch->next_offset += slot->length;
+        if (prefetch->next_offset == file->size) {
+            prefetch->next_file++;
+            prefetch->next_offset = 0;
+        }
+        prefetch->scheduled++;
+        jobs_submit(prefetch->readers, run_read_job, slot);
+    }
+}
+
+static bool create_write_data(WriteNode* file, int out_fd, void* ctx) {
+    Prefetch* prefetch = ctx;
+    uint64_t remaining = file->size;
+
+    while (remaining > 0) {
+        if (operation_cancelled()) return false;
+
+        PrefetchSlot* slot = &prefetch->slots[prefetch->consumed % prefetch->slot_count];
+
+        uint64_t wait_span = trace_begin();
+        pthread_mutex_lock(&prefetch->lock);
+        while (!slot->ready) {
+            pthread_cond_wait(&prefetch->ready, &prefetch->lock);
+        }
+        pthread_mutex_unlock(&prefetch->lock);
+        trace_end(wait_span, "wait_read", NULL);
+
+        if (slot->result != (ssize_t)slot->length) {
+            if (slot->result < 0 || slot->error) {
+                set_error("Failed to read %s (%s)", file->source_path, strerror(slot->error));
+            } else {
+                set_error("File changed while reading: %s", file->source_path);
+            }
+            return false;
+        }
+
+        uint64_t start = xiso_now_ns();
+        uint64_t write_span = trace_begin();
+        bool written = write_all(out_fd, slot->buffer, slot->length);
+        trace_end(write_span, "write", NULL);
+        STAT_ADD(stats_local(), copy_ns, xiso_now_ns() - start);
+        if (!written) {
+            set_error("Failed to write image (%s)", strerror(errno));
+            return false;
+        }
+
+        pool_release(slot->buffer, slot->length);
+        slot->buffer = NULL;
+        remaining -= slot->length;
+        prefetch->consumed++;
+        prefetch_schedule(prefetch);
+    }
+    return true;
+}
+
+bool xiso_create(const char* src_dir, const char* out_path) {
+    struct stat out_st;
+
+    DEBUG_PRINT("Creating %s from %s\n", out_path, src_dir);
+    stats_reset();
+    operation_begin();
+
+    if (!initialized) {
+        set_error("XISO not initialized");
+        return false;
+    }
+
+    int root_fd = io_open(src_dir, O_RDONLY | O_DIRECTORY, 0);
+    if (root_fd == -1) {
+        set_error("Failed to open source directory: %s (%s)", src_dir, strerror(errno));
+        return false;
+    }
+
+    // Opened before the scan so an output inside src_dir is left out of it
+    int out_fd = io_open(out_path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+    if (out_fd == -1 || fstat(out_fd, &out_st) != 0) {
+        set_error("Failed to create image: %s (%s)", out_path, strerror(errno));
+        if (out_fd != -1) close(out_fd);
+        close(root_fd);
+        return false;
+    }
+
+    Scan scan = { src_dir, out_st.st_dev, out_st.st_ino };
+    WriteNode* root = write_node_new("", true);
+    uint64_t walk_start = xiso_now_ns();
+    bool success = root && scan_directory(&scan, root_fd, root, "", 0);
+    STAT_ADD(stats_local(), walk_ns, xiso_now_ns() - walk_start);
+    if (!root) close(root_fd);
+    if (success && include_count) {
+        write_node_prune(root);
+    }
+
+    // Inode order stands in for the on-disk order of the source files
+    ImageLayout layout;
+    if (success && !image_layout(root, file_order, &layout)) {
+        success = false;
+    }
+
+    if (success) {
+        DEBUG_PRINT("Image layout: %u sectors, %zu tables, %zu files\n",
+                    layout.total_sectors, layout.dir_count, layout.file_count);
+
+        Prefetch prefetch;
+        memset(&prefetch, 0, sizeof(prefetch));
+        prefetch.slot_count = extract_threads * 2;
+        prefetch.chunk_size = xiso_get_buffer_size();
+        prefetch.layout = &layout;
+        prefetch.slots = calloc(prefetch.slot_count, sizeof(PrefetchSlot));
+        prefetch.readers = prefetch.slots
+            ? jobs_create(extract_threads, prefetch.slot_count, "reader") : NULL;
+
+        if (!prefetch.readers) {
+            if (!prefetch.slots) set_error("Failed to allocate read-ahead ring");
+            success = false;
+        } else {
+            pthread_mutex_init(&prefetch.lock, NULL);
+            pthread_cond_init(&prefetch.ready, NULL);
+            for (size_t i = 0; i < prefetch.slot_count; i++) {
+                prefetch.slots[i].prefetch = &prefetch;
+            }
+
+            prefetch_schedule(&prefetch);
+            success = image_write(&layout, root, out_fd, create_write_data, &prefetch);
+
+            // After a failure, chunks still in flight hold pool buffers
+            jobs_wait(prefetch.readers);
+            jobs_destroy(prefetch.readers);
+            for (uint64_t k = prefetch.consumed; k < prefetch.scheduled; k++) {
+                PrefetchSlot* slot = &prefetch.slots[k % prefetch.slot_count];
+                if (slot->buffer) pool_release(slot->buffer, slot->length);
+            }
+            pthread_cond_destroy(&prefetch.ready);
+            pthread_mutex_destroy(&prefetch.lock);
+        }
+        free(prefetch.slots);
+        image_layout_free(&layout);
+    }
+    write_node_free(root);
+
+    if (close(out_fd) != 0 && success) {
+        set_error("Failed to write image: %s (%s)", out_path, strerror(errno));
+        success = false;
+    }
+    if (!success) {
+        unlink(out_path);
+    }
+
+    DEBUG_PRINT("Create %s\n", success ? "completed successfully" : "failed");
+    return success;
+}